@@ -20,6 +20,7 @@
 #include <asm/byteorder.h>
 
 #include "binfmt_plan9.h"
+#include "../plan9/plan9.h"
 
 static int load_plan9_binary(struct linux_binprm *, struct pt_regs *);
 
@@ -30,6 +31,12 @@ static struct linux_binfmt plan9_format = {
 	.core_dump	= NULL
 };
 
+/* Whether mm is running a Plan 9 binary, for '#p' */
+int p9_binfmt(struct mm_struct *mm)
+{
+	return mm && mm->binfmt == &plan9_format;
+}
+
 /*
  * All Plan 9 programs linked with libc obtain the address of the
  * '_tos' structure from EAX when executing _main().
@@ -72,6 +79,7 @@ static unsigned long __user *create_args(char __user * p,
 	char __user * __user *argv;
 	unsigned long __user *sp;
 	int argc = bprm->argc;
+	int envc = bprm->envc;
     
 	unsigned long q = (unsigned long) p;
 
@@ -86,17 +94,19 @@ static unsigned long __user *create_args(char __user * p,
 
 	put_user(argc, --sp);
 	
+	/* The strings are end to end on the stack, as execve copied them */
 	current->mm->arg_start = q;
 	while (argc-- > 0) {
-		char c;
 		put_user(p, argv++);
-		do {
-			get_user(c, p++);
-		} while (c);
+		p += strnlen_user(p, MAX_ARG_STRLEN);
 	}
 	put_user(NULL, argv);
-	current->mm->arg_end = current->mm->env_start =
-		current->mm->env_end = q;
+	current->mm->arg_end = current->mm->env_start = (unsigned long) p;
+
+	/* The environment strings follow: they go into '#e' */
+	while (envc-- > 0)
+		p += strnlen_user(p, MAX_ARG_STRLEN);
+	current->mm->env_end = (unsigned long) p;
 
 	return sp;
 }
@@ -185,12 +195,21 @@ static int load_plan9_binary(struct linux_binprm * bprm, struct pt_regs * regs)
 				(char *)DAT_ADDR(ex), ex.data + ex.bss, &pos));
 	set_binfmt(&plan9_format);
 	
-	retval = setup_arg_pages(bprm, TASK_SIZE, EXSTACK_DEFAULT);
+	retval = setup_arg_pages(bprm, TIME_ADDR, EXSTACK_DEFAULT);
     
 	if (retval < 0) {
 		send_sig(SIGKILL, current, 0);
 		return retval;
 	}
+
+	/* The time page, for nsec() without a system call */
+	down_write(&current->mm->mmap_sem);
+	retval = p9_timepage_map(current->mm, TIME_ADDR);
+	up_write(&current->mm->mmap_sem);
+	if (retval < 0) {
+		send_sig(SIGKILL, current, 0);
+		return retval;
+	}
 	
 	printk(KERN_ALERT "9load: BPRM Value: %lx\n", bprm->p);
 	
@@ -199,6 +218,9 @@ static int load_plan9_binary(struct linux_binprm * bprm, struct pt_regs * regs)
 	
 	printk(KERN_ALERT "9load: Stack start: %lx, TOS: %lx\n", current->mm->start_stack, regs->bx);
 	
+	/* Set up the Plan 9 state while the environment is as execve left it */
+	p9_proc();
+
 	mangle_tos(ex.entry);
 	start_thread(regs, ex.entry, current->mm->start_stack);
 	printk(KERN_ALERT "9load: Program started: EBX: %lx, EIP: %lx\n", regs->bx, regs->ip);
@@ -40,4 +40,5 @@ struct plan9_exec
 #define STR_ADDR 0x1000	/* Start Address */
 #define TXT_ADDR(x) HDR_SIZE + x.text /* TEXT Address */
 #define DAT_ADDR(x) STR_ADDR + PAGE_ALIGN(TXT_ADDR(x)) /* DATA & BSS */
+#define TIME_ADDR (TASK_SIZE - PAGE_SIZE) /* Time page, above the stack */
 
@@ -0,0 +1,130 @@
+/*
+ * Copyright (C) 2008 Anant Narayanan <anant@kix.in>
+ * Plan 9 device names.
+ *
+ * A name beginning with '#' starts at the root of a kernel device: the
+ * '#' is followed by the device's character and, up to the next '/',
+ * a spec telling the device which of its trees is meant. Devices are
+ * found by their character in a table, so getting to one costs the
+ * same whichever it is. Devices register themselves as they start up
+ * and stay for good.
+ */
+#include <linux/fs.h>
+#include <linux/init.h>
+#include <linux/mount.h>
+#include <linux/sched.h>
+#include <linux/spinlock.h>
+#include <linux/fs_struct.h>
+
+#include "plan9.h"
+
+#define NDEV	128
+
+static struct p9_dev *devtab[NDEV];
+static DEFINE_SPINLOCK(devtab_lock);
+
+int p9_devregister(struct p9_dev *dev)
+{
+	int error = -EBUSY;
+
+	if (dev->dc <= 0 || dev->dc >= NDEV)
+		return -EINVAL;
+	spin_lock(&devtab_lock);
+	if (!devtab[dev->dc]) {
+		devtab[dev->dc] = dev;
+		error = 0;
+	}
+	spin_unlock(&devtab_lock);
+	return error;
+}
+
+void p9_devunregister(struct p9_dev *dev)
+{
+	spin_lock(&devtab_lock);
+	if (devtab[dev->dc] == dev)
+		devtab[dev->dc] = NULL;
+	spin_unlock(&devtab_lock);
+}
+
+/*
+ * Attach to the device *name starts with, leaving *name at the rest
+ * of the path. The spec is terminated in place while the device looks
+ * at it.
+ */
+int p9_devattach(char **name, struct path *root)
+{
+	int error;
+	char *spec, *e, c;
+	struct p9_dev *dev;
+	unsigned char dc = (*name)[1];
+
+	if (dc == 0 || dc >= NDEV)
+		return -ENODEV;
+	dev = devtab[dc];
+	if (!dev)
+		return -ENODEV;
+
+	spec = *name + 2;
+	for (e = spec; *e && *e != '/'; e++)
+		;
+	c = *e;
+	*e = '\0';
+	error = dev->attach(spec, root);
+	*e = c;
+	*name = e;
+	return error;
+}
+
+/*
+ * The name of path, as d_path gives it, into buf. A path in a device's
+ * own tree that isn't mounted in the Linux file system is given under
+ * '#' and the device's character instead.
+ */
+char *p9_devpath(struct path *path, char *buf, int buflen)
+{
+	int dc;
+	char *p = d_path(path, buf, buflen);
+
+	if (IS_ERR(p) || path->mnt->mnt_ns)
+		return p;
+	for (dc = 1; dc < NDEV; dc++)
+		if (devtab[dc] && devtab[dc]->fstype &&
+		    devtab[dc]->fstype == path->mnt->mnt_sb->s_type)
+			break;
+	if (dc == NDEV)
+		return p;
+
+	if (p - buf < 2)
+		return ERR_PTR(-ENAMETOOLONG);
+	/* The root of the tree is just the device */
+	if (p[0] == '/' && p[1] == '\0')
+		*p = '\0';
+	p -= 2;
+	p[0] = '#';
+	p[1] = dc;
+	return p;
+}
+
+/* '#/': the root of the Linux file system as this process sees it */
+static int root_attach(char *spec, struct path *root)
+{
+	read_lock(&current->fs->lock);
+	*root = current->fs->root;
+	path_get(root);
+	read_unlock(&current->fs->lock);
+	return 0;
+}
+
+static struct p9_dev root_dev = {
+	.dc	= '/',
+	.name	= "root",
+	.attach	= root_attach,
+};
+
+static int __init dev_init(void)
+{
+	p9_devregister(&root_dev);
+	return 0;
+}
+
+core_initcall(dev_init);
@@ -1,64 +1,622 @@
-/**
- * Plan 9 '#c' emulation.
- * Let's start with /dev/pid
+/*
+ * Copyright (C) 2008 Anant Narayanan <anant@kix.in>
+ * Plan 9 '#c' emulation: the console device.
+ *
+ * '#c' is a small file system of its own, attached through the device
+ * table. The files about the process reading them are answered from
+ * its task; the clocks are as Plan 9 gives them: bintime in binary,
+ * time as text. sysstat is made in sysstat.c, and mntstat, the
+ * counts of the mount cache, in devmnt.c.
+ *
+ * cons is the process's terminal, or the system console if it has
+ * none. Output is gathered into a page and written to the terminal in
+ * one go: when the page fills, when the process reads cons or closes
+ * it, or shortly after the last write. A program printing a line at a
+ * time then costs about one terminal write a page rather than one a
+ * line. The delayed writes may block on the terminal, so they have a
+ * workqueue of their own. What the terminal doesn't take stays in the
+ * page, and an error from a delayed write is returned by the next
+ * write or close. consctl puts the terminal in raw mode until it is
+ * closed.
  */
 #include <linux/fs.h>
+#include <linux/file.h>
 #include <linux/init.h>
+#include <linux/slab.h>
+#include <linux/cred.h>
+#include <linux/mount.h>
+#include <linux/mutex.h>
+#include <linux/sched.h>
 #include <linux/types.h>
 #include <linux/module.h>
+#include <linux/random.h>
+#include <linux/string.h>
+#include <linux/termios.h>
+#include <linux/utsname.h>
 #include <linux/uaccess.h>
-#include <linux/syscalls.h>
-#include <linux/miscdevice.h>
+#include <linux/workqueue.h>
+#include <asm/timex.h>
+#include <asm/byteorder.h>
+
+#include "plan9.h"
 
 MODULE_AUTHOR("Anant Narayanan <anant@kix.in>");
 MODULE_LICENSE("GPL");
 
-static ssize_t pid_read(struct file *, char __user *, size_t, loff_t *);
+#define CONS_MAGIC	0x39636f6e	/* "9con" */
 
-static const struct file_operations pid_fops = {
-	.owner = THIS_MODULE,
-	.read = pid_read
-	/* .write to /dev/pid doesn't make sense? */
+#define NUMSIZE		12		/* a number as Plan 9 formats it */
+#define CONSBUF		PAGE_SIZE	/* output gathered for one write */
+#define CONSDELAY	msecs_to_jiffies(10)	/* before it's written anyway */
+
+enum {
+	Qcons = 2,	/* inode numbers; 1 is the directory */
+	Qconsctl,
+	Qpid,
+	Qppid,
+	Quser,
+	Qsysname,
+	Qcputime,
+	Qrandom,
+	Qbintime,
+	Qtime,
+	Qsysstat,
+	Qmntstat,
+};
+
+/* An open cons */
+struct cons {
+	struct mutex lock;
+	struct file *tty;
+	struct delayed_work work;	/* writes out buf after a while */
+	size_t n;			/* bytes waiting in buf */
+	char *buf;			/* a page */
+	int err;			/* from a delayed write, to report */
+};
+
+/* An open consctl */
+struct consctl {
+	struct file *tty;
+	int raw;
+	struct termios cooked;		/* to go back to */
+};
+
+static struct vfsmount *cons_mnt;
+static struct workqueue_struct *cons_wq;
+
+/* The terminal behind cons and consctl */
+static struct file *cons_tty(void)
+{
+	struct file *f = filp_open("/dev/tty", O_RDWR | O_NOCTTY, 0);
+
+	if (IS_ERR(f))
+		f = filp_open("/dev/console", O_RDWR | O_NOCTTY, 0);
+	return f;
+}
+
+static long cons_ioctl(struct file *tty, unsigned int cmd, struct termios *t)
+{
+	long error;
+	mm_segment_t fs;
+
+	if (!tty->f_op || !tty->f_op->unlocked_ioctl)
+		return -ENOTTY;
+	fs = get_fs();
+	set_fs(KERNEL_DS);
+	error = tty->f_op->unlocked_ioctl(tty, cmd, (unsigned long)t);
+	set_fs(fs);
+	return error;
+}
+
+/*
+ * Write out what is waiting in c->buf. What the terminal won't take is
+ * kept for next time. Called with c->lock held.
+ */
+static ssize_t cons_flush(struct cons *c)
+{
+	ssize_t n = 0;
+	size_t off = 0;
+	loff_t pos = 0;
+	mm_segment_t fs;
+
+	fs = get_fs();
+	set_fs(KERNEL_DS);
+	while (off < c->n) {
+		n = vfs_write(c->tty, (const char __user *)c->buf + off,
+			      c->n - off, &pos);
+		if (n <= 0)
+			break;
+		off += n;
+	}
+	set_fs(fs);
+	c->n -= off;
+	if (c->n) {
+		memmove(c->buf, c->buf + off, c->n);
+		return n < 0 ? n : -EIO;
+	}
+	return 0;
+}
+
+/* The error left by a delayed write, once. Called with c->lock held. */
+static int cons_err(struct cons *c)
+{
+	int error = c->err;
+
+	c->err = 0;
+	return error;
+}
+
+static void cons_flushwork(struct work_struct *work)
+{
+	int error;
+	struct cons *c = container_of(work, struct cons, work.work);
+
+	mutex_lock(&c->lock);
+	error = cons_flush(c);
+	if (error)
+		c->err = error;
+	mutex_unlock(&c->lock);
+}
+
+static int cons_open(struct inode *inode, struct file *f)
+{
+	int error = -ENOMEM;
+	struct cons *c = kmalloc(sizeof(*c), GFP_KERNEL);
+
+	if (!c)
+		return -ENOMEM;
+	c->buf = (char *)__get_free_page(GFP_KERNEL);
+	if (!c->buf)
+		goto out;
+	c->tty = cons_tty();
+	if (IS_ERR(c->tty)) {
+		error = PTR_ERR(c->tty);
+		goto out;
+	}
+	mutex_init(&c->lock);
+	INIT_DELAYED_WORK(&c->work, cons_flushwork);
+	c->n = 0;
+	c->err = 0;
+	f->private_data = c;
+	return 0;
+out:
+	free_page((unsigned long)c->buf);
+	kfree(c);
+	return error;
+}
+
+static ssize_t cons_read(struct file *f, char __user *buf,
+			 size_t count, loff_t *offset)
+{
+	int error;
+	struct cons *c = f->private_data;
+
+	/* Whatever prompted for this input is shown first */
+	mutex_lock(&c->lock);
+	error = cons_flush(c);
+	if (error)
+		c->err = error;
+	mutex_unlock(&c->lock);
+	return vfs_read(c->tty, buf, count, &c->tty->f_pos);
+}
+
+static ssize_t cons_write(struct file *f, const char __user *buf,
+			  size_t count, loff_t *offset)
+{
+	ssize_t error;
+	size_t n, done = 0;
+	struct cons *c = f->private_data;
+
+	mutex_lock(&c->lock);
+	error = cons_err(c);
+	while (!error && done < count) {
+		if (c->n == CONSBUF) {
+			error = cons_flush(c);
+			if (error)
+				break;
+		}
+		n = min(count - done, CONSBUF - c->n);
+		if (copy_from_user(c->buf + c->n, buf + done, n)) {
+			error = -EFAULT;
+			break;
+		}
+		c->n += n;
+		done += n;
+	}
+	if (c->n)
+		queue_delayed_work(cons_wq, &c->work, CONSDELAY);
+	mutex_unlock(&c->lock);
+	return done ? done : error;
+}
+
+/* Called at each close, so the output of a process that exits is out */
+static int cons_fflush(struct file *f, fl_owner_t id)
+{
+	int error;
+	struct cons *c = f->private_data;
+
+	mutex_lock(&c->lock);
+	error = cons_flush(c);
+	if (!error)
+		error = cons_err(c);
+	mutex_unlock(&c->lock);
+	return error;
+}
+
+static int cons_release(struct inode *inode, struct file *f)
+{
+	struct cons *c = f->private_data;
+
+	cancel_delayed_work_sync(&c->work);
+	cons_flush(c);
+	fput(c->tty);
+	free_page((unsigned long)c->buf);
+	kfree(c);
+	return 0;
+}
+
+static const struct file_operations cons_fops = {
+	.open		= cons_open,
+	.read		= cons_read,
+	.write		= cons_write,
+	.flush		= cons_fflush,
+	.release	= cons_release,
 };
 
-static struct miscdevice pid_dev = {
-	.minor = MISC_DYNAMIC_MINOR,
-	.name = "pid",
-	.fops = &pid_fops
+static int consctl_open(struct inode *inode, struct file *f)
+{
+	struct consctl *cc = kzalloc(sizeof(*cc), GFP_KERNEL);
+
+	if (!cc)
+		return -ENOMEM;
+	cc->tty = cons_tty();
+	if (IS_ERR(cc->tty)) {
+		int error = PTR_ERR(cc->tty);
+
+		kfree(cc);
+		return error;
+	}
+	f->private_data = cc;
+	return 0;
+}
+
+static long consctl_raw(struct consctl *cc, int on)
+{
+	long error;
+	struct termios t;
+
+	if (on == cc->raw)
+		return 0;
+	if (!on) {
+		error = cons_ioctl(cc->tty, TCSETSW, &cc->cooked);
+		if (!error)
+			cc->raw = 0;
+		return error;
+	}
+
+	error = cons_ioctl(cc->tty, TCGETS, &cc->cooked);
+	if (error)
+		return error;
+	/* Characters as they are typed, not echoed */
+	t = cc->cooked;
+	t.c_lflag &= ~(ICANON | ECHO | ECHONL | IEXTEN);
+	t.c_cc[VMIN] = 1;
+	t.c_cc[VTIME] = 0;
+	error = cons_ioctl(cc->tty, TCSETSW, &t);
+	if (!error)
+		cc->raw = 1;
+	return error;
+}
+
+static ssize_t consctl_write(struct file *f, const char __user *buf,
+			     size_t count, loff_t *offset)
+{
+	long error;
+	char cmd[32], *p, *word;
+	struct consctl *cc = f->private_data;
+
+	if (count >= sizeof(cmd))
+		return -EINVAL;
+	if (copy_from_user(cmd, buf, count))
+		return -EFAULT;
+	cmd[count] = '\0';
+
+	p = cmd;
+	while ((word = strsep(&p, " \t\n")) != NULL) {
+		if (*word == '\0')
+			continue;
+		if (!strcmp(word, "rawon"))
+			error = consctl_raw(cc, 1);
+		else if (!strcmp(word, "rawoff"))
+			error = consctl_raw(cc, 0);
+		else
+			error = -EINVAL;
+		if (error)
+			return error;
+	}
+	return count;
+}
+
+static int consctl_release(struct inode *inode, struct file *f)
+{
+	struct consctl *cc = f->private_data;
+
+	consctl_raw(cc, 0);
+	fput(cc->tty);
+	kfree(cc);
+	return 0;
+}
+
+static const struct file_operations consctl_fops = {
+	.open		= consctl_open,
+	.write		= consctl_write,
+	.release	= consctl_release,
 };
 
+/* A number as Plan 9 formats it in pid, ppid and the like */
+static ssize_t cons_readnum(char __user *buf, size_t count, loff_t *offset,
+			    unsigned long val)
+{
+	char nbuf[NUMSIZE + 1];
+	int n;
+
+	n = scnprintf(nbuf, sizeof(nbuf), "%*lu ", NUMSIZE - 1, val);
+	return simple_read_from_buffer(buf, count, offset, nbuf, n);
+}
+
 static ssize_t pid_read(struct file *f, char __user *buf,
 			size_t count, loff_t *offset)
 {
-	int ret = 0;
-	char pidbuf[6];
-	unsigned long readcount;
-	
-	if (*offset != 0) {
-		ret = 0;
-	} else {
-		ret = scnprintf(pidbuf, 6, "%ld", sys_getpid());
-		readcount = min(count, (size_t)ret);
-		
-		if (!copy_to_user(buf, pidbuf, readcount)) {
-			*offset += readcount;
-			ret = readcount;
-		} else {
-			ret = -EFAULT;
-		}
+	return cons_readnum(buf, count, offset, task_tgid_vnr(current));
+}
+
+static const struct file_operations pid_fops = {
+	.read = pid_read
+};
+
+static ssize_t ppid_read(struct file *f, char __user *buf,
+			 size_t count, loff_t *offset)
+{
+	pid_t ppid;
+
+	rcu_read_lock();
+	ppid = task_tgid_vnr(current->real_parent);
+	rcu_read_unlock();
+	return cons_readnum(buf, count, offset, ppid);
+}
+
+static const struct file_operations ppid_fops = {
+	.read = ppid_read
+};
+
+/* Linux keeps no user names, so the user is named by number */
+static ssize_t user_read(struct file *f, char __user *buf,
+			 size_t count, loff_t *offset)
+{
+	char ubuf[NUMSIZE];
+	int n;
+
+	n = scnprintf(ubuf, sizeof(ubuf), "%u", current_uid());
+	return simple_read_from_buffer(buf, count, offset, ubuf, n);
+}
+
+static const struct file_operations user_fops = {
+	.read = user_read
+};
+
+static ssize_t sysname_read(struct file *f, char __user *buf,
+			    size_t count, loff_t *offset)
+{
+	char name[__NEW_UTS_LEN + 1];
+
+	down_read(&uts_sem);
+	strlcpy(name, utsname()->nodename, sizeof(name));
+	up_read(&uts_sem);
+	return simple_read_from_buffer(buf, count, offset, name, strlen(name));
+}
+
+static const struct file_operations sysname_fops = {
+	.read = sysname_read
+};
+
+/*
+ * cputime: user, system and real time of the process and then the
+ * user and system time of its children, in milliseconds. Linux doesn't
+ * add up the children's real time, so that last one is 0.
+ */
+static ssize_t cputime_read(struct file *f, char __user *buf,
+			    size_t count, loff_t *offset)
+{
+	char tbuf[6 * NUMSIZE + 1];
+	int n;
+	cputime_t cutime, cstime;
+	struct timespec now;
+	struct task_struct *t = current;
+
+	spin_lock_irq(&t->sighand->siglock);
+	cutime = t->signal->cutime;
+	cstime = t->signal->cstime;
+	spin_unlock_irq(&t->sighand->siglock);
+
+	do_posix_clock_monotonic_gettime(&now);
+	now = timespec_sub(now, t->start_time);
+
+	n = scnprintf(tbuf, sizeof(tbuf), "%*lu %*lu %*lu %*lu %*lu %*lu ",
+		      NUMSIZE - 1, (unsigned long)cputime_to_msecs(t->utime),
+		      NUMSIZE - 1, (unsigned long)cputime_to_msecs(t->stime),
+		      NUMSIZE - 1, (unsigned long)(now.tv_sec * MSEC_PER_SEC +
+					now.tv_nsec / NSEC_PER_MSEC),
+		      NUMSIZE - 1, (unsigned long)cputime_to_msecs(cutime),
+		      NUMSIZE - 1, (unsigned long)cputime_to_msecs(cstime),
+		      NUMSIZE - 1, 0UL);
+	return simple_read_from_buffer(buf, count, offset, tbuf, n);
+}
+
+static const struct file_operations cputime_fops = {
+	.read = cputime_read
+};
+
+static ssize_t random_read(struct file *f, char __user *buf,
+			   size_t count, loff_t *offset)
+{
+	char rbuf[64];
+	size_t n, done = 0;
+
+	while (done < count) {
+		if (done && signal_pending(current))
+			break;
+		n = min(count - done, sizeof(rbuf));
+		get_random_bytes(rbuf, n);
+		if (copy_to_user(buf + done, rbuf, n))
+			return done ? done : -EFAULT;
+		done += n;
+		cond_resched();
 	}
-	
-	return ret;
+	return done;
 }
 
+static const struct file_operations random_fops = {
+	.read = random_read
+};
+
+/*
+ * bintime: the time in nanoseconds, then the fast clock's ticks and
+ * its rate, each a big endian vlong. A short read gets the leading
+ * ones. Like the rest of the clocks, this is read at any offset.
+ */
+static ssize_t bintime_read(struct file *f, char __user *buf,
+			    size_t count, loff_t *offset)
+{
+	__be64 t[3];
+	size_t n;
+
+	n = min(count, sizeof(t)) & ~(sizeof(t[0]) - 1);
+	t[0] = cpu_to_be64(p9_nsec());
+	t[1] = cpu_to_be64(get_cycles());
+	t[2] = cpu_to_be64(p9_fasthz());
+	if (copy_to_user(buf, t, n))
+		return -EFAULT;
+	return n;
+}
+
+static const struct file_operations bintime_fops = {
+	.read = bintime_read
+};
+
+/* time: seconds, nanoseconds, fast ticks and their rate, as text */
+static ssize_t time_read(struct file *f, char __user *buf,
+			 size_t count, loff_t *offset)
+{
+	char tbuf[80];
+	int n;
+	s64 ns = p9_nsec();
+
+	n = scnprintf(tbuf, sizeof(tbuf), "%11lu %21lld %21llu %21llu ",
+		      (unsigned long)div_s64(ns, NSEC_PER_SEC), ns,
+		      (unsigned long long)get_cycles(), p9_fasthz());
+	return simple_read_from_buffer(buf, count, offset, tbuf, n);
+}
+
+static const struct file_operations time_fops = {
+	.read = time_read
+};
+
+static ssize_t sysstat_read(struct file *f, char __user *buf,
+			    size_t count, loff_t *offset)
+{
+	return p9_sysstat_read(buf, count, offset);
+}
+
+static const struct file_operations sysstat_fops = {
+	.read = sysstat_read
+};
+
+static ssize_t mntstat_read(struct file *f, char __user *buf,
+			    size_t count, loff_t *offset)
+{
+	return p9_mntstat_read(buf, count, offset);
+}
+
+static const struct file_operations mntstat_fops = {
+	.read = mntstat_read
+};
+
+static struct tree_descr cons_files[] = {
+	[Qcons]		= { "cons", &cons_fops, 0660 },
+	[Qconsctl]	= { "consctl", &consctl_fops, 0220 },
+	[Qpid]		= { "pid", &pid_fops, 0444 },
+	[Qppid]		= { "ppid", &ppid_fops, 0444 },
+	[Quser]		= { "user", &user_fops, 0444 },
+	[Qsysname]	= { "sysname", &sysname_fops, 0444 },
+	[Qcputime]	= { "cputime", &cputime_fops, 0444 },
+	[Qrandom]	= { "random", &random_fops, 0444 },
+	[Qbintime]	= { "bintime", &bintime_fops, 0444 },
+	[Qtime]		= { "time", &time_fops, 0444 },
+	[Qsysstat]	= { "sysstat", &sysstat_fops, 0444 },
+	[Qmntstat]	= { "mntstat", &mntstat_fops, 0444 },
+	{ "" }
+};
+
+static int cons_fill_super(struct super_block *sb, void *data, int silent)
+{
+	return simple_fill_super(sb, CONS_MAGIC, cons_files);
+}
+
+static int cons_get_sb(struct file_system_type *fs_type, int flags,
+		       const char *dev_name, void *data, struct vfsmount *mnt)
+{
+	return get_sb_single(fs_type, flags, data, cons_fill_super, mnt);
+}
+
+static struct file_system_type cons_fs_type = {
+	.name		= "plan9cons",
+	.get_sb		= cons_get_sb,
+	.kill_sb	= kill_litter_super,
+};
+
+static int cons_attach(char *spec, struct path *path)
+{
+	path->mnt = mntget(cons_mnt);
+	path->dentry = dget(cons_mnt->mnt_root);
+	return 0;
+}
+
+static struct p9_dev cons_dev = {
+	.dc	= 'c',
+	.name	= "cons",
+	.attach	= cons_attach,
+	.fstype	= &cons_fs_type,
+};
+
 static int __init cons_init(void)
 {
-	return misc_register(&pid_dev);
+	int err;
+
+	cons_wq = create_singlethread_workqueue("p9cons");
+	if (!cons_wq)
+		return -ENOMEM;
+	err = register_filesystem(&cons_fs_type);
+	if (err)
+		goto out_wq;
+	cons_mnt = kern_mount(&cons_fs_type);
+	if (IS_ERR(cons_mnt)) {
+		err = PTR_ERR(cons_mnt);
+		unregister_filesystem(&cons_fs_type);
+		goto out_wq;
+	}
+	return p9_devregister(&cons_dev);
+
+out_wq:
+	destroy_workqueue(cons_wq);
+	return err;
 }
 
 static void __exit cons_exit(void)
 {
-	misc_deregister(&pid_dev);
+	p9_devunregister(&cons_dev);
+	mntput(cons_mnt);
+	unregister_filesystem(&cons_fs_type);
+	destroy_workqueue(cons_wq);
 }
 
 module_init(cons_init);
@@ -0,0 +1,976 @@
+/*
+ * Copyright (C) 2008 Anant Narayanan <anant@kix.in>
+ * Plan 9 '#i' emulation: the draw device, without a display.
+ *
+ * Every image lives in memory, drawn on by memdraw.c, so Plan 9
+ * programs can render on a machine with no graphics at all. The screen
+ * is one more image, SCREENW by SCREENH x8r8g8b8, that every client
+ * knows as image 0 and that '#i/screen' reads back as a Plan 9 image
+ * file, as it was when opened. Each client has its own replication and
+ * clipping of it, so one setting them with 'c' doesn't change where
+ * the others draw.
+ *
+ *	draw/new		opening it makes a new client, and reads
+ *				as its ctl
+ *	draw/n/ctl		the client's number and the screen's
+ *				channels, size and clipping, or an image's
+ *				after writing its id
+ *	draw/n/data		draw messages are written here, and what
+ *				they read is read back
+ *	draw/n/refresh		always empty, with nothing to refresh
+ *	screen			the screen, as a picture
+ *
+ * The messages are those that make and free images, load and read
+ * their pixels, set their clipping and the operator, and draw. There
+ * are no public screens or windows on them, named images, fonts or
+ * geometric primitives yet, nor compressed loads; those fail with "bad
+ * draw command". Like Plan 9's, all of it runs under the one lock.
+ * So that no client keeps it long, a write may draw no more than
+ * DRAWWORK pixels; messages after those fail with Edrawwork.
+ *
+ * Anyone may open draw/new, so images come out of a pool, DRAWMEM
+ * for all clients and CLIENTMEM for any one, as Plan 9's come out of
+ * its image pool. Past either, allocating fails with Edrawmem.
+ */
+#include <linux/fs.h>
+#include <linux/hash.h>
+#include <linux/init.h>
+#include <linux/slab.h>
+#include <linux/cred.h>
+#include <linux/mount.h>
+#include <linux/mutex.h>
+#include <linux/sched.h>
+#include <linux/dcache.h>
+#include <linux/module.h>
+#include <linux/string.h>
+#include <linux/vmalloc.h>
+#include <linux/uaccess.h>
+#include <asm/unaligned.h>
+
+#include "plan9.h"
+
+#define DRAW_MAGIC	0x39647277	/* "9drw" */
+
+#define SCREENW		1024
+#define SCREENH		768
+#define SCREENCHAN	0x68081828	/* x8r8g8b8 */
+#define DBlack		0x000000FF
+
+#define DHASHBITS	6
+#define DRAWMAXWRITE	(64 * 1024)	/* of draw messages at once */
+#define NINFO		12		/* numbers in ctl */
+#define DRAWMEM		(64 << 20)	/* bytes of images, all clients */
+#define CLIENTMEM	(32 << 20)	/* bytes of images, one client */
+#define DRAWWORK	(64 << 20)	/* pixels drawn by one write */
+
+/* Inode numbers: the client and which file */
+#define QSHIFT		3
+#define DRAWINO(cl, q)	(((unsigned long)(cl) << QSHIFT) | (q))
+#define DRAWCLIENT(ino)	((int)((ino) >> QSHIFT))
+#define DRAWQ(ino)	((ino) & ((1 << QSHIFT) - 1))
+
+enum {
+	Qclient,	/* a client's directory */
+	Qroot,		/* '#i' itself */
+	Qdrawdir,
+	Qnew,
+	Qscreen,
+	Qctl,
+	Qdata,
+	Qrefresh,
+};
+
+/* Plan 9's errors, which programs compare with */
+static const char Enodrawimage[] = "unknown id for draw image";
+static const char Enodrawscreen[] = "unknown id for draw screen";
+static const char Eshortdraw[] = "short draw message";
+static const char Eshortread[] = "draw read too short";
+static const char Eimageexists[] = "image id in use";
+static const char Edrawmem[] = "image memory allocation failed";
+static const char Ereadoutside[] = "readimage outside image";
+static const char Ewriteoutside[] = "writeimage outside image";
+static const char Enoclient[] = "no such draw client";
+static const char Ebadchan[] = "bad channel descriptor";
+static const char Ebadrect[] = "bad rectangle";
+static const char Ebadcmd[] = "bad draw command";
+static const char Edrawwork[] = "too much drawing in one write";
+
+struct dimage {
+	struct hlist_node hash;
+	int id;
+	long size;			/* bytes charged to the pool */
+	struct p9_memimage i;
+};
+
+struct dclient {
+	struct list_head list;		/* in draw_clients, by id */
+	int id;
+	int ref;			/* its open files */
+	uid_t uid;
+	gid_t gid;
+	int infoid;			/* the image ctl tells of */
+	int op;				/* for the next draw */
+	long mem;			/* bytes of its images */
+	struct p9_memimage screen;	/* the screen, with its own clip */
+	struct hlist_head images[1 << DHASHBITS];
+	u8 *readdata;			/* what 'r' read, until read */
+	int nreaddata;
+};
+
+struct draw_file {
+	const char *name;
+	int q;
+	umode_t mode;
+	const struct file_operations *fops;
+	const struct inode_operations *iops;
+};
+
+/* draw_lock covers the clients, their images and the screen */
+static DEFINE_MUTEX(draw_lock);
+static LIST_HEAD(draw_clients);
+static int draw_clientid;
+static long draw_mem;			/* bytes of all clients' images */
+static struct p9_memimage draw_screen;
+static struct vfsmount *draw_mnt;
+
+/* Called with draw_lock held */
+static struct dclient *draw_client(int id)
+{
+	struct dclient *cl;
+
+	list_for_each_entry(cl, &draw_clients, list)
+		if (cl->id == id)
+			return cl;
+	return NULL;
+}
+
+static struct dimage *draw_dimage(struct dclient *cl, int id)
+{
+	struct dimage *di;
+	struct hlist_node *n;
+
+	hlist_for_each_entry(di, n, &cl->images[hash_long(id, DHASHBITS)], hash)
+		if (di->id == id)
+			return di;
+	return NULL;
+}
+
+/* Image id of the client; 0 is the screen unless it made its own */
+static struct p9_memimage *draw_image(struct dclient *cl, int id)
+{
+	struct dimage *di = draw_dimage(cl, id);
+
+	if (di)
+		return &di->i;
+	return id == 0 ? &cl->screen : NULL;
+}
+
+/* What an image covering r would take from the pool, 0 if r is bad */
+static u64 draw_size(struct p9_rect r)
+{
+	if (Dx(r) <= 0 || Dy(r) <= 0)
+		return 0;
+	return (u64)Dx(r) * Dy(r) * sizeof(u32);
+}
+
+static void draw_freeimage(struct dclient *cl, struct dimage *di)
+{
+	hlist_del(&di->hash);
+	cl->mem -= di->size;
+	draw_mem -= di->size;
+	p9_memfree(&di->i);
+	kfree(di);
+}
+
+static void draw_put(struct dclient *cl)
+{
+	int i;
+	struct dimage *di;
+	struct hlist_node *n, *t;
+
+	mutex_lock(&draw_lock);
+	if (--cl->ref > 0) {
+		mutex_unlock(&draw_lock);
+		return;
+	}
+	list_del(&cl->list);
+	for (i = 0; i < ARRAY_SIZE(cl->images); i++)
+		hlist_for_each_entry_safe(di, n, t, &cl->images[i], hash)
+			draw_freeimage(cl, di);
+	mutex_unlock(&draw_lock);
+	vfree(cl->readdata);
+	kfree(cl);
+}
+
+/* The draw protocol's little-endian numbers */
+static int draw_long(const u8 *p)
+{
+	return (int)get_unaligned_le32(p);
+}
+
+static void draw_point(const u8 *p, struct p9_point *pt)
+{
+	pt->x = draw_long(p);
+	pt->y = draw_long(p + 4);
+}
+
+static void draw_rect(const u8 *p, struct p9_rect *r)
+{
+	draw_point(p, &r->min);
+	draw_point(p + 8, &r->max);
+}
+
+static int draw_inside(struct p9_rect r, struct p9_rect b)
+{
+	return r.min.x >= b.min.x && r.min.y >= b.min.y &&
+	       r.max.x <= b.max.x && r.max.y <= b.max.y &&
+	       r.min.x <= r.max.x && r.min.y <= r.max.y;
+}
+
+/*
+ * Carry out the messages in a, in order. Those before one that fails
+ * stay done, as on Plan 9. Called with draw_lock held.
+ */
+static int draw_mesg(struct dclient *cl, const u8 *a, int n)
+{
+	int m, id, bpl, error;
+	long work = 0;
+	u32 chan;
+	u64 size;
+	const char *why;
+	struct dimage *di;
+	struct p9_memimage *dst, *src, *mask;
+	struct p9_rect r, clipr;
+	struct p9_point sp, mp;
+
+	for (; n > 0; a += m, n -= m) {
+		switch (*a) {
+		/* allocate: 'b' id[4] screenid[4] refresh[1] chan[4] repl[1]
+		 * R[4*4] clipR[4*4] rrggbbaa[4] */
+		case 'b':
+			m = 1 + 4 + 4 + 1 + 4 + 1 + 4 * 4 + 4 * 4 + 4;
+			if (n < m)
+				goto shortdraw;
+			id = draw_long(a + 1);
+			if (draw_dimage(cl, id)) {
+				why = Eimageexists;
+				goto bad;
+			}
+			if (draw_long(a + 5)) {
+				why = Enodrawscreen;
+				goto bad;
+			}
+			chan = draw_long(a + 10);
+			if (!p9_chandepth(chan)) {
+				why = Ebadchan;
+				goto bad;
+			}
+			draw_rect(a + 15, &r);
+			draw_rect(a + 31, &clipr);
+			size = draw_size(r);
+			if (size > CLIENTMEM - cl->mem ||
+			    size > DRAWMEM - draw_mem) {
+				why = Edrawmem;
+				goto bad;
+			}
+			di = kmalloc(sizeof(*di), GFP_KERNEL);
+			if (!di) {
+				why = Edrawmem;
+				goto bad;
+			}
+			error = p9_memalloc(&di->i, r, chan, draw_long(a + 47));
+			if (error) {
+				kfree(di);
+				why = error == -EINVAL ? Ebadrect : Edrawmem;
+				goto bad;
+			}
+			di->id = id;
+			di->size = size;
+			cl->mem += size;
+			draw_mem += size;
+			di->i.repl = a[14];
+			di->i.clipr = clipr;
+			hlist_add_head(&di->hash,
+				       &cl->images[hash_long(id, DHASHBITS)]);
+			break;
+
+		/* set repl and clip: 'c' dstid[4] repl[1] clipR[4*4] */
+		case 'c':
+			m = 1 + 4 + 1 + 4 * 4;
+			if (n < m)
+				goto shortdraw;
+			dst = draw_image(cl, draw_long(a + 1));
+			if (!dst)
+				goto noimage;
+			dst->repl = a[5];
+			draw_rect(a + 6, &dst->clipr);
+			break;
+
+		/* draw: 'd' dstid[4] srcid[4] maskid[4] R[4*4] P[2*4] P[2*4] */
+		case 'd':
+			m = 1 + 4 + 4 + 4 + 4 * 4 + 2 * 4 + 2 * 4;
+			if (n < m)
+				goto shortdraw;
+			if (work >= DRAWWORK) {
+				why = Edrawwork;
+				goto bad;
+			}
+			dst = draw_image(cl, draw_long(a + 1));
+			src = draw_image(cl, draw_long(a + 5));
+			mask = draw_image(cl, draw_long(a + 9));
+			if (!dst || !src || !mask)
+				goto noimage;
+			draw_rect(a + 13, &r);
+			draw_point(a + 29, &sp);
+			draw_point(a + 37, &mp);
+			work += p9_memdraw(dst, r, src, sp, mask, mp, cl->op);
+			cl->op = P9_SoverD;
+			break;
+
+		/* debug: 'D' val[1] */
+		case 'D':
+			m = 1 + 1;
+			if (n < m)
+				goto shortdraw;
+			break;
+
+		/* free: 'f' id[4] */
+		case 'f':
+			m = 1 + 4;
+			if (n < m)
+				goto shortdraw;
+			id = draw_long(a + 1);
+			di = draw_dimage(cl, id);
+			if (di)
+				draw_freeimage(cl, di);
+			else if (id != 0)
+				goto noimage;
+			if (cl->infoid == id)
+				cl->infoid = 0;
+			break;
+
+		/* set the operator for the next draw: 'O' op[1] */
+		case 'O':
+			m = 1 + 1;
+			if (n < m)
+				goto shortdraw;
+			if (a[1] > (P9_SinD | P9_DinS | P9_SoutD | P9_DoutS)) {
+				why = Ebadcmd;
+				goto bad;
+			}
+			cl->op = a[1];
+			break;
+
+		/* read: 'r' id[4] R[4*4] */
+		case 'r':
+			m = 1 + 4 + 4 * 4;
+			if (n < m)
+				goto shortdraw;
+			src = draw_image(cl, draw_long(a + 1));
+			if (!src)
+				goto noimage;
+			draw_rect(a + 5, &r);
+			if (!draw_inside(r, src->r)) {
+				why = Ereadoutside;
+				goto bad;
+			}
+			bpl = p9_bytesperline(r, p9_chandepth(src->chan));
+			vfree(cl->readdata);
+			cl->nreaddata = 0;
+			cl->readdata = vmalloc(bpl * (r.max.y - r.min.y) + 1);
+			if (!cl->readdata) {
+				why = Edrawmem;
+				goto bad;
+			}
+			p9_memunload(src, r, cl->readdata);
+			cl->nreaddata = bpl * (r.max.y - r.min.y);
+			break;
+
+		/* visible, a flush; the screen is always up to date */
+		case 'v':
+			m = 1;
+			break;
+
+		/* write: 'y' id[4] R[4*4] data[x*1] */
+		case 'y':
+			m = 1 + 4 + 4 * 4;
+			if (n < m)
+				goto shortdraw;
+			dst = draw_image(cl, draw_long(a + 1));
+			if (!dst)
+				goto noimage;
+			draw_rect(a + 5, &r);
+			if (!draw_inside(r, dst->r)) {
+				why = Ewriteoutside;
+				goto bad;
+			}
+			bpl = p9_bytesperline(r, p9_chandepth(dst->chan));
+			m += bpl * (r.max.y - r.min.y);
+			if (n < m)
+				goto shortdraw;
+			p9_memload(dst, r, a + 1 + 4 + 4 * 4);
+			break;
+
+		default:
+			why = Ebadcmd;
+			goto bad;
+		}
+	}
+	return 0;
+
+shortdraw:
+	why = Eshortdraw;
+	goto bad;
+noimage:
+	why = Enodrawimage;
+bad:
+	p9_werrstr("%s", why);
+	return -EINVAL;
+}
+
+/* The ctl line: client, image id, chan, repl, rectangle and clip */
+static int draw_info(struct dclient *cl, char *buf, int len)
+{
+	char chan[16];
+	struct p9_memimage *i = draw_image(cl, cl->infoid);
+
+	if (!i)
+		i = &cl->screen;
+	return scnprintf(buf, len, "%11d %11d %11s %11d %11d %11d %11d %11d "
+			 "%11d %11d %11d %11d ", cl->id, cl->infoid,
+			 p9_chantostr(chan, i->chan), i->repl,
+			 i->r.min.x, i->r.min.y, i->r.max.x, i->r.max.y,
+			 i->clipr.min.x, i->clipr.min.y,
+			 i->clipr.max.x, i->clipr.max.y);
+}
+
+/* Opening new makes a client; its other files find theirs */
+static int client_open(struct inode *inode, struct file *f)
+{
+	int i;
+	struct dclient *cl;
+
+	if (DRAWQ(inode->i_ino) != Qnew) {
+		mutex_lock(&draw_lock);
+		cl = draw_client(DRAWCLIENT(inode->i_ino));
+		if (cl)
+			cl->ref++;
+		mutex_unlock(&draw_lock);
+		if (!cl) {
+			p9_werrstr("%s", Enoclient);
+			return -ENOENT;
+		}
+		f->private_data = cl;
+		return 0;
+	}
+
+	cl = kzalloc(sizeof(*cl), GFP_KERNEL);
+	if (!cl)
+		return -ENOMEM;
+	for (i = 0; i < ARRAY_SIZE(cl->images); i++)
+		INIT_HLIST_HEAD(&cl->images[i]);
+	cl->ref = 1;
+	cl->uid = current_fsuid();
+	cl->gid = current_fsgid();
+	cl->op = P9_SoverD;
+	/* The screen's pixels, shared; its repl and clip, the client's */
+	cl->screen = draw_screen;
+	mutex_lock(&draw_lock);
+	cl->id = ++draw_clientid;
+	list_add_tail(&cl->list, &draw_clients);
+	mutex_unlock(&draw_lock);
+	f->private_data = cl;
+	return 0;
+}
+
+static int client_release(struct inode *inode, struct file *f)
+{
+	draw_put(f->private_data);
+	return 0;
+}
+
+static ssize_t ctl_read(struct file *f, char __user *buf, size_t count,
+			loff_t *ppos)
+{
+	int n;
+	char info[NINFO * 12 + 1];
+
+	mutex_lock(&draw_lock);
+	n = draw_info(f->private_data, info, sizeof(info));
+	mutex_unlock(&draw_lock);
+	return simple_read_from_buffer(buf, count, ppos, info, n);
+}
+
+/* Writing an image id makes ctl tell of that image */
+static ssize_t ctl_write(struct file *f, const char __user *buf,
+			 size_t count, loff_t *offset)
+{
+	u8 a[4];
+	int id, error = count;
+	struct dclient *cl = f->private_data;
+
+	if (count != sizeof(a)) {
+		p9_werrstr("unknown draw control request");
+		return -EINVAL;
+	}
+	if (copy_from_user(a, buf, sizeof(a)))
+		return -EFAULT;
+	id = draw_long(a);
+	mutex_lock(&draw_lock);
+	if (draw_image(cl, id)) {
+		cl->infoid = id;
+	} else {
+		p9_werrstr("%s", Enodrawimage);
+		error = -EINVAL;
+	}
+	mutex_unlock(&draw_lock);
+	return error;
+}
+
+static const struct file_operations ctl_fops = {
+	.open		= client_open,
+	.read		= ctl_read,
+	.write		= ctl_write,
+	.release	= client_release,
+};
+
+/* What the last 'r' read, all in one go */
+static ssize_t data_read(struct file *f, char __user *buf, size_t count,
+			 loff_t *ppos)
+{
+	ssize_t n;
+	u8 *data;
+	struct dclient *cl = f->private_data;
+
+	mutex_lock(&draw_lock);
+	data = cl->readdata;
+	n = cl->nreaddata;
+	if (data && count < n) {
+		mutex_unlock(&draw_lock);
+		p9_werrstr("%s", Eshortread);
+		return -EINVAL;
+	}
+	cl->readdata = NULL;
+	cl->nreaddata = 0;
+	mutex_unlock(&draw_lock);
+
+	if (!data)
+		return 0;
+	if (copy_to_user(buf, data, n))
+		n = -EFAULT;
+	vfree(data);
+	return n;
+}
+
+static ssize_t data_write(struct file *f, const char __user *buf,
+			  size_t count, loff_t *offset)
+{
+	int error;
+	u8 *a;
+
+	if (count > DRAWMAXWRITE)
+		return -EINVAL;
+	a = kmalloc(count, GFP_KERNEL);
+	if (!a)
+		return -ENOMEM;
+	if (copy_from_user(a, buf, count)) {
+		kfree(a);
+		return -EFAULT;
+	}
+	mutex_lock(&draw_lock);
+	error = draw_mesg(f->private_data, a, count);
+	mutex_unlock(&draw_lock);
+	kfree(a);
+	return error ? error : count;
+}
+
+static const struct file_operations data_fops = {
+	.open		= client_open,
+	.read		= data_read,
+	.write		= data_write,
+	.release	= client_release,
+};
+
+/* With no display, nothing is ever damaged to refresh */
+static ssize_t refresh_read(struct file *f, char __user *buf, size_t count,
+			    loff_t *ppos)
+{
+	return 0;
+}
+
+static const struct file_operations refresh_fops = {
+	.open		= client_open,
+	.read		= refresh_read,
+	.release	= client_release,
+};
+
+struct screenshot {
+	size_t n;
+	u8 data[];
+};
+
+/* The screen as an uncompressed Plan 9 image, as it is now */
+static int screen_open(struct inode *inode, struct file *f)
+{
+	int n, bpl;
+	char chan[16];
+	struct screenshot *s;
+	struct p9_rect r = draw_screen.r;
+
+	bpl = p9_bytesperline(r, p9_chandepth(draw_screen.chan));
+	s = vmalloc(sizeof(*s) + 5 * 12 + 1 + bpl * (r.max.y - r.min.y));
+	if (!s)
+		return -ENOMEM;
+	mutex_lock(&draw_lock);
+	n = sprintf((char *)s->data, "%11s %11d %11d %11d %11d ",
+		    p9_chantostr(chan, draw_screen.chan),
+		    r.min.x, r.min.y, r.max.x, r.max.y);
+	p9_memunload(&draw_screen, r, s->data + n);
+	mutex_unlock(&draw_lock);
+	s->n = n + bpl * (r.max.y - r.min.y);
+	f->private_data = s;
+	return 0;
+}
+
+static ssize_t screen_read(struct file *f, char __user *buf, size_t count,
+			   loff_t *ppos)
+{
+	struct screenshot *s = f->private_data;
+
+	return simple_read_from_buffer(buf, count, ppos, s->data, s->n);
+}
+
+static int screen_release(struct inode *inode, struct file *f)
+{
+	vfree(f->private_data);
+	return 0;
+}
+
+static const struct file_operations screen_fops = {
+	.open		= screen_open,
+	.read		= screen_read,
+	.llseek		= default_llseek,
+	.release	= screen_release,
+};
+
+static struct inode *draw_inode(struct super_block *sb, struct dclient *cl,
+				const struct draw_file *df)
+{
+	struct inode *inode = new_inode(sb);
+
+	if (!inode)
+		return NULL;
+	inode->i_ino = DRAWINO(cl ? cl->id : 0, df->q);
+	inode->i_mode = df->mode;
+	if (cl) {
+		inode->i_uid = cl->uid;
+		inode->i_gid = cl->gid;
+	}
+	inode->i_atime = inode->i_mtime = inode->i_ctime = CURRENT_TIME;
+	if (df->iops)
+		inode->i_op = df->iops;
+	inode->i_fop = df->fops;
+	return inode;
+}
+
+/* A client's entries hold as long as it does */
+static int draw_d_revalidate(struct dentry *dentry, struct nameidata *nd)
+{
+	int ok;
+
+	if (!dentry->d_inode)
+		return 0;
+	if (DRAWCLIENT(dentry->d_inode->i_ino) == 0)
+		return 1;
+	mutex_lock(&draw_lock);
+	ok = draw_client(DRAWCLIENT(dentry->d_inode->i_ino)) != NULL;
+	mutex_unlock(&draw_lock);
+	return ok;
+}
+
+static int draw_d_delete(struct dentry *dentry)
+{
+	return 1;
+}
+
+static const struct dentry_operations draw_dentry_ops = {
+	.d_revalidate	= draw_d_revalidate,
+	.d_delete	= draw_d_delete,
+};
+
+/* Look for dentry among a directory's fixed files, those of client id */
+static struct dentry *draw_lookup_files(struct inode *dir,
+					struct dentry *dentry,
+					const struct draw_file *df, int id)
+{
+	struct dclient *cl = NULL;
+	struct inode *inode = NULL;
+
+	dentry->d_op = &draw_dentry_ops;
+	for (; df->name; df++)
+		if (!strcmp(dentry->d_name.name, df->name))
+			break;
+	if (df->name) {
+		mutex_lock(&draw_lock);
+		if (id) {
+			cl = draw_client(id);
+			if (!cl) {
+				mutex_unlock(&draw_lock);
+				return ERR_PTR(-ENOENT);
+			}
+		}
+		inode = draw_inode(dir->i_sb, cl, df);
+		mutex_unlock(&draw_lock);
+		if (!inode)
+			return ERR_PTR(-ENOMEM);
+	}
+	d_add(dentry, inode);
+	return NULL;
+}
+
+/* List a directory's fixed files; f_pos is 2 past the next one */
+static int draw_readdir_files(struct file *filp, void *dirent,
+			      filldir_t filldir, const struct draw_file *df,
+			      int nfiles)
+{
+	int i;
+	struct inode *inode = filp->f_path.dentry->d_inode;
+	int id = DRAWCLIENT(inode->i_ino);
+
+	while (filp->f_pos < 2) {
+		if (filldir(dirent, "..", filp->f_pos + 1, filp->f_pos,
+			    inode->i_ino, DT_DIR) < 0)
+			return -1;
+		filp->f_pos++;
+	}
+	for (i = filp->f_pos - 2; i < nfiles; i++) {
+		if (filldir(dirent, df[i].name, strlen(df[i].name),
+			    filp->f_pos, DRAWINO(id, df[i].q),
+			    S_ISDIR(df[i].mode) ? DT_DIR : DT_REG) < 0)
+			return -1;
+		filp->f_pos++;
+	}
+	return 0;
+}
+
+static const struct draw_file client_files[] = {
+	{ "ctl",	Qctl,	S_IFREG | 0600,	&ctl_fops },
+	{ "data",	Qdata,	S_IFREG | 0600,	&data_fops },
+	{ "refresh",	Qrefresh, S_IFREG | 0400, &refresh_fops },
+	{ NULL }
+};
+
+static struct dentry *client_lookup(struct inode *dir, struct dentry *dentry,
+				    struct nameidata *nd)
+{
+	return draw_lookup_files(dir, dentry, client_files,
+				 DRAWCLIENT(dir->i_ino));
+}
+
+static int client_readdir(struct file *filp, void *dirent, filldir_t filldir)
+{
+	draw_readdir_files(filp, dirent, filldir, client_files,
+			   ARRAY_SIZE(client_files) - 1);
+	return 0;
+}
+
+static const struct inode_operations client_iops = {
+	.lookup		= client_lookup,
+};
+
+static const struct file_operations client_fops = {
+	.read		= generic_read_dir,
+	.readdir	= client_readdir,
+	.llseek		= default_llseek,
+};
+
+static const struct draw_file client_dir = {
+	"", Qclient, S_IFDIR | 0555, &client_fops, &client_iops
+};
+
+static const struct draw_file drawdir_files[] = {
+	{ "new",	Qnew,	S_IFREG | 0666,	&ctl_fops },
+	{ NULL }
+};
+
+/* draw holds new and a directory for each client, by number */
+static struct dentry *drawdir_lookup(struct inode *dir, struct dentry *dentry,
+				     struct nameidata *nd)
+{
+	unsigned long id;
+	char *end;
+	struct dclient *cl;
+	struct inode *inode = NULL;
+
+	if (!strcmp(dentry->d_name.name, "new"))
+		return draw_lookup_files(dir, dentry, drawdir_files, 0);
+
+	dentry->d_op = &draw_dentry_ops;
+	id = simple_strtoul(dentry->d_name.name, &end, 10);
+	if (*end == '\0' && id > 0 && id <= INT_MAX) {
+		mutex_lock(&draw_lock);
+		cl = draw_client(id);
+		if (cl) {
+			inode = draw_inode(dir->i_sb, cl, &client_dir);
+			if (!inode) {
+				mutex_unlock(&draw_lock);
+				return ERR_PTR(-ENOMEM);
+			}
+		}
+		mutex_unlock(&draw_lock);
+	}
+	d_add(dentry, inode);
+	return NULL;
+}
+
+/* Past new, f_pos is 3 past the client to go on from */
+static int drawdir_readdir(struct file *filp, void *dirent, filldir_t filldir)
+{
+	int len;
+	char name[16];
+	struct dclient *cl;
+
+	if (draw_readdir_files(filp, dirent, filldir, drawdir_files,
+			       ARRAY_SIZE(drawdir_files) - 1) < 0)
+		return 0;
+
+	mutex_lock(&draw_lock);
+	list_for_each_entry(cl, &draw_clients, list) {
+		if (cl->id + 3 <= filp->f_pos)
+			continue;
+		len = scnprintf(name, sizeof(name), "%d", cl->id);
+		if (filldir(dirent, name, len, filp->f_pos,
+			    DRAWINO(cl->id, Qclient), DT_DIR) < 0)
+			break;
+		filp->f_pos = cl->id + 3;
+	}
+	mutex_unlock(&draw_lock);
+	return 0;
+}
+
+static const struct inode_operations drawdir_iops = {
+	.lookup		= drawdir_lookup,
+};
+
+static const struct file_operations drawdir_fops = {
+	.read		= generic_read_dir,
+	.readdir	= drawdir_readdir,
+	.llseek		= default_llseek,
+};
+
+static const struct draw_file root_files[] = {
+	{ "draw",	Qdrawdir, S_IFDIR | 0555, &drawdir_fops,
+	  &drawdir_iops },
+	{ "screen",	Qscreen, S_IFREG | 0444, &screen_fops },
+	{ NULL }
+};
+
+static struct dentry *root_lookup(struct inode *dir, struct dentry *dentry,
+				  struct nameidata *nd)
+{
+	return draw_lookup_files(dir, dentry, root_files, 0);
+}
+
+static int root_readdir(struct file *filp, void *dirent, filldir_t filldir)
+{
+	draw_readdir_files(filp, dirent, filldir, root_files,
+			   ARRAY_SIZE(root_files) - 1);
+	return 0;
+}
+
+static const struct inode_operations root_iops = {
+	.lookup		= root_lookup,
+};
+
+static const struct file_operations root_fops = {
+	.read		= generic_read_dir,
+	.readdir	= root_readdir,
+	.llseek		= default_llseek,
+};
+
+static const struct super_operations draw_sops = {
+	.statfs		= simple_statfs,
+	.drop_inode	= generic_delete_inode,
+};
+
+static int draw_fill_super(struct super_block *sb, void *data, int silent)
+{
+	struct inode *inode;
+
+	sb->s_magic = DRAW_MAGIC;
+	sb->s_op = &draw_sops;
+	inode = new_inode(sb);
+	if (!inode)
+		return -ENOMEM;
+	inode->i_ino = Qroot;
+	inode->i_mode = S_IFDIR | 0555;
+	inode->i_atime = inode->i_mtime = inode->i_ctime = CURRENT_TIME;
+	inode->i_op = &root_iops;
+	inode->i_fop = &root_fops;
+	sb->s_root = d_alloc_root(inode);
+	if (!sb->s_root) {
+		iput(inode);
+		return -ENOMEM;
+	}
+	return 0;
+}
+
+static int draw_get_sb(struct file_system_type *fs_type, int flags,
+		       const char *dev_name, void *data, struct vfsmount *mnt)
+{
+	return get_sb_single(fs_type, flags, data, draw_fill_super, mnt);
+}
+
+static struct file_system_type draw_fs_type = {
+	.name		= "plan9draw",
+	.get_sb		= draw_get_sb,
+	.kill_sb	= kill_anon_super,
+};
+
+static int draw_attach(char *spec, struct path *path)
+{
+	path->mnt = mntget(draw_mnt);
+	path->dentry = dget(draw_mnt->mnt_root);
+	return 0;
+}
+
+static struct p9_dev draw_dev = {
+	.dc	= 'i',
+	.name	= "draw",
+	.attach	= draw_attach,
+	.fstype	= &draw_fs_type,
+};
+
+static int __init devdraw_init(void)
+{
+	int err;
+	struct p9_rect r = { { 0, 0 }, { SCREENW, SCREENH } };
+
+	err = p9_memalloc(&draw_screen, r, SCREENCHAN, DBlack);
+	if (err)
+		return err;
+	err = register_filesystem(&draw_fs_type);
+	if (err)
+		goto free;
+	draw_mnt = kern_mount(&draw_fs_type);
+	if (IS_ERR(draw_mnt)) {
+		err = PTR_ERR(draw_mnt);
+		unregister_filesystem(&draw_fs_type);
+		goto free;
+	}
+	return p9_devregister(&draw_dev);
+free:
+	p9_memfree(&draw_screen);
+	return err;
+}
+
+static void __exit devdraw_exit(void)
+{
+	p9_devunregister(&draw_dev);
+	mntput(draw_mnt);
+	unregister_filesystem(&draw_fs_type);
+	p9_memfree(&draw_screen);
+}
+
+module_init(devdraw_init);
+module_exit(devdraw_exit);
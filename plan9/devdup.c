@@ -0,0 +1,417 @@
+/*
+ * Copyright (C) 2008 Anant Narayanan <anant@kix.in>
+ * Plan 9 '#d' emulation: the open file descriptors of a process.
+ *
+ * '#d' holds two files for each open fd n of the process looking at it:
+ * opening 'n' is a dup of the fd, and 'nctl' reads as a line giving its
+ * mode, qid, offset and path, in the format of /proc/n/fd.
+ *
+ * fd2path lives here too.
+ */
+#include <linux/fs.h>
+#include <linux/file.h>
+#include <linux/init.h>
+#include <linux/slab.h>
+#include <linux/mount.h>
+#include <linux/sched.h>
+#include <linux/dcache.h>
+#include <linux/module.h>
+#include <linux/string.h>
+#include <linux/fdtable.h>
+#include <linux/uaccess.h>
+
+#include "plan9.h"
+#include "p9_constants.h"
+
+#define DUP_MAGIC	0x39647570	/* "9dup" */
+
+/*
+ * Inode numbers: 1 is the directory, then two for each fd. The entry
+ * inodes aren't kept: another process looking at '#d' has other fds.
+ */
+#define DUPINO(fd, ctl)	(2 + 2 * (fd) + (ctl))
+#define DUPFD(ino)	(((ino) - 2) / 2)
+#define DUPCTL(ino)	(((ino) - 2) & 1)
+
+static struct vfsmount *dup_mnt;
+
+/*
+ * The path of f in buf, which is filled from the end as by d_path.
+ * A union directory is named by its mount point, and a file in a
+ * device's own tree by '#' and the device's character.
+ */
+static char *dup_path(struct file *f, char *buf, int buflen)
+{
+	struct path *path = p9_ns_union(f);
+
+	return p9_devpath(path ? path : &f->f_path, buf, buflen);
+}
+
+/*
+ * fd2path(2). Most paths fit a small buffer on the stack; the longer
+ * ones are made in a names cache buffer. Only what fits in nbuf is
+ * copied out.
+ */
+long p9_fd2path(unsigned int fd, char __user *buf, size_t nbuf)
+{
+	long error;
+	char *p, *page = NULL;
+	char small[128];
+	size_t len;
+	struct file *f;
+
+	f = fget(fd);
+	if (!f)
+		return -EBADF;
+
+	p = dup_path(f, small, sizeof(small));
+	if (IS_ERR(p) && PTR_ERR(p) == -ENAMETOOLONG) {
+		page = __getname();
+		error = -ENOMEM;
+		if (!page)
+			goto out;
+		p = dup_path(f, page, PATH_MAX);
+	}
+	error = PTR_ERR(p);
+	if (IS_ERR(p))
+		goto out;
+
+	error = 0;
+	if (nbuf == 0)
+		goto out;
+	len = min(strlen(p), nbuf - 1);
+	if (copy_to_user(buf, p, len) || put_user('\0', buf + len))
+		error = -EFAULT;
+out:
+	if (page)
+		__putname(page);
+	fput(f);
+	return error;
+}
+
+static char dup_devchar(struct file *f)
+{
+	if (p9_pipe_isend(f))
+		return '|';
+	if (!strcmp(f->f_path.mnt->mnt_sb->s_type->name, "9p"))
+		return 'M';
+	return '/';
+}
+
+/*
+ * The line describing f as fd, as in /proc/n/fd:
+ *	fd mode devchar devno (qid.path qid.vers qid.type) iounit offset path
+ */
+int p9_dup_line(unsigned int fd, struct file *f, char *buf, int buflen)
+{
+	char *p;
+	int n;
+	struct kstat st;
+	struct p9_dir d;
+	const char *mode;
+
+	if (vfs_getattr(f->f_path.mnt, f->f_path.dentry, &st))
+		memset(&st, 0, sizeof(st));
+	p9_stat2dir(&st, f->f_path.dentry->d_inode, "", 0, &d);
+
+	switch (f->f_mode & (FMODE_READ | FMODE_WRITE)) {
+	case FMODE_READ | FMODE_WRITE:
+		mode = "rw";
+		break;
+	case FMODE_WRITE:
+		mode = " w";
+		break;
+	default:
+		mode = "r ";
+		break;
+	}
+
+	n = scnprintf(buf, buflen,
+		      "%3u %s %c %4u (%.16llx %6u %.2x) %5d %8lld ",
+		      fd, mode, dup_devchar(f), 0,
+		      (unsigned long long)d.qid.path, d.qid.vers, d.qid.type,
+		      0, (long long)f->f_pos);
+
+	p = dup_path(f, buf + n, buflen - n - 1);
+	if (IS_ERR(p))
+		p = "?";
+	/* d_path leaves the name at the end of its buffer */
+	memmove(buf + n, p, strlen(p) + 1);
+	n += strlen(buf + n);
+	buf[n++] = '\n';
+	return n;
+}
+
+static ssize_t dup_ctl_read(struct file *filp, char __user *buf,
+			    size_t count, loff_t *ppos)
+{
+	ssize_t n;
+	char *line;
+	struct file *f;
+	unsigned int fd = DUPFD(filp->f_path.dentry->d_inode->i_ino);
+
+	f = fget(fd);
+	if (!f)
+		return -EBADF;
+	line = __getname();
+	if (!line) {
+		fput(f);
+		return -ENOMEM;
+	}
+	n = p9_dup_line(fd, f, line, PATH_MAX);
+	fput(f);
+	n = simple_read_from_buffer(buf, count, ppos, line, n);
+	__putname(line);
+	return n;
+}
+
+static const struct file_operations dup_ctl_fops = {
+	.read		= dup_ctl_read,
+	.llseek		= generic_file_llseek,
+};
+
+/*
+ * Opening '#d/n' gives back the file of fd n itself, provided it was
+ * opened for what is asked now. Called by p9_ns_open.
+ */
+struct file *p9_dup_open(struct path *path, int flags)
+{
+	int want;
+	struct file *f;
+	unsigned long ino = path->dentry->d_inode->i_ino;
+
+	if (ino == 1 || DUPCTL(ino)) {
+		if ((flags & O_ACCMODE) != O_RDONLY)
+			return ERR_PTR(-EACCES);
+		path_get(path);
+		return dentry_open(path->dentry, path->mnt, flags,
+				   current_cred());
+	}
+
+	f = fget(DUPFD(ino));
+	if (!f)
+		return ERR_PTR(-EBADF);
+	switch (flags & O_ACCMODE) {
+	case O_WRONLY:
+		want = FMODE_WRITE;
+		break;
+	case O_RDWR:
+		want = FMODE_READ | FMODE_WRITE;
+		break;
+	default:
+		want = FMODE_READ;
+		break;
+	}
+	if ((f->f_mode & want) != want) {
+		fput(f);
+		return ERR_PTR(-EACCES);
+	}
+	return f;
+}
+
+/* Whether path is in '#d', whose files p9_dup_open opens */
+int p9_dup_isdup(struct path *path)
+{
+	return path->mnt == dup_mnt;
+}
+
+static int dup_d_revalidate(struct dentry *dentry, struct nameidata *nd)
+{
+	/* Whose fds these are depends on who asks */
+	return 0;
+}
+
+static int dup_d_delete(struct dentry *dentry)
+{
+	return 1;
+}
+
+static const struct dentry_operations dup_dentry_ops = {
+	.d_revalidate	= dup_d_revalidate,
+	.d_delete	= dup_d_delete,
+};
+
+/* Parse "n" or "nctl" */
+static int dup_name(const char *name, unsigned int len, int *ctl)
+{
+	unsigned int i, fd = 0;
+
+	*ctl = 0;
+	if (len > 3 && !memcmp(name + len - 3, "ctl", 3)) {
+		*ctl = 1;
+		len -= 3;
+	}
+	if (len == 0 || len > 9 || (len > 1 && name[0] == '0'))
+		return -1;
+	for (i = 0; i < len; i++) {
+		if (name[i] < '0' || name[i] > '9')
+			return -1;
+		fd = fd * 10 + name[i] - '0';
+	}
+	return fd;
+}
+
+static struct dentry *dup_lookup(struct inode *dir, struct dentry *dentry,
+				 struct nameidata *nd)
+{
+	int fd, ctl;
+	fmode_t mode;
+	struct file *f;
+	struct inode *inode;
+
+	dentry->d_op = &dup_dentry_ops;
+	fd = dup_name(dentry->d_name.name, dentry->d_name.len, &ctl);
+	f = fd < 0 ? NULL : fget(fd);
+	if (!f) {
+		d_add(dentry, NULL);
+		return NULL;
+	}
+	mode = f->f_mode;
+	fput(f);
+
+	inode = new_inode(dir->i_sb);
+	if (!inode)
+		return ERR_PTR(-ENOMEM);
+	inode->i_ino = DUPINO(fd, ctl);
+	inode->i_uid = current_fsuid();
+	inode->i_gid = current_fsgid();
+	inode->i_atime = inode->i_mtime = inode->i_ctime = CURRENT_TIME;
+	if (ctl) {
+		inode->i_mode = S_IFREG | 0400;
+		inode->i_fop = &dup_ctl_fops;
+	} else {
+		inode->i_mode = S_IFREG;
+		if (mode & FMODE_READ)
+			inode->i_mode |= 0400;
+		if (mode & FMODE_WRITE)
+			inode->i_mode |= 0200;
+	}
+	d_add(dentry, inode);
+	return NULL;
+}
+
+static int dup_readdir(struct file *filp, void *dirent, filldir_t filldir)
+{
+	int fd, ctl, len, max;
+	char name[16];
+	struct fdtable *fdt;
+	struct files_struct *files = current->files;
+	struct inode *inode = filp->f_path.dentry->d_inode;
+
+	while (filp->f_pos < 2) {
+		if (filldir(dirent, "..", filp->f_pos + 1, filp->f_pos,
+			    inode->i_ino, DT_DIR) < 0)
+			return 0;
+		filp->f_pos++;
+	}
+
+	for (;;) {
+		fd = DUPFD(filp->f_pos);
+		ctl = DUPCTL(filp->f_pos);
+		spin_lock(&files->file_lock);
+		fdt = files_fdtable(files);
+		max = fdt->max_fds;
+		while (fd < max && !fcheck_files(files, fd)) {
+			fd++;
+			ctl = 0;
+		}
+		spin_unlock(&files->file_lock);
+		if (fd >= max)
+			break;
+		len = scnprintf(name, sizeof(name), ctl ? "%dctl" : "%d", fd);
+		if (filldir(dirent, name, len, DUPINO(fd, ctl),
+			    DUPINO(fd, ctl), DT_REG) < 0)
+			break;
+		filp->f_pos = DUPINO(fd, ctl) + 1;
+	}
+	return 0;
+}
+
+static const struct inode_operations dup_dir_iops = {
+	.lookup		= dup_lookup,
+};
+
+static const struct file_operations dup_dir_fops = {
+	.read		= generic_read_dir,
+	.readdir	= dup_readdir,
+	.llseek		= default_llseek,
+};
+
+/* The root of '#d' */
+static int dup_attach(char *spec, struct path *path)
+{
+	path->mnt = mntget(dup_mnt);
+	path->dentry = dget(dup_mnt->mnt_root);
+	return 0;
+}
+
+static const struct super_operations dup_sops = {
+	.statfs		= simple_statfs,
+	.drop_inode	= generic_delete_inode,
+};
+
+static int dup_fill_super(struct super_block *sb, void *data, int silent)
+{
+	struct inode *inode;
+
+	sb->s_magic = DUP_MAGIC;
+	sb->s_op = &dup_sops;
+	inode = new_inode(sb);
+	if (!inode)
+		return -ENOMEM;
+	inode->i_ino = 1;
+	inode->i_mode = S_IFDIR | 0500;
+	inode->i_atime = inode->i_mtime = inode->i_ctime = CURRENT_TIME;
+	inode->i_op = &dup_dir_iops;
+	inode->i_fop = &dup_dir_fops;
+	sb->s_root = d_alloc_root(inode);
+	if (!sb->s_root) {
+		iput(inode);
+		return -ENOMEM;
+	}
+	return 0;
+}
+
+static int dup_get_sb(struct file_system_type *fs_type, int flags,
+		      const char *dev_name, void *data, struct vfsmount *mnt)
+{
+	return get_sb_single(fs_type, flags, data, dup_fill_super, mnt);
+}
+
+static struct file_system_type dup_fs_type = {
+	.name		= "plan9dup",
+	.get_sb		= dup_get_sb,
+	.kill_sb	= kill_anon_super,
+};
+
+static struct p9_dev dup_dev = {
+	.dc	= 'd',
+	.name	= "dup",
+	.attach	= dup_attach,
+	.fstype	= &dup_fs_type,
+};
+
+static int __init devdup_init(void)
+{
+	int err = register_filesystem(&dup_fs_type);
+
+	if (err)
+		return err;
+	dup_mnt = kern_mount(&dup_fs_type);
+	if (IS_ERR(dup_mnt)) {
+		err = PTR_ERR(dup_mnt);
+		unregister_filesystem(&dup_fs_type);
+		return err;
+	}
+	return p9_devregister(&dup_dev);
+}
+
+static void __exit devdup_exit(void)
+{
+	p9_devunregister(&dup_dev);
+	mntput(dup_mnt);
+	unregister_filesystem(&dup_fs_type);
+}
+
+module_init(devdup_init);
+module_exit(devdup_exit);
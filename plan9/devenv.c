@@ -0,0 +1,740 @@
+/*
+ * Copyright (C) 2008 Anant Narayanan <anant@kix.in>
+ * Plan 9 '#e' emulation: environment variables.
+ *
+ * Every Plan 9 process belongs to an environment group, whose
+ * variables are the files of '#e'. rfork shares the group with the
+ * child, gives it a copy (RFENVG) or an empty one (RFCENVG). A copy
+ * shares its parent's table of variables until either of them changes
+ * something, so forking with a large environment costs a reference,
+ * not a copy.
+ *
+ * Variables are found by name in a hash table. Reading one is a single
+ * copy out under the group's lock, so a read at offset 0 big enough
+ * for the value gets all of it at once; likewise a write to a variable
+ * opened with OTRUNC replaces the value at once.
+ *
+ * A process not made by rfork starts with the environment it was
+ * given by execve.
+ */
+#include <linux/fs.h>
+#include <linux/hash.h>
+#include <linux/init.h>
+#include <linux/kref.h>
+#include <linux/slab.h>
+#include <linux/mount.h>
+#include <linux/sched.h>
+#include <linux/dcache.h>
+#include <linux/module.h>
+#include <linux/string.h>
+#include <linux/rwsem.h>
+#include <linux/uaccess.h>
+
+#include "plan9.h"
+
+#define ENV_MAGIC	0x39656e76	/* "9env" */
+#define EHASHBITS	6
+#define ENVMAX		(1024 * 1024)	/* largest value */
+
+struct env_var {
+	struct hlist_node hash;
+	struct list_head list;		/* in the table, in qid order */
+	unsigned long qid;		/* and inode number */
+	size_t len;
+	char *val;
+	unsigned int namelen;
+	char name[];
+};
+
+struct env_tab {
+	struct kref ref;
+	struct list_head vars;
+	struct hlist_head hash[1 << EHASHBITS];
+};
+
+struct p9_egrp {
+	struct kref ref;
+	struct rw_semaphore sem;
+	struct env_tab *tab;		/* NULL while empty */
+};
+
+/* Qids of variables; a copied variable keeps its own. 1 is the root. */
+static atomic_long_t env_qid = ATOMIC_LONG_INIT(1);
+static struct vfsmount *env_mnt;
+
+static struct env_tab *tab_alloc(void)
+{
+	int i;
+	struct env_tab *tab = kmalloc(sizeof(*tab), GFP_KERNEL);
+
+	if (!tab)
+		return NULL;
+	kref_init(&tab->ref);
+	INIT_LIST_HEAD(&tab->vars);
+	for (i = 0; i < (1 << EHASHBITS); i++)
+		INIT_HLIST_HEAD(&tab->hash[i]);
+	return tab;
+}
+
+static void var_free(struct env_var *v)
+{
+	kfree(v->val);
+	kfree(v);
+}
+
+static void tab_free(struct kref *ref)
+{
+	struct env_var *v, *n;
+	struct env_tab *tab = container_of(ref, struct env_tab, ref);
+
+	list_for_each_entry_safe(v, n, &tab->vars, list)
+		var_free(v);
+	kfree(tab);
+}
+
+static struct env_var *var_alloc(const char *name, unsigned int len)
+{
+	struct env_var *v = kmalloc(sizeof(*v) + len + 1, GFP_KERNEL);
+
+	if (!v)
+		return NULL;
+	v->qid = 0;
+	v->len = 0;
+	v->val = NULL;
+	v->namelen = len;
+	memcpy(v->name, name, len);
+	v->name[len] = '\0';
+	return v;
+}
+
+static struct hlist_head *tab_bucket(struct env_tab *tab, const char *name,
+				     unsigned int len)
+{
+	return &tab->hash[hash_long(full_name_hash(name, len), EHASHBITS)];
+}
+
+/* Add v, whose qid is greater than any in tab, to the end of tab */
+static void tab_add(struct env_tab *tab, struct env_var *v)
+{
+	hlist_add_head(&v->hash, tab_bucket(tab, v->name, v->namelen));
+	list_add_tail(&v->list, &tab->vars);
+}
+
+static struct env_var *tab_find(struct env_tab *tab, const char *name,
+				unsigned int len)
+{
+	struct env_var *v;
+	struct hlist_node *n;
+
+	if (!tab)
+		return NULL;
+	hlist_for_each_entry(v, n, tab_bucket(tab, name, len), hash)
+		if (v->namelen == len && !memcmp(v->name, name, len))
+			return v;
+	return NULL;
+}
+
+static struct env_tab *tab_copy(struct env_tab *old)
+{
+	struct env_var *v, *new;
+	struct env_tab *tab = tab_alloc();
+
+	if (!tab)
+		return NULL;
+	list_for_each_entry(v, &old->vars, list) {
+		new = var_alloc(v->name, v->namelen);
+		if (!new)
+			goto nomem;
+		new->qid = v->qid;
+		if (v->len) {
+			new->val = kmemdup(v->val, v->len, GFP_KERNEL);
+			if (!new->val) {
+				kfree(new);
+				goto nomem;
+			}
+			new->len = v->len;
+		}
+		tab_add(tab, new);
+	}
+	return tab;
+
+nomem:
+	kref_put(&tab->ref, tab_free);
+	return NULL;
+}
+
+/*
+ * The table of g, ready to be changed: a table shared with another
+ * group is copied first. Called with g->sem held for writing.
+ */
+static struct env_tab *egrp_writable(struct p9_egrp *g)
+{
+	struct env_tab *tab = g->tab;
+
+	if (tab && atomic_read(&tab->ref.refcount) == 1)
+		return tab;
+
+	tab = tab ? tab_copy(g->tab) : tab_alloc();
+	if (!tab)
+		return NULL;
+	if (g->tab)
+		kref_put(&g->tab->ref, tab_free);
+	g->tab = tab;
+	return tab;
+}
+
+struct p9_egrp *p9_egrp_new(void)
+{
+	struct p9_egrp *g = kmalloc(sizeof(*g), GFP_KERNEL);
+
+	if (!g)
+		return NULL;
+	kref_init(&g->ref);
+	init_rwsem(&g->sem);
+	g->tab = NULL;
+	return g;
+}
+
+/* A copy of g, as for rfork(RFENVG). The variables are shared */
+struct p9_egrp *p9_egrp_copy(struct p9_egrp *g)
+{
+	struct p9_egrp *new = p9_egrp_new();
+
+	if (!new)
+		return NULL;
+
+	down_read(&g->sem);
+	if (g->tab) {
+		kref_get(&g->tab->ref);
+		new->tab = g->tab;
+	}
+	up_read(&g->sem);
+	return new;
+}
+
+struct p9_egrp *p9_egrp_get(struct p9_egrp *g)
+{
+	kref_get(&g->ref);
+	return g;
+}
+
+static void egrp_free(struct kref *ref)
+{
+	struct p9_egrp *g = container_of(ref, struct p9_egrp, ref);
+
+	if (g->tab)
+		kref_put(&g->tab->ref, tab_free);
+	kfree(g);
+}
+
+void p9_egrp_put(struct p9_egrp *g)
+{
+	kref_put(&g->ref, egrp_free);
+}
+
+/* Set name to val in g, making the variable if need be */
+static int egrp_set(struct p9_egrp *g, const char *name, unsigned int nlen,
+		    const char *val, size_t vlen)
+{
+	int error = -ENOMEM;
+	char *p = NULL;
+	struct env_var *v;
+	struct env_tab *tab;
+
+	if (vlen) {
+		p = kmemdup(val, vlen, GFP_KERNEL);
+		if (!p)
+			return -ENOMEM;
+	}
+
+	down_write(&g->sem);
+	tab = egrp_writable(g);
+	if (!tab)
+		goto out;
+	v = tab_find(tab, name, nlen);
+	if (!v) {
+		v = var_alloc(name, nlen);
+		if (!v)
+			goto out;
+		v->qid = atomic_long_inc_return(&env_qid);
+		tab_add(tab, v);
+	}
+	kfree(v->val);
+	v->val = p;
+	v->len = vlen;
+	p = NULL;
+	error = 0;
+out:
+	up_write(&g->sem);
+	kfree(p);
+	return error;
+}
+
+/*
+ * Fill g from the environment strings between p and end, as execve
+ * leaves them: "name=value", each NUL terminated.
+ */
+int p9_env_import(struct p9_egrp *g, const char __user *p,
+		  const char __user *end)
+{
+	int error = 0;
+	long len;
+	char *s, *eq;
+
+	while (p < end) {
+		len = strnlen_user(p, end - p);
+		if (len <= 0 || len > end - p)
+			return -EFAULT;
+		s = kmalloc(len, GFP_KERNEL);
+		if (!s)
+			return -ENOMEM;
+		if (copy_from_user(s, p, len)) {
+			kfree(s);
+			return -EFAULT;
+		}
+		s[len - 1] = '\0';
+		p += len;
+
+		eq = strchr(s, '=');
+		if (eq && eq != s && !memchr(s, '/', eq - s))
+			error = egrp_set(g, s, eq - s, eq + 1, strlen(eq + 1));
+		kfree(s);
+		if (error)
+			return error;
+	}
+	return 0;
+}
+
+/* The group of the process looking at '#e' */
+static struct p9_egrp *env_egrp(void)
+{
+	struct p9_proc *p = p9_proc();
+
+	return p ? p->egrp : NULL;
+}
+
+/* The variable dentry names in g. Called with g->sem held */
+static struct env_var *env_find(struct p9_egrp *g, struct dentry *dentry)
+{
+	return tab_find(g->tab, dentry->d_name.name, dentry->d_name.len);
+}
+
+static const struct inode_operations env_file_iops;
+static const struct file_operations env_file_fops;
+
+static struct inode *env_inode(struct super_block *sb, unsigned long qid)
+{
+	struct inode *inode = new_inode(sb);
+
+	if (!inode)
+		return NULL;
+	inode->i_ino = qid;
+	inode->i_mode = S_IFREG | 0666;
+	inode->i_uid = current_fsuid();
+	inode->i_gid = current_fsgid();
+	inode->i_atime = inode->i_mtime = inode->i_ctime = CURRENT_TIME;
+	inode->i_op = &env_file_iops;
+	inode->i_fop = &env_file_fops;
+	return inode;
+}
+
+/* A dentry holds as long as the variable is in the group looking */
+static int env_d_revalidate(struct dentry *dentry, struct nameidata *nd)
+{
+	int ok;
+	struct env_var *v;
+	struct p9_egrp *g = env_egrp();
+
+	if (!g || !dentry->d_inode)
+		return 0;
+	down_read(&g->sem);
+	v = env_find(g, dentry);
+	ok = v && v->qid == dentry->d_inode->i_ino;
+	up_read(&g->sem);
+	return ok;
+}
+
+static int env_d_delete(struct dentry *dentry)
+{
+	/* A missing variable may be there for someone else */
+	return !dentry->d_inode;
+}
+
+static const struct dentry_operations env_dentry_ops = {
+	.d_revalidate	= env_d_revalidate,
+	.d_delete	= env_d_delete,
+};
+
+static struct dentry *env_lookup(struct inode *dir, struct dentry *dentry,
+				 struct nameidata *nd)
+{
+	unsigned long qid = 0;
+	struct env_var *v;
+	struct inode *inode;
+	struct p9_egrp *g = env_egrp();
+
+	if (!g)
+		return ERR_PTR(-ENOMEM);
+	dentry->d_op = &env_dentry_ops;
+	down_read(&g->sem);
+	v = env_find(g, dentry);
+	if (v)
+		qid = v->qid;
+	up_read(&g->sem);
+	if (!qid) {
+		d_add(dentry, NULL);
+		return NULL;
+	}
+
+	inode = env_inode(dir->i_sb, qid);
+	if (!inode)
+		return ERR_PTR(-ENOMEM);
+	d_add(dentry, inode);
+	return NULL;
+}
+
+static int env_create(struct inode *dir, struct dentry *dentry, int mode,
+		      struct nameidata *nd)
+{
+	int error = -ENOMEM;
+	struct env_var *v;
+	struct env_tab *tab;
+	struct inode *inode;
+	struct p9_egrp *g = env_egrp();
+
+	if (!g)
+		return -ENOMEM;
+	down_write(&g->sem);
+	tab = egrp_writable(g);
+	if (!tab)
+		goto out;
+	v = env_find(g, dentry);
+	if (!v) {
+		v = var_alloc(dentry->d_name.name, dentry->d_name.len);
+		if (!v)
+			goto out;
+		v->qid = atomic_long_inc_return(&env_qid);
+		tab_add(tab, v);
+	}
+	inode = env_inode(dir->i_sb, v->qid);
+	if (!inode)
+		goto out;
+	d_instantiate(dentry, inode);
+	dir->i_mtime = dir->i_ctime = CURRENT_TIME;
+	error = 0;
+out:
+	up_write(&g->sem);
+	return error;
+}
+
+static int env_unlink(struct inode *dir, struct dentry *dentry)
+{
+	int error = -ENOMEM;
+	struct env_var *v;
+	struct p9_egrp *g = env_egrp();
+
+	if (!g)
+		return -ENOMEM;
+	down_write(&g->sem);
+	if (!egrp_writable(g))
+		goto out;
+	error = -ENOENT;
+	v = env_find(g, dentry);
+	if (!v)
+		goto out;
+	hlist_del(&v->hash);
+	list_del(&v->list);
+	var_free(v);
+	drop_nlink(dentry->d_inode);
+	dir->i_mtime = dir->i_ctime = CURRENT_TIME;
+	error = 0;
+out:
+	up_write(&g->sem);
+	return error;
+}
+
+/* Only the size can change, as when a variable is opened with OTRUNC */
+static int env_setattr(struct dentry *dentry, struct iattr *attr)
+{
+	int error;
+	char *p;
+	struct env_var *v;
+	struct p9_egrp *g = env_egrp();
+
+	error = inode_change_ok(dentry->d_inode, attr);
+	if (error)
+		return error;
+	if (!(attr->ia_valid & ATTR_SIZE))
+		return 0;
+	if (attr->ia_size > ENVMAX)
+		return -EFBIG;
+	if (!g)
+		return -ENOMEM;
+
+	down_write(&g->sem);
+	error = -ENOMEM;
+	if (!egrp_writable(g))
+		goto out;
+	error = -ENOENT;
+	v = env_find(g, dentry);
+	if (!v)
+		goto out;
+	if (attr->ia_size > v->len) {
+		error = -ENOMEM;
+		p = krealloc(v->val, attr->ia_size, GFP_KERNEL);
+		if (!p)
+			goto out;
+		memset(p + v->len, 0, attr->ia_size - v->len);
+		v->val = p;
+	}
+	v->len = attr->ia_size;
+	i_size_write(dentry->d_inode, v->len);
+	error = 0;
+out:
+	up_write(&g->sem);
+	return error;
+}
+
+static int env_getattr(struct vfsmount *mnt, struct dentry *dentry,
+		       struct kstat *stat)
+{
+	struct env_var *v;
+	struct p9_egrp *g = env_egrp();
+
+	generic_fillattr(dentry->d_inode, stat);
+	if (g) {
+		down_read(&g->sem);
+		v = env_find(g, dentry);
+		if (v)
+			stat->size = v->len;
+		up_read(&g->sem);
+	}
+	return 0;
+}
+
+static const struct inode_operations env_file_iops = {
+	.setattr	= env_setattr,
+	.getattr	= env_getattr,
+};
+
+/* An open variable stays with the group it was opened in */
+static int env_open(struct inode *inode, struct file *f)
+{
+	int found;
+	struct p9_egrp *g = env_egrp();
+
+	if (!g)
+		return -ENOMEM;
+	down_read(&g->sem);
+	found = env_find(g, f->f_path.dentry) != NULL;
+	up_read(&g->sem);
+	if (!found)
+		return -ENOENT;
+	f->private_data = p9_egrp_get(g);
+	return 0;
+}
+
+static int env_release(struct inode *inode, struct file *f)
+{
+	p9_egrp_put(f->private_data);
+	return 0;
+}
+
+static ssize_t env_read(struct file *f, char __user *buf,
+			size_t count, loff_t *ppos)
+{
+	ssize_t n;
+	struct env_var *v;
+	struct p9_egrp *g = f->private_data;
+
+	down_read(&g->sem);
+	v = env_find(g, f->f_path.dentry);
+	if (!v) {
+		n = -ENOENT;
+	} else if (*ppos >= v->len) {
+		n = 0;
+	} else {
+		n = min_t(size_t, count, v->len - *ppos);
+		if (copy_to_user(buf, v->val + *ppos, n))
+			n = -EFAULT;
+		else
+			*ppos += n;
+	}
+	up_read(&g->sem);
+	return n;
+}
+
+static ssize_t env_write(struct file *f, const char __user *buf,
+			 size_t count, loff_t *ppos)
+{
+	ssize_t n;
+	char *tmp, *p;
+	loff_t end = *ppos + count;
+	struct env_var *v;
+	struct p9_egrp *g = f->private_data;
+
+	if (*ppos < 0 || end > ENVMAX)
+		return -EFBIG;
+	tmp = kmalloc(count, GFP_KERNEL);
+	if (!tmp)
+		return -ENOMEM;
+	if (copy_from_user(tmp, buf, count)) {
+		kfree(tmp);
+		return -EFAULT;
+	}
+
+	down_write(&g->sem);
+	n = -ENOMEM;
+	if (!egrp_writable(g))
+		goto out;
+	n = -ENOENT;
+	v = env_find(g, f->f_path.dentry);
+	if (!v)
+		goto out;
+	if (end > v->len) {
+		n = -ENOMEM;
+		p = krealloc(v->val, end, GFP_KERNEL);
+		if (!p)
+			goto out;
+		if (*ppos > v->len)
+			memset(p + v->len, 0, *ppos - v->len);
+		v->val = p;
+		v->len = end;
+	}
+	memcpy(v->val + *ppos, tmp, count);
+	*ppos = end;
+	n = count;
+out:
+	up_write(&g->sem);
+	kfree(tmp);
+	return n;
+}
+
+static const struct file_operations env_file_fops = {
+	.open		= env_open,
+	.read		= env_read,
+	.write		= env_write,
+	.llseek		= default_llseek,
+	.release	= env_release,
+};
+
+static int env_readdir(struct file *filp, void *dirent, filldir_t filldir)
+{
+	struct env_var *v;
+	struct p9_egrp *g = env_egrp();
+	struct inode *inode = filp->f_path.dentry->d_inode;
+
+	if (!g)
+		return -ENOMEM;
+	while (filp->f_pos < 2) {
+		if (filldir(dirent, "..", filp->f_pos + 1, filp->f_pos,
+			    inode->i_ino, DT_DIR) < 0)
+			return 0;
+		filp->f_pos++;
+	}
+
+	/* f_pos is the qid to go on from */
+	down_read(&g->sem);
+	if (g->tab) {
+		list_for_each_entry(v, &g->tab->vars, list) {
+			if (v->qid < filp->f_pos)
+				continue;
+			if (filldir(dirent, v->name, v->namelen, v->qid,
+				    v->qid, DT_REG) < 0)
+				break;
+			filp->f_pos = v->qid + 1;
+		}
+	}
+	up_read(&g->sem);
+	return 0;
+}
+
+static const struct inode_operations env_dir_iops = {
+	.lookup		= env_lookup,
+	.create		= env_create,
+	.unlink		= env_unlink,
+};
+
+static const struct file_operations env_dir_fops = {
+	.read		= generic_read_dir,
+	.readdir	= env_readdir,
+	.llseek		= default_llseek,
+};
+
+static int env_attach(char *spec, struct path *path)
+{
+	path->mnt = mntget(env_mnt);
+	path->dentry = dget(env_mnt->mnt_root);
+	return 0;
+}
+
+static const struct super_operations env_sops = {
+	.statfs		= simple_statfs,
+	.drop_inode	= generic_delete_inode,
+};
+
+static int env_fill_super(struct super_block *sb, void *data, int silent)
+{
+	struct inode *inode;
+
+	sb->s_magic = ENV_MAGIC;
+	sb->s_op = &env_sops;
+	inode = new_inode(sb);
+	if (!inode)
+		return -ENOMEM;
+	inode->i_ino = 1;
+	inode->i_mode = S_IFDIR | 0777;
+	inode->i_atime = inode->i_mtime = inode->i_ctime = CURRENT_TIME;
+	inode->i_op = &env_dir_iops;
+	inode->i_fop = &env_dir_fops;
+	sb->s_root = d_alloc_root(inode);
+	if (!sb->s_root) {
+		iput(inode);
+		return -ENOMEM;
+	}
+	return 0;
+}
+
+static int env_get_sb(struct file_system_type *fs_type, int flags,
+		      const char *dev_name, void *data, struct vfsmount *mnt)
+{
+	return get_sb_single(fs_type, flags, data, env_fill_super, mnt);
+}
+
+static struct file_system_type env_fs_type = {
+	.name		= "plan9env",
+	.get_sb		= env_get_sb,
+	.kill_sb	= kill_anon_super,
+};
+
+static struct p9_dev env_dev = {
+	.dc	= 'e',
+	.name	= "env",
+	.attach	= env_attach,
+	.fstype	= &env_fs_type,
+};
+
+static int __init devenv_init(void)
+{
+	int err = register_filesystem(&env_fs_type);
+
+	if (err)
+		return err;
+	env_mnt = kern_mount(&env_fs_type);
+	if (IS_ERR(env_mnt)) {
+		err = PTR_ERR(env_mnt);
+		unregister_filesystem(&env_fs_type);
+		return err;
+	}
+	return p9_devregister(&env_dev);
+}
+
+static void __exit devenv_exit(void)
+{
+	p9_devunregister(&env_dev);
+	mntput(env_mnt);
+	unregister_filesystem(&env_fs_type);
+}
+
+module_init(devenv_init);
+module_exit(devenv_exit);
@@ -0,0 +1,441 @@
+/*
+ * Copyright (C) 2008 Anant Narayanan <anant@kix.in>
+ * Plan 9 '#T' emulation: the kernel profiler.
+ *
+ * While profiling is on, every timer tick adds its milliseconds to a
+ * bin for the kernel pc it interrupted. kpdata reads as Plan 9's
+ * kprof(8) expects: big-endian longs, the first the time of all ticks,
+ * the second those outside the kernel's text, then a bin for each 8
+ * bytes of text from _stext. kpsym reads as a line for each function
+ * that has been hit, its start, end, time and name, so the profile
+ * can be read without the kernel's symbol table at hand.
+ *
+ * Ticks in the text of a loaded module, such as the network stack of
+ * plan9_net.ko, count in kpdata as outside the text, since kprof(8)
+ * knows only the kernel's. They are also kept by pc, for each 8 bytes,
+ * in a hash, and kpsym lists the module functions they resolve to
+ * along with the kernel's. A module's time is dropped when it unloads,
+ * as its pcs may next belong to another.
+ *
+ * kpctl takes start, startclr, stop and clr, and plan9 or all: whether
+ * to count only ticks that interrupt a process running a Plan 9
+ * binary, which is how to see what the Plan 9 system calls cost, or
+ * every tick.
+ */
+#include <linux/fs.h>
+#include <linux/init.h>
+#include <linux/slab.h>
+#include <linux/mount.h>
+#include <linux/mutex.h>
+#include <linux/sched.h>
+#include <linux/module.h>
+#include <linux/string.h>
+#include <linux/hash.h>
+#include <linux/sort.h>
+#include <linux/kallsyms.h>
+#include <linux/profile.h>
+#include <linux/seq_file.h>
+#include <linux/vmalloc.h>
+#include <linux/uaccess.h>
+#include <asm/sections.h>
+#include <asm/byteorder.h>
+
+#include "plan9.h"
+
+#define KPROF_MAGIC	0x396b7066	/* "9kpf" */
+#define LRES		3		/* log of the bytes of text a bin */
+#define MODPCBITS	12
+#define NMODPC		(1 << MODPCBITS)	/* module pcs kept */
+#define MODPCPROBE	16		/* slots tried for a pc */
+
+enum {
+	Qkpdata = 2,
+	Qkpctl,
+	Qkpsym,
+};
+
+/* [0] all ticks, [1] those outside the text, then the bins */
+static atomic_t *kprof_buf;
+static unsigned long kprof_nbuf;
+
+/* A bin of module text; pc, once set, stays until cleared */
+struct kprof_pc {
+	unsigned long	pc;
+	atomic_t	ms;
+};
+static struct kprof_pc *kprof_modpc;
+static unsigned int kprof_ms;		/* a tick, in milliseconds */
+static int kprof_plan9;			/* only Plan 9 processes count */
+static int kprof_on;
+static DEFINE_MUTEX(kprof_lock);	/* for starting and stopping */
+static struct vfsmount *kprof_mnt;
+
+/*
+ * Add a tick to the bin of module text holding pc. A free slot is
+ * claimed with cmpxchg, as other CPUs may be after the same one; with
+ * none free near its hash, the tick is left to count as outside the
+ * text only.
+ */
+static void kprof_modtick(unsigned long pc)
+{
+	struct kprof_pc *p;
+	unsigned long old;
+	unsigned int i, h;
+
+	pc &= ~((1UL << LRES) - 1);
+	h = hash_long(pc, MODPCBITS);
+	for (i = 0; i < MODPCPROBE; i++) {
+		p = &kprof_modpc[(h + i) & (NMODPC - 1)];
+		old = ACCESS_ONCE(p->pc);
+		if (!old)
+			old = cmpxchg(&p->pc, 0, pc);
+		if (!old || old == pc) {
+			atomic_add(kprof_ms, &p->ms);
+			return;
+		}
+	}
+}
+
+/* Called from the timer interrupt on every CPU */
+static int kprof_tick(struct pt_regs *regs)
+{
+	unsigned long pc = profile_pc(regs);
+	unsigned long text = (unsigned long)_stext;
+
+	if (kprof_plan9 && !p9_binfmt(current->mm))
+		return 0;
+	atomic_add(kprof_ms, &kprof_buf[0]);
+	if (!user_mode_vm(regs) && pc >= text &&
+	    pc < (unsigned long)_etext) {
+		atomic_add(kprof_ms, &kprof_buf[2 + ((pc - text) >> LRES)]);
+		return 0;
+	}
+	atomic_add(kprof_ms, &kprof_buf[1]);
+	/* Preemption is off here, as __module_text_address wants */
+	if (!user_mode_vm(regs) && __module_text_address(pc))
+		kprof_modtick(pc);
+	return 0;
+}
+
+static void kprof_clear(void)
+{
+	unsigned long i;
+
+	for (i = 0; i < kprof_nbuf; i++)
+		atomic_set(&kprof_buf[i], 0);
+	for (i = 0; i < NMODPC; i++) {
+		kprof_modpc[i].pc = 0;
+		atomic_set(&kprof_modpc[i].ms, 0);
+	}
+}
+
+/*
+ * A module is going: drop its time. Its slots keep their pcs, which
+ * other pcs may have been hashed past; a module loaded at the same
+ * place takes them over.
+ */
+static int kprof_module(struct notifier_block *nb, unsigned long state,
+			void *data)
+{
+	struct module *mod = data;
+	unsigned long i, base = (unsigned long)mod->module_core;
+
+	if (state != MODULE_STATE_GOING)
+		return NOTIFY_DONE;
+	mutex_lock(&kprof_lock);
+	if (kprof_modpc)
+		for (i = 0; i < NMODPC; i++)
+			if (kprof_modpc[i].pc - base < mod->core_text_size)
+				atomic_set(&kprof_modpc[i].ms, 0);
+	mutex_unlock(&kprof_lock);
+	return NOTIFY_DONE;
+}
+
+static struct notifier_block kprof_module_nb = {
+	.notifier_call	= kprof_module,
+};
+
+/* Called with kprof_lock held */
+static int kprof_start(void)
+{
+	int error;
+
+	if (kprof_on)
+		return 0;
+	if (!kprof_buf) {
+		kprof_nbuf = 2 + (((unsigned long)_etext -
+				   (unsigned long)_stext) >> LRES) + 1;
+		kprof_buf = vmalloc(kprof_nbuf * sizeof(*kprof_buf));
+		if (!kprof_buf)
+			return -ENOMEM;
+		kprof_modpc = vmalloc(NMODPC * sizeof(*kprof_modpc));
+		if (!kprof_modpc) {
+			vfree(kprof_buf);
+			kprof_buf = NULL;
+			return -ENOMEM;
+		}
+		kprof_clear();
+	}
+	/* oprofile's timer mode uses the same hook */
+	error = register_timer_hook(kprof_tick);
+	if (error)
+		return error;
+	kprof_on = 1;
+	return 0;
+}
+
+static void kprof_stop(void)
+{
+	if (!kprof_on)
+		return;
+	unregister_timer_hook(kprof_tick);
+	kprof_on = 0;
+}
+
+static ssize_t kpctl_write(struct file *f, const char __user *buf,
+			   size_t count, loff_t *offset)
+{
+	int error = 0;
+	char msg[16];
+
+	if (count >= sizeof(msg))
+		return -EINVAL;
+	if (copy_from_user(msg, buf, count))
+		return -EFAULT;
+	msg[count] = '\0';
+	if (count && msg[count - 1] == '\n')
+		msg[count - 1] = '\0';
+
+	mutex_lock(&kprof_lock);
+	if (!strcmp(msg, "start")) {
+		error = kprof_start();
+	} else if (!strcmp(msg, "startclr")) {
+		if (kprof_buf)
+			kprof_clear();
+		error = kprof_start();
+	} else if (!strcmp(msg, "stop")) {
+		kprof_stop();
+	} else if (!strcmp(msg, "clr")) {
+		if (kprof_buf)
+			kprof_clear();
+	} else if (!strcmp(msg, "plan9")) {
+		kprof_plan9 = 1;
+	} else if (!strcmp(msg, "all")) {
+		kprof_plan9 = 0;
+	} else {
+		error = -EINVAL;
+	}
+	mutex_unlock(&kprof_lock);
+	return error ? error : count;
+}
+
+static const struct file_operations kpctl_fops = {
+	.write		= kpctl_write,
+};
+
+/* The bins as big-endian longs, a page at a time */
+static ssize_t kpdata_read(struct file *f, char __user *buf,
+			   size_t count, loff_t *ppos)
+{
+	__be32 *page;
+	unsigned long i, j, nw, n, off;
+	unsigned long size = kprof_nbuf * sizeof(__be32);
+	ssize_t done = 0;
+
+	if (!kprof_buf || *ppos >= size)
+		return 0;
+	page = (__be32 *)__get_free_page(GFP_KERNEL);
+	if (!page)
+		return -ENOMEM;
+
+	while (count > 0 && *ppos < size) {
+		i = *ppos / sizeof(__be32);
+		off = *ppos % sizeof(__be32);
+		nw = min_t(unsigned long, kprof_nbuf - i,
+			   PAGE_SIZE / sizeof(__be32));
+		for (j = 0; j < nw; j++, i++)
+			page[j] = cpu_to_be32(atomic_read(&kprof_buf[i]));
+		n = min_t(unsigned long, nw * sizeof(__be32) - off, count);
+		if (copy_to_user(buf, (char *)page + off, n)) {
+			if (!done)
+				done = -EFAULT;
+			break;
+		}
+		buf += n;
+		count -= n;
+		done += n;
+		*ppos += n;
+	}
+	free_page((unsigned long)page);
+	return done;
+}
+
+static const struct file_operations kpdata_fops = {
+	.read		= kpdata_read,
+	.llseek		= default_llseek,
+};
+
+static int kpsym_cmp(const void *a, const void *b)
+{
+	const struct kprof_pc *x = a, *y = b;
+
+	if (x->pc != y->pc)
+		return x->pc < y->pc ? -1 : 1;
+	return 0;
+}
+
+/* The module functions with time in them, in address order */
+static int kpsym_modules(struct seq_file *m)
+{
+	char name[KSYM_NAME_LEN];
+	char *modname;
+	struct kprof_pc *pcs;
+	unsigned long i, j, n, pc, size, off, end, ms;
+
+	pcs = vmalloc(NMODPC * sizeof(*pcs));
+	if (!pcs)
+		return -ENOMEM;
+	for (i = n = 0; i < NMODPC; i++) {
+		pcs[n].pc = kprof_modpc[i].pc;
+		atomic_set(&pcs[n].ms, atomic_read(&kprof_modpc[i].ms));
+		if (pcs[n].pc && atomic_read(&pcs[n].ms))
+			n++;
+	}
+	sort(pcs, n, sizeof(*pcs), kpsym_cmp, NULL);
+
+	for (i = 0; i < n; i = j) {
+		pc = pcs[i].pc;
+		if (!kallsyms_lookup(pc, &size, &off, &modname, name)) {
+			seq_printf(m, "%.8lx %.8lx %8d ?\n", pc, pc + (1 << LRES),
+				   atomic_read(&pcs[i].ms));
+			j = i + 1;
+			continue;
+		}
+		pc -= off;
+		end = pc + size;
+		ms = 0;
+		for (j = i; j < n && pcs[j].pc < end; j++)
+			ms += atomic_read(&pcs[j].ms);
+		if (modname)
+			seq_printf(m, "%.8lx %.8lx %8lu %s [%s]\n", pc, end, ms,
+				   name, modname);
+		else
+			seq_printf(m, "%.8lx %.8lx %8lu %s\n", pc, end, ms, name);
+	}
+	vfree(pcs);
+	return 0;
+}
+
+/* A line for each function with time in it, in address order */
+static int kpsym_show(struct seq_file *m, void *v)
+{
+	char name[KSYM_NAME_LEN];
+	char *modname;
+	unsigned long i, pc, size, off, end, ms;
+	unsigned long text = (unsigned long)_stext;
+
+	if (!kprof_buf)
+		return 0;
+	for (i = 2; i < kprof_nbuf; i++) {
+		if (!atomic_read(&kprof_buf[i]))
+			continue;
+		pc = text + ((i - 2) << LRES);
+		if (!kallsyms_lookup(pc, &size, &off, &modname, name)) {
+			seq_printf(m, "%.8lx %.8lx %8d ?\n", pc, pc + (1 << LRES),
+				   atomic_read(&kprof_buf[i]));
+			continue;
+		}
+		pc -= off;
+		end = pc + size;
+		ms = 0;
+		/* The function's bins, this one first */
+		for (; i < kprof_nbuf && text + ((i - 2) << LRES) < end; i++)
+			ms += atomic_read(&kprof_buf[i]);
+		i--;
+		seq_printf(m, "%.8lx %.8lx %8lu %s\n", pc, end, ms, name);
+	}
+	return kpsym_modules(m);
+}
+
+static int kpsym_open(struct inode *inode, struct file *f)
+{
+	return single_open(f, kpsym_show, NULL);
+}
+
+static const struct file_operations kpsym_fops = {
+	.open		= kpsym_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static struct tree_descr kprof_files[] = {
+	[Qkpdata]	= { "kpdata", &kpdata_fops, 0444 },
+	[Qkpctl]	= { "kpctl", &kpctl_fops, 0600 },
+	[Qkpsym]	= { "kpsym", &kpsym_fops, 0444 },
+	{ "" }
+};
+
+static int kprof_fill_super(struct super_block *sb, void *data, int silent)
+{
+	return simple_fill_super(sb, KPROF_MAGIC, kprof_files);
+}
+
+static int kprof_get_sb(struct file_system_type *fs_type, int flags,
+			const char *dev_name, void *data, struct vfsmount *mnt)
+{
+	return get_sb_single(fs_type, flags, data, kprof_fill_super, mnt);
+}
+
+static struct file_system_type kprof_fs_type = {
+	.name		= "plan9kprof",
+	.get_sb		= kprof_get_sb,
+	.kill_sb	= kill_litter_super,
+};
+
+static int kprof_attach(char *spec, struct path *path)
+{
+	path->mnt = mntget(kprof_mnt);
+	path->dentry = dget(kprof_mnt->mnt_root);
+	return 0;
+}
+
+static struct p9_dev kprof_dev = {
+	.dc	= 'T',
+	.name	= "kprof",
+	.attach	= kprof_attach,
+	.fstype	= &kprof_fs_type,
+};
+
+static int __init kprof_init(void)
+{
+	int err = register_filesystem(&kprof_fs_type);
+
+	if (err)
+		return err;
+	kprof_ms = jiffies_to_msecs(1);
+	kprof_mnt = kern_mount(&kprof_fs_type);
+	if (IS_ERR(kprof_mnt)) {
+		err = PTR_ERR(kprof_mnt);
+		unregister_filesystem(&kprof_fs_type);
+		return err;
+	}
+	register_module_notifier(&kprof_module_nb);
+	return p9_devregister(&kprof_dev);
+}
+
+static void __exit kprof_exit(void)
+{
+	p9_devunregister(&kprof_dev);
+	unregister_module_notifier(&kprof_module_nb);
+	mutex_lock(&kprof_lock);
+	kprof_stop();
+	mutex_unlock(&kprof_lock);
+	vfree(kprof_modpc);
+	vfree(kprof_buf);
+	mntput(kprof_mnt);
+	unregister_filesystem(&kprof_fs_type);
+}
+
+module_init(kprof_init);
+module_exit(kprof_exit);
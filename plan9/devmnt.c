@@ -0,0 +1,189 @@
+/*
+ * Copyright (C) 2008 Anant Narayanan <anant@kix.in>
+ * Plan 9 mount driver: attach a 9P server on a file descriptor.
+ *
+ * The 9P client is the kernel's own (net/9p and fs/9p) speaking plain
+ * 9P2000 over its fd transport. That transport keeps a tag for every
+ * request in flight and reads replies as they come, so Plan 9
+ * processes sharing a mount don't wait for each other's RPCs. The
+ * root of the attach is then bound into the name space like any other
+ * directory.
+ *
+ * An fd that is an end of a '#|' pipe gets the pipe's own transport,
+ * which hands messages between the client's buffers and the server
+ * without going through the pipe's queues as a file would.
+ *
+ * In a virtual machine, mounting with an fd of -1 attaches the next
+ * free virtio 9P channel instead, to reach a tree exported by the
+ * host. The virtio transport hands the device the client's message
+ * buffers as they are; read and write data is copied once, between
+ * the process and those buffers.
+ *
+ * With MCACHE, file data is kept in the page cache. As in Plan 9's
+ * cache, what was cached is kept only if qid.vers hasn't moved since
+ * it was read; the qid is the one the server gave in reply to the open.
+ * How often that has kept or dropped the cache is in '#c/mntstat'.
+ */
+#include <linux/fs.h>
+#include <linux/cred.h>
+#include <linux/file.h>
+#include <linux/init.h>
+#include <linux/slab.h>
+#include <linux/mount.h>
+#include <linux/sched.h>
+#include <linux/string.h>
+#include <linux/uaccess.h>
+#include <net/9p/9p.h>
+#include <net/9p/client.h>
+
+#include "plan9.h"
+#include "p9_constants.h"
+
+/*
+ * The largest message we offer in Tversion: the limit of the fd
+ * transport, and a larger one over virtio where messages don't pass
+ * through a file. The server may settle on less.
+ */
+#define MNTMSIZE	(64 * 1024)
+#define MNTVMSIZE	(128 * 1024)
+
+/* Cache statistics, as read from '#c/mntstat' */
+static atomic_t mnt_hits;		/* opens that found the cache current */
+static atomic_t mnt_misses;		/* opens that had to drop it */
+static atomic_long_t mnt_dropped;	/* pages dropped by those */
+
+static struct vfsmount *mnt_attach(const char *trans, int fd,
+				   unsigned int msize, const char *aname,
+				   int cache)
+{
+	char *opts;
+	struct vfsmount *mnt;
+	struct file_system_type *type;
+
+	opts = kasprintf(GFP_KERNEL, "trans=%s,rfdno=%d,wfdno=%d,noextend,"
+			 "msize=%u,dfltuid=%u,dfltgid=%u,aname=%s%s",
+			 trans, fd, fd, msize,
+			 current_fsuid(), current_fsgid(), aname,
+			 cache ? ",cache=loose" : "");
+	if (!opts)
+		return ERR_PTR(-ENOMEM);
+
+	type = get_fs_type("9p");
+	if (!type) {
+		kfree(opts);
+		return ERR_PTR(-ENODEV);
+	}
+	mnt = vfs_kern_mount(type, 0, "#M", opts);
+	put_filesystem(type);
+	kfree(opts);
+	return mnt;
+}
+
+/*
+ * mount(2): speak 9P on fd, which must be open for reading and
+ * writing, and bind the tree named aname onto old. Files on the mount
+ * belong to whoever mounted it.
+ */
+int p9_mount(int fd, int afd, struct path *old, int flag, const char *aname)
+{
+	int error, cache = flag & MCACHE;
+	struct file *f;
+	struct path root;
+	struct vfsmount *mnt;
+
+	/* The client attaches without an auth fid */
+	if (afd >= 0)
+		return -EOPNOTSUPP;
+	/* aname ends up in a mount option string */
+	if (strchr(aname, ','))
+		return -EINVAL;
+
+	if (fd < 0) {
+		mnt = mnt_attach("virtio", 0, MNTVMSIZE, aname, cache);
+		goto bind;
+	}
+
+	f = fget(fd);
+	if (!f)
+		return -EBADF;
+	if ((f->f_mode & (FMODE_READ | FMODE_WRITE)) !=
+	    (FMODE_READ | FMODE_WRITE)) {
+		fput(f);
+		return -EBADF;
+	}
+	if (p9_pipe_isend(f))
+		mnt = mnt_attach("p9pipe", fd, MNTMSIZE, aname, cache);
+	else
+		mnt = mnt_attach("fd", fd, MNTMSIZE, aname, cache);
+	fput(f);
+
+bind:
+	if (IS_ERR(mnt))
+		return PTR_ERR(mnt);
+
+	root.mnt = mnt;
+	root.dentry = dget(mnt->mnt_root);
+	error = p9_bind(&root, old, flag);
+	/* Unless it was bound, this was the last reference */
+	path_put(&root);
+	return error;
+}
+
+/*
+ * Called once a file is open: if it is on a 9P mount made with MCACHE,
+ * check what the page cache holds of it against the qid.vers of the
+ * server's reply to the open, which the client leaves in the open fid.
+ * The version the pages were read at is kept in i_version, which 9p has
+ * no other use for. Only when it has moved is the server asked for the
+ * new length. Without MCACHE, 9p reads past the page cache and makes a
+ * new inode for every walk, so there is nothing to check.
+ */
+void p9_mnt_revalidate(struct file *f)
+{
+	struct p9_fid *fid;
+	struct p9_wstat *st;
+	struct inode *inode = f->f_path.dentry->d_inode;
+	struct address_space *mapping = inode->i_mapping;
+
+	if (!S_ISREG(inode->i_mode) ||
+	    strcmp(inode->i_sb->s_type->name, "9p"))
+		return;
+	/* Only cache=loose files are read through the page cache */
+	if (f->f_op->aio_read != generic_file_aio_read)
+		return;
+	/* 9p keeps the fid it opened as the file's private data */
+	fid = f->private_data;
+
+	mutex_lock(&inode->i_mutex);
+	if (inode->i_version == fid->qid.version) {
+		if (mapping->nrpages)
+			atomic_inc(&mnt_hits);
+		goto out;
+	}
+	if (mapping->nrpages) {
+		atomic_inc(&mnt_misses);
+		atomic_long_add(mapping->nrpages, &mnt_dropped);
+		invalidate_inode_pages2(mapping);
+	}
+	st = p9_client_stat(fid);
+	if (IS_ERR(st))
+		goto out;
+	i_size_write(inode, st->length);
+	inode->i_version = fid->qid.version;
+	p9stat_free(st);
+	kfree(st);
+out:
+	mutex_unlock(&inode->i_mutex);
+}
+
+/* '#c/mntstat' */
+ssize_t p9_mntstat_read(char __user *buf, size_t count, loff_t *offset)
+{
+	char statbuf[96];
+	int n;
+
+	n = scnprintf(statbuf, sizeof(statbuf),
+		      "hit %d\nmiss %d\ndropped %ld\n", atomic_read(&mnt_hits),
+		      atomic_read(&mnt_misses), atomic_long_read(&mnt_dropped));
+	return simple_read_from_buffer(buf, count, offset, statbuf, n);
+}
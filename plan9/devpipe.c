@@ -0,0 +1,989 @@
+/*
+ * Copyright (C) 2008 Anant Narayanan <anant@kix.in>
+ * Plan 9 '#|' emulation: bidirectional, message preserving pipes.
+ *
+ * Every attach of '#|' creates a new pipe, a directory holding the two
+ * ends 'data' and 'data1'. Whatever is written on one end is read from
+ * the other, and each read stops at the end of a write.
+ *
+ * When the kernel's 9P client mounts one end, it doesn't read and write
+ * it like a file. Requests are queued for the server by reference to
+ * the client's buffer, and the server's replies are copied straight
+ * into the buffer of the request they answer. The server still sees
+ * ordinary 9P on its end.
+ */
+#include <linux/fs.h>
+#include <linux/mm.h>
+#include <linux/file.h>
+#include <linux/init.h>
+#include <linux/kref.h>
+#include <linux/poll.h>
+#include <linux/slab.h>
+#include <linux/wait.h>
+#include <linux/mount.h>
+#include <linux/namei.h>
+#include <linux/sched.h>
+#include <linux/module.h>
+#include <linux/highmem.h>
+#include <linux/pagemap.h>
+#include <net/9p/9p.h>
+#include <net/9p/client.h>
+#include <net/9p/transport.h>
+
+#include <asm/uaccess.h>
+
+#include "plan9.h"
+
+#define PIPE_MAGIC	0x39706970	/* "9pip" */
+#define PIPE_QMAX	(64 * 1024)	/* bytes queued before writers block */
+
+/*
+ * A message. Small writes are copied into data; writes of a page or
+ * more are copied into pages of their own, listed in data, so that a
+ * large message needs no large allocation. The pages go to the reader
+ * with the block, which frees them once it is read. A 9P request from
+ * the kernel client points at the request's own buffer.
+ */
+struct p9pipe_block {
+	struct list_head list;
+	size_t len;			/* bytes left to read */
+	size_t off;			/* into base, or into the first page */
+	char *base;			/* data, or the request's buffer */
+	struct page **pages;		/* NULL unless copied into pages */
+	int npages;
+	struct p9_req_t *req;		/* 9P requests only */
+	char data[0];
+};
+
+struct p9pipe_queue {
+	struct mutex lock;
+	struct list_head blocks;
+	size_t len;			/* bytes in written blocks */
+	int hungup;			/* the writing end went away */
+	int closed;			/* the reading end went away */
+	struct p9_client *sink;		/* 9P client reading this queue */
+	wait_queue_head_t rwait;
+	wait_queue_head_t wwait;
+};
+
+struct p9pipe;
+
+struct p9pipe_end {
+	struct p9pipe *pipe;
+	int side;
+};
+
+struct p9pipe {
+	struct kref ref;
+	unsigned long id;
+	struct p9pipe_queue q[2];	/* q[i] is read from end i */
+	struct p9pipe_end end[2];
+	atomic_t nopen[2];
+};
+
+static struct vfsmount *p9pipe_mnt;
+static atomic_t p9pipe_ids = ATOMIC_INIT(0);
+
+static const char *p9pipe_names[] = { "data", "data1" };
+
+static const struct file_operations p9pipe_fops;
+static void p9pipe_trans_hangup(struct p9_client *);
+
+static void p9pipe_qinit(struct p9pipe_queue *q)
+{
+	mutex_init(&q->lock);
+	INIT_LIST_HEAD(&q->blocks);
+	q->len = 0;
+	q->hungup = 0;
+	q->closed = 0;
+	q->sink = NULL;
+	init_waitqueue_head(&q->rwait);
+	init_waitqueue_head(&q->wwait);
+}
+
+static struct p9pipe *p9pipe_alloc(void)
+{
+	int i;
+	struct p9pipe *p = kzalloc(sizeof(*p), GFP_KERNEL);
+
+	if (!p)
+		return NULL;
+	kref_init(&p->ref);
+	p->id = atomic_inc_return(&p9pipe_ids);
+	for (i = 0; i < 2; i++) {
+		p9pipe_qinit(&p->q[i]);
+		p->end[i].pipe = p;
+		p->end[i].side = i;
+		atomic_set(&p->nopen[i], 0);
+	}
+	return p;
+}
+
+static void p9pipe_freeblock(struct p9pipe_block *b)
+{
+	int i;
+
+	for (i = 0; i < b->npages; i++)
+		__free_page(b->pages[i]);
+	kfree(b);
+}
+
+/* Drop everything queued */
+static void p9pipe_flush(struct p9pipe_queue *q)
+{
+	struct p9pipe_block *b, *n;
+
+	list_for_each_entry_safe(b, n, &q->blocks, list) {
+		list_del_init(&b->list);
+		p9pipe_freeblock(b);
+	}
+	q->len = 0;
+}
+
+static void p9pipe_free(struct kref *ref)
+{
+	struct p9pipe *p = container_of(ref, struct p9pipe, ref);
+
+	p9pipe_flush(&p->q[0]);
+	p9pipe_flush(&p->q[1]);
+	kfree(p);
+}
+
+static struct p9pipe *p9pipe_of(struct inode *inode)
+{
+	if (S_ISDIR(inode->i_mode))
+		return inode->i_private;
+	return ((struct p9pipe_end *)inode->i_private)->pipe;
+}
+
+/*
+ * File operations on the two ends.
+ */
+static int p9pipe_open(struct inode *inode, struct file *filp)
+{
+	struct p9pipe_end *end = inode->i_private;
+	struct p9pipe *p = end->pipe;
+	struct p9pipe_queue *rq = &p->q[end->side];
+	struct p9pipe_queue *wq = &p->q[!end->side];
+
+	/* Reopening an end that was closed brings the pipe back up */
+	if (atomic_inc_return(&p->nopen[end->side]) == 1) {
+		mutex_lock(&rq->lock);
+		rq->closed = 0;
+		mutex_unlock(&rq->lock);
+		mutex_lock(&wq->lock);
+		wq->hungup = 0;
+		mutex_unlock(&wq->lock);
+	}
+	filp->private_data = end;
+	return 0;
+}
+
+static int p9pipe_release(struct inode *inode, struct file *filp)
+{
+	struct p9pipe_end *end = filp->private_data;
+	struct p9pipe *p = end->pipe;
+	struct p9pipe_queue *rq = &p->q[end->side];
+	struct p9pipe_queue *wq = &p->q[!end->side];
+
+	if (atomic_dec_and_test(&p->nopen[end->side])) {
+		mutex_lock(&rq->lock);
+		rq->closed = 1;
+		p9pipe_flush(rq);
+		mutex_unlock(&rq->lock);
+		wake_up_interruptible(&rq->wwait);
+
+		mutex_lock(&wq->lock);
+		wq->hungup = 1;
+		if (wq->sink)
+			p9pipe_trans_hangup(wq->sink);
+		mutex_unlock(&wq->lock);
+		wake_up_interruptible(&wq->rwait);
+	}
+	return 0;
+}
+
+static int p9pipe_copypages(struct p9pipe_block *b, char __user *buf,
+			    size_t n)
+{
+	char *kaddr;
+	size_t done = 0, off = b->off;
+	unsigned long left, poff, len;
+
+	while (done < n) {
+		poff = off & ~PAGE_MASK;
+		len = min_t(size_t, n - done, PAGE_SIZE - poff);
+		kaddr = kmap(b->pages[off >> PAGE_SHIFT]);
+		left = copy_to_user(buf + done, kaddr + poff, len);
+		kunmap(b->pages[off >> PAGE_SHIFT]);
+		if (left)
+			return -EFAULT;
+		done += len;
+		off += len;
+	}
+	return 0;
+}
+
+static ssize_t p9pipe_read(struct file *filp, char __user *buf,
+			   size_t count, loff_t *ppos)
+{
+	ssize_t ret;
+	size_t n;
+	struct p9pipe_block *b;
+	struct p9pipe_end *end = filp->private_data;
+	struct p9pipe_queue *q = &end->pipe->q[end->side];
+
+	if (count == 0)
+		return 0;
+
+	if (mutex_lock_interruptible(&q->lock))
+		return -ERESTARTSYS;
+	while (list_empty(&q->blocks)) {
+		ret = 0;
+		if (q->hungup)
+			goto out;
+		ret = -EAGAIN;
+		if (filp->f_flags & O_NONBLOCK)
+			goto out;
+		mutex_unlock(&q->lock);
+		if (wait_event_interruptible(q->rwait,
+				!list_empty(&q->blocks) || q->hungup))
+			return -ERESTARTSYS;
+		if (mutex_lock_interruptible(&q->lock))
+			return -ERESTARTSYS;
+	}
+
+	/* Never read past the end of a message */
+	b = list_first_entry(&q->blocks, struct p9pipe_block, list);
+	n = min(count, b->len);
+	if (b->pages)
+		ret = p9pipe_copypages(b, buf, n);
+	else
+		ret = copy_to_user(buf, b->base + b->off, n) ? -EFAULT : 0;
+	if (ret)
+		goto out;
+
+	b->off += n;
+	b->len -= n;
+	if (!b->req)
+		q->len -= n;
+	if (b->len == 0) {
+		list_del_init(&b->list);
+		p9pipe_freeblock(b);
+	}
+	ret = n;
+	wake_up_interruptible(&q->wwait);
+out:
+	mutex_unlock(&q->lock);
+	return ret;
+}
+
+/* Queue b, waiting for room unless filp is non-blocking; b is ours now */
+static ssize_t p9pipe_enqueue(struct file *filp, struct p9pipe_queue *q,
+			      struct p9pipe_block *b)
+{
+	ssize_t ret;
+	size_t n = b->len;
+
+	if (mutex_lock_interruptible(&q->lock)) {
+		p9pipe_freeblock(b);
+		return -ERESTARTSYS;
+	}
+	while (q->len >= PIPE_QMAX && !q->closed) {
+		ret = -EAGAIN;
+		if (filp->f_flags & O_NONBLOCK)
+			goto out_free;
+		mutex_unlock(&q->lock);
+		if (wait_event_interruptible(q->wwait,
+				q->len < PIPE_QMAX || q->closed)) {
+			p9pipe_freeblock(b);
+			return -ERESTARTSYS;
+		}
+		if (mutex_lock_interruptible(&q->lock)) {
+			p9pipe_freeblock(b);
+			return -ERESTARTSYS;
+		}
+	}
+	ret = -EPIPE;
+	if (q->closed)
+		goto out_free;
+
+	list_add_tail(&b->list, &q->blocks);
+	q->len += n;
+	mutex_unlock(&q->lock);
+	wake_up_interruptible(&q->rwait);
+	return n;
+
+out_free:
+	mutex_unlock(&q->lock);
+	p9pipe_freeblock(b);
+	return ret;
+}
+
+static ssize_t p9pipe_writecopy(struct file *filp, struct p9pipe_queue *q,
+				const char __user *buf, size_t n)
+{
+	struct p9pipe_block *b;
+
+	b = kmalloc(sizeof(*b) + n, GFP_KERNEL);
+	if (!b)
+		return -ENOMEM;
+	b->len = n;
+	b->off = 0;
+	b->base = b->data;
+	b->pages = NULL;
+	b->npages = 0;
+	b->req = NULL;
+	if (copy_from_user(b->data, buf, n)) {
+		kfree(b);
+		return -EFAULT;
+	}
+	return p9pipe_enqueue(filp, q, b);
+}
+
+/*
+ * A write of a page or more, into pages of its own. The writer's pages
+ * can't be lent instead: the writer may change them as soon as write
+ * returns, and it mustn't wait for the reader.
+ */
+static ssize_t p9pipe_writepages(struct file *filp, struct p9pipe_queue *q,
+				 const char __user *buf, size_t n)
+{
+	int i, npages = (n + PAGE_SIZE - 1) >> PAGE_SHIFT;
+	size_t len, done = 0;
+	struct p9pipe_block *b;
+
+	b = kmalloc(sizeof(*b) + npages * sizeof(struct page *), GFP_KERNEL);
+	if (!b)
+		return -ENOMEM;
+	b->len = n;
+	b->off = 0;
+	b->base = NULL;
+	b->pages = (struct page **)b->data;
+	b->npages = 0;
+	b->req = NULL;
+	for (i = 0; i < npages; i++) {
+		b->pages[i] = alloc_page(GFP_HIGHUSER);
+		if (!b->pages[i]) {
+			p9pipe_freeblock(b);
+			return -ENOMEM;
+		}
+		b->npages++;
+		len = min_t(size_t, n - done, PAGE_SIZE);
+		if (copy_from_user(kmap(b->pages[i]), buf + done, len)) {
+			kunmap(b->pages[i]);
+			p9pipe_freeblock(b);
+			return -EFAULT;
+		}
+		kunmap(b->pages[i]);
+		done += len;
+	}
+	return p9pipe_enqueue(filp, q, b);
+}
+
+/*
+ * The loopback 9P transport.
+ */
+struct p9pipe_trans {
+	struct file *file;		/* the client's end */
+	struct p9pipe_queue *rq;	/* replies, written by the server */
+	struct p9pipe_queue *wq;	/* requests, read by the server */
+	struct list_head reqs;		/* sent and not yet answered */
+};
+
+/*
+ * The server's end is gone: fail whatever is outstanding. Called with
+ * the reply queue locked.
+ */
+static void p9pipe_trans_hangup(struct p9_client *client)
+{
+	struct p9_req_t *req, *n;
+	struct p9pipe_trans *t = client->trans;
+	LIST_HEAD(dead);
+
+	spin_lock(&client->lock);
+	client->status = Disconnected;
+	list_splice_init(&t->reqs, &dead);
+	list_for_each_entry(req, &dead, req_list) {
+		req->status = REQ_STATUS_ERROR;
+		if (!req->t_err)
+			req->t_err = -EIO;
+	}
+	spin_unlock(&client->lock);
+
+	list_for_each_entry_safe(req, n, &dead, req_list) {
+		list_del(&req->req_list);
+		p9_client_cb(client, req);
+	}
+}
+
+/*
+ * Whether req has gone to the server and still wants its reply. One
+ * being flushed does too: the server may answer it before the Rflush.
+ */
+static int p9pipe_waiting(struct p9_client *client, struct p9_req_t *req)
+{
+	int ok;
+
+	spin_lock(&client->lock);
+	ok = req->status == REQ_STATUS_SENT || req->status == REQ_STATUS_FLSH;
+	spin_unlock(&client->lock);
+	return ok;
+}
+
+/*
+ * A write on the server's end. 9P servers write each reply whole, so
+ * the write is a message, and it goes straight into the buffer of the
+ * request with its tag. Called without the queue locked.
+ */
+static ssize_t p9pipe_reply(struct p9pipe_queue *q, const char __user *buf,
+			    size_t count)
+{
+	u8 hdr[7];
+	u16 tag;
+	u32 size;
+	ssize_t ret;
+	struct p9_req_t *req;
+	struct p9_client *client;
+
+	if (count < sizeof(hdr))
+		return -EIO;
+	if (copy_from_user(hdr, buf, sizeof(hdr)))
+		return -EFAULT;
+	size = le32_to_cpu(*(__le32 *)hdr);
+	tag = le16_to_cpu(*(__le16 *)(hdr + 5));
+
+	if (mutex_lock_interruptible(&q->lock))
+		return -ERESTARTSYS;
+	ret = -EPIPE;
+	client = q->sink;
+	if (!client || q->closed)
+		goto out;
+	ret = -EIO;
+	if (size != count || size > client->msize)
+		goto out;
+	req = p9_tag_lookup(client, tag);
+	if (!req || !p9pipe_waiting(client, req))
+		goto out;
+
+	if (!req->rc) {
+		req->rc = kmalloc(sizeof(struct p9_fcall) + client->msize,
+				  GFP_KERNEL);
+		ret = -ENOMEM;
+		if (!req->rc)
+			goto out;
+		req->rc->sdata = (char *)req->rc + sizeof(struct p9_fcall);
+		req->rc->capacity = client->msize;
+	}
+	ret = -EFAULT;
+	if (copy_from_user(req->rc->sdata, buf, count))
+		goto out;
+
+	/* It may have been cancelled or failed while we copied */
+	ret = -EIO;
+	spin_lock(&client->lock);
+	if (req->status != REQ_STATUS_SENT && req->status != REQ_STATUS_FLSH) {
+		spin_unlock(&client->lock);
+		goto out;
+	}
+	req->status = REQ_STATUS_RCVD;
+	list_del_init(&req->req_list);
+	spin_unlock(&client->lock);
+	p9_client_cb(client, req);
+	ret = count;
+out:
+	mutex_unlock(&q->lock);
+	return ret;
+}
+
+static int p9pipe_trans_create(struct p9_client *client, const char *addr,
+			       char *args)
+{
+	int fd;
+	char *p;
+	struct file *f;
+	struct p9pipe_end *end;
+	struct p9pipe_trans *t;
+
+	p = args ? strstr(args, "rfdno=") : NULL;
+	if (!p)
+		return -EINVAL;
+	fd = simple_strtol(p + 6, NULL, 10);
+
+	f = fget(fd);
+	if (!f)
+		return -EBADF;
+	if (f->f_op != &p9pipe_fops) {
+		fput(f);
+		return -EINVAL;
+	}
+	t = kmalloc(sizeof(*t), GFP_KERNEL);
+	if (!t) {
+		fput(f);
+		return -ENOMEM;
+	}
+	end = f->private_data;
+	t->file = f;
+	t->rq = &end->pipe->q[end->side];
+	t->wq = &end->pipe->q[!end->side];
+	INIT_LIST_HEAD(&t->reqs);
+
+	/* Anything already queued would be taken for a reply */
+	mutex_lock(&t->rq->lock);
+	if (t->rq->sink || !list_empty(&t->rq->blocks) || t->rq->hungup) {
+		mutex_unlock(&t->rq->lock);
+		kfree(t);
+		fput(f);
+		return -EBUSY;
+	}
+	client->trans = t;
+	client->status = Connected;
+	t->rq->sink = client;
+	mutex_unlock(&t->rq->lock);
+	return 0;
+}
+
+static void p9pipe_trans_close(struct p9_client *client)
+{
+	struct p9pipe_block *b, *n;
+	struct p9pipe_trans *t = client->trans;
+
+	if (!t)
+		return;
+
+	mutex_lock(&t->rq->lock);
+	t->rq->sink = NULL;
+	mutex_unlock(&t->rq->lock);
+
+	/* Requests the server never read point at buffers about to go */
+	mutex_lock(&t->wq->lock);
+	list_for_each_entry_safe(b, n, &t->wq->blocks, list) {
+		if (b->req) {
+			list_del(&b->list);
+			kfree(b);
+		}
+	}
+	mutex_unlock(&t->wq->lock);
+
+	client->status = Disconnected;
+	client->trans = NULL;
+	fput(t->file);
+	kfree(t);
+}
+
+/* Queue req for the server without copying it */
+static int p9pipe_trans_request(struct p9_client *client, struct p9_req_t *req)
+{
+	struct p9pipe_block *b;
+	struct p9pipe_trans *t = client->trans;
+
+	b = kmalloc(sizeof(*b), GFP_KERNEL);
+	if (!b)
+		return -ENOMEM;
+	b->len = req->tc->size;
+	b->off = 0;
+	b->base = req->tc->sdata;
+	b->pages = NULL;
+	b->npages = 0;
+	b->req = req;
+
+	mutex_lock(&t->wq->lock);
+	if (t->wq->closed) {
+		mutex_unlock(&t->wq->lock);
+		kfree(b);
+		return -EPIPE;
+	}
+	spin_lock(&client->lock);
+	req->status = REQ_STATUS_SENT;
+	list_add_tail(&req->req_list, &t->reqs);
+	spin_unlock(&client->lock);
+	list_add_tail(&b->list, &t->wq->blocks);
+	mutex_unlock(&t->wq->lock);
+	wake_up_interruptible(&t->wq->rwait);
+	return 0;
+}
+
+/*
+ * A request the server hasn't started reading is simply taken back;
+ * otherwise the client has to send a Tflush.
+ */
+static int p9pipe_trans_cancel(struct p9_client *client, struct p9_req_t *req)
+{
+	int ret = 1;
+	struct p9pipe_block *b;
+	struct p9pipe_trans *t = client->trans;
+
+	mutex_lock(&t->wq->lock);
+	list_for_each_entry(b, &t->wq->blocks, list) {
+		if (b->req == req) {
+			if (b->off == 0) {
+				list_del(&b->list);
+				kfree(b);
+				spin_lock(&client->lock);
+				list_del_init(&req->req_list);
+				req->status = REQ_STATUS_FLSHD;
+				spin_unlock(&client->lock);
+				ret = 0;
+			}
+			break;
+		}
+	}
+	mutex_unlock(&t->wq->lock);
+	return ret;
+}
+
+static struct p9_trans_module p9pipe_trans = {
+	.name		= "p9pipe",
+	.maxsize	= 128 * 1024,
+	.def		= 0,
+	.create		= p9pipe_trans_create,
+	.close		= p9pipe_trans_close,
+	.request	= p9pipe_trans_request,
+	.cancel		= p9pipe_trans_cancel,
+	.owner		= THIS_MODULE,
+};
+
+/* Whether f is an end of a '#|' pipe, which can carry p9pipe */
+int p9_pipe_isend(struct file *f)
+{
+	return f->f_op == &p9pipe_fops;
+}
+
+static ssize_t p9pipe_write(struct file *filp, const char __user *buf,
+			    size_t count, loff_t *ppos)
+{
+	size_t n;
+	ssize_t ret = 0, done = 0;
+	struct p9pipe_end *end = filp->private_data;
+	struct p9pipe_queue *q = &end->pipe->q[!end->side];
+
+	if (q->sink)
+		return p9pipe_reply(q, buf, count);
+
+	/* Like Plan 9, writes too big for one message are split */
+	while (done < count) {
+		n = count - done;
+		n = min_t(size_t, n, PIPE_QMAX);
+		if (n >= PAGE_SIZE)
+			ret = p9pipe_writepages(filp, q, buf + done, n);
+		else
+			ret = p9pipe_writecopy(filp, q, buf + done, n);
+		if (ret <= 0)
+			break;
+		done += ret;
+	}
+
+	if (ret == -EPIPE)
+		send_sig(SIGPIPE, current, 0);
+	return done ? done : ret;
+}
+
+static unsigned int p9pipe_poll(struct file *filp, poll_table *wait)
+{
+	unsigned int mask = 0;
+	struct p9pipe_end *end = filp->private_data;
+	struct p9pipe_queue *rq = &end->pipe->q[end->side];
+	struct p9pipe_queue *wq = &end->pipe->q[!end->side];
+
+	poll_wait(filp, &rq->rwait, wait);
+	poll_wait(filp, &wq->wwait, wait);
+
+	if (!list_empty(&rq->blocks) || rq->hungup)
+		mask |= POLLIN | POLLRDNORM;
+	if (rq->hungup)
+		mask |= POLLHUP;
+	if (wq->len < PIPE_QMAX || wq->closed)
+		mask |= POLLOUT | POLLWRNORM;
+	if (wq->closed)
+		mask |= POLLERR;
+	return mask;
+}
+
+static const struct file_operations p9pipe_fops = {
+	.owner		= THIS_MODULE,
+	.open		= p9pipe_open,
+	.release	= p9pipe_release,
+	.read		= p9pipe_read,
+	.write		= p9pipe_write,
+	.poll		= p9pipe_poll,
+	.llseek		= no_llseek,
+};
+
+/*
+ * The pipe directory.
+ */
+static int p9pipe_d_delete(struct dentry *dentry)
+{
+	/* Don't keep finished pipes around in the dcache */
+	return 1;
+}
+
+/* Name pipes the way Plan 9 does, for fd2path */
+static char *p9pipe_d_dname(struct dentry *dentry, char *buf, int buflen)
+{
+	if (dentry->d_parent == dentry->d_sb->s_root)
+		return dynamic_dname(dentry, buf, buflen, "#|");
+	return dynamic_dname(dentry, buf, buflen, "#|/%s",
+			     dentry->d_name.name);
+}
+
+static const struct dentry_operations p9pipe_dentry_ops = {
+	.d_delete	= p9pipe_d_delete,
+	.d_dname	= p9pipe_d_dname,
+};
+
+static struct inode *p9pipe_inode(struct p9pipe *p, int mode)
+{
+	struct inode *inode = new_inode(p9pipe_mnt->mnt_sb);
+
+	if (!inode)
+		return NULL;
+	inode->i_mode = mode;
+	inode->i_uid = current_fsuid();
+	inode->i_gid = current_fsgid();
+	inode->i_atime = inode->i_mtime = inode->i_ctime = CURRENT_TIME;
+	kref_get(&p->ref);
+	return inode;
+}
+
+static struct dentry *p9pipe_lookup(struct inode *dir, struct dentry *dentry,
+				    struct nameidata *nd)
+{
+	int side;
+	struct inode *inode;
+	struct p9pipe *p = dir->i_private;
+
+	dentry->d_op = &p9pipe_dentry_ops;
+	for (side = 0; side < 2; side++)
+		if (dentry->d_name.len == strlen(p9pipe_names[side]) &&
+		    !memcmp(dentry->d_name.name, p9pipe_names[side],
+			    dentry->d_name.len))
+			break;
+	if (side == 2) {
+		d_add(dentry, NULL);
+		return NULL;
+	}
+
+	inode = p9pipe_inode(p, S_IFREG | 0600);
+	if (!inode)
+		return ERR_PTR(-ENOMEM);
+	inode->i_ino = dir->i_ino + 1 + side;
+	inode->i_fop = &p9pipe_fops;
+	inode->i_private = &p->end[side];
+	d_add(dentry, inode);
+	return NULL;
+}
+
+static int p9pipe_readdir(struct file *filp, void *dirent, filldir_t filldir)
+{
+	int i;
+	const char *name;
+	struct inode *inode = filp->f_path.dentry->d_inode;
+
+	while (filp->f_pos < 4) {
+		i = filp->f_pos;
+		if (i < 2) {
+			name = i ? ".." : ".";
+			if (filldir(dirent, name, i + 1, i, inode->i_ino,
+				    DT_DIR) < 0)
+				break;
+		} else {
+			name = p9pipe_names[i - 2];
+			if (filldir(dirent, name, strlen(name), i,
+				    inode->i_ino + i - 1, DT_REG) < 0)
+				break;
+		}
+		filp->f_pos++;
+	}
+	return 0;
+}
+
+static const struct inode_operations p9pipe_dir_iops = {
+	.lookup		= p9pipe_lookup,
+};
+
+static const struct file_operations p9pipe_dir_fops = {
+	.read		= generic_read_dir,
+	.readdir	= p9pipe_readdir,
+	.llseek		= default_llseek,
+};
+
+/* Attach to '#|', creating a new pipe */
+static struct dentry *p9pipe_attach(void)
+{
+	struct p9pipe *p;
+	struct inode *inode;
+	struct dentry *dentry;
+	struct qstr name = { .name = "|", .len = 1 };
+
+	p = p9pipe_alloc();
+	if (!p)
+		return ERR_PTR(-ENOMEM);
+
+	dentry = ERR_PTR(-ENOMEM);
+	inode = p9pipe_inode(p, S_IFDIR | 0500);
+	if (!inode)
+		goto out;
+	inode->i_ino = p->id << 2;
+	inode->i_op = &p9pipe_dir_iops;
+	inode->i_fop = &p9pipe_dir_fops;
+	inode->i_private = p;
+
+	dentry = d_alloc(p9pipe_mnt->mnt_sb->s_root, &name);
+	if (!dentry) {
+		iput(inode);
+		dentry = ERR_PTR(-ENOMEM);
+		goto out;
+	}
+	dentry->d_op = &p9pipe_dentry_ops;
+	d_instantiate(dentry, inode);
+out:
+	/* The directory inode holds the pipe from here on */
+	kref_put(&p->ref, p9pipe_free);
+	return dentry;
+}
+
+/* Open the end called name in the pipe directory dir */
+static struct file *p9pipe_openend(struct dentry *dir, const char *name,
+				   int flags)
+{
+	struct dentry *dentry;
+
+	mutex_lock(&dir->d_inode->i_mutex);
+	dentry = lookup_one_len(name, dir, strlen(name));
+	mutex_unlock(&dir->d_inode->i_mutex);
+	if (IS_ERR(dentry))
+		return (struct file *)dentry;
+	if (!dentry->d_inode) {
+		dput(dentry);
+		return ERR_PTR(-ENOENT);
+	}
+	return dentry_open(dentry, mntget(p9pipe_mnt), flags, current_cred());
+}
+
+/*
+ * The root of '#|': a fresh pipe. Each attach makes a new one, as in
+ * Plan 9; the way to get both ends is to bind '#|' somewhere first or
+ * to use the pipe system call.
+ */
+static int pipe_attach(char *spec, struct path *path)
+{
+	struct dentry *dir = p9pipe_attach();
+
+	if (IS_ERR(dir))
+		return PTR_ERR(dir);
+	path->dentry = dir;
+	path->mnt = mntget(p9pipe_mnt);
+	return 0;
+}
+
+static struct p9_dev pipe_dev = {
+	.dc	= '|',
+	.name	= "pipe",
+	.attach	= pipe_attach,
+};
+
+/* pipe(2): attach '#|' and open both of its ends */
+long p9_pipe(int __user *fildes)
+{
+	int i, fd[2];
+	long error;
+	struct file *f[2];
+	struct dentry *dir;
+
+	dir = p9pipe_attach();
+	if (IS_ERR(dir))
+		return PTR_ERR(dir);
+
+	f[0] = p9pipe_openend(dir, p9pipe_names[0], O_RDWR);
+	error = PTR_ERR(f[0]);
+	if (IS_ERR(f[0]))
+		goto out_dir;
+	f[1] = p9pipe_openend(dir, p9pipe_names[1], O_RDWR);
+	error = PTR_ERR(f[1]);
+	if (IS_ERR(f[1]))
+		goto out_f0;
+
+	error = fd[0] = get_unused_fd();
+	if (fd[0] < 0)
+		goto out_f1;
+	error = fd[1] = get_unused_fd();
+	if (fd[1] < 0)
+		goto out_fd0;
+
+	error = -EFAULT;
+	if (copy_to_user(fildes, fd, sizeof(fd)))
+		goto out_fd1;
+
+	for (i = 0; i < 2; i++)
+		fd_install(fd[i], f[i]);
+	dput(dir);
+	return 0;
+
+out_fd1:
+	put_unused_fd(fd[1]);
+out_fd0:
+	put_unused_fd(fd[0]);
+out_f1:
+	fput(f[1]);
+out_f0:
+	fput(f[0]);
+out_dir:
+	dput(dir);
+	return error;
+}
+
+/*
+ * A single internal mount holds every pipe.
+ */
+static void p9pipe_clear_inode(struct inode *inode)
+{
+	if (inode->i_private)
+		kref_put(&p9pipe_of(inode)->ref, p9pipe_free);
+}
+
+static const struct super_operations p9pipe_sops = {
+	.statfs		= simple_statfs,
+	.drop_inode	= generic_delete_inode,
+	.clear_inode	= p9pipe_clear_inode,
+};
+
+static int p9pipe_get_sb(struct file_system_type *fs_type, int flags,
+			 const char *dev_name, void *data,
+			 struct vfsmount *mnt)
+{
+	return get_sb_pseudo(fs_type, "|:", &p9pipe_sops, PIPE_MAGIC, mnt);
+}
+
+static struct file_system_type p9pipe_fs_type = {
+	.name		= "plan9pipe",
+	.get_sb		= p9pipe_get_sb,
+	.kill_sb	= kill_anon_super,
+};
+
+static int __init devpipe_init(void)
+{
+	int err = register_filesystem(&p9pipe_fs_type);
+
+	if (err)
+		return err;
+	p9pipe_mnt = kern_mount(&p9pipe_fs_type);
+	if (IS_ERR(p9pipe_mnt)) {
+		err = PTR_ERR(p9pipe_mnt);
+		unregister_filesystem(&p9pipe_fs_type);
+		return err;
+	}
+	v9fs_register_trans(&p9pipe_trans);
+	return p9_devregister(&pipe_dev);
+}
+
+static void __exit devpipe_exit(void)
+{
+	p9_devunregister(&pipe_dev);
+	v9fs_unregister_trans(&p9pipe_trans);
+	mntput(p9pipe_mnt);
+	unregister_filesystem(&p9pipe_fs_type);
+}
+
+module_init(devpipe_init);
+module_exit(devpipe_exit);
@@ -0,0 +1,1064 @@
+/*
+ * Copyright (C) 2008 Anant Narayanan <anant@kix.in>
+ * Plan 9 '#p' emulation: the processes.
+ *
+ * '#p' has a directory for each process running a Plan 9 binary,
+ * named by its pid, with the files Plan 9's tools expect:
+ *
+ *	ctl	kill, stop or start the process, or set where and
+ *		how urgently it runs
+ *	edf	its real-time parameters and missed deadlines
+ *	mem	its memory, at offsets that are addresses
+ *	note	notes written here become the nearest Linux signal
+ *	ns	the binds that would make its name space
+ *	regs	its registers, as a Ureg
+ *	segment	its segments
+ *	status	its name, user, state, times, size, priorities and
+ *		the CPU it is wired to
+ *	text	its executable
+ *	wait	the exit of its next child, for the process itself
+ *
+ * status is a single fixed size record made in one go, so ps costs one
+ * read a process. mem is copied a page at a time between the address
+ * spaces.
+ */
+#include <linux/fs.h>
+#include <linux/mm.h>
+#include <linux/init.h>
+#include <linux/slab.h>
+#include <linux/cred.h>
+#include <linux/file.h>
+#include <linux/mount.h>
+#include <linux/sched.h>
+#include <linux/dcache.h>
+#include <linux/module.h>
+#include <linux/ptrace.h>
+#include <linux/string.h>
+#include <linux/cpumask.h>
+#include <linux/security.h>
+#include <linux/resource.h>
+#include <linux/seq_file.h>
+#include <linux/syscalls.h>
+#include <linux/uaccess.h>
+#include <linux/fs_struct.h>
+#include <linux/pid_namespace.h>
+
+#include "plan9.h"
+
+#define PROC_MAGIC	0x39707263	/* "9prc" */
+
+#define KNAMELEN	28
+#define NUMSIZE		12
+#define STATSIZE	(2 * KNAMELEN + 12 + 10 * NUMSIZE)
+
+/* Inode numbers: the pid and which file */
+#define QSHIFT		4
+#define PROCINO(pid, q)	(((unsigned long)(pid) << QSHIFT) | (q))
+#define PROCQ(ino)	((ino) & ((1 << QSHIFT) - 1))
+
+enum {
+	Qdir,		/* a process's directory */
+	Qroot,		/* '#p' itself */
+	Qctl,
+	Qmem,
+	Qnote,
+	Qns,
+	Qregs,
+	Qsegment,
+	Qstatus,
+	Qtext,
+	Qwait,
+	Qedf,
+};
+
+/* The user-settable flags in a Ureg */
+#define UREGFLAGS	(X86_EFLAGS_CF | X86_EFLAGS_PF | X86_EFLAGS_AF | \
+			 X86_EFLAGS_ZF | X86_EFLAGS_SF | X86_EFLAGS_TF | \
+			 X86_EFLAGS_DF | X86_EFLAGS_OF | X86_EFLAGS_RF | \
+			 X86_EFLAGS_AC)
+
+/* Plan 9's 386 registers, as in /proc/n/regs */
+struct ureg {
+	u32 di, si, bp, nsp, bx, dx, cx, ax;
+	u32 gs, fs, es, ds;
+	u32 trap, ecode;
+	u32 pc, cs, flags;
+	u32 sp, ss;
+};
+
+struct proc_file {
+	const char *name;
+	int q;
+	umode_t mode;
+	const struct file_operations *fops;
+};
+
+static const struct proc_file proc_files[];
+static const struct inode_operations proc_pid_iops;
+static const struct file_operations proc_pid_fops;
+static struct vfsmount *proc_mnt;
+
+/* Whether t is a process running a Plan 9 binary */
+static int proc_isplan9(struct task_struct *t)
+{
+	int ok;
+
+	if (!thread_group_leader(t))
+		return 0;
+	task_lock(t);
+	ok = p9_binfmt(t->mm);
+	task_unlock(t);
+	return ok;
+}
+
+/*
+ * The process an inode of '#p' is about, referenced, or NULL if gone.
+ * The inode holds the struct pid it was made for, so a process that
+ * has since been given the same number is never mistaken for it.
+ */
+static struct task_struct *proc_task(struct inode *inode)
+{
+	return get_pid_task(inode->i_private, PIDTYPE_PID);
+}
+
+/* Linux nice values as Plan 9 priorities: 0 to 19, normally 10 */
+static int proc_pri(int nice)
+{
+	return clamp(10 - nice / 2, 0, 19);
+}
+
+static const char *proc_state(struct task_struct *t)
+{
+	if (t->exit_state & EXIT_DEAD)
+		return "Dead";
+	if (t->exit_state & EXIT_ZOMBIE)
+		return "Moribund";
+	if (t->state == TASK_RUNNING)
+		return task_curr(t) ? "Running" : "Ready";
+	if (t->state & (TASK_STOPPED | TASK_TRACED))
+		return "Stopped";
+	return "Wakeme";
+}
+
+/* The CPU t is wired to, or -1 */
+static int proc_wired(struct task_struct *t)
+{
+	if (cpumask_weight(&t->cpus_allowed) != 1)
+		return -1;
+	return cpumask_first(&t->cpus_allowed);
+}
+
+static ssize_t status_read(struct file *f, char __user *buf,
+			   size_t count, loff_t *offset)
+{
+	int n, basepri, pri;
+	char sbuf[STATSIZE + 1];
+	unsigned long size = 0, real;
+	cputime_t cutime = cputime_zero, cstime = cputime_zero;
+	unsigned long flags;
+	struct timespec now;
+	struct mm_struct *mm;
+	struct task_struct *t = proc_task(f->f_path.dentry->d_inode);
+
+	if (!t)
+		return -ESRCH;
+
+	if (lock_task_sighand(t, &flags)) {
+		cutime = t->signal->cutime;
+		cstime = t->signal->cstime;
+		unlock_task_sighand(t, &flags);
+	}
+	mm = get_task_mm(t);
+	if (mm) {
+		size = mm->total_vm << (PAGE_SHIFT - 10);
+		mmput(mm);
+	}
+	do_posix_clock_monotonic_gettime(&now);
+	now = timespec_sub(now, t->start_time);
+	real = now.tv_sec * MSEC_PER_SEC + now.tv_nsec / NSEC_PER_MSEC;
+	basepri = proc_pri(task_nice(t));
+	pri = rt_task(t) ? 19 : basepri;
+
+	n = scnprintf(sbuf, sizeof(sbuf),
+		      "%-*s %-*u %-11s %11lu %11lu %11lu %11lu %11lu %11lu "
+		      "%11lu %11d %11d %11d ",
+		      KNAMELEN - 1, t->comm, KNAMELEN - 1, task_uid(t),
+		      proc_state(t),
+		      (unsigned long)cputime_to_msecs(t->utime),
+		      (unsigned long)cputime_to_msecs(t->stime), real,
+		      (unsigned long)cputime_to_msecs(cutime),
+		      (unsigned long)cputime_to_msecs(cstime), 0UL,
+		      size, basepri, pri, proc_wired(t));
+	put_task_struct(t);
+	return simple_read_from_buffer(buf, count, offset, sbuf, n);
+}
+
+static const struct file_operations status_fops = {
+	.read		= status_read,
+};
+
+/* Copy between the process's memory at *ppos and buf, a page at a time */
+static ssize_t mem_rw(struct file *f, char __user *buf, size_t count,
+		      loff_t *ppos, int write)
+{
+	char *page;
+	int n, got;
+	ssize_t done = 0, error = 0;
+	unsigned long addr = *ppos;
+	struct task_struct *t = proc_task(f->f_path.dentry->d_inode);
+
+	if (!t)
+		return -ESRCH;
+	error = -EPERM;
+	if (!ptrace_may_access(t, PTRACE_MODE_ATTACH))
+		goto out;
+	error = -ENOMEM;
+	page = (char *)__get_free_page(GFP_TEMPORARY);
+	if (!page)
+		goto out;
+
+	error = 0;
+	while (count > 0) {
+		n = min_t(size_t, count, PAGE_SIZE);
+		if (write && copy_from_user(page, buf, n)) {
+			error = -EFAULT;
+			break;
+		}
+		got = access_process_vm(t, addr, page, n, write);
+		if (got <= 0) {
+			error = -EIO;
+			break;
+		}
+		if (!write && copy_to_user(buf, page, got)) {
+			error = -EFAULT;
+			break;
+		}
+		buf += got;
+		addr += got;
+		done += got;
+		count -= got;
+		if (got < n)
+			break;
+	}
+	*ppos = addr;
+	free_page((unsigned long)page);
+out:
+	put_task_struct(t);
+	return done ? done : error;
+}
+
+static ssize_t mem_read(struct file *f, char __user *buf,
+			size_t count, loff_t *ppos)
+{
+	return mem_rw(f, buf, count, ppos, 0);
+}
+
+static ssize_t mem_write(struct file *f, const char __user *buf,
+			 size_t count, loff_t *ppos)
+{
+	return mem_rw(f, (char __user *)buf, count, ppos, 1);
+}
+
+static const struct file_operations mem_fops = {
+	.read		= mem_read,
+	.write		= mem_write,
+	.llseek		= default_llseek,
+};
+
+static void regs_get(struct task_struct *t, struct ureg *u)
+{
+	struct pt_regs *regs = task_pt_regs(t);
+
+	u->di = regs->di;
+	u->si = regs->si;
+	u->bp = regs->bp;
+	u->nsp = regs->sp;
+	u->bx = regs->bx;
+	u->dx = regs->dx;
+	u->cx = regs->cx;
+	u->ax = regs->ax;
+	u->gs = regs->gs;
+	u->fs = regs->fs;
+	u->es = regs->es;
+	u->ds = regs->ds;
+	u->trap = t->thread.trap_no;
+	u->ecode = t->thread.error_code;
+	u->pc = regs->ip;
+	u->cs = regs->cs;
+	u->flags = regs->flags;
+	u->sp = regs->sp;
+	u->ss = regs->ss;
+}
+
+static ssize_t regs_read(struct file *f, char __user *buf,
+			 size_t count, loff_t *offset)
+{
+	struct ureg u;
+	struct task_struct *t = proc_task(f->f_path.dentry->d_inode);
+
+	if (!t)
+		return -ESRCH;
+	if (!ptrace_may_access(t, PTRACE_MODE_READ)) {
+		put_task_struct(t);
+		return -EPERM;
+	}
+	regs_get(t, &u);
+	put_task_struct(t);
+	return simple_read_from_buffer(buf, count, offset, &u, sizeof(u));
+}
+
+/*
+ * The registers of a stopped process can be set, all at once. Only
+ * those a process could set for itself are taken. The process must be
+ * off its CPU, with its registers saved, and is kept from being woken
+ * while they change: waking it takes its siglock.
+ */
+static ssize_t regs_write(struct file *f, const char __user *buf,
+			  size_t count, loff_t *offset)
+{
+	long state;
+	ssize_t error;
+	unsigned long flags;
+	struct ureg u;
+	struct pt_regs *regs;
+	struct task_struct *t;
+
+	if (*offset != 0 || count != sizeof(u))
+		return -EINVAL;
+	if (copy_from_user(&u, buf, sizeof(u)))
+		return -EFAULT;
+	t = proc_task(f->f_path.dentry->d_inode);
+	if (!t)
+		return -ESRCH;
+	error = -EPERM;
+	if (!ptrace_may_access(t, PTRACE_MODE_ATTACH))
+		goto out;
+	error = -EBUSY;
+	state = t->state;
+	if (!(state & (__TASK_STOPPED | __TASK_TRACED)) ||
+	    !wait_task_inactive(t, state))
+		goto out;
+	error = -ESRCH;
+	if (!lock_task_sighand(t, &flags))
+		goto out;
+	error = -EBUSY;
+	if (t->state != state)
+		goto out_unlock;
+
+	regs = task_pt_regs(t);
+	regs->di = u.di;
+	regs->si = u.si;
+	regs->bp = u.bp;
+	regs->bx = u.bx;
+	regs->dx = u.dx;
+	regs->cx = u.cx;
+	regs->ax = u.ax;
+	regs->ip = u.pc;
+	regs->sp = u.sp;
+	regs->flags = (regs->flags & ~UREGFLAGS) | (u.flags & UREGFLAGS);
+	/* Not back out through sysexit, which has its own ideas */
+	set_tsk_thread_flag(t, TIF_IRET);
+	error = count;
+out_unlock:
+	unlock_task_sighand(t, &flags);
+out:
+	put_task_struct(t);
+	return error;
+}
+
+static const struct file_operations regs_fops = {
+	.read		= regs_read,
+	.write		= regs_write,
+};
+
+static int segment_show(struct seq_file *m, void *v)
+{
+	struct mm_struct *mm;
+	struct vm_area_struct *vma;
+	struct task_struct *t = m->private;
+
+	mm = get_task_mm(t);
+	if (!mm)
+		return 0;
+	down_read(&mm->mmap_sem);
+	vma = find_vma(mm, mm->start_stack);
+	if (vma)
+		seq_printf(m, "%-6s %c%c %.8lx %.8lx %4d\n", "Stack", ' ', ' ',
+			   vma->vm_start, vma->vm_end, 1);
+	seq_printf(m, "%-6s %c%c %.8lx %.8lx %4d\n", "Text", 'R', ' ',
+		   mm->start_code & PAGE_MASK, PAGE_ALIGN(mm->end_code), 1);
+	seq_printf(m, "%-6s %c%c %.8lx %.8lx %4d\n", "Data", ' ', ' ',
+		   mm->start_data & PAGE_MASK, PAGE_ALIGN(mm->end_data), 1);
+	seq_printf(m, "%-6s %c%c %.8lx %.8lx %4d\n", "Bss", ' ', ' ',
+		   PAGE_ALIGN(mm->end_data), PAGE_ALIGN(mm->brk), 1);
+	up_read(&mm->mmap_sem);
+	mmput(mm);
+	return 0;
+}
+
+static int ns_show(struct seq_file *m, void *v)
+{
+	char *buf, *p;
+	struct path pwd;
+	struct p9_ns *ns;
+	struct task_struct *t = m->private;
+
+	ns = p9_proc_ns(t);
+	if (ns) {
+		p9_ns_show(m, ns);
+		p9_ns_put(ns);
+	}
+
+	task_lock(t);
+	if (!t->fs) {
+		task_unlock(t);
+		return 0;
+	}
+	read_lock(&t->fs->lock);
+	pwd = t->fs->pwd;
+	path_get(&pwd);
+	read_unlock(&t->fs->lock);
+	task_unlock(t);
+
+	buf = __getname();
+	if (buf) {
+		p = p9_devpath(&pwd, buf, PATH_MAX);
+		if (!IS_ERR(p))
+			seq_printf(m, "cd %s\n", p);
+		__putname(buf);
+	}
+	path_put(&pwd);
+	return 0;
+}
+
+/* Open a seq_file listing of the process, which stays with the file */
+static int proc_seq_open(struct file *f, int (*show)(struct seq_file *, void *))
+{
+	int error;
+	struct task_struct *t = proc_task(f->f_path.dentry->d_inode);
+
+	if (!t)
+		return -ESRCH;
+	error = single_open(f, show, t);
+	if (error)
+		put_task_struct(t);
+	return error;
+}
+
+static int proc_seq_release(struct inode *inode, struct file *f)
+{
+	put_task_struct(((struct seq_file *)f->private_data)->private);
+	return single_release(inode, f);
+}
+
+static int segment_open(struct inode *inode, struct file *f)
+{
+	return proc_seq_open(f, segment_show);
+}
+
+static const struct file_operations segment_fops = {
+	.open		= segment_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= proc_seq_release,
+};
+
+static int ns_open(struct inode *inode, struct file *f)
+{
+	return proc_seq_open(f, ns_show);
+}
+
+static const struct file_operations ns_fops = {
+	.open		= ns_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= proc_seq_release,
+};
+
+/*
+ * text: the process's executable, opened as it was for exec. Reading
+ * it takes read permission on the executable itself, as well as on
+ * text.
+ */
+static int text_open(struct inode *inode, struct file *f)
+{
+	int error = -ENOENT;
+	struct file *exe = NULL;
+	struct mm_struct *mm;
+	struct vm_area_struct *vma;
+	struct task_struct *t = proc_task(inode);
+
+	if (!t)
+		return -ESRCH;
+	mm = get_task_mm(t);
+	put_task_struct(t);
+	if (!mm)
+		return -ENOENT;
+	down_read(&mm->mmap_sem);
+	for (vma = mm->mmap; vma; vma = vma->vm_next) {
+		if ((vma->vm_flags & VM_EXECUTABLE) && vma->vm_file) {
+			exe = get_file(vma->vm_file);
+			break;
+		}
+	}
+	up_read(&mm->mmap_sem);
+	mmput(mm);
+	if (!exe)
+		return error;
+	error = inode_permission(exe->f_path.dentry->d_inode, MAY_READ);
+	if (error) {
+		fput(exe);
+		return error;
+	}
+	f->private_data = exe;
+	return 0;
+}
+
+static ssize_t text_read(struct file *f, char __user *buf,
+			 size_t count, loff_t *ppos)
+{
+	return vfs_read(f->private_data, buf, count, ppos);
+}
+
+static int text_release(struct inode *inode, struct file *f)
+{
+	fput(f->private_data);
+	return 0;
+}
+
+static const struct file_operations text_fops = {
+	.open		= text_open,
+	.read		= text_read,
+	.llseek		= default_llseek,
+	.release	= text_release,
+};
+
+/* Post sig to the process as kill(2) would */
+static int proc_signal(struct inode *inode, int sig)
+{
+	int error;
+	struct task_struct *t = proc_task(inode);
+
+	if (!t)
+		return -ESRCH;
+	error = group_send_sig_info(sig, SEND_SIG_NOINFO, t);
+	put_task_struct(t);
+	return error;
+}
+
+/* A written message, without a trailing newline */
+static char *proc_msg(const char __user *buf, size_t count)
+{
+	char *msg;
+
+	if (count > PAGE_SIZE)
+		return ERR_PTR(-EINVAL);
+	msg = kmalloc(count + 1, GFP_KERNEL);
+	if (!msg)
+		return ERR_PTR(-ENOMEM);
+	if (copy_from_user(msg, buf, count)) {
+		kfree(msg);
+		return ERR_PTR(-EFAULT);
+	}
+	msg[count] = '\0';
+	if (count && msg[count - 1] == '\n')
+		msg[count - 1] = '\0';
+	return msg;
+}
+
+static const struct {
+	const char *note;
+	int sig;
+} proc_notes[] = {
+	{ "interrupt",	SIGINT },
+	{ "hangup",	SIGHUP },
+	{ "alarm",	SIGALRM },
+	{ "kill",	SIGKILL },
+};
+
+/*
+ * A note becomes the signal Linux has for it. Notes without one
+ * become SIGTERM, which like an unhandled note ends the process.
+ */
+static ssize_t note_write(struct file *f, const char __user *buf,
+			  size_t count, loff_t *offset)
+{
+	int i, sig = SIGTERM;
+	ssize_t error;
+	char *msg = proc_msg(buf, count);
+
+	if (IS_ERR(msg))
+		return PTR_ERR(msg);
+	for (i = 0; i < ARRAY_SIZE(proc_notes); i++)
+		if (!strcmp(msg, proc_notes[i].note))
+			sig = proc_notes[i].sig;
+	kfree(msg);
+	error = proc_signal(f->f_path.dentry->d_inode, sig);
+	return error ? error : count;
+}
+
+static const struct file_operations note_fops = {
+	.write		= note_write,
+};
+
+/* Plan 9 priorities as nice values, the inverse of proc_pri */
+static int proc_nice(long pri)
+{
+	return clamp_t(long, (10 - pri) * 2, -20, 19);
+}
+
+/*
+ * wired, pri and fixedpri. The task is checked before it is changed.
+ * CFS never lets a priority float, so fixedpri is pri. With mem they
+ * are for every proc sharing this one's memory, but rfork refuses
+ * RFMEM: no proc shares its memory, and mem is refused as well.
+ */
+static int proc_sched(struct inode *inode, const char *cmd, long n, int mem)
+{
+	int nice = proc_nice(n), error;
+	const struct cpumask *mask = cpu_all_mask;
+	struct task_struct *t;
+	int wired = !strcmp(cmd, "wired");
+
+	if (mem) {
+		p9_werrstr("RFMEM procs are not supported");
+		return -EINVAL;
+	}
+	if (wired && n >= 0) {
+		if (n >= nr_cpu_ids || !cpu_online(n))
+			return -EINVAL;
+		mask = cpumask_of(n);
+	}
+	t = proc_task(inode);
+	if (!t)
+		return -ESRCH;
+	/* An admitted proc's CPU and priority are edf.c's */
+	error = p9_edf_lock(t);
+	if (error)
+		goto out;
+
+	if (wired) {
+		error = security_task_setscheduler(t, 0, NULL);
+		if (!error)
+			error = set_cpus_allowed_ptr(t, mask);
+	} else if (nice < task_nice(t) && !can_nice(t, nice)) {
+		error = -EPERM;
+	} else {
+		error = security_task_setnice(t, nice);
+		if (!error)
+			set_user_nice(t, nice);
+	}
+	p9_edf_unlock();
+out:
+	put_task_struct(t);
+	return error;
+}
+
+/* Apply a real-time message to the process */
+static int proc_edf(struct inode *inode, const char *cmd, const char *arg)
+{
+	int error;
+	struct task_struct *t = proc_task(inode);
+
+	if (!t)
+		return -ESRCH;
+	error = p9_edf_ctl(t, cmd, arg);
+	put_task_struct(t);
+	return error;
+}
+
+/*
+ * Besides kill, stop and start, ctl takes "wired n", "pri n" and
+ * "fixedpri n"; "wired -1" unwires. Any of those followed by "mem" is
+ * refused, see proc_sched. The real-time messages are edf.c's.
+ */
+static ssize_t ctl_write(struct file *f, const char __user *buf,
+			 size_t count, loff_t *offset)
+{
+	int nf;
+	long n;
+	ssize_t error;
+	char cmd[16], arg[32], qual[8];
+	char *msg = proc_msg(buf, count);
+	struct inode *inode = f->f_path.dentry->d_inode;
+
+	if (IS_ERR(msg))
+		return PTR_ERR(msg);
+	nf = sscanf(msg, "%15s %31s %7s", cmd, arg, qual);
+	if (!strcmp(msg, "kill"))
+		error = proc_signal(inode, SIGKILL);
+	else if (!strcmp(msg, "stop"))
+		error = proc_signal(inode, SIGSTOP);
+	else if (!strcmp(msg, "start"))
+		error = proc_signal(inode, SIGCONT);
+	else if (nf >= 2 && (!strcmp(cmd, "wired") || !strcmp(cmd, "pri") ||
+			     !strcmp(cmd, "fixedpri")) &&
+		 !strict_strtol(arg, 10, &n) &&
+		 (nf == 2 || !strcmp(qual, "mem")))
+		error = proc_sched(inode, cmd, n, nf == 3);
+	else if (nf >= 1 && nf <= 2)
+		error = proc_edf(inode, cmd, nf == 2 ? arg : NULL);
+	else
+		error = -EINVAL;
+	kfree(msg);
+	if (error == -ENOENT)
+		error = -EINVAL;
+	return error ? error : count;
+}
+
+static const struct file_operations ctl_fops = {
+	.write		= ctl_write,
+};
+
+static ssize_t edf_read(struct file *f, char __user *buf,
+			size_t count, loff_t *offset)
+{
+	int n;
+	char ebuf[160];
+	struct task_struct *t = proc_task(f->f_path.dentry->d_inode);
+
+	if (!t)
+		return -ESRCH;
+	n = p9_edf_read(t, ebuf, sizeof(ebuf));
+	put_task_struct(t);
+	return simple_read_from_buffer(buf, count, offset, ebuf, n);
+}
+
+static const struct file_operations edf_fops = {
+	.read		= edf_read,
+};
+
+/*
+ * wait: the next child of the process to exit, as Plan 9's Waitmsg
+ * text. Only the process itself can reap its children.
+ */
+static ssize_t wait_read(struct file *f, char __user *buf,
+			 size_t count, loff_t *offset)
+{
+	int n, status;
+	long pid;
+	char wbuf[64], msg[24];
+	struct rusage ru;
+	mm_segment_t fs;
+
+	if (f->f_path.dentry->d_inode->i_private != task_tgid(current))
+		return -EPERM;
+
+	fs = get_fs();
+	set_fs(KERNEL_DS);
+	pid = sys_wait4(-1, (int __user *)&status, 0,
+			(struct rusage __user *)&ru);
+	set_fs(fs);
+	if (pid < 0)
+		return pid;
+
+	if (WIFEXITED(status) && WEXITSTATUS(status) == 0)
+		msg[0] = '\0';
+	else if (WIFEXITED(status))
+		snprintf(msg, sizeof(msg), "exit %d", WEXITSTATUS(status));
+	else
+		snprintf(msg, sizeof(msg), "signal %d", WTERMSIG(status));
+	n = scnprintf(wbuf, sizeof(wbuf), "%ld %lu %lu %lu '%s'", pid,
+		      ru.ru_utime.tv_sec * MSEC_PER_SEC +
+		      ru.ru_utime.tv_usec / USEC_PER_MSEC,
+		      ru.ru_stime.tv_sec * MSEC_PER_SEC +
+		      ru.ru_stime.tv_usec / USEC_PER_MSEC, 0UL, msg);
+	/* Each read is a whole message */
+	if (count < n)
+		n = count;
+	if (copy_to_user(buf, wbuf, n))
+		return -EFAULT;
+	return n;
+}
+
+static const struct file_operations wait_fops = {
+	.read		= wait_read,
+};
+
+static const struct proc_file proc_files[] = {
+	{ "ctl",	Qctl,		0200,	&ctl_fops },
+	{ "edf",	Qedf,		0444,	&edf_fops },
+	{ "mem",	Qmem,		0600,	&mem_fops },
+	{ "note",	Qnote,		0200,	&note_fops },
+	{ "ns",		Qns,		0444,	&ns_fops },
+	{ "regs",	Qregs,		0600,	&regs_fops },
+	{ "segment",	Qsegment,	0444,	&segment_fops },
+	{ "status",	Qstatus,	0444,	&status_fops },
+	{ "text",	Qtext,		0400,	&text_fops },
+	{ "wait",	Qwait,		0400,	&wait_fops },
+	{ NULL }
+};
+
+static struct inode *proc_inode(struct super_block *sb, struct task_struct *t,
+				const struct proc_file *pf)
+{
+	pid_t pid = task_tgid_vnr(t);
+	const struct cred *cred;
+	struct inode *inode = new_inode(sb);
+
+	if (!inode)
+		return NULL;
+	rcu_read_lock();
+	cred = __task_cred(t);
+	inode->i_uid = cred->euid;
+	inode->i_gid = cred->egid;
+	rcu_read_unlock();
+	inode->i_atime = inode->i_mtime = inode->i_ctime = CURRENT_TIME;
+	inode->i_private = get_pid(task_tgid(t));
+	if (pf) {
+		inode->i_ino = PROCINO(pid, pf->q);
+		inode->i_mode = S_IFREG | pf->mode;
+		inode->i_fop = pf->fops;
+	} else {
+		inode->i_ino = PROCINO(pid, Qdir);
+		inode->i_mode = S_IFDIR | 0555;
+		inode->i_op = &proc_pid_iops;
+		inode->i_fop = &proc_pid_fops;
+	}
+	return inode;
+}
+
+/* An entry holds as long as its process does */
+static int proc_d_revalidate(struct dentry *dentry, struct nameidata *nd)
+{
+	struct task_struct *t;
+
+	if (!dentry->d_inode)
+		return 0;
+	t = proc_task(dentry->d_inode);
+	if (!t)
+		return 0;
+	put_task_struct(t);
+	return 1;
+}
+
+static int proc_d_delete(struct dentry *dentry)
+{
+	return 1;
+}
+
+static const struct dentry_operations proc_dentry_ops = {
+	.d_revalidate	= proc_d_revalidate,
+	.d_delete	= proc_d_delete,
+};
+
+static struct dentry *proc_pid_lookup(struct inode *dir, struct dentry *dentry,
+				      struct nameidata *nd)
+{
+	const struct proc_file *pf;
+	struct inode *inode = NULL;
+	struct task_struct *t;
+
+	dentry->d_op = &proc_dentry_ops;
+	for (pf = proc_files; pf->name; pf++)
+		if (!strcmp(dentry->d_name.name, pf->name))
+			break;
+	if (pf->name) {
+		t = proc_task(dir);
+		if (!t)
+			return ERR_PTR(-ESRCH);
+		inode = proc_inode(dir->i_sb, t, pf);
+		put_task_struct(t);
+		if (!inode)
+			return ERR_PTR(-ENOMEM);
+	}
+	d_add(dentry, inode);
+	return NULL;
+}
+
+static int proc_pid_readdir(struct file *filp, void *dirent, filldir_t filldir)
+{
+	int i;
+	const struct proc_file *pf;
+	struct inode *inode = filp->f_path.dentry->d_inode;
+
+	while (filp->f_pos < 2) {
+		if (filldir(dirent, "..", filp->f_pos + 1, filp->f_pos,
+			    inode->i_ino, DT_DIR) < 0)
+			return 0;
+		filp->f_pos++;
+	}
+	for (i = filp->f_pos - 2; i < ARRAY_SIZE(proc_files) - 1; i++) {
+		pf = &proc_files[i];
+		if (filldir(dirent, pf->name, strlen(pf->name), filp->f_pos,
+			    inode->i_ino - Qdir + pf->q, DT_REG) < 0)
+			break;
+		filp->f_pos++;
+	}
+	return 0;
+}
+
+static const struct inode_operations proc_pid_iops = {
+	.lookup		= proc_pid_lookup,
+};
+
+static const struct file_operations proc_pid_fops = {
+	.read		= generic_read_dir,
+	.readdir	= proc_pid_readdir,
+	.llseek		= default_llseek,
+};
+
+static struct dentry *proc_root_lookup(struct inode *dir, struct dentry *dentry,
+				       struct nameidata *nd)
+{
+	unsigned long pid;
+	char *end;
+	struct inode *inode = NULL;
+	struct task_struct *t;
+
+	dentry->d_op = &proc_dentry_ops;
+	pid = simple_strtoul(dentry->d_name.name, &end, 10);
+	if (*end == '\0' && pid > 0 && pid <= PID_MAX_LIMIT) {
+		rcu_read_lock();
+		t = find_task_by_vpid(pid);
+		if (t && proc_isplan9(t))
+			get_task_struct(t);
+		else
+			t = NULL;
+		rcu_read_unlock();
+		if (t) {
+			inode = proc_inode(dir->i_sb, t, NULL);
+			put_task_struct(t);
+			if (!inode)
+				return ERR_PTR(-ENOMEM);
+		}
+	}
+	d_add(dentry, inode);
+	return NULL;
+}
+
+/* f_pos is 2 past the pid to go on from */
+static int proc_root_readdir(struct file *filp, void *dirent, filldir_t filldir)
+{
+	int ok, len;
+	pid_t nr;
+	char name[16];
+	struct pid *pid;
+	struct task_struct *t;
+	struct pid_namespace *ns = task_active_pid_ns(current);
+	struct inode *inode = filp->f_path.dentry->d_inode;
+
+	while (filp->f_pos < 2) {
+		if (filldir(dirent, "..", filp->f_pos + 1, filp->f_pos,
+			    inode->i_ino, DT_DIR) < 0)
+			return 0;
+		filp->f_pos++;
+	}
+
+	for (;;) {
+		rcu_read_lock();
+		pid = find_ge_pid(filp->f_pos - 2, ns);
+		if (!pid) {
+			rcu_read_unlock();
+			break;
+		}
+		nr = pid_nr_ns(pid, ns);
+		t = pid_task(pid, PIDTYPE_PID);
+		ok = t && proc_isplan9(t);
+		rcu_read_unlock();
+
+		if (ok) {
+			len = scnprintf(name, sizeof(name), "%d", nr);
+			if (filldir(dirent, name, len, filp->f_pos,
+				    PROCINO(nr, Qdir), DT_DIR) < 0)
+				break;
+		}
+		filp->f_pos = nr + 3;
+	}
+	return 0;
+}
+
+static const struct inode_operations proc_root_iops = {
+	.lookup		= proc_root_lookup,
+};
+
+static const struct file_operations proc_root_fops = {
+	.read		= generic_read_dir,
+	.readdir	= proc_root_readdir,
+	.llseek		= default_llseek,
+};
+
+/* Let go of the pid a process's inode holds */
+static void proc_clear_inode(struct inode *inode)
+{
+	put_pid(inode->i_private);
+}
+
+static const struct super_operations proc_sops = {
+	.statfs		= simple_statfs,
+	.drop_inode	= generic_delete_inode,
+	.clear_inode	= proc_clear_inode,
+};
+
+static int proc_fill_super(struct super_block *sb, void *data, int silent)
+{
+	struct inode *inode;
+
+	sb->s_magic = PROC_MAGIC;
+	sb->s_op = &proc_sops;
+	inode = new_inode(sb);
+	if (!inode)
+		return -ENOMEM;
+	inode->i_ino = Qroot;
+	inode->i_mode = S_IFDIR | 0555;
+	inode->i_atime = inode->i_mtime = inode->i_ctime = CURRENT_TIME;
+	inode->i_op = &proc_root_iops;
+	inode->i_fop = &proc_root_fops;
+	sb->s_root = d_alloc_root(inode);
+	if (!sb->s_root) {
+		iput(inode);
+		return -ENOMEM;
+	}
+	return 0;
+}
+
+static int proc_get_sb(struct file_system_type *fs_type, int flags,
+		       const char *dev_name, void *data, struct vfsmount *mnt)
+{
+	return get_sb_single(fs_type, flags, data, proc_fill_super, mnt);
+}
+
+static struct file_system_type proc_fs_type = {
+	.name		= "plan9proc",
+	.get_sb		= proc_get_sb,
+	.kill_sb	= kill_anon_super,
+};
+
+static int proc_attach(char *spec, struct path *path)
+{
+	path->mnt = mntget(proc_mnt);
+	path->dentry = dget(proc_mnt->mnt_root);
+	return 0;
+}
+
+static struct p9_dev proc_dev = {
+	.dc	= 'p',
+	.name	= "proc",
+	.attach	= proc_attach,
+	.fstype	= &proc_fs_type,
+};
+
+static int __init devproc_init(void)
+{
+	int err = register_filesystem(&proc_fs_type);
+
+	if (err)
+		return err;
+	proc_mnt = kern_mount(&proc_fs_type);
+	if (IS_ERR(proc_mnt)) {
+		err = PTR_ERR(proc_mnt);
+		unregister_filesystem(&proc_fs_type);
+		return err;
+	}
+	return p9_devregister(&proc_dev);
+}
+
+static void __exit devproc_exit(void)
+{
+	p9_devunregister(&proc_dev);
+	mntput(proc_mnt);
+	unregister_filesystem(&proc_fs_type);
+}
+
+module_init(devproc_init);
+module_exit(devproc_exit);
@@ -0,0 +1,406 @@
+/*
+ * Copyright (C) 2008 Anant Narayanan <anant@kix.in>
+ * Plan 9 '#s' emulation: the service registry.
+ *
+ * A server posts an open file in '#s' for others to find: it creates
+ * a file there and writes the number of an fd to it. Opening the entry
+ * after that gives a dup of the posted file, as long as the file was
+ * opened for what is asked now, in any process and name space. The
+ * registry holds on to the file until the entry is removed.
+ *
+ * There is one registry for the whole system. Entries are found by
+ * name in a hash table and listed in the order they were made.
+ */
+#include <linux/fs.h>
+#include <linux/file.h>
+#include <linux/hash.h>
+#include <linux/init.h>
+#include <linux/slab.h>
+#include <linux/mount.h>
+#include <linux/sched.h>
+#include <linux/dcache.h>
+#include <linux/module.h>
+#include <linux/string.h>
+#include <linux/rwsem.h>
+#include <linux/uaccess.h>
+
+#include "plan9.h"
+
+#define SRV_MAGIC	0x39737276	/* "9srv" */
+#define SHASHBITS	10
+
+struct srv {
+	struct hlist_node hash;
+	struct list_head list;		/* in srv_list, in qid order */
+	unsigned long qid;		/* and inode number */
+	struct file *chan;		/* what was posted, if anything yet */
+	uid_t uid;
+	gid_t gid;
+	int mode;
+	unsigned int namelen;
+	char name[];
+};
+
+/* The registry; srv_sem covers the entries and what they hold */
+static struct hlist_head srv_hash[1 << SHASHBITS];
+static LIST_HEAD(srv_list);
+static DECLARE_RWSEM(srv_sem);
+
+/* Qids of entries; 1 is the root */
+static unsigned long srv_qid = 1;
+static struct vfsmount *srv_mnt;
+
+static struct hlist_head *srv_bucket(const char *name, unsigned int len)
+{
+	return &srv_hash[hash_long(full_name_hash(name, len), SHASHBITS)];
+}
+
+/* The entry dentry names. Called with srv_sem held */
+static struct srv *srv_find(struct dentry *dentry)
+{
+	struct srv *s;
+	struct hlist_node *n;
+	const char *name = dentry->d_name.name;
+	unsigned int len = dentry->d_name.len;
+
+	hlist_for_each_entry(s, n, srv_bucket(name, len), hash)
+		if (s->namelen == len && !memcmp(s->name, name, len))
+			return s;
+	return NULL;
+}
+
+static const struct file_operations srv_file_fops;
+
+static struct inode *srv_inode(struct super_block *sb, struct srv *s)
+{
+	struct inode *inode = new_inode(sb);
+
+	if (!inode)
+		return NULL;
+	inode->i_ino = s->qid;
+	inode->i_mode = S_IFREG | s->mode;
+	inode->i_uid = s->uid;
+	inode->i_gid = s->gid;
+	inode->i_atime = inode->i_mtime = inode->i_ctime = CURRENT_TIME;
+	inode->i_fop = &srv_file_fops;
+	return inode;
+}
+
+/*
+ * There is only the one directory, and the dentry of an entry is kept
+ * from its creation until it is unlinked, so lookup should only be
+ * asked about names that aren't there.
+ */
+static struct dentry *srv_lookup(struct inode *dir, struct dentry *dentry,
+				 struct nameidata *nd)
+{
+	struct srv *s;
+	struct inode *inode = NULL;
+
+	down_read(&srv_sem);
+	s = srv_find(dentry);
+	if (s) {
+		inode = srv_inode(dir->i_sb, s);
+		if (!inode) {
+			up_read(&srv_sem);
+			return ERR_PTR(-ENOMEM);
+		}
+	}
+	up_read(&srv_sem);
+	d_add(dentry, inode);
+	return NULL;
+}
+
+static int srv_create(struct inode *dir, struct dentry *dentry, int mode,
+		      struct nameidata *nd)
+{
+	int error = -EEXIST;
+	struct srv *s;
+	struct inode *inode;
+	unsigned int len = dentry->d_name.len;
+
+	down_write(&srv_sem);
+	if (srv_find(dentry))
+		goto out;
+	error = -ENOMEM;
+	s = kmalloc(sizeof(*s) + len + 1, GFP_KERNEL);
+	if (!s)
+		goto out;
+	s->qid = ++srv_qid;
+	s->chan = NULL;
+	s->uid = current_fsuid();
+	s->gid = current_fsgid();
+	s->mode = mode & 0777;
+	inode = srv_inode(dir->i_sb, s);
+	if (!inode) {
+		kfree(s);
+		goto out;
+	}
+	s->namelen = len;
+	memcpy(s->name, dentry->d_name.name, len);
+	s->name[len] = '\0';
+	hlist_add_head(&s->hash, srv_bucket(s->name, len));
+	list_add_tail(&s->list, &srv_list);
+
+	d_instantiate(dentry, inode);
+	dget(dentry);			/* kept until unlinked */
+	dir->i_mtime = dir->i_ctime = CURRENT_TIME;
+	error = 0;
+out:
+	up_write(&srv_sem);
+	return error;
+}
+
+/* Removing an entry lets go of what was posted in it */
+static int srv_unlink(struct inode *dir, struct dentry *dentry)
+{
+	struct srv *s;
+	struct file *chan = NULL;
+
+	down_write(&srv_sem);
+	s = srv_find(dentry);
+	if (s) {
+		hlist_del(&s->hash);
+		list_del(&s->list);
+		chan = s->chan;
+		kfree(s);
+	}
+	up_write(&srv_sem);
+
+	if (!s)
+		return -ENOENT;
+	if (chan)
+		fput(chan);
+	drop_nlink(dentry->d_inode);
+	dput(dentry);
+	dir->i_mtime = dir->i_ctime = CURRENT_TIME;
+	return 0;
+}
+
+/* Writing an fd number posts its file, once */
+static ssize_t srv_write(struct file *f, const char __user *buf,
+			 size_t count, loff_t *offset)
+{
+	char num[16];
+	unsigned long fd;
+	ssize_t error;
+	struct srv *s;
+	struct file *chan;
+
+	if (count >= sizeof(num))
+		return -EINVAL;
+	if (copy_from_user(num, buf, count))
+		return -EFAULT;
+	num[count] = '\0';
+	if (count && num[count - 1] == '\n')
+		num[count - 1] = '\0';
+	if (strict_strtoul(num, 10, &fd))
+		return -EINVAL;
+
+	chan = fget(fd);
+	if (!chan)
+		return -EBADF;
+	/* An entry can't be posted in the registry */
+	error = -EINVAL;
+	if (chan->f_path.mnt == srv_mnt)
+		goto out;
+
+	down_write(&srv_sem);
+	s = srv_find(f->f_path.dentry);
+	if (!s || s->qid != f->f_path.dentry->d_inode->i_ino) {
+		error = -ENOENT;
+	} else if (s->chan) {
+		error = -EBUSY;
+	} else {
+		s->chan = chan;
+		chan = NULL;
+		error = count;
+	}
+	up_write(&srv_sem);
+out:
+	if (chan)
+		fput(chan);
+	return error;
+}
+
+static const struct file_operations srv_file_fops = {
+	.write		= srv_write,
+};
+
+/*
+ * Opening '#s/name' gives back the posted file itself, if the entry
+ * allows and the file was opened for what is asked now. Called by
+ * p9_ns_open.
+ */
+struct file *p9_srv_open(struct path *path, int flags)
+{
+	int want, mask, error;
+	struct srv *s;
+	struct file *f = NULL;
+	struct inode *inode = path->dentry->d_inode;
+
+	if (inode->i_ino == 1) {
+		if ((flags & O_ACCMODE) != O_RDONLY)
+			return ERR_PTR(-EISDIR);
+		path_get(path);
+		return dentry_open(path->dentry, path->mnt, flags,
+				   current_cred());
+	}
+
+	switch (flags & O_ACCMODE) {
+	case O_WRONLY:
+		want = FMODE_WRITE;
+		mask = MAY_WRITE;
+		break;
+	case O_RDWR:
+		want = FMODE_READ | FMODE_WRITE;
+		mask = MAY_READ | MAY_WRITE;
+		break;
+	default:
+		want = FMODE_READ;
+		mask = MAY_READ;
+		break;
+	}
+	error = inode_permission(inode, mask);
+	if (error)
+		return ERR_PTR(error);
+
+	down_read(&srv_sem);
+	s = srv_find(path->dentry);
+	if (s && s->qid == inode->i_ino && s->chan)
+		f = get_file(s->chan);
+	up_read(&srv_sem);
+
+	if (!f) {
+		p9_werrstr("device shut down");
+		return ERR_PTR(-EIO);
+	}
+	if ((f->f_mode & want) != want) {
+		fput(f);
+		return ERR_PTR(-EACCES);
+	}
+	return f;
+}
+
+/* Whether path is in '#s', whose files p9_srv_open opens */
+int p9_srv_issrv(struct path *path)
+{
+	return path->mnt == srv_mnt;
+}
+
+static int srv_readdir(struct file *filp, void *dirent, filldir_t filldir)
+{
+	struct srv *s;
+	struct inode *inode = filp->f_path.dentry->d_inode;
+
+	while (filp->f_pos < 2) {
+		if (filldir(dirent, "..", filp->f_pos + 1, filp->f_pos,
+			    inode->i_ino, DT_DIR) < 0)
+			return 0;
+		filp->f_pos++;
+	}
+
+	/* f_pos is the qid to go on from */
+	down_read(&srv_sem);
+	list_for_each_entry(s, &srv_list, list) {
+		if (s->qid < filp->f_pos)
+			continue;
+		if (filldir(dirent, s->name, s->namelen, s->qid,
+			    s->qid, DT_REG) < 0)
+			break;
+		filp->f_pos = s->qid + 1;
+	}
+	up_read(&srv_sem);
+	return 0;
+}
+
+static const struct inode_operations srv_dir_iops = {
+	.lookup		= srv_lookup,
+	.create		= srv_create,
+	.unlink		= srv_unlink,
+};
+
+static const struct file_operations srv_dir_fops = {
+	.read		= generic_read_dir,
+	.readdir	= srv_readdir,
+	.llseek		= default_llseek,
+};
+
+static int srv_attach(char *spec, struct path *path)
+{
+	path->mnt = mntget(srv_mnt);
+	path->dentry = dget(srv_mnt->mnt_root);
+	return 0;
+}
+
+static const struct super_operations srv_sops = {
+	.statfs		= simple_statfs,
+	.drop_inode	= generic_delete_inode,
+};
+
+static int srv_fill_super(struct super_block *sb, void *data, int silent)
+{
+	struct inode *inode;
+
+	sb->s_magic = SRV_MAGIC;
+	sb->s_op = &srv_sops;
+	inode = new_inode(sb);
+	if (!inode)
+		return -ENOMEM;
+	inode->i_ino = 1;
+	/* Anyone may post, only the poster may remove */
+	inode->i_mode = S_IFDIR | S_ISVTX | 0777;
+	inode->i_atime = inode->i_mtime = inode->i_ctime = CURRENT_TIME;
+	inode->i_op = &srv_dir_iops;
+	inode->i_fop = &srv_dir_fops;
+	sb->s_root = d_alloc_root(inode);
+	if (!sb->s_root) {
+		iput(inode);
+		return -ENOMEM;
+	}
+	return 0;
+}
+
+static int srv_get_sb(struct file_system_type *fs_type, int flags,
+		      const char *dev_name, void *data, struct vfsmount *mnt)
+{
+	return get_sb_single(fs_type, flags, data, srv_fill_super, mnt);
+}
+
+static struct file_system_type srv_fs_type = {
+	.name		= "plan9srv",
+	.get_sb		= srv_get_sb,
+	.kill_sb	= kill_litter_super,
+};
+
+static struct p9_dev srv_dev = {
+	.dc	= 's',
+	.name	= "srv",
+	.attach	= srv_attach,
+	.fstype	= &srv_fs_type,
+};
+
+static int __init devsrv_init(void)
+{
+	int err = register_filesystem(&srv_fs_type);
+
+	if (err)
+		return err;
+	srv_mnt = kern_mount(&srv_fs_type);
+	if (IS_ERR(srv_mnt)) {
+		err = PTR_ERR(srv_mnt);
+		unregister_filesystem(&srv_fs_type);
+		return err;
+	}
+	return p9_devregister(&srv_dev);
+}
+
+static void __exit devsrv_exit(void)
+{
+	p9_devunregister(&srv_dev);
+	mntput(srv_mnt);
+	unregister_filesystem(&srv_fs_type);
+}
+
+module_init(devsrv_init);
+module_exit(devsrv_exit);
@@ -0,0 +1,1554 @@
+/*
+ * Copyright (C) 2008 Anant Narayanan <anant@kix.in>
+ * Plan 9 '#a' emulation: the TLS record layer.
+ *
+ * As on Plan 9, the handshake is done in user space, by libsec's
+ * tlshand, and '#a' is told what came of it. Opening tls/clone makes
+ * a conversation, and writing "fd n" to its ctl puts it on top of a
+ * connection: any open file, but usually a socket or a /net data file.
+ * From then on what is written to hand or data goes out as TLS records
+ * on the connection, and hand and data read what comes in:
+ *
+ *	tls/clone	opening it makes a conversation; reads and is
+ *			written as its ctl
+ *	tls/encalgs	the ciphers there are, and tls/hashalgs the MACs
+ *	tls/n/ctl	fd n, version v, secret hashalg encalg isclient
+ *			keys, changecipher, opened or alert n
+ *	tls/n/data	application data, once opened
+ *	tls/n/hand	handshake messages
+ *	tls/n/status	its state, version and algorithms
+ *	tls/n/stats	the bytes through it each way
+ *
+ * The keys are base64, the client's and the server's MAC secrets, then
+ * their keys, then their IVs, as TLS derives them. Records are MACed
+ * and encrypted with the kernel's crypto API. Linux has no kernel TLS
+ * to give the socket to, so each record is built in place around the
+ * bytes written and sent with one write: data is copied out of the
+ * process only once. TLS 1.0 to 1.2 with HMAC and CBC or RC4 suites
+ * are supported; SSL 3.0 and AEAD ciphers are not.
+ */
+#include <linux/fs.h>
+#include <linux/file.h>
+#include <linux/init.h>
+#include <linux/slab.h>
+#include <linux/cred.h>
+#include <linux/mount.h>
+#include <linux/mutex.h>
+#include <linux/sched.h>
+#include <linux/crypto.h>
+#include <linux/dcache.h>
+#include <linux/module.h>
+#include <linux/random.h>
+#include <linux/string.h>
+#include <linux/spinlock.h>
+#include <linux/scatterlist.h>
+#include <linux/uaccess.h>
+#include <asm/unaligned.h>
+
+#include "plan9.h"
+
+#define TLS_MAGIC	0x39746c73	/* "9tls" */
+
+#define RECHDR		5		/* type[1] version[2] len[2] */
+#define MAXPLAIN	16384
+#define MAXCIPHER	(MAXPLAIN + 2048)
+#define MAXMAC		32
+#define MAXIV		16
+#define MAXCTL		512
+
+/* Inode numbers: the conversation and which file */
+#define QSHIFT		4
+#define TLSINO(c, q)	(((unsigned long)(c) << QSHIFT) | (q))
+#define TLSCONV(ino)	((int)((ino) >> QSHIFT))
+#define TLSQ(ino)	((ino) & ((1 << QSHIFT) - 1))
+
+enum {
+	Qconv,		/* a conversation's directory */
+	Qroot,		/* '#a' itself */
+	Qtlsdir,
+	Qclone,
+	Qencalgs,
+	Qhashalgs,
+	Qctl,
+	Qdata,
+	Qhand,
+	Qstatus,
+	Qstats,
+};
+
+/* Record types */
+enum {
+	RChangeCipherSpec = 20,
+	RAlert,
+	RHandshake,
+	RApplication,
+};
+
+/* Alerts we send */
+enum {
+	ECloseNotify = 0,
+	EUnexpectedMessage = 10,
+	EBadRecordMac = 20,
+	ERecordOverflow = 22,
+	EDecodeError = 50,
+	EProtocolVersion = 70,
+	ENoRenegotiation = 100,
+};
+
+static const struct {
+	int code;
+	const char *name;
+} tls_alerts[] = {
+	{ 0,	"close notify" },
+	{ 10,	"unexpected message" },
+	{ 20,	"bad record mac" },
+	{ 21,	"decryption failed" },
+	{ 22,	"record overflow" },
+	{ 30,	"decompression failure" },
+	{ 40,	"handshake failure" },
+	{ 41,	"no certificate" },
+	{ 42,	"bad certificate" },
+	{ 43,	"unsupported certificate" },
+	{ 44,	"certificate revoked" },
+	{ 45,	"certificate expired" },
+	{ 46,	"certificate unknown" },
+	{ 47,	"illegal parameter" },
+	{ 48,	"unknown ca" },
+	{ 49,	"access denied" },
+	{ 50,	"decode error" },
+	{ 51,	"decrypt error" },
+	{ 60,	"export restriction" },
+	{ 70,	"protocol version" },
+	{ 71,	"insufficient security" },
+	{ 80,	"internal error" },
+	{ 90,	"user canceled" },
+	{ 100,	"no renegotiation" },
+};
+
+enum {
+	SHandshake,
+	SOpen,
+	SRemoteClosed,
+	SError,
+};
+
+static const char * const tls_states[] = {
+	[SHandshake]	= "Handshaking",
+	[SOpen]		= "Established",
+	[SRemoteClosed]	= "RemoteClosed",
+	[SError]	= "Errored",
+};
+
+/* A cipher's block size is its IV's; 0 for a stream cipher */
+struct tls_encalg {
+	const char *name;
+	const char *crypto;
+	int keylen;
+	int ivlen;
+};
+
+struct tls_hashalg {
+	const char *name;
+	const char *crypto;
+	int maclen;
+};
+
+static const struct tls_encalg tls_encalgs[] = {
+	{ "clear",		NULL,			0,	0 },
+	{ "rc4_128",		"ecb(arc4)",		16,	0 },
+	{ "3des_ede_cbc",	"cbc(des3_ede)",	24,	8 },
+	{ "aes_128_cbc",	"cbc(aes)",		16,	16 },
+	{ "aes_256_cbc",	"cbc(aes)",		32,	16 },
+	{ NULL }
+};
+
+static const struct tls_hashalg tls_hashalgs[] = {
+	{ "clear",	NULL,		0 },
+	{ "md5",	"hmac(md5)",	16 },
+	{ "sha1",	"hmac(sha1)",	20 },
+	{ "sha256",	"hmac(sha256)",	32 },
+	{ NULL }
+};
+
+/* One direction's keys and place; none at all is in the clear */
+struct tls_secret {
+	const struct tls_encalg *enc;
+	const struct tls_hashalg *hash;
+	struct crypto_blkcipher *cipher;
+	struct crypto_hash *mac;
+	u8 iv[MAXIV];
+	u64 seq;
+};
+
+/* A record's contents, waiting to be read */
+struct tls_block {
+	struct list_head list;
+	int n, off;
+	u8 data[];
+};
+
+struct tls {
+	struct list_head list;		/* in tls_convs, by id */
+	int id;
+	int ref;			/* its open files */
+	uid_t uid;
+	gid_t gid;
+	struct file *chan;		/* the connection, once pushed on */
+
+	/*
+	 * lock covers the state, the version and the secrets waiting to
+	 * be changed to
+	 */
+	spinlock_t lock;
+	int state;
+	int version;			/* 0 until the hello has set it */
+	char err[ERRMAX];
+	struct tls_secret *newin, *newout;
+
+	/* inlock is held reading a record, outlock writing one */
+	struct mutex inlock;
+	struct tls_secret *in;
+	struct list_head handq, dataq;
+	u8 *ibuf;
+	struct mutex outlock;
+	struct tls_secret *out;
+	u8 *obuf;
+
+	u64 handin, handout, datain, dataout;
+};
+
+/* tls_lock covers the conversations' list and counts */
+static DEFINE_MUTEX(tls_lock);
+static LIST_HEAD(tls_convs);
+static int tls_convid;
+static struct vfsmount *tls_mnt;
+
+static const char *tls_alertname(int code)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(tls_alerts); i++)
+		if (tls_alerts[i].code == code)
+			return tls_alerts[i].name;
+	return "unknown alert";
+}
+
+static void tls_freesecret(struct tls_secret *s)
+{
+	if (!s)
+		return;
+	if (s->cipher)
+		crypto_free_blkcipher(s->cipher);
+	if (s->mac)
+		crypto_free_hash(s->mac);
+	memset(s, 0, sizeof(*s));
+	kfree(s);
+}
+
+static struct tls_secret *tls_newsecret(const struct tls_hashalg *ha,
+					const struct tls_encalg *ea,
+					const u8 *mackey, const u8 *key,
+					const u8 *iv)
+{
+	int error = -ENOMEM;
+	struct tls_secret *s = kzalloc(sizeof(*s), GFP_KERNEL);
+
+	if (!s)
+		return ERR_PTR(-ENOMEM);
+	s->enc = ea;
+	s->hash = ha;
+	if (ea->crypto) {
+		s->cipher = crypto_alloc_blkcipher(ea->crypto, 0,
+						   CRYPTO_ALG_ASYNC);
+		if (IS_ERR(s->cipher)) {
+			error = PTR_ERR(s->cipher);
+			s->cipher = NULL;
+			goto bad;
+		}
+		error = crypto_blkcipher_setkey(s->cipher, key, ea->keylen);
+		if (error)
+			goto bad;
+		memcpy(s->iv, iv, ea->ivlen);
+	}
+	if (ha->crypto) {
+		s->mac = crypto_alloc_hash(ha->crypto, 0, CRYPTO_ALG_ASYNC);
+		if (IS_ERR(s->mac)) {
+			error = PTR_ERR(s->mac);
+			s->mac = NULL;
+			goto bad;
+		}
+		error = crypto_hash_setkey(s->mac, mackey, ha->maclen);
+		if (error)
+			goto bad;
+	}
+	return s;
+bad:
+	tls_freesecret(s);
+	return ERR_PTR(error);
+}
+
+static int tls_version(struct tls *t)
+{
+	int v;
+
+	spin_lock(&t->lock);
+	v = t->version;
+	spin_unlock(&t->lock);
+	return v;
+}
+
+/* HMAC of the sequence number, record header and n bytes of plain text */
+static int tls_mac(struct tls_secret *s, int type, int version,
+		   const u8 *data, int n, u8 *mac)
+{
+	u8 hdr[8 + RECHDR];
+	struct scatterlist sg[2];
+	struct hash_desc desc = { .tfm = s->mac };
+
+	put_unaligned_be64(s->seq, hdr);
+	hdr[8] = type;
+	put_unaligned_be16(version, hdr + 9);
+	put_unaligned_be16(n, hdr + 11);
+	sg_init_table(sg, n ? 2 : 1);
+	sg_set_buf(&sg[0], hdr, sizeof(hdr));
+	if (n)
+		sg_set_buf(&sg[1], data, n);
+	return crypto_hash_digest(&desc, sg, sizeof(hdr) + n, mac);
+}
+
+/*
+ * HMAC as many more blocks of buf as a MAC of max bytes of plain text
+ * would have taken than one of n did. Checking a record's MAC then
+ * takes as long whatever its padding, which would otherwise tell an
+ * attacker something of the plain text.
+ */
+static void tls_macpad(struct tls_secret *s, const u8 *buf, int n, int max)
+{
+	u8 mac[MAXMAC];
+	struct scatterlist sg;
+	struct hash_desc desc = { .tfm = s->mac };
+	int bs = crypto_hash_blocksize(s->mac);
+
+	/* The blocks of a hash of the header, n bytes, 0x80 and the length */
+#define BLOCKS(n)	((8 + RECHDR + (n) + 1 + 8 + bs - 1) / bs)
+	sg_init_one(&sg, buf, (BLOCKS(max) - BLOCKS(n)) * bs + 1);
+#undef BLOCKS
+	crypto_hash_digest(&desc, &sg, sg.length, mac);
+}
+
+/* Encrypt or decrypt in place, going on from the IV in s */
+static int tls_crypt(struct tls_secret *s, u8 *data, int n, int encrypt)
+{
+	struct scatterlist sg;
+	struct blkcipher_desc desc = { .tfm = s->cipher, .info = s->iv };
+
+	sg_init_one(&sg, data, n);
+	if (encrypt)
+		return crypto_blkcipher_encrypt_iv(&desc, &sg, &sg, n);
+	return crypto_blkcipher_decrypt_iv(&desc, &sg, &sg, n);
+}
+
+static void tls_error(struct tls *t, const char *msg)
+{
+	spin_lock(&t->lock);
+	if (t->state != SError) {
+		t->state = SError;
+		strlcpy(t->err, msg, sizeof(t->err));
+	}
+	spin_unlock(&t->lock);
+}
+
+/* Why t failed, as errstr; called once it has */
+static int tls_failed(struct tls *t)
+{
+	spin_lock(&t->lock);
+	p9_werrstr("%s", t->err);
+	spin_unlock(&t->lock);
+	return -EIO;
+}
+
+/* All n bytes of buf to the connection */
+static int tls_put(struct tls *t, const u8 *buf, int n)
+{
+	ssize_t r = 0;
+	int off = 0;
+	loff_t pos = 0;
+	mm_segment_t fs;
+
+	fs = get_fs();
+	set_fs(KERNEL_DS);
+	while (off < n) {
+		r = vfs_write(t->chan, (const char __user *)buf + off,
+			      n - off, &pos);
+		if (r <= 0)
+			break;
+		off += r;
+	}
+	set_fs(fs);
+	if (off == n)
+		return 0;
+	return r < 0 ? r : -EPIPE;
+}
+
+/* All n bytes from the connection; fewer at its end */
+static int tls_get(struct tls *t, u8 *buf, int n)
+{
+	ssize_t r = 0;
+	int off = 0;
+	loff_t pos = 0;
+	mm_segment_t fs;
+
+	fs = get_fs();
+	set_fs(KERNEL_DS);
+	while (off < n) {
+		r = vfs_read(t->chan, (char __user *)buf + off, n - off, &pos);
+		if (r <= 0)
+			break;
+		off += r;
+	}
+	set_fs(fs);
+	return r < 0 && off == 0 ? r : off;
+}
+
+/*
+ * Send n bytes, from the process if ubuf is set or else from kbuf, as
+ * one record of type. The plain text goes straight to where it belongs
+ * in the record and is sealed there. Called with outlock held.
+ */
+static int tls_send(struct tls *t, int type, const char __user *ubuf,
+		    const u8 *kbuf, int n)
+{
+	int len, pad, bs, ivlen = 0, error;
+	int version = tls_version(t);
+	struct tls_secret *s = t->out;
+	u8 *p = t->obuf, *body;
+
+	bs = s && s->cipher ? s->enc->ivlen : 0;
+	if (bs && version >= 0x302)
+		ivlen = bs;
+	if (!version)
+		version = 0x301;
+	body = p + RECHDR + ivlen;
+	if (ubuf) {
+		if (copy_from_user(body, ubuf, n))
+			return -EFAULT;
+	} else {
+		memcpy(body, kbuf, n);
+	}
+
+	len = n;
+	if (s) {
+		if (s->mac) {
+			error = tls_mac(s, type, version, body, n, body + n);
+			if (error)
+				return error;
+			len += s->hash->maclen;
+		}
+		if (s->cipher) {
+			if (bs) {
+				pad = bs - (len + 1) % bs;
+				memset(body + len, pad, pad + 1);
+				len += pad + 1;
+			}
+			/* From 1.1 each record starts with an IV of its own */
+			if (ivlen) {
+				get_random_bytes(p + RECHDR, ivlen);
+				memcpy(s->iv, p + RECHDR, ivlen);
+			}
+			error = tls_crypt(s, body, len, 1);
+			if (error)
+				return error;
+			len += ivlen;
+		}
+		s->seq++;
+	}
+	p[0] = type;
+	put_unaligned_be16(version, p + 1);
+	put_unaligned_be16(len, p + 3);
+	return tls_put(t, p, RECHDR + len);
+}
+
+/* Tell the other side; a fatal alert ends the conversation */
+static void tls_alert(struct tls *t, int code)
+{
+	u8 a[2];
+	int warning = code == ECloseNotify || code == ENoRenegotiation;
+
+	a[0] = warning ? 1 : 2;
+	a[1] = code;
+	mutex_lock(&t->outlock);
+	if (t->chan)
+		tls_send(t, RAlert, NULL, a, sizeof(a));
+	mutex_unlock(&t->outlock);
+	if (!warning)
+		tls_error(t, tls_alertname(code));
+}
+
+static int tls_queue(struct list_head *q, const u8 *data, int n)
+{
+	struct tls_block *b = kmalloc(sizeof(*b) + n, GFP_KERNEL);
+
+	if (!b)
+		return -ENOMEM;
+	b->n = n;
+	b->off = 0;
+	memcpy(b->data, data, n);
+	list_add_tail(&b->list, q);
+	return 0;
+}
+
+/*
+ * Read a record and act on it: queue handshake messages and data for
+ * their readers, change the cipher or take note of an alert. Called
+ * with inlock held.
+ */
+static int tls_recv(struct tls *t)
+{
+	int type, version, len, n, bs, pad, maclen, i, bad, code, error;
+	int tv = tls_version(t), max;
+	struct tls_secret *s = t->in, *new;
+	u8 *p = t->ibuf, *data, mac[MAXMAC];
+
+	n = tls_get(t, p, RECHDR);
+	if (n < 0)
+		return n;
+	if (n < RECHDR) {
+		tls_error(t, "tls hungup");
+		return tls_failed(t);
+	}
+	type = p[0];
+	version = get_unaligned_be16(p + 1);
+	len = get_unaligned_be16(p + 3);
+	if ((version >> 8) != 3 || (tv && version != tv)) {
+		code = EProtocolVersion;
+		goto alert;
+	}
+	if (len > MAXCIPHER) {
+		code = ERecordOverflow;
+		goto alert;
+	}
+	n = tls_get(t, p, len);
+	if (n != len) {
+		tls_error(t, "tls hungup");
+		return tls_failed(t);
+	}
+
+	data = p;
+	if (s) {
+		bad = 0;
+		bs = s->cipher ? s->enc->ivlen : 0;
+		maclen = s->mac ? s->hash->maclen : 0;
+		if (bs) {
+			if (n % bs || n < bs ||
+			    (tv >= 0x302 && n < 2 * bs)) {
+				code = EBadRecordMac;
+				goto alert;
+			}
+			if (tv >= 0x302) {
+				memcpy(s->iv, data, bs);
+				data += bs;
+				n -= bs;
+			}
+		}
+		if (s->cipher && tls_crypt(s, data, n, 0)) {
+			code = EBadRecordMac;
+			goto alert;
+		}
+		/*
+		 * Check the padding and the MAC alike, whatever was wrong,
+		 * and in the same time whatever the padding is
+		 */
+		if (n < maclen + (bs ? 1 : 0)) {
+			code = EBadRecordMac;
+			goto alert;
+		}
+		max = n - maclen - (bs ? 1 : 0);
+		if (bs) {
+			pad = data[n - 1];
+			if (pad + 1 + maclen > n) {
+				bad = 1;
+				pad = 0;
+			}
+			for (i = 0; i < min(n, 256); i++)
+				bad |= (i <= pad) & (data[n - 1 - i] != pad);
+			n -= pad + 1;
+		}
+		n -= maclen;
+		if (s->mac) {
+			if (tls_mac(s, type, version, data, n, mac)) {
+				code = EBadRecordMac;
+				goto alert;
+			}
+			tls_macpad(s, t->ibuf, n, max);
+			for (i = 0; i < maclen; i++)
+				bad |= mac[i] ^ data[n + i];
+		}
+		if (bad) {
+			code = EBadRecordMac;
+			goto alert;
+		}
+		s->seq++;
+	}
+	if (n > MAXPLAIN) {
+		code = ERecordOverflow;
+		goto alert;
+	}
+
+	switch (type) {
+	case RChangeCipherSpec:
+		if (n != 1 || data[0] != 1) {
+			code = EDecodeError;
+			goto alert;
+		}
+		spin_lock(&t->lock);
+		new = t->newin;
+		t->newin = NULL;
+		if (new) {
+			s = t->in;
+			t->in = new;
+		}
+		spin_unlock(&t->lock);
+		if (!new) {
+			code = EUnexpectedMessage;
+			goto alert;
+		}
+		tls_freesecret(s);
+		return 0;
+
+	case RAlert:
+		if (n != 2) {
+			code = EDecodeError;
+			goto alert;
+		}
+		if (data[1] == ECloseNotify) {
+			spin_lock(&t->lock);
+			if (t->state != SError)
+				t->state = SRemoteClosed;
+			spin_unlock(&t->lock);
+			return 0;
+		}
+		if (data[0] == 1)
+			return 0;
+		spin_lock(&t->lock);
+		if (t->state != SError) {
+			t->state = SError;
+			snprintf(t->err, sizeof(t->err), "remote error: %s",
+				 tls_alertname(data[1]));
+		}
+		spin_unlock(&t->lock);
+		return tls_failed(t);
+
+	case RHandshake:
+		error = tls_queue(&t->handq, data, n);
+		if (!error)
+			t->handin += n;
+		return error;
+
+	case RApplication:
+		if (t->state != SOpen) {
+			code = EUnexpectedMessage;
+			goto alert;
+		}
+		error = tls_queue(&t->dataq, data, n);
+		if (!error)
+			t->datain += n;
+		return error;
+	}
+	code = EUnexpectedMessage;
+alert:
+	tls_alert(t, code);
+	return tls_failed(t);
+}
+
+/* Some of the next record for q, reading records until there is one */
+static ssize_t tls_read(struct tls *t, struct list_head *q, char __user *buf,
+			size_t count)
+{
+	int state;
+	ssize_t n;
+	struct tls_block *b;
+
+	mutex_lock(&t->inlock);
+	while (list_empty(q)) {
+		state = t->state;
+		if (state == SError) {
+			n = tls_failed(t);
+			goto out;
+		}
+		if (state == SRemoteClosed || !t->chan) {
+			n = 0;
+			goto out;
+		}
+		if (q == &t->dataq && state != SOpen) {
+			p9_werrstr("tls not open");
+			n = -EIO;
+			goto out;
+		}
+		n = tls_recv(t);
+		if (n < 0)
+			goto out;
+	}
+	b = list_first_entry(q, struct tls_block, list);
+	n = min_t(size_t, b->n - b->off, count);
+	if (copy_to_user(buf, b->data + b->off, n)) {
+		n = -EFAULT;
+		goto out;
+	}
+	b->off += n;
+	if (b->off == b->n) {
+		list_del(&b->list);
+		kfree(b);
+	}
+out:
+	mutex_unlock(&t->inlock);
+	return n;
+}
+
+/* count bytes as records of type, as many as it takes */
+static ssize_t tls_write(struct tls *t, int type, const char __user *buf,
+			 size_t count)
+{
+	int n, state, error = 0;
+	size_t done = 0;
+
+	mutex_lock(&t->outlock);
+	state = t->state;
+	if (state == SError) {
+		error = tls_failed(t);
+		goto out;
+	}
+	if (!t->chan) {
+		p9_werrstr("tls not connected");
+		error = -EIO;
+		goto out;
+	}
+	if (type == RApplication && state != SOpen) {
+		p9_werrstr("tls not open");
+		error = -EIO;
+		goto out;
+	}
+	while (done < count) {
+		n = min_t(size_t, count - done, MAXPLAIN);
+		error = tls_send(t, type, buf + done, NULL, n);
+		if (error)
+			break;
+		done += n;
+		if (type == RApplication)
+			t->dataout += n;
+		else
+			t->handout += n;
+	}
+	if (error && error != -EFAULT)
+		tls_error(t, "tls write failed");
+out:
+	mutex_unlock(&t->outlock);
+	return done ? done : error;
+}
+
+static int tls_dec64(u8 *out, int lim, const char *in)
+{
+	int n = 0, nb = 0, v;
+	u32 b = 0;
+
+	for (; *in && *in != '='; in++) {
+		if (*in >= 'A' && *in <= 'Z')
+			v = *in - 'A';
+		else if (*in >= 'a' && *in <= 'z')
+			v = *in - 'a' + 26;
+		else if (*in >= '0' && *in <= '9')
+			v = *in - '0' + 52;
+		else if (*in == '+')
+			v = 62;
+		else if (*in == '/')
+			v = 63;
+		else
+			continue;
+		b = b << 6 | v;
+		nb += 6;
+		if (nb >= 8) {
+			nb -= 8;
+			if (n >= lim)
+				return -1;
+			out[n++] = b >> nb;
+			b &= (1 << nb) - 1;
+		}
+	}
+	return n;
+}
+
+/* secret hashalg encalg isclient keys */
+static int tls_setsecret(struct tls *t, char **f)
+{
+	int n, m, k, v;
+	u8 *x;
+	const struct tls_hashalg *ha;
+	const struct tls_encalg *ea;
+	struct tls_secret *toserver, *toclient, *oldin, *oldout;
+
+	for (ha = tls_hashalgs; ha->name; ha++)
+		if (!strcmp(f[0], ha->name))
+			break;
+	for (ea = tls_encalgs; ea->name; ea++)
+		if (!strcmp(f[1], ea->name))
+			break;
+	if (!ha->name || !ea->name) {
+		p9_werrstr("unsupported algorithm");
+		return -EINVAL;
+	}
+
+	x = kmalloc(MAXCTL, GFP_KERNEL);
+	if (!x)
+		return -ENOMEM;
+	n = tls_dec64(x, MAXCTL, f[3]);
+	m = ha->maclen;
+	k = ea->keylen;
+	v = ea->ivlen;
+	if (n < 2 * m + 2 * k + 2 * v) {
+		memset(x, 0, MAXCTL);
+		kfree(x);
+		p9_werrstr("not enough secret data provided");
+		return -EINVAL;
+	}
+	toserver = tls_newsecret(ha, ea, x, x + 2 * m, x + 2 * m + 2 * k);
+	toclient = tls_newsecret(ha, ea, x + m, x + 2 * m + k,
+				 x + 2 * m + 2 * k + v);
+	memset(x, 0, MAXCTL);
+	kfree(x);
+	if (IS_ERR(toserver) || IS_ERR(toclient)) {
+		n = IS_ERR(toserver) ? PTR_ERR(toserver) : PTR_ERR(toclient);
+		if (!IS_ERR(toserver))
+			tls_freesecret(toserver);
+		if (!IS_ERR(toclient))
+			tls_freesecret(toclient);
+		p9_werrstr("unsupported algorithm");
+		return n;
+	}
+
+	spin_lock(&t->lock);
+	oldin = t->newin;
+	oldout = t->newout;
+	if (simple_strtol(f[2], NULL, 0)) {
+		t->newin = toclient;
+		t->newout = toserver;
+	} else {
+		t->newin = toserver;
+		t->newout = toclient;
+	}
+	spin_unlock(&t->lock);
+	tls_freesecret(oldin);
+	tls_freesecret(oldout);
+	return 0;
+}
+
+/* Start sending with the new secret */
+static int tls_changecipher(struct tls *t)
+{
+	int error;
+	u8 ccs = 1;
+	struct tls_secret *new, *old;
+
+	mutex_lock(&t->outlock);
+	spin_lock(&t->lock);
+	new = t->chan ? t->newout : NULL;
+	t->newout = NULL;
+	spin_unlock(&t->lock);
+	if (!new) {
+		mutex_unlock(&t->outlock);
+		p9_werrstr("cannot change cipher spec without setting secret");
+		return -EINVAL;
+	}
+	/* The change itself goes under the old secret */
+	error = tls_send(t, RChangeCipherSpec, NULL, &ccs, 1);
+	if (error) {
+		mutex_unlock(&t->outlock);
+		tls_freesecret(new);
+		tls_error(t, "tls write failed");
+		return error;
+	}
+	spin_lock(&t->lock);
+	old = t->out;
+	t->out = new;
+	spin_unlock(&t->lock);
+	mutex_unlock(&t->outlock);
+	tls_freesecret(old);
+	return 0;
+}
+
+static int tls_setfd(struct tls *t, const char *arg)
+{
+	unsigned long fd;
+	struct file *chan;
+
+	if (strict_strtoul(arg, 10, &fd))
+		return -EINVAL;
+	chan = fget(fd);
+	if (!chan)
+		return -EBADF;
+	if (chan->f_path.mnt == tls_mnt) {
+		fput(chan);
+		return -EINVAL;
+	}
+	mutex_lock(&t->inlock);
+	mutex_lock(&t->outlock);
+	if (t->chan) {
+		mutex_unlock(&t->outlock);
+		mutex_unlock(&t->inlock);
+		fput(chan);
+		p9_werrstr("tls already pushed");
+		return -EBUSY;
+	}
+	t->chan = chan;
+	mutex_unlock(&t->outlock);
+	mutex_unlock(&t->inlock);
+	return 0;
+}
+
+static int tls_ctl(struct tls *t, char *msg)
+{
+	int nf, error = 0;
+	unsigned long v;
+	char *f[6], *p;
+
+	for (nf = 0; nf < ARRAY_SIZE(f) && (p = strsep(&msg, " \t\n")); )
+		if (*p)
+			f[nf++] = p;
+	if (nf == 0)
+		goto usage;
+
+	if (!strcmp(f[0], "fd")) {
+		if (nf != 2)
+			goto usage;
+		return tls_setfd(t, f[1]);
+	} else if (!strcmp(f[0], "version")) {
+		if (nf != 2 || strict_strtoul(f[1], 0, &v))
+			goto usage;
+		if (v < 0x301 || v > 0x303) {
+			p9_werrstr("unsupported version");
+			return -EINVAL;
+		}
+		spin_lock(&t->lock);
+		if (t->version && t->version != v) {
+			p9_werrstr("version already set");
+			error = -EINVAL;
+		} else {
+			t->version = v;
+		}
+		spin_unlock(&t->lock);
+		return error;
+	} else if (!strcmp(f[0], "secret")) {
+		if (nf != 5)
+			goto usage;
+		return tls_setsecret(t, f + 1);
+	} else if (!strcmp(f[0], "changecipher")) {
+		return tls_changecipher(t);
+	} else if (!strcmp(f[0], "opened")) {
+		spin_lock(&t->lock);
+		if (t->state != SHandshake) {
+			p9_werrstr("tls not handshaking");
+			error = -EINVAL;
+		} else if (!t->in || !t->out) {
+			p9_werrstr("cipher must be configured before "
+				   "enabling data messages");
+			error = -EINVAL;
+		} else {
+			t->state = SOpen;
+		}
+		spin_unlock(&t->lock);
+		return error;
+	} else if (!strcmp(f[0], "alert")) {
+		if (nf != 2 || strict_strtoul(f[1], 0, &v) || v > 255)
+			goto usage;
+		tls_alert(t, v);
+		return 0;
+	}
+	p9_werrstr("unknown control request");
+	return -EINVAL;
+usage:
+	p9_werrstr("bad control message");
+	return -EINVAL;
+}
+
+static void tls_put_conv(struct tls *t)
+{
+	struct tls_block *b, *nb;
+
+	mutex_lock(&tls_lock);
+	if (--t->ref > 0) {
+		mutex_unlock(&tls_lock);
+		return;
+	}
+	list_del(&t->list);
+	mutex_unlock(&tls_lock);
+
+	if (t->chan) {
+		if (t->state == SOpen)
+			tls_alert(t, ECloseNotify);
+		fput(t->chan);
+	}
+	tls_freesecret(t->in);
+	tls_freesecret(t->out);
+	tls_freesecret(t->newin);
+	tls_freesecret(t->newout);
+	list_for_each_entry_safe(b, nb, &t->handq, list)
+		kfree(b);
+	list_for_each_entry_safe(b, nb, &t->dataq, list)
+		kfree(b);
+	kfree(t->ibuf);
+	kfree(t->obuf);
+	kfree(t);
+}
+
+static struct tls *tls_newconv(void)
+{
+	struct tls *t = kzalloc(sizeof(*t), GFP_KERNEL);
+
+	if (!t)
+		return NULL;
+	t->ibuf = kmalloc(RECHDR + MAXCIPHER, GFP_KERNEL);
+	t->obuf = kmalloc(RECHDR + MAXIV + MAXPLAIN + MAXMAC + 256,
+			  GFP_KERNEL);
+	if (!t->ibuf || !t->obuf) {
+		kfree(t->ibuf);
+		kfree(t->obuf);
+		kfree(t);
+		return NULL;
+	}
+	t->ref = 1;
+	t->uid = current_fsuid();
+	t->gid = current_fsgid();
+	t->state = SHandshake;
+	spin_lock_init(&t->lock);
+	mutex_init(&t->inlock);
+	mutex_init(&t->outlock);
+	INIT_LIST_HEAD(&t->handq);
+	INIT_LIST_HEAD(&t->dataq);
+	mutex_lock(&tls_lock);
+	t->id = ++tls_convid;
+	list_add_tail(&t->list, &tls_convs);
+	mutex_unlock(&tls_lock);
+	return t;
+}
+
+/* Called with tls_lock held */
+static struct tls *tls_conv(int id)
+{
+	struct tls *t;
+
+	list_for_each_entry(t, &tls_convs, list)
+		if (t->id == id)
+			return t;
+	return NULL;
+}
+
+/* Opening clone makes a conversation; its other files find theirs */
+static int conv_open(struct inode *inode, struct file *f)
+{
+	struct tls *t;
+
+	if (TLSQ(inode->i_ino) == Qclone) {
+		t = tls_newconv();
+		if (!t)
+			return -ENOMEM;
+		f->private_data = t;
+		return 0;
+	}
+	mutex_lock(&tls_lock);
+	t = tls_conv(TLSCONV(inode->i_ino));
+	if (t)
+		t->ref++;
+	mutex_unlock(&tls_lock);
+	if (!t)
+		return -ENOENT;
+	f->private_data = t;
+	return 0;
+}
+
+static int conv_release(struct inode *inode, struct file *f)
+{
+	tls_put_conv(f->private_data);
+	return 0;
+}
+
+static ssize_t ctl_read(struct file *f, char __user *buf, size_t count,
+			loff_t *ppos)
+{
+	char num[16];
+	struct tls *t = f->private_data;
+	int n = scnprintf(num, sizeof(num), "%d", t->id);
+
+	return simple_read_from_buffer(buf, count, ppos, num, n);
+}
+
+static ssize_t ctl_write(struct file *f, const char __user *buf,
+			 size_t count, loff_t *offset)
+{
+	int error;
+	char *msg;
+
+	if (count >= MAXCTL)
+		return -EINVAL;
+	msg = kmalloc(count + 1, GFP_KERNEL);
+	if (!msg)
+		return -ENOMEM;
+	if (copy_from_user(msg, buf, count)) {
+		kfree(msg);
+		return -EFAULT;
+	}
+	msg[count] = '\0';
+	error = tls_ctl(f->private_data, msg);
+	memset(msg, 0, count);
+	kfree(msg);
+	return error ? error : count;
+}
+
+static const struct file_operations ctl_fops = {
+	.open		= conv_open,
+	.read		= ctl_read,
+	.write		= ctl_write,
+	.release	= conv_release,
+};
+
+static ssize_t data_read(struct file *f, char __user *buf, size_t count,
+			 loff_t *ppos)
+{
+	struct tls *t = f->private_data;
+
+	return tls_read(t, &t->dataq, buf, count);
+}
+
+static ssize_t data_write(struct file *f, const char __user *buf,
+			  size_t count, loff_t *offset)
+{
+	return tls_write(f->private_data, RApplication, buf, count);
+}
+
+static const struct file_operations data_fops = {
+	.open		= conv_open,
+	.read		= data_read,
+	.write		= data_write,
+	.release	= conv_release,
+};
+
+static ssize_t hand_read(struct file *f, char __user *buf, size_t count,
+			 loff_t *ppos)
+{
+	struct tls *t = f->private_data;
+
+	return tls_read(t, &t->handq, buf, count);
+}
+
+static ssize_t hand_write(struct file *f, const char __user *buf,
+			  size_t count, loff_t *offset)
+{
+	return tls_write(f->private_data, RHandshake, buf, count);
+}
+
+static const struct file_operations hand_fops = {
+	.open		= conv_open,
+	.read		= hand_read,
+	.write		= hand_write,
+	.release	= conv_release,
+};
+
+static const char *tls_encname(struct tls_secret *s)
+{
+	return s ? s->enc->name : "clear";
+}
+
+static const char *tls_hashname(struct tls_secret *s)
+{
+	return s ? s->hash->name : "clear";
+}
+
+static ssize_t status_read(struct file *f, char __user *buf, size_t count,
+			   loff_t *ppos)
+{
+	int n;
+	char s[256];
+	struct tls *t = f->private_data;
+
+	spin_lock(&t->lock);
+	n = scnprintf(s, sizeof(s), "State: %s\nVersion: 0x%x\n"
+		      "EncIn: %s\nHashIn: %s\nEncOut: %s\nHashOut: %s\n",
+		      tls_states[t->state], t->version,
+		      tls_encname(t->in), tls_hashname(t->in),
+		      tls_encname(t->out), tls_hashname(t->out));
+	spin_unlock(&t->lock);
+	return simple_read_from_buffer(buf, count, ppos, s, n);
+}
+
+static const struct file_operations status_fops = {
+	.open		= conv_open,
+	.read		= status_read,
+	.release	= conv_release,
+};
+
+static ssize_t stats_read(struct file *f, char __user *buf, size_t count,
+			  loff_t *ppos)
+{
+	int n;
+	char s[128];
+	struct tls *t = f->private_data;
+
+	n = scnprintf(s, sizeof(s), "DataIn: %llu\nDataOut: %llu\n"
+		      "HandIn: %llu\nHandOut: %llu\n", t->datain, t->dataout,
+		      t->handin, t->handout);
+	return simple_read_from_buffer(buf, count, ppos, s, n);
+}
+
+static const struct file_operations stats_fops = {
+	.open		= conv_open,
+	.read		= stats_read,
+	.release	= conv_release,
+};
+
+/* encalgs and hashalgs: the names, space separated */
+static ssize_t algs_read(struct file *f, char __user *buf, size_t count,
+			 loff_t *ppos)
+{
+	int n = 0, i;
+	char s[128];
+	struct inode *inode = f->f_path.dentry->d_inode;
+
+	for (i = 0; ; i++) {
+		const char *name = TLSQ(inode->i_ino) == Qencalgs ?
+			tls_encalgs[i].name : tls_hashalgs[i].name;
+
+		if (!name)
+			break;
+		n += scnprintf(s + n, sizeof(s) - n, "%s%s", i ? " " : "",
+			       name);
+	}
+	n += scnprintf(s + n, sizeof(s) - n, "\n");
+	return simple_read_from_buffer(buf, count, ppos, s, n);
+}
+
+static const struct file_operations algs_fops = {
+	.read		= algs_read,
+	.llseek		= default_llseek,
+};
+
+struct tls_file {
+	const char *name;
+	int q;
+	umode_t mode;
+	const struct file_operations *fops;
+	const struct inode_operations *iops;
+};
+
+static struct inode *tls_inode(struct super_block *sb, struct tls *t,
+			       const struct tls_file *tf)
+{
+	struct inode *inode = new_inode(sb);
+
+	if (!inode)
+		return NULL;
+	inode->i_ino = TLSINO(t ? t->id : 0, tf->q);
+	inode->i_mode = tf->mode;
+	if (t) {
+		inode->i_uid = t->uid;
+		inode->i_gid = t->gid;
+	}
+	inode->i_atime = inode->i_mtime = inode->i_ctime = CURRENT_TIME;
+	if (tf->iops)
+		inode->i_op = tf->iops;
+	inode->i_fop = tf->fops;
+	return inode;
+}
+
+/* A conversation's entries hold as long as it does */
+static int tls_d_revalidate(struct dentry *dentry, struct nameidata *nd)
+{
+	int ok;
+	struct inode *inode = dentry->d_inode;
+
+	if (!inode)
+		return 0;
+	if (TLSQ(inode->i_ino) != Qconv && TLSQ(inode->i_ino) < Qctl)
+		return 1;
+	mutex_lock(&tls_lock);
+	ok = tls_conv(TLSCONV(inode->i_ino)) != NULL;
+	mutex_unlock(&tls_lock);
+	return ok;
+}
+
+static int tls_d_delete(struct dentry *dentry)
+{
+	return 1;
+}
+
+static const struct dentry_operations tls_dentry_ops = {
+	.d_revalidate	= tls_d_revalidate,
+	.d_delete	= tls_d_delete,
+};
+
+/* Look for dentry among a directory's fixed files, those of conv if set */
+static struct dentry *tls_lookup_files(struct inode *dir,
+				       struct dentry *dentry,
+				       const struct tls_file *tf, int conv)
+{
+	struct tls *t = NULL;
+	struct inode *inode = NULL;
+
+	dentry->d_op = &tls_dentry_ops;
+	for (; tf->name; tf++)
+		if (!strcmp(dentry->d_name.name, tf->name))
+			break;
+	if (tf->name) {
+		mutex_lock(&tls_lock);
+		if (conv) {
+			t = tls_conv(conv);
+			if (!t) {
+				mutex_unlock(&tls_lock);
+				return ERR_PTR(-ENOENT);
+			}
+		}
+		inode = tls_inode(dir->i_sb, t, tf);
+		mutex_unlock(&tls_lock);
+		if (!inode)
+			return ERR_PTR(-ENOMEM);
+	}
+	d_add(dentry, inode);
+	return NULL;
+}
+
+/* List a directory's fixed files; f_pos is 2 past the next one */
+static int tls_readdir_files(struct file *filp, void *dirent,
+			     filldir_t filldir, const struct tls_file *tf,
+			     int nfiles)
+{
+	int i;
+	struct inode *inode = filp->f_path.dentry->d_inode;
+	int conv = TLSCONV(inode->i_ino);
+
+	while (filp->f_pos < 2) {
+		if (filldir(dirent, "..", filp->f_pos + 1, filp->f_pos,
+			    inode->i_ino, DT_DIR) < 0)
+			return -1;
+		filp->f_pos++;
+	}
+	for (i = filp->f_pos - 2; i < nfiles; i++) {
+		if (filldir(dirent, tf[i].name, strlen(tf[i].name),
+			    filp->f_pos, TLSINO(conv, tf[i].q),
+			    S_ISDIR(tf[i].mode) ? DT_DIR : DT_REG) < 0)
+			return -1;
+		filp->f_pos++;
+	}
+	return 0;
+}
+
+static const struct tls_file conv_files[] = {
+	{ "ctl",	Qctl,	S_IFREG | 0660,	&ctl_fops },
+	{ "data",	Qdata,	S_IFREG | 0660,	&data_fops },
+	{ "hand",	Qhand,	S_IFREG | 0660,	&hand_fops },
+	{ "status",	Qstatus, S_IFREG | 0444, &status_fops },
+	{ "stats",	Qstats,	S_IFREG | 0444,	&stats_fops },
+	{ NULL }
+};
+
+static struct dentry *conv_lookup(struct inode *dir, struct dentry *dentry,
+				  struct nameidata *nd)
+{
+	return tls_lookup_files(dir, dentry, conv_files, TLSCONV(dir->i_ino));
+}
+
+static int conv_readdir(struct file *filp, void *dirent, filldir_t filldir)
+{
+	tls_readdir_files(filp, dirent, filldir, conv_files,
+			  ARRAY_SIZE(conv_files) - 1);
+	return 0;
+}
+
+static const struct inode_operations conv_iops = {
+	.lookup		= conv_lookup,
+};
+
+static const struct file_operations conv_fops = {
+	.read		= generic_read_dir,
+	.readdir	= conv_readdir,
+	.llseek		= default_llseek,
+};
+
+static const struct tls_file conv_dir = {
+	"", Qconv, S_IFDIR | 0555, &conv_fops, &conv_iops
+};
+
+static const struct tls_file tlsdir_files[] = {
+	{ "clone",	Qclone,	S_IFREG | 0666,	&ctl_fops },
+	{ "encalgs",	Qencalgs, S_IFREG | 0444, &algs_fops },
+	{ "hashalgs",	Qhashalgs, S_IFREG | 0444, &algs_fops },
+	{ NULL }
+};
+
+/* tls holds clone, the algorithms and a directory for each conversation */
+static struct dentry *tlsdir_lookup(struct inode *dir, struct dentry *dentry,
+				    struct nameidata *nd)
+{
+	unsigned long id;
+	char *end;
+	struct tls *t;
+	struct inode *inode = NULL;
+	const struct tls_file *tf;
+
+	for (tf = tlsdir_files; tf->name; tf++)
+		if (!strcmp(dentry->d_name.name, tf->name))
+			return tls_lookup_files(dir, dentry, tlsdir_files, 0);
+
+	dentry->d_op = &tls_dentry_ops;
+	id = simple_strtoul(dentry->d_name.name, &end, 10);
+	if (*end == '\0' && id > 0 && id <= INT_MAX) {
+		mutex_lock(&tls_lock);
+		t = tls_conv(id);
+		if (t) {
+			inode = tls_inode(dir->i_sb, t, &conv_dir);
+			if (!inode) {
+				mutex_unlock(&tls_lock);
+				return ERR_PTR(-ENOMEM);
+			}
+		}
+		mutex_unlock(&tls_lock);
+	}
+	d_add(dentry, inode);
+	return NULL;
+}
+
+/* Past the fixed files, f_pos is 5 past the conversation to go on from */
+static int tlsdir_readdir(struct file *filp, void *dirent, filldir_t filldir)
+{
+	int len;
+	char name[16];
+	struct tls *t;
+
+	if (tls_readdir_files(filp, dirent, filldir, tlsdir_files,
+			      ARRAY_SIZE(tlsdir_files) - 1) < 0)
+		return 0;
+
+	mutex_lock(&tls_lock);
+	list_for_each_entry(t, &tls_convs, list) {
+		if (t->id + 5 <= filp->f_pos)
+			continue;
+		len = scnprintf(name, sizeof(name), "%d", t->id);
+		if (filldir(dirent, name, len, filp->f_pos,
+			    TLSINO(t->id, Qconv), DT_DIR) < 0)
+			break;
+		filp->f_pos = t->id + 5;
+	}
+	mutex_unlock(&tls_lock);
+	return 0;
+}
+
+static const struct inode_operations tlsdir_iops = {
+	.lookup		= tlsdir_lookup,
+};
+
+static const struct file_operations tlsdir_fops = {
+	.read		= generic_read_dir,
+	.readdir	= tlsdir_readdir,
+	.llseek		= default_llseek,
+};
+
+static const struct tls_file root_files[] = {
+	{ "tls",	Qtlsdir, S_IFDIR | 0555, &tlsdir_fops, &tlsdir_iops },
+	{ NULL }
+};
+
+static struct dentry *root_lookup(struct inode *dir, struct dentry *dentry,
+				  struct nameidata *nd)
+{
+	return tls_lookup_files(dir, dentry, root_files, 0);
+}
+
+static int root_readdir(struct file *filp, void *dirent, filldir_t filldir)
+{
+	tls_readdir_files(filp, dirent, filldir, root_files,
+			  ARRAY_SIZE(root_files) - 1);
+	return 0;
+}
+
+static const struct inode_operations root_iops = {
+	.lookup		= root_lookup,
+};
+
+static const struct file_operations root_fops = {
+	.read		= generic_read_dir,
+	.readdir	= root_readdir,
+	.llseek		= default_llseek,
+};
+
+static const struct super_operations tls_sops = {
+	.statfs		= simple_statfs,
+	.drop_inode	= generic_delete_inode,
+};
+
+static int tls_fill_super(struct super_block *sb, void *data, int silent)
+{
+	struct inode *inode;
+
+	sb->s_magic = TLS_MAGIC;
+	sb->s_op = &tls_sops;
+	inode = new_inode(sb);
+	if (!inode)
+		return -ENOMEM;
+	inode->i_ino = Qroot;
+	inode->i_mode = S_IFDIR | 0555;
+	inode->i_atime = inode->i_mtime = inode->i_ctime = CURRENT_TIME;
+	inode->i_op = &root_iops;
+	inode->i_fop = &root_fops;
+	sb->s_root = d_alloc_root(inode);
+	if (!sb->s_root) {
+		iput(inode);
+		return -ENOMEM;
+	}
+	return 0;
+}
+
+static int tls_get_sb(struct file_system_type *fs_type, int flags,
+		      const char *dev_name, void *data, struct vfsmount *mnt)
+{
+	return get_sb_single(fs_type, flags, data, tls_fill_super, mnt);
+}
+
+static struct file_system_type tls_fs_type = {
+	.name		= "plan9tls",
+	.get_sb		= tls_get_sb,
+	.kill_sb	= kill_anon_super,
+};
+
+static int tls_attach(char *spec, struct path *path)
+{
+	path->mnt = mntget(tls_mnt);
+	path->dentry = dget(tls_mnt->mnt_root);
+	return 0;
+}
+
+static struct p9_dev tls_dev = {
+	.dc	= 'a',
+	.name	= "tls",
+	.attach	= tls_attach,
+	.fstype	= &tls_fs_type,
+};
+
+static int __init devtls_init(void)
+{
+	int err = register_filesystem(&tls_fs_type);
+
+	if (err)
+		return err;
+	tls_mnt = kern_mount(&tls_fs_type);
+	if (IS_ERR(tls_mnt)) {
+		err = PTR_ERR(tls_mnt);
+		unregister_filesystem(&tls_fs_type);
+		return err;
+	}
+	return p9_devregister(&tls_dev);
+}
+
+static void __exit devtls_exit(void)
+{
+	p9_devunregister(&tls_dev);
+	mntput(tls_mnt);
+	unregister_filesystem(&tls_fs_type);
+}
+
+module_init(devtls_init);
+module_exit(devtls_exit);
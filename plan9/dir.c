@@ -0,0 +1,538 @@
+/*
+ * Copyright (C) 2008 Anant Narayanan <anant@kix.in>
+ * Conversion between Linux inode attributes and Plan 9 Dir entries
+ */
+
+#include <linux/fs.h>
+#include <linux/slab.h>
+#include <linux/mount.h>
+#include <linux/namei.h>
+#include <linux/dcache.h>
+#include <linux/kernel.h>
+#include <linux/string.h>
+
+#include <asm/uaccess.h>
+#include <asm/unaligned.h>
+
+#include "plan9.h"
+#include "p9_constants.h"
+
+/* Big enough for any Dir whose name fits in NAME_MAX */
+#define DIRBUFSZ	(STATFIXLEN + NAME_MAX + 3 * 10)
+
+/* Number of decimal digits in n */
+static unsigned int numlen(unsigned long n)
+{
+	unsigned int len = 1;
+
+	while (n >= 10) {
+		n /= 10;
+		len++;
+	}
+	return len;
+}
+
+/* Write n as exactly len decimal digits at p */
+static void putnum(u8 *p, unsigned int len, unsigned long n)
+{
+	while (len-- > 0) {
+		p[len] = '0' + n % 10;
+		n /= 10;
+	}
+}
+
+/*
+ * Fill in a Dir from the attributes of an inode. The owner strings
+ * are left NULL so that p9_convD2M writes the numeric ids directly,
+ * the kernel has no idea of user names.
+ */
+void p9_stat2dir(struct kstat *st, struct inode *inode, const char *name,
+		 unsigned int namelen, struct p9_dir *d)
+{
+	memset(d, 0, sizeof(*d));
+	d->dev = new_encode_dev(st->dev);
+	d->qid.path = st->ino;
+	/* ctime moves on every data or metadata change */
+	d->qid.vers = (u32)(st->ctime.tv_sec ^ st->ctime.tv_nsec);
+	d->qid.type = QTFILE;
+	d->mode = st->mode & 0777;
+
+	if (S_ISDIR(st->mode)) {
+		d->mode |= DMDIR;
+		d->qid.type |= QTDIR;
+	}
+	if (inode && IS_APPEND(inode)) {
+		d->mode |= DMAPPEND;
+		d->qid.type |= QTAPPEND;
+	}
+	/* Linux marks mandatory locking as setgid without group execute */
+	if (S_ISREG(st->mode) && (st->mode & (S_ISGID | S_IXGRP)) == S_ISGID) {
+		d->mode |= DMEXCL;
+		d->qid.type |= QTEXCL;
+	}
+
+	d->atime = st->atime.tv_sec;
+	d->mtime = st->mtime.tv_sec;
+	d->length = S_ISDIR(st->mode) ? 0 : st->size;
+	d->name = name;
+	d->namelen = namelen;
+	d->nuid = st->uid;
+	d->ngid = st->gid;
+}
+
+static unsigned int strsz(const char *s, unsigned int len, unsigned long n)
+{
+	return s ? len : numlen(n);
+}
+
+unsigned int p9_sizeD2M(struct p9_dir *d)
+{
+	return STATFIXLEN + d->namelen +
+		strsz(d->uid, d->uidlen, d->nuid) +
+		strsz(d->gid, d->gidlen, d->ngid) +
+		strsz(d->muid, d->muidlen, d->nuid);
+}
+
+/* A NULL string is written as the decimal form of n */
+static u8 *pstring(u8 *p, const char *s, unsigned int len, unsigned long n)
+{
+	if (!s)
+		len = numlen(n);
+	put_unaligned_le16(len, p);
+	p += BIT16SZ;
+	if (s)
+		memcpy(p, s, len);
+	else
+		putnum(p, len, n);
+	return p + len;
+}
+
+/*
+ * Pack d into buf in the machine independent format. Returns the
+ * number of bytes used, BIT16SZ if only the size field fits (the
+ * caller can then retry with a bigger buffer) or 0 if not even that.
+ */
+unsigned int p9_convD2M(struct p9_dir *d, u8 *buf, unsigned int nbuf)
+{
+	u8 *p = buf;
+	unsigned int ss = p9_sizeD2M(d);
+
+	if (nbuf < BIT16SZ)
+		return 0;
+	put_unaligned_le16(ss - BIT16SZ, p);
+	if (nbuf < ss)
+		return BIT16SZ;
+	p += BIT16SZ;
+
+	put_unaligned_le16(d->type, p);
+	p += BIT16SZ;
+	put_unaligned_le32(d->dev, p);
+	p += BIT32SZ;
+	*p = d->qid.type;
+	p += BIT8SZ;
+	put_unaligned_le32(d->qid.vers, p);
+	p += BIT32SZ;
+	put_unaligned_le64(d->qid.path, p);
+	p += BIT64SZ;
+	put_unaligned_le32(d->mode, p);
+	p += BIT32SZ;
+	put_unaligned_le32(d->atime, p);
+	p += BIT32SZ;
+	put_unaligned_le32(d->mtime, p);
+	p += BIT32SZ;
+	put_unaligned_le64(d->length, p);
+	p += BIT64SZ;
+
+	p = pstring(p, d->name, d->namelen, 0);
+	p = pstring(p, d->uid, d->uidlen, d->nuid);
+	p = pstring(p, d->gid, d->gidlen, d->ngid);
+	p = pstring(p, d->muid, d->muidlen, d->nuid);
+
+	return p - buf;
+}
+
+static u8 *gstring(u8 *p, u8 *ep, const char **s, unsigned int *len)
+{
+	unsigned int n;
+
+	if (p + BIT16SZ > ep)
+		return NULL;
+	n = get_unaligned_le16(p);
+	p += BIT16SZ;
+	if (p + n > ep)
+		return NULL;
+	*s = (const char *)p;
+	*len = n;
+	return p + n;
+}
+
+/*
+ * Unpack a Dir. The strings in d point into buf, which must stay
+ * around for as long as d is used.
+ */
+int p9_convM2D(u8 *buf, unsigned int nbuf, struct p9_dir *d)
+{
+	u8 *p = buf, *ep = buf + nbuf;
+
+	if (nbuf < STATFIXLEN || get_unaligned_le16(p) + BIT16SZ != nbuf)
+		return -EINVAL;
+	p += BIT16SZ;
+
+	memset(d, 0, sizeof(*d));
+	d->type = get_unaligned_le16(p);
+	p += BIT16SZ;
+	d->dev = get_unaligned_le32(p);
+	p += BIT32SZ;
+	d->qid.type = *p;
+	p += BIT8SZ;
+	d->qid.vers = get_unaligned_le32(p);
+	p += BIT32SZ;
+	d->qid.path = get_unaligned_le64(p);
+	p += BIT64SZ;
+	d->mode = get_unaligned_le32(p);
+	p += BIT32SZ;
+	d->atime = get_unaligned_le32(p);
+	p += BIT32SZ;
+	d->mtime = get_unaligned_le32(p);
+	p += BIT32SZ;
+	d->length = get_unaligned_le64(p);
+	p += BIT64SZ;
+
+	if (!(p = gstring(p, ep, &d->name, &d->namelen)) ||
+	    !(p = gstring(p, ep, &d->uid, &d->uidlen)) ||
+	    !(p = gstring(p, ep, &d->gid, &d->gidlen)) ||
+	    !(p = gstring(p, ep, &d->muid, &d->muidlen)))
+		return -EINVAL;
+
+	return p == ep ? 0 : -EINVAL;
+}
+
+/*
+ * Marshal the Dir for path straight into the user's buffer. Like
+ * Plan 9, a buffer too small for the whole entry gets just the size.
+ */
+int p9_statpath(struct path *path, u8 __user *edir, unsigned int nedir)
+{
+	int error;
+	unsigned int n;
+	struct kstat st;
+	struct p9_dir d;
+	u8 buf[DIRBUFSZ];
+	struct dentry *dentry = path->dentry;
+
+	error = vfs_getattr(path->mnt, dentry, &st);
+	if (error)
+		return error;
+
+	spin_lock(&dentry->d_lock);
+	if (IS_ROOT(dentry))
+		p9_stat2dir(&st, dentry->d_inode, "/", 1, &d);
+	else
+		p9_stat2dir(&st, dentry->d_inode, dentry->d_name.name,
+			    dentry->d_name.len, &d);
+	if (p9_sizeD2M(&d) > sizeof(buf))
+		n = 0;
+	else
+		n = p9_convD2M(&d, buf, min_t(unsigned int, nedir, sizeof(buf)));
+	spin_unlock(&dentry->d_lock);
+
+	if (n == 0)
+		return nedir < BIT16SZ ? -EINVAL : -ENAMETOOLONG;
+	if (copy_to_user(edir, buf, n))
+		return -EFAULT;
+	return n;
+}
+
+/* Parse a decimal owner id out of a (non NUL terminated) Dir string */
+static int getid(const char *s, unsigned int len, unsigned long *id)
+{
+	unsigned long n = 0;
+
+	if (len == 0 || len > 10)
+		return -EINVAL;
+	while (len-- > 0) {
+		if (*s < '0' || *s > '9')
+			return -EINVAL;
+		n = n * 10 + (*s++ - '0');
+	}
+	*id = n;
+	return 0;
+}
+
+static int p9_rename(struct path *path, const char *name, unsigned int len)
+{
+	int error;
+	struct dentry *parent, *new;
+	struct dentry *dentry = path->dentry;
+
+	if (memchr(name, '/', len) || memchr(name, '\0', len) ||
+	    (len == 1 && name[0] == '.') ||
+	    (len == 2 && name[0] == '.' && name[1] == '.'))
+		return -EINVAL;
+	if (IS_ROOT(dentry))
+		return -EPERM;
+
+	parent = dget_parent(dentry);
+	lock_rename(parent, parent);
+
+	error = -ENOENT;
+	if (dentry->d_parent != parent || d_unhashed(dentry))
+		goto out_unlock;
+	error = 0;
+	if (dentry->d_name.len == len &&
+	    memcmp(dentry->d_name.name, name, len) == 0)
+		goto out_unlock;
+
+	new = lookup_one_len(name, parent, len);
+	error = PTR_ERR(new);
+	if (IS_ERR(new))
+		goto out_unlock;
+
+	/* Plan 9 never replaces an existing file through wstat */
+	error = -EEXIST;
+	if (!new->d_inode)
+		error = vfs_rename(parent->d_inode, dentry,
+				   parent->d_inode, new);
+	dput(new);
+
+out_unlock:
+	unlock_rename(parent, parent);
+	dput(parent);
+	return error;
+}
+
+/*
+ * Apply a wstat. Every attribute that isn't "don't touch" (~0 for
+ * numbers, the empty string for names) is collected into a single
+ * iattr so the file system sees one notify_change; a rename, if any,
+ * follows it.
+ */
+int p9_wstatpath(struct path *path, u8 __user *edir, unsigned int nedir)
+{
+	u8 *buf;
+	int error, trunc;
+	unsigned long id;
+	struct p9_dir d;
+	struct iattr attr;
+	struct dentry *dentry = path->dentry;
+	struct inode *inode = dentry->d_inode;
+
+	if (nedir < STATFIXLEN || nedir > STATMAX)
+		return -EINVAL;
+
+	buf = kmalloc(nedir, GFP_KERNEL);
+	if (!buf)
+		return -ENOMEM;
+
+	error = -EFAULT;
+	if (copy_from_user(buf, edir, nedir))
+		goto out_free;
+	error = p9_convM2D(buf, nedir, &d);
+	if (error)
+		goto out_free;
+
+	memset(&attr, 0, sizeof(attr));
+
+	if (d.mode != ~0U) {
+		error = -EPERM;
+		if (!(d.mode & DMDIR) != !S_ISDIR(inode->i_mode))
+			goto out_free;
+		/* The append only flag lives outside the mode bits */
+		error = -EOPNOTSUPP;
+		if (!(d.mode & DMAPPEND) != !IS_APPEND(inode))
+			goto out_free;
+
+		attr.ia_mode = (inode->i_mode & S_IFMT) | (d.mode & 0777);
+		if (S_ISREG(inode->i_mode) && (d.mode & DMEXCL))
+			attr.ia_mode = (attr.ia_mode | S_ISGID) & ~S_IXGRP;
+		attr.ia_valid |= ATTR_MODE;
+	}
+	if (d.atime != ~0U) {
+		attr.ia_atime.tv_sec = d.atime;
+		attr.ia_valid |= ATTR_ATIME | ATTR_ATIME_SET;
+	}
+	if (d.mtime != ~0U) {
+		attr.ia_mtime.tv_sec = d.mtime;
+		attr.ia_valid |= ATTR_MTIME | ATTR_MTIME_SET;
+	}
+	if (d.length != ~0ULL) {
+		error = -EISDIR;
+		if (S_ISDIR(inode->i_mode))
+			goto out_free;
+		error = inode_permission(inode, MAY_WRITE);
+		if (error)
+			goto out_free;
+		attr.ia_size = d.length;
+		attr.ia_valid |= ATTR_SIZE | ATTR_MTIME | ATTR_CTIME;
+	}
+	if (d.uidlen) {
+		error = getid(d.uid, d.uidlen, &id);
+		if (error)
+			goto out_free;
+		attr.ia_uid = id;
+		attr.ia_valid |= ATTR_UID;
+	}
+	if (d.gidlen) {
+		error = getid(d.gid, d.gidlen, &id);
+		if (error)
+			goto out_free;
+		attr.ia_gid = id;
+		attr.ia_valid |= ATTR_GID;
+	}
+
+	error = mnt_want_write(path->mnt);
+	if (error)
+		goto out_free;
+
+	trunc = attr.ia_valid & ATTR_SIZE;
+	if (attr.ia_valid) {
+		if (trunc) {
+			error = get_write_access(inode);
+			if (error)
+				goto out_drop;
+			down_write(&inode->i_alloc_sem);
+		}
+		mutex_lock(&inode->i_mutex);
+		error = notify_change(dentry, &attr);
+		mutex_unlock(&inode->i_mutex);
+		if (trunc) {
+			up_write(&inode->i_alloc_sem);
+			put_write_access(inode);
+		}
+	}
+	if (!error && d.namelen)
+		error = p9_rename(path, d.name, d.namelen);
+
+out_drop:
+	mnt_drop_write(path->mnt);
+out_free:
+	kfree(buf);
+	return error ? error : nedir;
+}
+
+struct p9_readdir {
+	struct vfsmount *mnt;
+	struct dentry *dir;
+	u8 __user *buf;
+	unsigned int count;
+	unsigned int used;
+	int full;
+	int error;
+};
+
+/*
+ * Called by the file system for each entry. The Dir is marshalled
+ * from the name the file system hands us, so the name is only ever
+ * copied into the packed entry. Returning non-zero stops the walk
+ * without the file system advancing f_pos past this entry, which is
+ * how the next read picks up where this one left off.
+ */
+static int p9_filldir(void *__buf, const char *name, int namlen,
+		      loff_t offset, u64 ino, unsigned int d_type)
+{
+	int error;
+	unsigned int n;
+	struct kstat st;
+	struct p9_dir d;
+	struct dentry *dentry;
+	u8 ebuf[DIRBUFSZ];
+	struct p9_readdir *rd = __buf;
+
+	/* Plan 9 directories don't list themselves or their parent */
+	if (name[0] == '.' && (namlen == 1 || (namlen == 2 && name[1] == '.')))
+		return 0;
+
+	/* vfs_readdir holds the directory's i_mutex for us */
+	dentry = lookup_one_len(name, rd->dir, namlen);
+	if (IS_ERR(dentry)) {
+		error = PTR_ERR(dentry);
+		goto out_err;
+	}
+	/* Raced with an unlink, skip it */
+	error = 0;
+	if (!dentry->d_inode)
+		goto out;
+
+	error = vfs_getattr(rd->mnt, dentry, &st);
+	if (error)
+		goto out_dput;
+	p9_stat2dir(&st, dentry->d_inode, name, namlen, &d);
+
+	error = -ENAMETOOLONG;
+	n = p9_sizeD2M(&d);
+	if (n > sizeof(ebuf))
+		goto out_dput;
+
+	/* Doesn't fit, leave it for the next read */
+	if (n > rd->count - rd->used) {
+		rd->full = 1;
+		if (rd->used == 0)
+			rd->error = -EINVAL;
+		error = -EINVAL;
+		goto out;
+	}
+
+	p9_convD2M(&d, ebuf, n);
+	error = -EFAULT;
+	if (copy_to_user(rd->buf + rd->used, ebuf, n))
+		goto out_dput;
+	rd->used += n;
+	error = 0;
+	goto out;
+
+out_dput:
+	dput(dentry);
+out_err:
+	rd->error = error;
+	return error;
+out:
+	dput(dentry);
+	return error;
+}
+
+/*
+ * Read as many packed Dir entries from a directory as fit in buf,
+ * starting at its f_pos. full is set if an entry was left over for
+ * want of space.
+ */
+long p9_readdir(struct file *file, char __user *buf, size_t count, int *full)
+{
+	int error;
+	struct p9_readdir rd;
+
+	rd.mnt = file->f_path.mnt;
+	rd.dir = file->f_path.dentry;
+	rd.buf = (u8 __user *)buf;
+	rd.count = min_t(size_t, count, INT_MAX);
+	rd.used = 0;
+	rd.full = 0;
+	rd.error = 0;
+
+	error = vfs_readdir(file, p9_filldir, &rd);
+	*full = rd.full;
+	if (rd.used)
+		return rd.used;
+	if (rd.error)
+		return rd.error;
+	return error;
+}
+
+/*
+ * pread on a directory. Reads continue where the last one stopped
+ * unless rewind is set.
+ */
+long p9_dirread(struct file *file, char __user *buf, size_t count, int rewind)
+{
+	int full;
+	loff_t pos;
+
+	if (p9_ns_union(file))
+		return p9_ns_dirread(file, buf, count, rewind);
+
+	if (rewind) {
+		pos = vfs_llseek(file, 0, SEEK_SET);
+		if (pos < 0)
+			return pos;
+	}
+	return p9_readdir(file, buf, count, &full);
+}
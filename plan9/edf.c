@@ -0,0 +1,437 @@
+/*
+ * Copyright (C) 2008 Anant Narayanan <anant@kix.in>
+ * Plan 9 real-time scheduling, set through '#p/n/ctl'.
+ *
+ * A Plan 9 real-time proc has a period T, a deadline D within each
+ * period and a cost C, the CPU time it needs before the deadline. It
+ * runs only once admitted, when it is certain every real-time proc on
+ * its CPU will meet its deadlines.
+ *
+ * Linux has no deadline scheduler for us to hand these to, so admitted
+ * procs are wired to a CPU and run SCHED_FIFO, the shorter the deadline
+ * the higher the priority. Admission is an exact response time test of
+ * that fixed priority schedule. A timer follows each admitted proc's
+ * periods and counts the jobs still unfinished at their deadline and
+ * those that ran over their cost, for '#p/n/edf'. A sporadic proc is
+ * followed as though released every period. Costs are not enforced
+ * per proc; the kernel's real-time throttling bounds them together.
+ */
+#include <linux/init.h>
+#include <linux/list.h>
+#include <linux/ctype.h>
+#include <linux/slab.h>
+#include <linux/sched.h>
+#include <linux/string.h>
+#include <linux/ktime.h>
+#include <linux/log2.h>
+#include <linux/mutex.h>
+#include <linux/hrtimer.h>
+#include <linux/math64.h>
+#include <linux/cpumask.h>
+#include <linux/profile.h>
+#include <linux/notifier.h>
+
+#include "plan9.h"
+
+struct edf_params {
+	u64 T, D, C;			/* nanoseconds */
+	int sporadic;
+};
+
+struct edf {
+	struct list_head list;
+	struct task_struct *task;
+	struct edf_params p;
+	int admitted;
+	int cpu;			/* where it is wired when admitted */
+	int prio;			/* its SCHED_FIFO priority then */
+	cpumask_t oldmask;		/* its affinity before */
+
+	/* Kept by edf_tick */
+	struct hrtimer timer;
+	int atdeadline;			/* next expiry is a deadline */
+	ktime_t release;
+	unsigned long nvcsw;		/* at release */
+	u64 runtime;
+	unsigned long released, missed, overran;
+};
+
+/*
+ * Longest period, deadline or cost. A cost this long still leaves room
+ * for the shifts and products of edf_schedulable.
+ */
+#define EDFMAX		(1000ULL * NSEC_PER_SEC)
+
+/* Shortest period: edf_tick runs twice in every one */
+#define EDFMIN		(100 * NSEC_PER_USEC)
+
+/* Every proc with real-time parameters; edf_lock also serialises admission */
+static LIST_HEAD(edf_list);
+static DEFINE_MUTEX(edf_lock);
+
+static struct edf *edf_find(struct task_struct *t)
+{
+	struct edf *e;
+
+	list_for_each_entry(e, &edf_list, list)
+		if (e->task == t)
+			return e;
+	return NULL;
+}
+
+/*
+ * Follow the proc through its periods. A job is done when the proc
+ * blocks; still runnable at the deadline without having blocked since
+ * its release, it has missed it.
+ */
+static enum hrtimer_restart edf_tick(struct hrtimer *timer)
+{
+	u64 ran, n;
+	int late;
+	ktime_t since;
+	struct edf *e = container_of(timer, struct edf, timer);
+	struct task_struct *t = e->task;
+
+	if (!e->atdeadline) {
+		e->nvcsw = t->nvcsw;
+		e->runtime = task_sched_runtime(t);
+		e->released++;
+		e->atdeadline = 1;
+		hrtimer_set_expires(timer, ktime_add_ns(e->release, e->p.D));
+	} else {
+		late = t->nvcsw == e->nvcsw && t->state == TASK_RUNNING;
+		if (late)
+			e->missed++;
+		ran = task_sched_runtime(t) - e->runtime;
+		if (ran > e->p.C)
+			e->overran++;
+		e->release = ktime_add_ns(e->release, e->p.T);
+		e->atdeadline = 0;
+		hrtimer_set_expires(timer, e->release);
+		/*
+		 * Run late, the timer may have let whole periods go by: go
+		 * on from the last release before now, and count those
+		 * before it as released, and as missed if the proc hasn't
+		 * blocked since. That is hrtimer_forward_now, one period
+		 * short, so as not to skip a release that is due now.
+		 */
+		since = ktime_sub_ns(hrtimer_cb_get_time(timer), e->p.T);
+		n = hrtimer_forward(timer, since, ns_to_ktime(e->p.T));
+		if (n) {
+			e->released += n;
+			if (late)
+				e->missed += n;
+			e->release = hrtimer_get_expires(timer);
+		}
+	}
+	return HRTIMER_RESTART;
+}
+
+/* Deadline monotonic, in powers of two of microseconds */
+static int edf_prio(u64 D)
+{
+	int b = ilog2(max_t(u64, div_u64(D, NSEC_PER_USEC), 1));
+
+	return MAX_USER_RT_PRIO - 1 - min(b, MAX_USER_RT_PRIO / 2);
+}
+
+/*
+ * Would every admitted proc on cpu still meet its deadlines with n
+ * (with parameters p) among them? Each job's worst response time is its
+ * cost plus that of every job of equal or higher priority released
+ * meanwhile.
+ */
+static const char *edf_schedulable(struct edf *n, struct edf_params *p, int cpu)
+{
+	u64 util = 0, R, Rn;
+	struct edf *e, *j;
+	struct edf_params *ep, *jp;
+	u64 bound = 1ULL << 20;
+
+	if (sysctl_sched_rt_runtime >= 0)
+		bound = div_u64((u64)sysctl_sched_rt_runtime << 20,
+				sysctl_sched_rt_period);
+
+#define PARAMS(x)	((x) == n ? p : &(x)->p)
+#define ON(x)		((x) == n || ((x)->admitted && (x)->cpu == cpu))
+	list_for_each_entry(e, &edf_list, list)
+		if (ON(e))
+			util += div64_u64(PARAMS(e)->C << 20, PARAMS(e)->T);
+	if (util > bound)
+		return "utilization too high";
+
+	list_for_each_entry(e, &edf_list, list) {
+		if (!ON(e))
+			continue;
+		ep = PARAMS(e);
+		Rn = ep->C;
+		do {
+			R = Rn;
+			Rn = ep->C;
+			list_for_each_entry(j, &edf_list, list) {
+				if (j == e || !ON(j))
+					continue;
+				jp = PARAMS(j);
+				if (edf_prio(jp->D) < edf_prio(ep->D))
+					continue;
+				Rn += div64_u64(R + jp->T - 1, jp->T) * jp->C;
+			}
+			if (Rn > ep->D)
+				return "not schedulable";
+		} while (Rn != R);
+	}
+#undef ON
+#undef PARAMS
+	return NULL;
+}
+
+static void edf_expel(struct edf *e)
+{
+	struct sched_param sp = { .sched_priority = 0 };
+
+	if (!e->admitted)
+		return;
+	hrtimer_cancel(&e->timer);
+	sched_setscheduler_nocheck(e->task, SCHED_NORMAL, &sp);
+	set_cpus_allowed_ptr(e->task, &e->oldmask);
+	e->admitted = 0;
+}
+
+/* Admit e with parameters p, in place of any it was admitted with */
+static int edf_admit(struct edf *e, struct edf_params *p)
+{
+	int cpu, error;
+	const char *why;
+	struct sched_param sp;
+	struct task_struct *t = e->task;
+
+	if (p->T == 0)
+		why = "T not set";
+	else if (p->T < EDFMIN)
+		why = "T too short";
+	else if (p->C == 0)
+		why = "C not set";
+	else if (p->D > p->T)
+		why = "D > T";
+	else if (p->C > (p->D ? p->D : p->T))
+		why = "C > D";
+	else
+		why = NULL;
+	if (why) {
+		p9_werrstr("%s", why);
+		return -EINVAL;
+	}
+	if (p->D == 0)
+		p->D = p->T;
+
+	cpu = e->admitted ? e->cpu : task_cpu(t);
+	why = edf_schedulable(e, p, cpu);
+	if (why) {
+		p9_werrstr("%s", why);
+		return -EBUSY;
+	}
+
+	sp.sched_priority = edf_prio(p->D);
+	error = sched_setscheduler(t, SCHED_FIFO, &sp);
+	if (error)
+		return error;
+	if (!e->admitted) {
+		e->oldmask = t->cpus_allowed;
+		error = set_cpus_allowed_ptr(t, cpumask_of(cpu));
+		if (error) {
+			sp.sched_priority = 0;
+			sched_setscheduler_nocheck(t, SCHED_NORMAL, &sp);
+			return error;
+		}
+	} else {
+		hrtimer_cancel(&e->timer);
+	}
+
+	e->p = *p;
+	e->cpu = cpu;
+	e->prio = sp.sched_priority;
+	e->admitted = 1;
+	e->atdeadline = 0;
+	e->release = ktime_get();
+	hrtimer_start(&e->timer, e->release, HRTIMER_MODE_ABS);
+	return 0;
+}
+
+/*
+ * A time: a number, perhaps with a fraction, then s, ms, us, µs or ns.
+ * Seconds if there is no unit. At most EDFMAX.
+ */
+static int edf_time(const char *s, u64 *ns)
+{
+	u64 whole = 0, frac = 0, scale = NSEC_PER_SEC, fscale = 1;
+
+	if (!isdigit(*s))
+		return -EINVAL;
+	while (isdigit(*s)) {
+		if (whole > EDFMAX)
+			goto toolong;
+		whole = whole * 10 + (*s++ - '0');
+	}
+	if (*s == '.') {
+		for (s++; isdigit(*s); s++) {
+			if (fscale < NSEC_PER_SEC) {
+				frac = frac * 10 + (*s - '0');
+				fscale *= 10;
+			}
+		}
+	}
+	if (!strcmp(s, "ms"))
+		scale = NSEC_PER_MSEC;
+	else if (!strcmp(s, "us") || !strcmp(s, "\xc2\xb5s"))
+		scale = NSEC_PER_USEC;
+	else if (!strcmp(s, "ns"))
+		scale = 1;
+	else if (*s && strcmp(s, "s"))
+		return -EINVAL;
+	if (whole > div64_u64(EDFMAX, scale))
+		goto toolong;
+	*ns = whole * scale + div64_u64(frac * scale, fscale);
+	if (*ns > EDFMAX)
+		goto toolong;
+	return 0;
+
+toolong:
+	p9_werrstr("time too long");
+	return -EINVAL;
+}
+
+/*
+ * A real-time ctl message for t: period, deadline or cost with a time,
+ * sporadic, admit or expel. -ENOENT if cmd is not one of those.
+ * Changing the parameters of an admitted proc admits it afresh, and
+ * leaves it as it was if that fails.
+ */
+int p9_edf_ctl(struct task_struct *t, const char *cmd, const char *arg)
+{
+	int error = 0;
+	u64 ns = 0;
+	struct edf *e;
+	struct edf_params p;
+
+	if (!strcmp(cmd, "period") || !strcmp(cmd, "deadline") ||
+	    !strcmp(cmd, "cost")) {
+		if (!arg || edf_time(arg, &ns))
+			return -EINVAL;
+	} else if (strcmp(cmd, "sporadic") && strcmp(cmd, "admit") &&
+		   strcmp(cmd, "expel")) {
+		return -ENOENT;
+	}
+
+	mutex_lock(&edf_lock);
+	e = edf_find(t);
+	if (!e) {
+		error = -ENOMEM;
+		e = kzalloc(sizeof(*e), GFP_KERNEL);
+		if (!e)
+			goto out;
+		get_task_struct(t);
+		e->task = t;
+		hrtimer_init(&e->timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+		e->timer.function = edf_tick;
+		list_add(&e->list, &edf_list);
+		error = 0;
+	}
+
+	p = e->p;
+	if (!strcmp(cmd, "period"))
+		p.T = ns;
+	else if (!strcmp(cmd, "deadline"))
+		p.D = ns;
+	else if (!strcmp(cmd, "cost"))
+		p.C = ns;
+	else if (!strcmp(cmd, "sporadic"))
+		p.sporadic = 1;
+	else if (!strcmp(cmd, "expel"))
+		edf_expel(e);
+
+	if (!strcmp(cmd, "admit") || (e->admitted && strcmp(cmd, "expel")))
+		error = edf_admit(e, &p);
+	else
+		e->p = p;
+out:
+	mutex_unlock(&edf_lock);
+	return error;
+}
+
+/*
+ * Hold off admission while t's affinity or priority is changed by hand:
+ * -EBUSY if t is admitted, otherwise 0 with edf_lock held until
+ * p9_edf_unlock.
+ */
+int p9_edf_lock(struct task_struct *t)
+{
+	struct edf *e;
+
+	mutex_lock(&edf_lock);
+	e = edf_find(t);
+	if (e && e->admitted) {
+		mutex_unlock(&edf_lock);
+		p9_werrstr("proc is admitted real-time");
+		return -EBUSY;
+	}
+	return 0;
+}
+
+void p9_edf_unlock(void)
+{
+	mutex_unlock(&edf_lock);
+}
+
+/* '#p/n/edf': t's parameters in nanoseconds and how its jobs have gone */
+int p9_edf_read(struct task_struct *t, char *buf, int len)
+{
+	int n;
+	struct edf *e;
+
+	mutex_lock(&edf_lock);
+	e = edf_find(t);
+	if (!e)
+		n = scnprintf(buf, len, "none\n");
+	else
+		n = scnprintf(buf, len,
+			      "%s%s T %llu D %llu C %llu cpu %d pri %d "
+			      "released %lu missed %lu overran %lu\n",
+			      e->admitted ? "admitted" : "expelled",
+			      e->p.sporadic ? " sporadic" : "",
+			      e->p.T, e->p.D, e->p.C,
+			      e->admitted ? e->cpu : -1,
+			      e->admitted ? e->prio : 0,
+			      e->released, e->missed, e->overran);
+	mutex_unlock(&edf_lock);
+	return n;
+}
+
+static int edf_exit(struct notifier_block *nb, unsigned long val, void *data)
+{
+	struct edf *e;
+
+	mutex_lock(&edf_lock);
+	e = edf_find(data);
+	if (e) {
+		list_del(&e->list);
+		hrtimer_cancel(&e->timer);
+	}
+	mutex_unlock(&edf_lock);
+
+	if (!e)
+		return NOTIFY_DONE;
+	put_task_struct(e->task);
+	kfree(e);
+	return NOTIFY_OK;
+}
+
+static struct notifier_block edf_exit_nb = {
+	.notifier_call = edf_exit,
+};
+
+static int __init edf_init(void)
+{
+	return profile_event_register(PROFILE_TASK_EXIT, &edf_exit_nb);
+}
+
+module_init(edf_init);
@@ -0,0 +1,165 @@
+/*
+ * Copyright (C) 2008 Anant Narayanan <anant@kix.in>
+ * Plan 9 error strings.
+ *
+ * A failed Plan 9 system call returns -1 and leaves its error for
+ * errstr. All the failure path does is note the errno; it only becomes
+ * a string, from the table below, if the process asks for it. Each
+ * process has two ERRMAX buffers so that errstr can trade strings with
+ * the caller with one copy each way. Errors peculiar to Plan 9 can
+ * put their string in place directly with p9_werrstr.
+ */
+#include <linux/errno.h>
+#include <linux/sched.h>
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/uaccess.h>
+
+#include "plan9.h"
+#include "p9_constants.h"
+
+/* Mostly the strings of the Plan 9 kernel, port/error.h */
+static const char *const p9_errtab[] = {
+	[EPERM]		= "permission denied",
+	[ENOENT]	= "file does not exist",
+	[ESRCH]		= "process does not exist",
+	[EINTR]		= "interrupted",
+	[EIO]		= "i/o error",
+	[ENXIO]		= "device does not exist",
+	[E2BIG]		= "argument list too long",
+	[ENOEXEC]	= "bad exec header",
+	[EBADF]		= "fd out of range or not open",
+	[ECHILD]	= "no living children",
+	[EAGAIN]	= "resource temporarily unavailable",
+	[ENOMEM]	= "out of memory: kernel",
+	[EACCES]	= "permission denied",
+	[EFAULT]	= "bad address in syscall",
+	[EBUSY]		= "device or object already in use",
+	[EEXIST]	= "file already exists",
+	[EXDEV]		= "cross-device link",
+	[ENODEV]	= "no such device",
+	[ENOTDIR]	= "not a directory",
+	[EISDIR]	= "file is a directory",
+	[EINVAL]	= "bad arg in system call",
+	[ENFILE]	= "no free file descriptors",
+	[EMFILE]	= "no free file descriptors",
+	[ENOTTY]	= "inappropriate use of fd",
+	[ETXTBSY]	= "file in use",
+	[EFBIG]		= "file too big",
+	[ENOSPC]	= "file system full",
+	[ESPIPE]	= "seek on a stream",
+	[EROFS]		= "file system read only",
+	[EMLINK]	= "too many links",
+	[EPIPE]		= "write on closed pipe",
+	[ERANGE]	= "buffer too small",
+	[EDEADLK]	= "deadlock",
+	[ENAMETOOLONG]	= "file name too long",
+	[ENOSYS]	= "system call not implemented",
+	[ENOTEMPTY]	= "directory not empty",
+	[ELOOP]		= "too many symbolic links",
+	[ENOTSOCK]	= "not a socket",
+	[EOPNOTSUPP]	= "operation not supported",
+	[EADDRINUSE]	= "address in use",
+	[ENETUNREACH]	= "network unreachable",
+	[ECONNRESET]	= "connection reset",
+	[ETIMEDOUT]	= "connection timed out",
+	[ECONNREFUSED]	= "connection refused",
+	[EHOSTUNREACH]	= "host unreachable",
+	[EDQUOT]	= "disk quota exceeded",
+};
+
+/*
+ * Called from the system call entry for any system call that failed,
+ * with its return value. Returns what the process gets back instead:
+ * -1, except for -ERESTARTNOINTR, which the signal code has yet to see
+ * and always restarts with the same call. As on Plan 9, a call a note
+ * interrupts fails with "interrupted" rather than being restarted:
+ * the signal code would hand back the others as a raw -EINTR if a
+ * handler ran, and would restart a restart block as Linux's
+ * restart_syscall, which is slot 0 of the Plan 9 table.
+ */
+long p9_syserror(long ret)
+{
+	struct p9_proc *p;
+
+	switch (ret) {
+	case -ERESTARTNOINTR:
+		return ret;
+	case -ERESTARTSYS:
+	case -ERESTARTNOHAND:
+	case -ERESTART_RESTARTBLOCK:
+		ret = -EINTR;
+		break;
+	}
+
+	p = p9_proc();
+	if (p) {
+		if (p->errset)
+			p->errset = 0;
+		else
+			p->err = -ret;
+	}
+	return -1;
+}
+
+/*
+ * Fail with an error string of our own, for errors no errno describes.
+ * The system call must go on to fail; its errno is then ignored.
+ */
+void p9_werrstr(const char *fmt, ...)
+{
+	va_list ap;
+	struct p9_proc *p;
+
+	if (!p9_binfmt(current->mm))
+		return;
+	p = p9_proc();
+	if (!p)
+		return;
+	va_start(ap, fmt);
+	vsnprintf(p->errbuf[p->ebuf], ERRMAX, fmt, ap);
+	va_end(ap);
+	p->err = 0;
+	p->errset = 1;
+}
+
+/*
+ * errstr(2): give the caller the current error and make the string in
+ * its buffer the new one.
+ */
+long p9_errstr(char __user *buf, unsigned int nbuf)
+{
+	long len;
+	char *cur, *new;
+	struct p9_proc *p = p9_proc();
+
+	if (!p)
+		return -ENOMEM;
+	cur = p->errbuf[p->ebuf];
+	new = p->errbuf[!p->ebuf];
+
+	/* The string for a pending errno is only made now */
+	if (p->err) {
+		if (p->err < ARRAY_SIZE(p9_errtab) && p9_errtab[p->err])
+			strlcpy(cur, p9_errtab[p->err], ERRMAX);
+		else
+			snprintf(cur, ERRMAX, "linux error %d", p->err);
+		p->err = 0;
+	}
+
+	if (nbuf == 0)
+		return 0;
+	if (nbuf > ERRMAX)
+		nbuf = ERRMAX;
+	len = strncpy_from_user(new, buf, nbuf - 1);
+	if (len < 0)
+		return -EFAULT;
+	new[len] = '\0';
+
+	len = min_t(long, strlen(cur), nbuf - 1);
+	if (copy_to_user(buf, cur, len) || put_user('\0', buf + len))
+		return -EFAULT;
+
+	p->ebuf = !p->ebuf;
+	return 0;
+}
@@ -0,0 +1,744 @@
+/*
+ * Copyright (C) 2008 Anant Narayanan <anant@kix.in>
+ * Plan 9 memdraw: images in memory, and compositing them.
+ *
+ * Every image is kept as premultiplied a8r8g8b8 whatever its channel
+ * descriptor says, and only converted when pixels are loaded into it
+ * or read back. That leaves one pixel format for the compositing loops
+ * to handle. They work on two 8 bit channels at a time in each 32 bit
+ * multiply, as Plan 9's own do, and step their pointers a row at a
+ * time. Solid fills, SoverD of a colour or of an image without a mask,
+ * and straight copies, by far the most common draws, have loops of
+ * their own. Where the CPU has SSE2, those (but the copy, which is a
+ * memmove) do four pixels at a time in the SSE registers, which they
+ * take with kernel_fpu_begin a row at a time. Between rows, with the
+ * FPU given back, every loop lets the scheduler run something else, as
+ * one draw can cover millions of pixels.
+ *
+ * An image without an alpha channel is opaque. Used as a mask, it
+ * masks by its grey level. One whose channels are under 8 bits, or
+ * grey, has each pixel drawn rounded to what its channels can hold, so
+ * that it looks as it will when read back.
+ */
+#include <linux/kernel.h>
+#include <linux/sched.h>
+#include <linux/string.h>
+#include <linux/vmalloc.h>
+#include <asm/i387.h>
+#include <asm/cpufeature.h>
+
+#include "plan9.h"
+
+#define Dx(r)		((r).max.x - (r).min.x)
+#define Dy(r)		((r).max.y - (r).min.y)
+
+#define MAXDIM		16384		/* widest or tallest image */
+#define MAXPIX		(16 << 20)	/* most pixels in one */
+#define SSEMIN		16		/* pixels a row worth taking the FPU */
+
+/* Channel types in a descriptor */
+enum {
+	CRed,
+	CGreen,
+	CBlue,
+	CGrey,
+	CAlpha,
+	CMap,
+	CIgnore,
+};
+
+#define XRGB32		0x68081828	/* x8r8g8b8 */
+#define ARGB32		0x48081828	/* a8r8g8b8 */
+
+/* The bits of a pixel, or 0 for a descriptor we can't handle */
+int p9_chandepth(u32 chan)
+{
+	int t, n, d = 0;
+	u32 c;
+
+	for (c = chan; c; c >>= 8) {
+		t = (c >> 4) & 15;
+		n = c & 15;
+		if (n == 0 || n > 8 || t == CMap || t > CIgnore)
+			return 0;
+		d += n;
+	}
+	switch (d) {
+	case 1: case 2: case 4: case 8: case 16: case 24: case 32:
+		return d;
+	}
+	return 0;
+}
+
+static int chanhas(u32 chan, int type)
+{
+	for (; chan; chan >>= 8)
+		if (((chan >> 4) & 15) == type)
+			return 1;
+	return 0;
+}
+
+/* The descriptor as text, most significant channel first: x8r8g8b8 */
+char *p9_chantostr(char *buf, u32 chan)
+{
+	int i;
+	char *p = buf;
+
+	for (i = 24; i >= 0; i -= 8) {
+		u32 c = (chan >> i) & 0xff;
+
+		if (!c)
+			continue;
+		*p++ = "rgbkamx"[(c >> 4) & 15];
+		*p++ = '0' + (c & 15);
+	}
+	*p = '\0';
+	return buf;
+}
+
+/* Bytes of a row of r, as images are loaded and read */
+int p9_bytesperline(struct p9_rect r, int d)
+{
+	if (r.min.x >= 0)
+		return (r.max.x * d + 7) / 8 - (r.min.x * d) / 8;
+	return (-r.min.x * d + 7) / 8 + (r.max.x * d + 7) / 8;
+}
+
+/* The byte of such a row that r.min.x is in */
+static int firstbyte(struct p9_rect r, int d)
+{
+	if (r.min.x >= 0)
+		return (r.min.x * d) / 8;
+	return -((-r.min.x * d + 7) / 8);
+}
+
+/* A pixel in chan's format as premultiplied a8r8g8b8 */
+static u32 topix(u32 chan, u32 v)
+{
+	u32 c, bits, v8, a = 255, r = 0, g = 0, b = 0;
+	int n;
+
+	for (c = chan; c; c >>= 8) {
+		n = c & 15;
+		bits = v & ((1 << n) - 1);
+		v >>= n;
+		v8 = n == 8 ? bits : bits * 255 / ((1 << n) - 1);
+		switch ((c >> 4) & 15) {
+		case CRed:
+			r = v8;
+			break;
+		case CGreen:
+			g = v8;
+			break;
+		case CBlue:
+			b = v8;
+			break;
+		case CGrey:
+			r = g = b = v8;
+			break;
+		case CAlpha:
+			a = v8;
+			break;
+		}
+	}
+	return a << 24 | r << 16 | g << 8 | b;
+}
+
+static u32 grey(u32 p)
+{
+	return (((p >> 16) & 0xff) * 299 + ((p >> 8) & 0xff) * 587 +
+		(p & 0xff) * 114) / 1000;
+}
+
+/* The other way */
+static u32 frompix(u32 chan, u32 p)
+{
+	u32 c, v8, v = 0;
+	int n, shift = 0;
+
+	for (c = chan; c; c >>= 8) {
+		n = c & 15;
+		switch ((c >> 4) & 15) {
+		case CRed:
+			v8 = (p >> 16) & 0xff;
+			break;
+		case CGreen:
+			v8 = (p >> 8) & 0xff;
+			break;
+		case CBlue:
+			v8 = p & 0xff;
+			break;
+		case CGrey:
+			v8 = grey(p);
+			break;
+		case CAlpha:
+			v8 = p >> 24;
+			break;
+		default:
+			v8 = 0xff;
+			break;
+		}
+		v |= (v8 >> (8 - n)) << shift;
+		shift += n;
+	}
+	return v;
+}
+
+/* Whether chan can't hold every a8r8g8b8 pixel as it is */
+static int chanquant(u32 chan)
+{
+	u32 t;
+
+	for (; chan; chan >>= 8) {
+		t = (chan >> 4) & 15;
+		if (t != CIgnore && ((chan & 15) < 8 || t == CGrey))
+			return 1;
+	}
+	return 0;
+}
+
+/* p rounded to what i's channels hold */
+static u32 quantize(struct p9_memimage *i, u32 p)
+{
+	return topix(i->chan, frompix(i->chan, p));
+}
+
+static inline u32 *pixaddr(struct p9_memimage *i, int x, int y)
+{
+	return i->data + (y - i->r.min.y) * i->width + (x - i->r.min.x);
+}
+
+/*
+ * Allocate i to cover r, filled with rgba, a premultiplied colour as
+ * Plan 9 gives them: red in the top byte, alpha in the bottom.
+ */
+int p9_memalloc(struct p9_memimage *i, struct p9_rect r, u32 chan, u32 rgba)
+{
+	long n, npix;
+	u32 p;
+
+	if (!p9_chandepth(chan))
+		return -EINVAL;
+	if (Dx(r) <= 0 || Dy(r) <= 0 || Dx(r) > MAXDIM || Dy(r) > MAXDIM)
+		return -EINVAL;
+	npix = (long)Dx(r) * Dy(r);
+	if (npix > MAXPIX)
+		return -ENOMEM;
+	i->data = vmalloc(npix * sizeof(u32));
+	if (!i->data)
+		return -ENOMEM;
+	i->r = r;
+	i->clipr = r;
+	i->repl = 0;
+	i->chan = chan;
+	i->alpha = chanhas(chan, CAlpha);
+	i->quant = chanquant(chan);
+	i->width = Dx(r);
+
+	p = (rgba & 0xff) << 24 | rgba >> 8;
+	if (!i->alpha)
+		p |= 0xff000000;
+	if (i->quant)
+		p = quantize(i, p);
+	for (n = 0; n < npix; n++)
+		i->data[n] = p;
+	return 0;
+}
+
+void p9_memfree(struct p9_memimage *i)
+{
+	vfree(i->data);
+	i->data = NULL;
+}
+
+/* Load r of i from data, in rows of p9_bytesperline in i's format */
+void p9_memload(struct p9_memimage *i, struct p9_rect r, const u8 *data)
+{
+	int d = p9_chandepth(i->chan);
+	int bpl = p9_bytesperline(r, d), base = firstbyte(r, d);
+	int x, y, k, bit;
+	u32 v, *dp;
+	const u8 *b;
+
+	for (y = r.min.y; y < r.max.y; y++, data += bpl) {
+		dp = pixaddr(i, r.min.x, y);
+		/* The formats we are kept in need no converting */
+		if (i->chan == ARGB32 || i->chan == XRGB32) {
+			memcpy(dp, data, Dx(r) * sizeof(u32));
+			if (i->chan == XRGB32)
+				for (x = 0; x < Dx(r); x++)
+					dp[x] |= 0xff000000;
+			continue;
+		}
+		for (x = r.min.x; x < r.max.x; x++) {
+			bit = x * d - base * 8;
+			b = data + bit / 8;
+			if (d < 8) {
+				v = *b >> (8 - d - bit % 8);
+				v &= (1 << d) - 1;
+			} else {
+				for (v = 0, k = d / 8; k > 0; k--)
+					v = v << 8 | b[k - 1];
+			}
+			*dp++ = topix(i->chan, v);
+		}
+	}
+}
+
+/* Read r of i into data, as p9_memload takes it */
+void p9_memunload(struct p9_memimage *i, struct p9_rect r, u8 *data)
+{
+	int d = p9_chandepth(i->chan);
+	int bpl = p9_bytesperline(r, d), base = firstbyte(r, d);
+	int x, y, k, bit, shift;
+	u32 v, *sp;
+	u8 *b;
+
+	for (y = r.min.y; y < r.max.y; y++, data += bpl) {
+		sp = pixaddr(i, r.min.x, y);
+		if (i->chan == ARGB32 || i->chan == XRGB32) {
+			memcpy(data, sp, Dx(r) * sizeof(u32));
+			continue;
+		}
+		if (d < 8)
+			memset(data, 0, bpl);
+		for (x = r.min.x; x < r.max.x; x++) {
+			v = frompix(i->chan, *sp++);
+			bit = x * d - base * 8;
+			b = data + bit / 8;
+			if (d < 8) {
+				shift = 8 - d - bit % 8;
+				*b |= v << shift;
+			} else {
+				for (k = 0; k < d / 8; k++, v >>= 8)
+					b[k] = v;
+			}
+		}
+	}
+}
+
+static int rectclip(struct p9_rect *r, struct p9_rect b)
+{
+	r->min.x = max(r->min.x, b.min.x);
+	r->min.y = max(r->min.y, b.min.y);
+	r->max.x = min(r->max.x, b.max.x);
+	r->max.y = min(r->max.y, b.max.y);
+	return r->min.x < r->max.x && r->min.y < r->max.y;
+}
+
+/*
+ * Narrow r, drawn with p of i at r.min (and q of the other image), to
+ * what i can supply: all of its clip rectangle if it is replicated,
+ * else the part of that inside it.
+ */
+static int clipsrc(struct p9_rect *r, struct p9_point *p, struct p9_point *q,
+		   struct p9_memimage *i)
+{
+	int dx, dy;
+	struct p9_rect sr;
+
+	sr.min = *p;
+	sr.max.x = p->x + Dx(*r);
+	sr.max.y = p->y + Dy(*r);
+	if (!rectclip(&sr, i->clipr))
+		return 0;
+	if (!i->repl && !rectclip(&sr, i->r))
+		return 0;
+	dx = sr.min.x - p->x;
+	dy = sr.min.y - p->y;
+	r->min.x += dx;
+	r->min.y += dy;
+	r->max.x = r->min.x + Dx(sr);
+	r->max.y = r->min.y + Dy(sr);
+	q->x += dx;
+	q->y += dy;
+	*p = sr.min;
+	return 1;
+}
+
+static int drawclip(struct p9_memimage *dst, struct p9_rect *r,
+		    struct p9_memimage *src, struct p9_point *sp,
+		    struct p9_memimage *mask, struct p9_point *mp)
+{
+	struct p9_rect rr = *r;
+
+	if (!rectclip(&rr, dst->r) || !rectclip(&rr, dst->clipr))
+		return 0;
+	sp->x += rr.min.x - r->min.x;
+	sp->y += rr.min.y - r->min.y;
+	mp->x += rr.min.x - r->min.x;
+	mp->y += rr.min.y - r->min.y;
+	*r = rr;
+	if (!clipsrc(r, sp, mp, src))
+		return 0;
+	return !mask || clipsrc(r, mp, sp, mask);
+}
+
+static inline int wrap(int v, int min, int max)
+{
+	int d = max - min;
+
+	v = (v - min) % d;
+	if (v < 0)
+		v += d;
+	return v + min;
+}
+
+/* The next of w pixels along a row, going by xi, wrapping at its ends */
+static inline int stepx(int x, int xi, int w)
+{
+	x += xi;
+	if (x == w)
+		return 0;
+	if (x < 0)
+		return w - 1;
+	return x;
+}
+
+/* Each channel of p times a/255, two channels a multiply */
+static inline u32 mul(u32 p, u32 a)
+{
+	u32 rb, ag;
+
+	rb = (p & 0x00ff00ff) * a + 0x00800080;
+	rb = ((rb + ((rb >> 8) & 0x00ff00ff)) >> 8) & 0x00ff00ff;
+	ag = ((p >> 8) & 0x00ff00ff) * a + 0x00800080;
+	ag = (ag + ((ag >> 8) & 0x00ff00ff)) & 0xff00ff00;
+	return rb | ag;
+}
+
+/* How much pixel p of mask m lets through */
+static inline u32 maskof(struct p9_memimage *m, u32 p)
+{
+	return m->alpha ? p >> 24 : grey(p);
+}
+
+static inline u32 maskval(struct p9_memimage *m, int x, int y)
+{
+	return maskof(m, *pixaddr(m, x, y));
+}
+
+/* The Porter-Duff operators, from which of their four terms they take */
+static inline u32 compose(int op, u32 s, u32 d)
+{
+	u32 sa = s >> 24, da = d >> 24, fs = 0, fd = 0;
+
+	if (op & P9_SinD)
+		fs += da;
+	if (op & P9_SoutD)
+		fs += 255 - da;
+	if (op & P9_DinS)
+		fd += sa;
+	if (op & P9_DoutS)
+		fd += 255 - sa;
+	return mul(s, fs) + mul(d, fd);
+}
+
+/*
+ * The SSE2 loops take four pixels at a time, each channel widened to a
+ * 16 bit word so that mul's rounding, SSE2_DIV255 here, comes out the
+ * same. They run between kernel_fpu_begin and kernel_fpu_end, and load
+ * the constants they keep in xmm5 to xmm7 each time. The channels of a
+ * premultiplied pixel can't exceed its alpha, so adding them a byte at
+ * a time is the same as mul's adding them a word at a time.
+ */
+static inline int usesse(int n)
+{
+	return n >= SSEMIN && boot_cpu_has(X86_FEATURE_XMM2);
+}
+
+/* xmm0 and xmm1, four pixels' products, to pixels in xmm0 */
+#define SSE2_DIV255				\
+	"paddw %%xmm5,%%xmm0\n\t"		\
+	"paddw %%xmm5,%%xmm1\n\t"		\
+	"movdqa %%xmm0,%%xmm2\n\t"		\
+	"movdqa %%xmm1,%%xmm3\n\t"		\
+	"psrlw $8,%%xmm2\n\t"			\
+	"psrlw $8,%%xmm3\n\t"			\
+	"paddw %%xmm2,%%xmm0\n\t"		\
+	"paddw %%xmm3,%%xmm1\n\t"		\
+	"psrlw $8,%%xmm0\n\t"			\
+	"psrlw $8,%%xmm1\n\t"			\
+	"packuswb %%xmm1,%%xmm0\n\t"
+
+static void sse2_fill(u32 *dp, int n, u32 p)
+{
+	asm volatile("movd %0,%%xmm0\n\t"
+		     "pshufd $0,%%xmm0,%%xmm0" : : "r" (p));
+	for (; n >= 4; n -= 4, dp += 4)
+		asm volatile("movdqu %%xmm0,%0" : "=m" (*(u32 (*)[4])dp));
+	for (; n > 0; n--)
+		*dp++ = p;
+}
+
+/* dp = s + dp(1 - sa), for one colour s */
+static void sse2_over1(u32 *dp, int n, u32 s)
+{
+	u32 na = 255 - (s >> 24);
+
+	asm volatile("pxor %%xmm7,%%xmm7\n\t"
+		     "movd %0,%%xmm4\n\t"
+		     "pshufd $0,%%xmm4,%%xmm4\n\t"
+		     "movd %1,%%xmm5\n\t"
+		     "pshufd $0,%%xmm5,%%xmm5\n\t"
+		     "movd %2,%%xmm6\n\t"
+		     "pshufd $0,%%xmm6,%%xmm6"
+		     : : "r" (s), "r" (0x00800080), "r" (na * 0x00010001));
+	for (; n >= 4; n -= 4, dp += 4)
+		asm volatile("movdqu %0,%%xmm0\n\t"
+			     "movdqa %%xmm0,%%xmm1\n\t"
+			     "punpcklbw %%xmm7,%%xmm0\n\t"
+			     "punpckhbw %%xmm7,%%xmm1\n\t"
+			     "pmullw %%xmm6,%%xmm0\n\t"
+			     "pmullw %%xmm6,%%xmm1\n\t"
+			     SSE2_DIV255
+			     "paddusb %%xmm4,%%xmm0\n\t"
+			     "movdqu %%xmm0,%0"
+			     : "+m" (*(u32 (*)[4])dp));
+	for (; n > 0; n--, dp++)
+		*dp = s + mul(*dp, na);
+}
+
+/* dp = sp + dp(1 - spa), a pixel of sp at a time */
+static void sse2_over(u32 *dp, const u32 *sp, int n)
+{
+	asm volatile("pxor %%xmm7,%%xmm7\n\t"
+		     "movd %0,%%xmm5\n\t"
+		     "pshufd $0,%%xmm5,%%xmm5\n\t"
+		     "movd %1,%%xmm6\n\t"
+		     "pshufd $0,%%xmm6,%%xmm6"
+		     : : "r" (0x00800080), "r" (0x00ff00ff));
+	for (; n >= 4; n -= 4, dp += 4, sp += 4)
+		asm volatile("movdqu %1,%%xmm4\n\t"
+			     "movdqu %0,%%xmm0\n\t"
+			     "movdqa %%xmm0,%%xmm1\n\t"
+			     "punpcklbw %%xmm7,%%xmm0\n\t"
+			     "punpckhbw %%xmm7,%%xmm1\n\t"
+			     /* each pixel's 255 - alpha in all its words */
+			     "movdqa %%xmm4,%%xmm2\n\t"
+			     "movdqa %%xmm4,%%xmm3\n\t"
+			     "punpcklbw %%xmm7,%%xmm2\n\t"
+			     "punpckhbw %%xmm7,%%xmm3\n\t"
+			     "pshuflw $0xff,%%xmm2,%%xmm2\n\t"
+			     "pshufhw $0xff,%%xmm2,%%xmm2\n\t"
+			     "pshuflw $0xff,%%xmm3,%%xmm3\n\t"
+			     "pshufhw $0xff,%%xmm3,%%xmm3\n\t"
+			     "pxor %%xmm6,%%xmm2\n\t"
+			     "pxor %%xmm6,%%xmm3\n\t"
+			     "pmullw %%xmm2,%%xmm0\n\t"
+			     "pmullw %%xmm3,%%xmm1\n\t"
+			     SSE2_DIV255
+			     "paddusb %%xmm4,%%xmm0\n\t"
+			     "movdqu %%xmm0,%0"
+			     : "+m" (*(u32 (*)[4])dp)
+			     : "m" (*(const u32 (*)[4])sp));
+	for (; n > 0; n--, dp++, sp++)
+		*dp = *sp + mul(*dp, 255 - (*sp >> 24));
+}
+
+static void fillrows(struct p9_memimage *dst, struct p9_rect r, u32 p)
+{
+	int x, y, n = Dx(r), sse = usesse(n);
+	u32 *dp = pixaddr(dst, r.min.x, r.min.y);
+
+	for (y = Dy(r); y > 0; y--, dp += dst->width) {
+		if (sse) {
+			kernel_fpu_begin();
+			sse2_fill(dp, n, p);
+			kernel_fpu_end();
+		} else {
+			for (x = 0; x < n; x++)
+				dp[x] = p;
+		}
+		cond_resched();
+	}
+}
+
+/* SoverD of one colour with no mask: the colour's part is constant */
+static void overrows(struct p9_memimage *dst, struct p9_rect r, u32 s)
+{
+	int x, y, n = Dx(r), sse = usesse(n);
+	u32 *dp = pixaddr(dst, r.min.x, r.min.y), na = 255 - (s >> 24);
+
+	for (y = Dy(r); y > 0; y--, dp += dst->width) {
+		if (sse) {
+			kernel_fpu_begin();
+			sse2_over1(dp, n, s);
+			kernel_fpu_end();
+		} else {
+			for (x = 0; x < n; x++)
+				dp[x] = s + mul(dp[x], na);
+		}
+		cond_resched();
+	}
+}
+
+/* SoverD of an image that isn't dst, with no mask */
+static void blendrows(struct p9_memimage *dst, struct p9_rect r,
+		      struct p9_memimage *src, struct p9_point sp)
+{
+	int x, y, n = Dx(r), sse = usesse(n);
+	u32 *dp = pixaddr(dst, r.min.x, r.min.y);
+	u32 *s = pixaddr(src, sp.x, sp.y);
+
+	for (y = Dy(r); y > 0; y--, dp += dst->width, s += src->width) {
+		if (sse) {
+			kernel_fpu_begin();
+			sse2_over(dp, s, n);
+			kernel_fpu_end();
+		} else {
+			for (x = 0; x < n; x++)
+				dp[x] = s[x] + mul(dp[x], 255 - (s[x] >> 24));
+		}
+		cond_resched();
+	}
+}
+
+static void copyrows(struct p9_memimage *dst, struct p9_rect r,
+		     struct p9_memimage *src, struct p9_point sp)
+{
+	int y, n = Dx(r) * sizeof(u32);
+
+	/* Overlapping rows must be taken in the order they are moving */
+	if (dst == src && sp.y < r.min.y) {
+		for (y = Dy(r) - 1; y >= 0; y--) {
+			memmove(pixaddr(dst, r.min.x, r.min.y + y),
+				pixaddr(src, sp.x, sp.y + y), n);
+			cond_resched();
+		}
+	} else {
+		for (y = 0; y < Dy(r); y++) {
+			memmove(pixaddr(dst, r.min.x, r.min.y + y),
+				pixaddr(src, sp.x, sp.y + y), n);
+			cond_resched();
+		}
+	}
+}
+
+/*
+ * Plan 9's draw: combine r of dst with src, lined up so that sp is at
+ * r.min, through mask (lined up by mp) with op. Where the mask is m,
+ * dst becomes m(src op dst) + (1-m)dst. A NULL mask is opaque. Returns
+ * the pixels of dst it covered, once clipped. It may sleep.
+ */
+long p9_memdraw(struct p9_memimage *dst, struct p9_rect r,
+		struct p9_memimage *src, struct p9_point sp,
+		struct p9_memimage *mask, struct p9_point mp, int op)
+{
+	int x, y, sx, sy, mx, my, xi, yi, x0, y0, x1, y1, sw, mw;
+	int solid, overlap;
+	long npix;
+	u32 s, d, m, res, *dp, *srow, *mrow, setalpha;
+
+	if (!drawclip(dst, &r, src, &sp, mask, &mp))
+		return 0;
+	npix = (long)Dx(r) * Dy(r);
+	setalpha = dst->alpha ? 0 : 0xff000000;
+
+	/* A one pixel replicated opaque mask is no mask */
+	if (mask && mask->repl && Dx(mask->r) == 1 && Dy(mask->r) == 1 &&
+	    maskval(mask, mask->r.min.x, mask->r.min.y) == 255)
+		mask = NULL;
+
+	/*
+	 * Without an alpha channel, dst's alpha is 255 in every pixel, and
+	 * SoverD keeps it so: those loops needn't set it.
+	 */
+	solid = src->repl && Dx(src->r) == 1 && Dy(src->r) == 1;
+	if (!mask && solid) {
+		s = *src->data;
+		if (op == P9_S || (op == P9_SoverD && s >> 24 == 255)) {
+			fillrows(dst, r, dst->quant ? quantize(dst, s) :
+				 s | setalpha);
+			return npix;
+		}
+		if (op == P9_SoverD && !dst->quant) {
+			overrows(dst, r, s);
+			return npix;
+		}
+	}
+	if (!mask && op == P9_S && !src->repl &&
+	    (dst->alpha || !src->alpha) &&
+	    (!dst->quant || src->chan == dst->chan)) {
+		copyrows(dst, r, src, sp);
+		return npix;
+	}
+	if (!mask && op == P9_SoverD && !src->repl && src != dst &&
+	    !dst->quant) {
+		blendrows(dst, r, src, sp);
+		return npix;
+	}
+
+	/* Overlapping a copy of itself, go the way it is moving */
+	overlap = dst == src;
+	y0 = 0;
+	y1 = Dy(r);
+	yi = 1;
+	if (overlap && sp.y < r.min.y) {
+		y0 = Dy(r) - 1;
+		y1 = -1;
+		yi = -1;
+	}
+	x0 = 0;
+	x1 = Dx(r);
+	xi = 1;
+	if (overlap && sp.y == r.min.y && sp.x < r.min.x) {
+		x0 = Dx(r) - 1;
+		x1 = -1;
+		xi = -1;
+	}
+
+	/*
+	 * A row at a time: where each image's row starts, and where along
+	 * it we are, stepped (and wrapped, if it is replicated) a pixel at
+	 * a time. A row of an image that isn't replicated never wraps.
+	 */
+	sw = Dx(src->r);
+	mw = mask ? Dx(mask->r) : 0;
+	mrow = NULL;
+	mx = 0;
+	for (y = y0; y != y1; y += yi) {
+		sy = sp.y + y;
+		sx = sp.x + x0;
+		if (src->repl) {
+			sy = wrap(sy, src->r.min.y, src->r.max.y);
+			sx = wrap(sx, src->r.min.x, src->r.max.x);
+		}
+		srow = pixaddr(src, src->r.min.x, sy);
+		sx -= src->r.min.x;
+		if (mask) {
+			my = mp.y + y;
+			mx = mp.x + x0;
+			if (mask->repl) {
+				my = wrap(my, mask->r.min.y, mask->r.max.y);
+				mx = wrap(mx, mask->r.min.x, mask->r.max.x);
+			}
+			mrow = pixaddr(mask, mask->r.min.x, my);
+			mx -= mask->r.min.x;
+		}
+		dp = pixaddr(dst, r.min.x + x0, r.min.y + y);
+		for (x = x0; x != x1; x += xi, dp += xi,
+		     sx = stepx(sx, xi, sw), mx = stepx(mx, xi, mw)) {
+			s = srow[sx];
+			m = 255;
+			if (mask) {
+				m = maskof(mask, mrow[mx]);
+				if (m == 0)
+					continue;
+			}
+			d = *dp;
+			if (op == P9_SoverD) {
+				if (m != 255)
+					s = mul(s, m);
+				res = s + mul(d, 255 - (s >> 24));
+			} else {
+				res = compose(op, s, d);
+				if (m != 255)
+					res = mul(res, m) + mul(d, 255 - m);
+			}
+			*dp = dst->quant ? quantize(dst, res) : res | setalpha;
+		}
+		cond_resched();
+	}
+	return npix;
+}
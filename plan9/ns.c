@@ -0,0 +1,1254 @@
+/*
+ * Copyright (C) 2008 Anant Narayanan <anant@kix.in>
+ * Plan 9 name spaces: bind, unmount and union directories.
+ *
+ * A name space is a mount table consulted by the Plan 9 system calls
+ * as they walk a path. Whenever the walk reaches a directory something
+ * has been bound onto, the next element is looked up in each directory
+ * of the union in turn. Linux itself never sees the table, so it is
+ * private to the Plan 9 processes that share it.
+ *
+ * Walks through a union are remembered in a per name space cache, so
+ * that finding /bin/ls doesn't mean looking in every directory bound
+ * on /bin each time. The cache is flushed by bind and unmount.
+ *
+ * The mount table is not locked while a walk looks in a directory: on a
+ * 9P mount that waits for a server, which may itself be walking in the
+ * same name space behind someone's bind. A walk through a union notes
+ * the table's generation and looks again if it changed meanwhile.
+ *
+ * rfork(RFNAMEG) doesn't copy the mount table: parent and child share
+ * it until one of them changes it with bind or unmount, which makes
+ * its own copy first.
+ */
+#include <linux/fs.h>
+#include <linux/file.h>
+#include <linux/hash.h>
+#include <linux/kref.h>
+#include <linux/slab.h>
+#include <linux/mount.h>
+#include <linux/namei.h>
+#include <linux/sched.h>
+#include <linux/dcache.h>
+#include <linux/rwsem.h>
+#include <linux/string.h>
+#include <linux/seq_file.h>
+#include <linux/fs_struct.h>
+#include <linux/anon_inodes.h>
+
+#include "plan9.h"
+#include "p9_constants.h"
+
+#define NSHASHBITS	5
+#define NCHASHBITS	8
+#define NCMAX		2048	/* cached walks before the cache is flushed */
+#define NSWALKDEPTH	16	/* elements remembered for ".." */
+
+/* A directory (or file) bound onto a mount point */
+struct p9_mount {
+	struct list_head list;
+	struct path path;
+	int flag;
+};
+
+/* Everything bound onto one mount point, in search order */
+struct p9_mhead {
+	struct hlist_node hash;
+	struct path from;
+	struct list_head mounts;
+	int nmounts;
+};
+
+/*
+ * A walk of name through the union at head, which found it in member
+ * number 'member'. It stays good for as long as the members before
+ * that one are unchanged, which stamp records.
+ */
+struct p9_ncache {
+	struct hlist_node hash;
+	struct p9_mhead *head;
+	struct path path;
+	int member;
+	unsigned long stamp;
+	unsigned int nhash;
+	unsigned int len;
+	char name[0];
+};
+
+/* A mount table, shared read only between name spaces copied from one */
+struct p9_mtab {
+	struct kref ref;
+	struct hlist_head heads[1 << NSHASHBITS];
+};
+
+struct p9_ns {
+	struct kref ref;
+	struct rw_semaphore sem;	/* tab and, if we own it, its contents */
+	struct p9_mtab *tab;		/* NULL while nothing is bound */
+	unsigned long gen;		/* changes with the table */
+	spinlock_t clock;		/* the cache */
+	int ncache;
+	struct hlist_head cache[1 << NCHASHBITS];
+};
+
+/* An open union directory, reading each member in turn */
+struct p9_union {
+	struct mutex lock;
+	struct path from;
+	struct file *f;			/* open member, if any */
+	int cur;
+	int nmembers;
+	struct path members[0];
+};
+
+static const struct file_operations p9_union_fops;
+
+static inline struct hlist_head *ns_bucket(struct p9_mtab *tab,
+					   struct path *p)
+{
+	return &tab->heads[hash_ptr(p->dentry, NSHASHBITS)];
+}
+
+struct p9_ns *p9_ns_new(void)
+{
+	int i;
+	struct p9_ns *ns = kzalloc(sizeof(*ns), GFP_KERNEL);
+
+	if (!ns)
+		return NULL;
+	kref_init(&ns->ref);
+	init_rwsem(&ns->sem);
+	spin_lock_init(&ns->clock);
+	for (i = 0; i < (1 << NCHASHBITS); i++)
+		INIT_HLIST_HEAD(&ns->cache[i]);
+	return ns;
+}
+
+struct p9_ns *p9_ns_get(struct p9_ns *ns)
+{
+	kref_get(&ns->ref);
+	return ns;
+}
+
+/*
+ * Empty the walk cache, as the mount table has changed. Called with the
+ * table locked for writing.
+ */
+static void ns_flush(struct p9_ns *ns)
+{
+	int i;
+	struct p9_ncache *c;
+	struct hlist_node *n, *t;
+	HLIST_HEAD(dead);
+
+	ns->gen++;
+	spin_lock(&ns->clock);
+	for (i = 0; i < (1 << NCHASHBITS); i++) {
+		hlist_for_each_entry_safe(c, n, t, &ns->cache[i], hash) {
+			hlist_del(&c->hash);
+			hlist_add_head(&c->hash, &dead);
+		}
+	}
+	ns->ncache = 0;
+	spin_unlock(&ns->clock);
+
+	hlist_for_each_entry_safe(c, n, t, &dead, hash) {
+		path_put(&c->path);
+		kfree(c);
+	}
+}
+
+static void mount_free(struct p9_mount *m)
+{
+	path_put(&m->path);
+	kfree(m);
+}
+
+static void mhead_free(struct p9_mhead *h)
+{
+	struct p9_mount *m, *t;
+
+	list_for_each_entry_safe(m, t, &h->mounts, list)
+		mount_free(m);
+	path_put(&h->from);
+	kfree(h);
+}
+
+static void mtab_free(struct kref *ref)
+{
+	int i;
+	struct p9_mhead *h;
+	struct hlist_node *n, *t;
+	struct p9_mtab *tab = container_of(ref, struct p9_mtab, ref);
+
+	for (i = 0; i < (1 << NSHASHBITS); i++)
+		hlist_for_each_entry_safe(h, n, t, &tab->heads[i], hash)
+			mhead_free(h);
+	kfree(tab);
+}
+
+static void ns_free(struct kref *ref)
+{
+	struct p9_ns *ns = container_of(ref, struct p9_ns, ref);
+
+	ns_flush(ns);
+	if (ns->tab)
+		kref_put(&ns->tab->ref, mtab_free);
+	kfree(ns);
+}
+
+void p9_ns_put(struct p9_ns *ns)
+{
+	kref_put(&ns->ref, ns_free);
+}
+
+static struct p9_mount *mount_alloc(struct path *path, int flag)
+{
+	struct p9_mount *m = kmalloc(sizeof(*m), GFP_KERNEL);
+
+	if (!m)
+		return NULL;
+	m->path = *path;
+	path_get(&m->path);
+	m->flag = flag;
+	return m;
+}
+
+static struct p9_mhead *mhead_alloc(struct path *from)
+{
+	struct p9_mhead *h = kmalloc(sizeof(*h), GFP_KERNEL);
+
+	if (!h)
+		return NULL;
+	INIT_HLIST_NODE(&h->hash);
+	INIT_LIST_HEAD(&h->mounts);
+	h->nmounts = 0;
+	h->from = *from;
+	path_get(&h->from);
+	return h;
+}
+
+static struct p9_mtab *mtab_alloc(void)
+{
+	int i;
+	struct p9_mtab *tab = kmalloc(sizeof(*tab), GFP_KERNEL);
+
+	if (!tab)
+		return NULL;
+	kref_init(&tab->ref);
+	for (i = 0; i < (1 << NSHASHBITS); i++)
+		INIT_HLIST_HEAD(&tab->heads[i]);
+	return tab;
+}
+
+static struct p9_mtab *mtab_copy(struct p9_mtab *tab)
+{
+	int i;
+	struct p9_mount *m, *nm;
+	struct p9_mhead *h, *nh;
+	struct hlist_node *n;
+	struct p9_mtab *new = mtab_alloc();
+
+	if (!new)
+		return NULL;
+
+	for (i = 0; i < (1 << NSHASHBITS); i++) {
+		hlist_for_each_entry(h, n, &tab->heads[i], hash) {
+			nh = mhead_alloc(&h->from);
+			if (!nh)
+				goto nomem;
+			hlist_add_head(&nh->hash, &new->heads[i]);
+			list_for_each_entry(m, &h->mounts, list) {
+				nm = mount_alloc(&m->path, m->flag);
+				if (!nm)
+					goto nomem;
+				list_add_tail(&nm->list, &nh->mounts);
+				nh->nmounts++;
+			}
+		}
+	}
+	return new;
+
+nomem:
+	kref_put(&new->ref, mtab_free);
+	return NULL;
+}
+
+/*
+ * Make the mount table of ns its own, so that it can be changed.
+ * Called with ns->sem held for writing; nobody else can be looking at
+ * a table only we hold.
+ */
+static struct p9_mtab *ns_writable(struct p9_ns *ns)
+{
+	struct p9_mtab *tab = ns->tab;
+
+	if (tab && atomic_read(&tab->ref.refcount) == 1)
+		return tab;
+
+	tab = tab ? mtab_copy(ns->tab) : mtab_alloc();
+	if (!tab)
+		return NULL;
+	if (ns->tab)
+		kref_put(&ns->tab->ref, mtab_free);
+	ns->tab = tab;
+	/* The cache points into the old table */
+	ns_flush(ns);
+	return tab;
+}
+
+/* A copy of ns, as for rfork(RFNAMEG). The mount table is shared */
+struct p9_ns *p9_ns_copy(struct p9_ns *ns)
+{
+	struct p9_ns *new = p9_ns_new();
+
+	if (!new)
+		return NULL;
+
+	down_read(&ns->sem);
+	if (ns->tab) {
+		kref_get(&ns->tab->ref);
+		new->tab = ns->tab;
+	}
+	up_read(&ns->sem);
+	return new;
+}
+
+/* The union mounted on path, if any. The mount table must be locked */
+static struct p9_mhead *ns_head(struct p9_ns *ns, struct path *path)
+{
+	struct p9_mhead *h;
+	struct hlist_node *n;
+
+	if (!ns->tab)
+		return NULL;
+	hlist_for_each_entry(h, n, ns_bucket(ns->tab, path), hash)
+		if (h->from.dentry == path->dentry && h->from.mnt == path->mnt)
+			return h;
+	return NULL;
+}
+
+static struct p9_mount *mhead_first(struct p9_mhead *h)
+{
+	return list_first_entry(&h->mounts, struct p9_mount, list);
+}
+
+/*
+ * Fingerprint the directories of h before member number upto. Returns
+ * 0 if one changed during the current second, since on file systems
+ * with coarse times a second change in the same second wouldn't show.
+ */
+static int ns_stamp(struct p9_mhead *h, int upto, unsigned long *stamp)
+{
+	int i = 0;
+	struct inode *inode;
+	struct p9_mount *m;
+	unsigned long s = 0, now = get_seconds();
+
+	list_for_each_entry(m, &h->mounts, list) {
+		if (i++ == upto)
+			break;
+		inode = m->path.dentry->d_inode;
+		if (inode->i_mtime.tv_sec >= now || inode->i_ctime.tv_sec >= now)
+			return 0;
+		s = s * 31 + inode->i_mtime.tv_sec;
+		s = s * 31 + inode->i_mtime.tv_nsec;
+		s = s * 31 + inode->i_ctime.tv_nsec;
+	}
+	*stamp = s;
+	return 1;
+}
+
+/* A walk through h remembered, and the member of h it found name in */
+static int ncache_lookup(struct p9_ns *ns, struct p9_mhead *h,
+			 const char *name, unsigned int len,
+			 unsigned int nhash, struct path *res, int *member)
+{
+	unsigned long stamp;
+	struct p9_ncache *c;
+	struct hlist_node *n;
+	struct hlist_head *b = &ns->cache[hash_long(nhash ^
+				hash_ptr(h, NCHASHBITS), NCHASHBITS)];
+
+	spin_lock(&ns->clock);
+	hlist_for_each_entry(c, n, b, hash) {
+		if (c->head != h || c->nhash != nhash || c->len != len ||
+		    memcmp(c->name, name, len))
+			continue;
+		if (d_unhashed(c->path.dentry) || !c->path.dentry->d_inode ||
+		    !ns_stamp(h, c->member, &stamp) || stamp != c->stamp)
+			break;
+		*res = c->path;
+		path_get(res);
+		*member = c->member;
+		spin_unlock(&ns->clock);
+		return 1;
+	}
+	spin_unlock(&ns->clock);
+	return 0;
+}
+
+static void ncache_enter(struct p9_ns *ns, struct p9_mhead *h,
+			 const char *name, unsigned int len,
+			 unsigned int nhash, int member, struct path *path)
+{
+	struct p9_ncache *c, *old;
+	struct hlist_node *n, *t;
+	struct hlist_head *b = &ns->cache[hash_long(nhash ^
+				hash_ptr(h, NCHASHBITS), NCHASHBITS)];
+
+	c = kmalloc(sizeof(*c) + len, GFP_KERNEL);
+	if (!c)
+		return;
+	if (!ns_stamp(h, member, &c->stamp)) {
+		kfree(c);
+		return;
+	}
+	c->head = h;
+	c->member = member;
+	c->nhash = nhash;
+	c->len = len;
+	memcpy(c->name, name, len);
+	c->path = *path;
+	path_get(&c->path);
+
+	spin_lock(&ns->clock);
+	/* Replace a stale entry for the same name */
+	hlist_for_each_entry_safe(old, n, t, b, hash) {
+		if (old->head == h && old->nhash == nhash && old->len == len &&
+		    !memcmp(old->name, name, len)) {
+			hlist_del(&old->hash);
+			ns->ncache--;
+			hlist_add_head(&c->hash, b);
+			ns->ncache++;
+			spin_unlock(&ns->clock);
+			path_put(&old->path);
+			kfree(old);
+			return;
+		}
+	}
+	if (ns->ncache >= NCMAX) {
+		spin_unlock(&ns->clock);
+		path_put(&c->path);
+		kfree(c);
+		return;
+	}
+	hlist_add_head(&c->hash, b);
+	ns->ncache++;
+	spin_unlock(&ns->clock);
+}
+
+/*
+ * A symbolic link is left to Linux to resolve: rebuild the path of
+ * the element and look it up from the top.
+ */
+static int lookup_link(struct path *dir, const char *name, unsigned int len,
+		       struct path *res)
+{
+	int error;
+	char *buf, *p;
+	struct nameidata nd;
+
+	buf = __getname();
+	if (!buf)
+		return -ENOMEM;
+	p = d_path(dir, buf, PATH_MAX - len - 1);
+	error = PTR_ERR(p);
+	if (IS_ERR(p))
+		goto out;
+	p[strlen(p)] = '/';
+	memcpy(buf + PATH_MAX - len - 1, name, len);
+	buf[PATH_MAX - 1] = '\0';
+
+	error = path_lookup(p, LOOKUP_FOLLOW, &nd);
+	if (!error)
+		*res = nd.path;
+out:
+	__putname(buf);
+	return error;
+}
+
+/* Look up a single element in a directory, crossing Linux mounts */
+static int lookup1(struct path *dir, const char *name, unsigned int len,
+		   struct path *res)
+{
+	int error;
+	struct qstr q;
+	struct dentry *dentry;
+	struct inode *inode = dir->dentry->d_inode;
+
+	if (!S_ISDIR(inode->i_mode))
+		return -ENOTDIR;
+	error = inode_permission(inode, MAY_EXEC);
+	if (error)
+		return error;
+
+	/* Try the dcache before taking the directory's lock */
+	dentry = NULL;
+	if (!dir->dentry->d_op || !dir->dentry->d_op->d_hash) {
+		q.name = name;
+		q.len = len;
+		q.hash = full_name_hash(name, len);
+		dentry = d_lookup(dir->dentry, &q);
+		if (dentry && dentry->d_op && dentry->d_op->d_revalidate) {
+			dput(dentry);
+			dentry = NULL;
+		}
+	}
+	if (!dentry) {
+		mutex_lock(&inode->i_mutex);
+		dentry = lookup_one_len(name, dir->dentry, len);
+		mutex_unlock(&inode->i_mutex);
+		if (IS_ERR(dentry))
+			return PTR_ERR(dentry);
+	}
+	if (!dentry->d_inode) {
+		dput(dentry);
+		return -ENOENT;
+	}
+	if (S_ISLNK(dentry->d_inode->i_mode)) {
+		dput(dentry);
+		return lookup_link(dir, name, len, res);
+	}
+
+	res->dentry = dentry;
+	res->mnt = mntget(dir->mnt);
+	while (d_mountpoint(res->dentry) && follow_down(res))
+		;
+	return 0;
+}
+
+/*
+ * Whether the cached walk through member number i of h may be taken
+ * by us: the directory must be searchable with our credentials, as
+ * lookup1 would have checked.
+ */
+static int ncache_permitted(struct p9_mhead *h, int i)
+{
+	struct p9_mount *m;
+
+	list_for_each_entry(m, &h->mounts, list)
+		if (i-- == 0)
+			return !inode_permission(m->path.dentry->d_inode,
+						 MAY_EXEC);
+	return 0;
+}
+
+/*
+ * Look up a single element of a walk in cur: in each member of the
+ * union bound there in turn, if there is one. The mount table is only
+ * locked while we look at it, never during a lookup.
+ */
+static int ns_walk1(struct p9_ns *ns, struct path *cur, const char *name,
+		    unsigned int len, struct path *res)
+{
+	int i, n, found, error, e;
+	unsigned long gen;
+	struct p9_mhead *h;
+	struct p9_mount *m;
+	struct path *members;
+	unsigned int nhash = full_name_hash(name, len);
+
+again:
+	down_read(&ns->sem);
+	h = ns_head(ns, cur);
+	if (!h) {
+		up_read(&ns->sem);
+		return lookup1(cur, name, len, res);
+	}
+	if (ncache_lookup(ns, h, name, len, nhash, res, &i)) {
+		if (ncache_permitted(h, i)) {
+			up_read(&ns->sem);
+			return 0;
+		}
+		path_put(res);
+	}
+
+	/* What is bound there now, to look in without the lock */
+	gen = ns->gen;
+	n = h->nmounts;
+	members = kmalloc(n * sizeof(*members), GFP_KERNEL);
+	if (!members) {
+		up_read(&ns->sem);
+		return -ENOMEM;
+	}
+	i = 0;
+	list_for_each_entry(m, &h->mounts, list) {
+		members[i] = m->path;
+		path_get(&members[i++]);
+	}
+	up_read(&ns->sem);
+
+	error = -ENOENT;
+	found = -1;
+	for (i = 0; i < n; i++) {
+		e = lookup1(&members[i], name, len, res);
+		if (e == 0) {
+			found = i;
+			break;
+		}
+		if (error == -ENOENT)
+			error = e;
+	}
+	for (i = 0; i < n; i++)
+		path_put(&members[i]);
+	kfree(members);
+
+	down_read(&ns->sem);
+	if (ns->gen != gen) {
+		/* Rebound while we looked, so h may be gone */
+		up_read(&ns->sem);
+		if (found >= 0)
+			path_put(res);
+		goto again;
+	}
+	if (found >= 0) {
+		ncache_enter(ns, h, name, len, nhash, found, res);
+		error = 0;
+	}
+	up_read(&ns->sem);
+	return error;
+}
+
+/* Step up to the parent of cur, the way Linux does for ".." */
+static void dotdot(struct path *cur)
+{
+	struct dentry *parent;
+	struct path root;
+
+	read_lock(&current->fs->lock);
+	root = current->fs->root;
+	path_get(&root);
+	read_unlock(&current->fs->lock);
+
+	for (;;) {
+		if (cur->dentry == root.dentry && cur->mnt == root.mnt)
+			break;
+		if (cur->dentry != cur->mnt->mnt_root) {
+			parent = dget_parent(cur->dentry);
+			dput(cur->dentry);
+			cur->dentry = parent;
+			break;
+		}
+		if (!follow_up(cur))
+			break;
+	}
+	path_put(&root);
+}
+
+/*
+ * Walk name through the current process's name space. With P9_PARENT
+ * the walk stops short of the last element, which is returned in
+ * last; if the parent is a union, the result is the first member that
+ * allows creation. ".." goes back the way the walk came, so it leaves
+ * a union the way it was entered.
+ */
+int p9_namei(char *name, int flags, struct path *res, char **last)
+{
+	int error, depth = 0;
+	char *p, *e, *n;
+	unsigned int len;
+	struct p9_ns *ns;
+	struct p9_mhead *h;
+	struct p9_mount *m;
+	struct p9_proc *proc = p9_proc();
+	struct path cur, next, stack[NSWALKDEPTH];
+
+	if (!proc)
+		return -ENOMEM;
+	ns = proc->ns;
+
+	if (*name == '#') {
+		error = p9_devattach(&name, &cur);
+		if (error)
+			return error;
+	} else {
+		read_lock(&current->fs->lock);
+		cur = (*name == '/') ? current->fs->root : current->fs->pwd;
+		path_get(&cur);
+		read_unlock(&current->fs->lock);
+	}
+	if (last)
+		*last = NULL;
+
+	for (p = name; ; p = e) {
+		while (*p == '/')
+			p++;
+		if (*p == '\0')
+			break;
+		for (e = p; *e && *e != '/'; e++)
+			;
+		len = e - p;
+
+		if (flags & P9_PARENT) {
+			for (n = e; *n == '/'; n++)
+				;
+			if (*n == '\0') {
+				*last = p;
+				break;
+			}
+		}
+
+		if (len == 1 && p[0] == '.')
+			continue;
+		if (len == 2 && p[0] == '.' && p[1] == '.') {
+			if (depth > 0) {
+				path_put(&cur);
+				cur = stack[--depth];
+			} else {
+				dotdot(&cur);
+			}
+			continue;
+		}
+
+		error = -ENAMETOOLONG;
+		if (len > NAME_MAX)
+			goto out;
+		error = ns_walk1(ns, &cur, p, len, &next);
+		if (error)
+			goto out;
+
+		if (depth == NSWALKDEPTH) {
+			path_put(&stack[0]);
+			memmove(stack, stack + 1,
+				(NSWALKDEPTH - 1) * sizeof(stack[0]));
+			depth--;
+		}
+		stack[depth++] = cur;
+		cur = next;
+	}
+
+	down_read(&ns->sem);
+	h = ns_head(ns, &cur);
+	if (h && (flags & P9_PARENT)) {
+		error = -EACCES;
+		list_for_each_entry(m, &h->mounts, list)
+			if (m->flag & MCREATE)
+				break;
+		if (&m->list == &h->mounts) {
+			up_read(&ns->sem);
+			goto out;
+		}
+		next = m->path;
+		path_get(&next);
+		path_put(&cur);
+		cur = next;
+	} else if (h && (flags & P9_MOUNTED)) {
+		next = mhead_first(h)->path;
+		path_get(&next);
+		path_put(&cur);
+		cur = next;
+	}
+	up_read(&ns->sem);
+	*res = cur;
+	error = 0;
+
+out:
+	while (depth > 0)
+		path_put(&stack[--depth]);
+	if (error)
+		path_put(&cur);
+	return error;
+}
+
+static int accmode(int flags)
+{
+	switch (flags & O_ACCMODE) {
+	case O_WRONLY:
+		return MAY_WRITE;
+	case O_RDWR:
+		return MAY_READ | MAY_WRITE;
+	}
+	return MAY_READ;
+}
+
+static int p9_union_release(struct inode *inode, struct file *filp)
+{
+	int i;
+	struct p9_union *u = filp->private_data;
+
+	if (u->f)
+		fput(u->f);
+	for (i = 0; i < u->nmembers; i++)
+		path_put(&u->members[i]);
+	path_put(&u->from);
+	kfree(u);
+	return 0;
+}
+
+static const struct file_operations p9_union_fops = {
+	.release	= p9_union_release,
+	.llseek		= no_llseek,
+};
+
+/* The mount point of an open union directory, or NULL */
+struct path *p9_ns_union(struct file *filp)
+{
+	if (filp->f_op != &p9_union_fops)
+		return NULL;
+	return &((struct p9_union *)filp->private_data)->from;
+}
+
+/* Snapshot the members of a union for reading */
+static struct file *union_open(struct p9_mhead *h, int flags)
+{
+	int i = 0;
+	struct file *f;
+	struct p9_union *u;
+	struct p9_mount *m;
+
+	if ((flags & O_ACCMODE) != O_RDONLY)
+		return ERR_PTR(-EISDIR);
+
+	u = kmalloc(sizeof(*u) + h->nmounts * sizeof(struct path),
+		    GFP_KERNEL);
+	if (!u)
+		return ERR_PTR(-ENOMEM);
+	mutex_init(&u->lock);
+	u->from = h->from;
+	path_get(&u->from);
+	u->f = NULL;
+	u->cur = 0;
+	list_for_each_entry(m, &h->mounts, list) {
+		u->members[i] = m->path;
+		path_get(&u->members[i++]);
+	}
+	u->nmembers = i;
+
+	f = anon_inode_getfile("[9union]", &p9_union_fops, u, flags);
+	if (IS_ERR(f)) {
+		while (i > 0)
+			path_put(&u->members[--i]);
+		path_put(&u->from);
+		kfree(u);
+	}
+	return f;
+}
+
+/*
+ * Open a file found by p9_namei. A directory with more than one
+ * thing bound onto it opens as a union.
+ */
+struct file *p9_ns_open(struct path *path, int flags)
+{
+	int error;
+	struct file *f;
+	struct path target;
+	struct p9_mhead *h;
+	struct p9_proc *proc = p9_proc();
+
+	if (!proc)
+		return ERR_PTR(-ENOMEM);
+
+	down_read(&proc->ns->sem);
+	h = ns_head(proc->ns, path);
+	if (h && h->nmounts > 1 &&
+	    S_ISDIR(mhead_first(h)->path.dentry->d_inode->i_mode)) {
+		f = union_open(h, flags);
+		up_read(&proc->ns->sem);
+		return f;
+	}
+	target = h ? mhead_first(h)->path : *path;
+	path_get(&target);
+	up_read(&proc->ns->sem);
+
+	/* '#d/n' is fd n itself */
+	if (p9_dup_isdup(&target)) {
+		f = p9_dup_open(&target, flags);
+		path_put(&target);
+		return f;
+	}
+
+	/* '#s/name' is the file posted there */
+	if (p9_srv_issrv(&target)) {
+		f = p9_srv_open(&target, flags);
+		path_put(&target);
+		return f;
+	}
+
+	/* may_open truncates, which needs the mount writable */
+	if (flags & O_TRUNC) {
+		error = mnt_want_write(target.mnt);
+		if (error) {
+			path_put(&target);
+			return ERR_PTR(error);
+		}
+	}
+	error = may_open(&target, accmode(flags), flags);
+	if (flags & O_TRUNC)
+		mnt_drop_write(target.mnt);
+	if (error) {
+		path_put(&target);
+		return ERR_PTR(error);
+	}
+	f = dentry_open(target.dentry, target.mnt, flags, current_cred());
+	if (!IS_ERR(f))
+		p9_mnt_revalidate(f);
+	return f;
+}
+
+/*
+ * Create name in dir, which p9_namei returned for P9_PARENT. As in
+ * Plan 9, creating an existing file truncates it, and the permissions
+ * of a new file are limited by those of its directory.
+ */
+struct file *p9_ns_create(struct path *dir, char *name, int flags,
+			  unsigned long perm)
+{
+	int error, mode, created = 0;
+	unsigned int len;
+	struct path path;
+	struct dentry *dentry;
+	struct inode *inode = dir->dentry->d_inode;
+
+	for (len = 0; name[len] && name[len] != '/'; len++)
+		;
+	if ((len == 1 && name[0] == '.') ||
+	    (len == 2 && name[0] == '.' && name[1] == '.'))
+		return ERR_PTR(-EEXIST);
+	if (perm & DMDIR)
+		flags = (flags & ~(O_ACCMODE | O_TRUNC)) | O_RDONLY;
+
+	error = mnt_want_write(dir->mnt);
+	if (error)
+		return ERR_PTR(error);
+
+	mutex_lock_nested(&inode->i_mutex, I_MUTEX_PARENT);
+	dentry = lookup_one_len(name, dir->dentry, len);
+	if (IS_ERR(dentry)) {
+		mutex_unlock(&inode->i_mutex);
+		error = PTR_ERR(dentry);
+		goto out;
+	}
+	if (!dentry->d_inode) {
+		if (perm & DMDIR) {
+			mode = perm & (~0777 | (inode->i_mode & 0777)) & 0777;
+			error = vfs_mkdir(inode, dentry, mode);
+		} else {
+			mode = perm & (~0666 | (inode->i_mode & 0666)) & 0777;
+			error = vfs_create(inode, dentry, S_IFREG | mode, NULL);
+		}
+		created = 1;
+		flags &= ~O_TRUNC;
+	} else if (perm & DMDIR) {
+		error = -EEXIST;
+	}
+	mutex_unlock(&inode->i_mutex);
+	if (error) {
+		dput(dentry);
+		goto out;
+	}
+
+	path.dentry = dentry;
+	path.mnt = mntget(dir->mnt);
+	if (!created) {
+		error = may_open(&path, accmode(flags), flags);
+		if (error) {
+			path_put(&path);
+			goto out;
+		}
+	}
+	mnt_drop_write(dir->mnt);
+	return dentry_open(path.dentry, path.mnt, flags, current_cred());
+
+out:
+	mnt_drop_write(dir->mnt);
+	return ERR_PTR(error);
+}
+
+/*
+ * Remove the file at path, which p9_namei returned, directory or not.
+ * It goes from its own parent, whichever member of a union it was
+ * found in. The root of a mount or device has no parent to go from.
+ */
+int p9_ns_remove(struct path *path)
+{
+	int error;
+	struct dentry *dir, *dentry = path->dentry;
+
+	if (dentry == path->mnt->mnt_root)
+		return -EBUSY;
+	error = mnt_want_write(path->mnt);
+	if (error)
+		return error;
+
+	dir = dget_parent(dentry);
+	mutex_lock_nested(&dir->d_inode->i_mutex, I_MUTEX_PARENT);
+	/* It may have been renamed or removed since the walk */
+	if (dentry->d_parent != dir || d_unhashed(dentry) ||
+	    !dentry->d_inode)
+		error = -ENOENT;
+	else if (S_ISDIR(dentry->d_inode->i_mode))
+		error = vfs_rmdir(dir->d_inode, dentry);
+	else
+		error = vfs_unlink(dir->d_inode, dentry);
+	mutex_unlock(&dir->d_inode->i_mutex);
+	dput(dir);
+
+	mnt_drop_write(path->mnt);
+	return error;
+}
+
+/*
+ * pread on an open union: the members' entries one after the other.
+ * Members that can't be read are skipped, like Plan 9 does.
+ */
+long p9_ns_dirread(struct file *filp, char __user *buf, size_t count,
+		   int rewind)
+{
+	int full = 0;
+	long n, used = 0;
+	struct path *m;
+	struct p9_union *u = filp->private_data;
+
+	if (mutex_lock_interruptible(&u->lock))
+		return -ERESTARTSYS;
+	if (rewind) {
+		if (u->f)
+			fput(u->f);
+		u->f = NULL;
+		u->cur = 0;
+	}
+
+	while (u->cur < u->nmembers && used < count) {
+		if (!u->f) {
+			m = &u->members[u->cur];
+			if (may_open(m, MAY_READ, O_RDONLY)) {
+				u->cur++;
+				continue;
+			}
+			path_get(m);
+			u->f = dentry_open(m->dentry, m->mnt,
+					   O_RDONLY | O_LARGEFILE, current_cred());
+			if (IS_ERR(u->f)) {
+				u->f = NULL;
+				u->cur++;
+				continue;
+			}
+		}
+		n = p9_readdir(u->f, buf + used, count - used, &full);
+		if (n < 0) {
+			if (used == 0)
+				used = n;
+			break;
+		}
+		used += n;
+		if (full)
+			break;
+		fput(u->f);
+		u->f = NULL;
+		u->cur++;
+	}
+	mutex_unlock(&u->lock);
+	return used;
+}
+
+/*
+ * Bind new onto old. If new is a union itself, what is bound is the
+ * list of its members as they are now.
+ */
+int p9_bind(struct path *new, struct path *old, int flag)
+{
+	int error = 0;
+	LIST_HEAD(add);
+	struct p9_ns *ns;
+	struct p9_mtab *tab;
+	struct p9_mhead *h, *nh;
+	struct p9_mount *m, *t;
+	struct p9_proc *proc = p9_proc();
+
+	if (!proc)
+		return -ENOMEM;
+	ns = proc->ns;
+
+	if ((flag & ~MMASK) || (flag & MORDER) == MORDER)
+		return -EINVAL;
+	if (!S_ISDIR(new->dentry->d_inode->i_mode) !=
+	    !S_ISDIR(old->dentry->d_inode->i_mode))
+		return -ENOTDIR;
+	if (!S_ISDIR(old->dentry->d_inode->i_mode) &&
+	    (flag & MORDER) != MREPL)
+		return -EINVAL;
+
+	down_write(&ns->sem);
+
+	/* What we are going to add, in order */
+	nh = ns_head(ns, new);
+	if (nh) {
+		list_for_each_entry(m, &nh->mounts, list) {
+			t = mount_alloc(&m->path, flag & MCREATE);
+			if (!t)
+				goto nomem;
+			list_add_tail(&t->list, &add);
+		}
+	} else {
+		t = mount_alloc(new, flag & MCREATE);
+		if (!t)
+			goto nomem;
+		list_add_tail(&t->list, &add);
+	}
+
+	tab = ns_writable(ns);
+	if (!tab)
+		goto nomem;
+	h = ns_head(ns, old);
+	if (!h) {
+		h = mhead_alloc(old);
+		if (!h)
+			goto nomem;
+		/* Binding before or after keeps what was there */
+		if ((flag & MORDER) != MREPL) {
+			t = mount_alloc(old, 0);
+			if (!t) {
+				mhead_free(h);
+				goto nomem;
+			}
+			list_add(&t->list, &h->mounts);
+			h->nmounts++;
+		}
+		hlist_add_head(&h->hash, ns_bucket(tab, old));
+	}
+
+	switch (flag & MORDER) {
+	case MREPL:
+		list_for_each_entry_safe(m, t, &h->mounts, list) {
+			list_del(&m->list);
+			mount_free(m);
+		}
+		h->nmounts = 0;
+		/* fall through */
+	case MAFTER:
+		list_for_each_entry_safe(m, t, &add, list) {
+			list_move_tail(&m->list, &h->mounts);
+			h->nmounts++;
+		}
+		break;
+	case MBEFORE:
+		list_for_each_entry_safe_reverse(m, t, &add, list) {
+			list_move(&m->list, &h->mounts);
+			h->nmounts++;
+		}
+		break;
+	}
+	ns_flush(ns);
+	up_write(&ns->sem);
+	return 0;
+
+nomem:
+	error = -ENOMEM;
+	list_for_each_entry_safe(m, t, &add, list)
+		mount_free(m);
+	up_write(&ns->sem);
+	return error;
+}
+
+/*
+ * Undo binds onto old: all of them, or just the one of new if it is
+ * given.
+ */
+int p9_unmount(struct path *new, struct path *old)
+{
+	int error = 0;
+	struct p9_ns *ns;
+	struct p9_mhead *h;
+	struct p9_mount *m, *t;
+	struct p9_proc *proc = p9_proc();
+
+	if (!proc)
+		return -ENOMEM;
+	ns = proc->ns;
+
+	down_write(&ns->sem);
+	error = -EINVAL;
+	if (!ns_head(ns, old))
+		goto out;
+	error = -ENOMEM;
+	if (!ns_writable(ns))
+		goto out;
+	h = ns_head(ns, old);
+	error = 0;
+	if (new) {
+		error = -ENOENT;
+		list_for_each_entry_safe(m, t, &h->mounts, list) {
+			if (m->path.dentry == new->dentry &&
+			    m->path.mnt == new->mnt) {
+				list_del(&m->list);
+				mount_free(m);
+				h->nmounts--;
+				error = 0;
+				break;
+			}
+		}
+	}
+	if (!new || h->nmounts == 0) {
+		hlist_del(&h->hash);
+		ns_flush(ns);
+		mhead_free(h);
+		goto out;
+	}
+	ns_flush(ns);
+out:
+	up_write(&ns->sem);
+	return error;
+}
+
+/* s quoted for rc, as Plan 9's %q would */
+static void ns_quote(struct seq_file *m, const char *s)
+{
+	seq_putc(m, '\'');
+	for (; *s; s++) {
+		if (*s == '\'')
+			seq_putc(m, '\'');
+		seq_putc(m, *s);
+	}
+	seq_putc(m, '\'');
+}
+
+/*
+ * Print ns as the binds that would make it again, for /proc/n/ns:
+ * each union as a bind of its first member and a bind -a of each of
+ * the others.
+ */
+void p9_ns_show(struct seq_file *m, struct p9_ns *ns)
+{
+	int i, first;
+	char *nbuf, *obuf, *new, *old;
+	struct p9_mhead *h;
+	struct p9_mount *mt;
+	struct hlist_node *n;
+
+	nbuf = __getname();
+	obuf = __getname();
+	if (!nbuf || !obuf)
+		goto out;
+
+	down_read(&ns->sem);
+	for (i = 0; ns->tab && i < (1 << NSHASHBITS); i++) {
+		hlist_for_each_entry(h, n, &ns->tab->heads[i], hash) {
+			old = p9_devpath(&h->from, obuf, PATH_MAX);
+			if (IS_ERR(old))
+				continue;
+			first = 1;
+			list_for_each_entry(mt, &h->mounts, list) {
+				new = p9_devpath(&mt->path, nbuf, PATH_MAX);
+				if (IS_ERR(new))
+					continue;
+				seq_puts(m, "bind ");
+				if (!first || (mt->flag & MCREATE))
+					seq_printf(m, "-%s%s ", first ? "" : "a",
+						   (mt->flag & MCREATE) ? "c" : "");
+				ns_quote(m, new);
+				seq_putc(m, ' ');
+				ns_quote(m, old);
+				seq_putc(m, '\n');
+				first = 0;
+			}
+		}
+	}
+	up_read(&ns->sem);
+out:
+	if (nbuf)
+		__putname(nbuf);
+	if (obuf)
+		__putname(obuf);
+}
@@ -1,6 +1,8 @@
 /*
  * Plan 9 constants
  */
+#ifndef _PLAN9_P9_CONSTANTS_H
+#define _PLAN9_P9_CONSTANTS_H
 
 /* rfork */
 #define RFNAMEG		1
@@ -16,3 +18,52 @@
 #define RFREND		8192
 #define RFNOMNT		16384
 
+/* bind and mount */
+#define MREPL		0x0000
+#define MBEFORE		0x0001
+#define MAFTER		0x0002
+#define MORDER		0x0003
+#define MCREATE		0x0004
+#define MCACHE		0x0010
+#define MMASK		0x0017
+
+
+/* errstr */
+#define ERRMAX		128
+
+/* Dir.mode bits */
+#define DMDIR		0x80000000
+#define DMAPPEND	0x40000000
+#define DMEXCL		0x20000000
+#define DMMOUNT		0x10000000
+#define DMAUTH		0x08000000
+#define DMTMP		0x04000000
+
+/* Qid.type bits */
+#define QTDIR		0x80
+#define QTAPPEND	0x40
+#define QTEXCL		0x20
+#define QTMOUNT		0x10
+#define QTAUTH		0x08
+#define QTTMP		0x04
+#define QTFILE		0x00
+
+/* Sizes in the machine independent Dir encoding */
+#define BIT8SZ		1
+#define BIT16SZ		2
+#define BIT32SZ		4
+#define BIT64SZ		8
+#define QIDSZ		(BIT8SZ + BIT32SZ + BIT64SZ)
+#define STATFIXLEN	(BIT16SZ + QIDSZ + 5 * BIT16SZ + 4 * BIT32SZ + BIT64SZ)
+#define STATMAX		65535
+
+/* open */
+#define OREAD		0
+#define OWRITE		1
+#define ORDWR		2
+#define OEXEC		3
+#define OTRUNC		16
+#define OCEXEC		32
+#define ORCLOSE		64
+
+#endif /* _PLAN9_P9_CONSTANTS_H */
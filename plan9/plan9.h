@@ -0,0 +1,238 @@
+/*
+ * Copyright (C) 2008 Anant Narayanan <anant@kix.in>
+ * Interfaces shared between the Plan 9 support files
+ */
+#ifndef _PLAN9_PLAN9_H
+#define _PLAN9_PLAN9_H
+
+#include <linux/fs.h>
+#include <linux/path.h>
+#include <linux/stat.h>
+#include <linux/types.h>
+#include <linux/list.h>
+#include <linux/rcupdate.h>
+
+#include "p9_constants.h"
+
+struct p9_qid {
+	u8 type;
+	u32 vers;
+	u64 path;
+};
+
+/*
+ * Unpacked form of a Plan 9 Dir. Strings are not NUL terminated;
+ * a NULL string with a zero length means "don't touch" in wstat.
+ */
+struct p9_dir {
+	u16 type;
+	u32 dev;
+	struct p9_qid qid;
+	u32 mode;
+	u32 atime;
+	u32 mtime;
+	u64 length;
+	const char *name;
+	unsigned int namelen;
+	const char *uid;
+	unsigned int uidlen;
+	const char *gid;
+	unsigned int gidlen;
+	const char *muid;
+	unsigned int muidlen;
+	/* numeric owners, used when uid/gid are NULL */
+	uid_t nuid;
+	gid_t ngid;
+};
+
+struct p9_ns;
+struct p9_egrp;
+struct seq_file;
+struct mm_struct;
+
+/* Plan 9 state of a process, see proc.c */
+struct p9_proc {
+	struct hlist_node hash;
+	struct task_struct *task;
+	pid_t pid;
+	struct p9_ns *ns;
+	struct p9_egrp *egrp;		/* environment group */
+	struct list_head pending;	/* children rfork has set up */
+	struct list_head plist;		/* on our parent's pending list */
+	struct rcu_head rcu;
+	unsigned long spawn;		/* spawn: the name to exec, and... */
+	unsigned long spawnargv;	/* ...its argv, before anything else */
+	long spawnerr;			/* how our spawned child's exec failed */
+	int err;			/* errno of the last failure, if any */
+	int errset;			/* or p9_werrstr has set its string */
+	int ebuf;			/* which errbuf holds the error */
+	char errbuf[2][ERRMAX];
+};
+
+/*
+ * The time page mapped into every Plan 9 process, see time.c. seq is
+ * odd while the kernel is changing it.
+ */
+struct p9_timepage {
+	u32 seq;
+	u32 flags;
+	u64 nsec;		/* nanoseconds since the epoch... */
+	u64 tsc;		/* ...when the TSC read this */
+	u32 mult;		/* ns = TSC ticks * mult >> shift */
+	u32 shift;
+	u64 fasthz;		/* TSC ticks a second */
+};
+
+#define P9TIME_TSC	1	/* extrapolating with the TSC is good */
+
+/* A kernel device, named by '#' and its character */
+struct p9_dev {
+	int dc;
+	const char *name;
+	int (*attach)(char *spec, struct path *root);
+	struct file_system_type *fstype;	/* of its trees, if its own */
+};
+
+/* An image in memory, see memdraw.c */
+struct p9_point {
+	int x, y;
+};
+
+struct p9_rect {
+	struct p9_point min, max;
+};
+
+struct p9_memimage {
+	struct p9_rect r;		/* what it covers */
+	struct p9_rect clipr;		/* what may be drawn on or from */
+	int repl;			/* tiles the plane */
+	u32 chan;			/* Plan 9 channel descriptor */
+	int alpha;			/* chan has alpha */
+	int quant;			/* pixels are rounded to chan */
+	int width;			/* pixels a row */
+	u32 *data;			/* premultiplied a8r8g8b8 */
+};
+
+/* Compositing operators, by the Porter-Duff terms they take */
+#define P9_DoutS	1
+#define P9_SoutD	2
+#define P9_DinS		4
+#define P9_SinD		8
+#define P9_S		(P9_SinD | P9_SoutD)
+#define P9_SoverD	(P9_SinD | P9_SoutD | P9_DoutS)
+
+/* dev.c */
+int p9_devregister(struct p9_dev *);
+void p9_devunregister(struct p9_dev *);
+int p9_devattach(char **, struct path *);
+char *p9_devpath(struct path *, char *, int);
+
+/* fs/binfmt_plan9.c */
+int p9_binfmt(struct mm_struct *);
+
+/* fs/exec.c, as the kernel patch leaves it */
+struct pt_regs;
+int do_execve_file(struct file *, char *, char __user * __user *,
+		   char __user * __user *, struct pt_regs *);
+
+/* time.c */
+s64 p9_nsec(void);
+u64 p9_fasthz(void);
+int p9_timepage_map(struct mm_struct *, unsigned long);
+
+/* devenv.c */
+struct p9_egrp *p9_egrp_new(void);
+struct p9_egrp *p9_egrp_copy(struct p9_egrp *);
+struct p9_egrp *p9_egrp_get(struct p9_egrp *);
+void p9_egrp_put(struct p9_egrp *);
+int p9_env_import(struct p9_egrp *, const char __user *, const char __user *);
+
+/* edf.c */
+int p9_edf_ctl(struct task_struct *, const char *, const char *);
+int p9_edf_read(struct task_struct *, char *, int);
+int p9_edf_lock(struct task_struct *);
+void p9_edf_unlock(void);
+
+/* sysstat.c */
+ssize_t p9_sysstat_read(char __user *, size_t, loff_t *);
+
+/* proc.c */
+struct p9_proc *p9_proc(void);
+int p9_proc_prefork(unsigned long);
+int p9_proc_prespawn(unsigned long, unsigned long, unsigned long);
+void p9_proc_spawnerr(long);
+void p9_proc_exec(void);
+void p9_proc_postfork(long);
+int p9_proc_rfork(unsigned long);
+struct p9_ns *p9_proc_ns(struct task_struct *);
+
+/* syscalls.c */
+struct pt_regs;
+void p9_ret_from_fork(struct pt_regs *);
+
+/* errstr.c */
+long p9_syserror(long);
+long p9_errstr(char __user *, unsigned int);
+void p9_werrstr(const char *, ...)
+	__attribute__ ((format (printf, 1, 2)));
+
+/* ns.c */
+#define P9_PARENT	1	/* stop at the parent of the last element */
+#define P9_MOUNTED	2	/* a union at the end yields its first member */
+
+struct p9_ns *p9_ns_new(void);
+struct p9_ns *p9_ns_copy(struct p9_ns *);
+struct p9_ns *p9_ns_get(struct p9_ns *);
+void p9_ns_put(struct p9_ns *);
+int p9_namei(char *, int, struct path *, char **);
+struct file *p9_ns_open(struct path *, int);
+struct file *p9_ns_create(struct path *, char *, int, unsigned long);
+int p9_ns_remove(struct path *);
+struct path *p9_ns_union(struct file *);
+void p9_ns_show(struct seq_file *, struct p9_ns *);
+long p9_ns_dirread(struct file *, char __user *, size_t, int);
+int p9_bind(struct path *, struct path *, int);
+int p9_unmount(struct path *, struct path *);
+
+/* dir.c */
+void p9_stat2dir(struct kstat *, struct inode *, const char *, unsigned int,
+		 struct p9_dir *);
+unsigned int p9_sizeD2M(struct p9_dir *);
+unsigned int p9_convD2M(struct p9_dir *, u8 *, unsigned int);
+int p9_convM2D(u8 *, unsigned int, struct p9_dir *);
+int p9_statpath(struct path *, u8 __user *, unsigned int);
+int p9_wstatpath(struct path *, u8 __user *, unsigned int);
+long p9_dirread(struct file *, char __user *, size_t, int);
+long p9_readdir(struct file *, char __user *, size_t, int *);
+
+/* devmnt.c */
+int p9_mount(int, int, struct path *, int, const char *);
+void p9_mnt_revalidate(struct file *);
+ssize_t p9_mntstat_read(char __user *, size_t, loff_t *);
+
+/* devdup.c */
+long p9_fd2path(unsigned int, char __user *, size_t);
+int p9_dup_line(unsigned int, struct file *, char *, int);
+struct file *p9_dup_open(struct path *, int);
+int p9_dup_isdup(struct path *);
+
+/* devsrv.c */
+struct file *p9_srv_open(struct path *, int);
+int p9_srv_issrv(struct path *);
+
+/* memdraw.c */
+int p9_chandepth(u32);
+char *p9_chantostr(char *, u32);
+int p9_bytesperline(struct p9_rect, int);
+int p9_memalloc(struct p9_memimage *, struct p9_rect, u32, u32);
+void p9_memfree(struct p9_memimage *);
+void p9_memload(struct p9_memimage *, struct p9_rect, const u8 *);
+void p9_memunload(struct p9_memimage *, struct p9_rect, u8 *);
+long p9_memdraw(struct p9_memimage *, struct p9_rect, struct p9_memimage *,
+		struct p9_point, struct p9_memimage *, struct p9_point, int);
+
+/* devpipe.c */
+int p9_pipe_isend(struct file *);
+long p9_pipe(int __user *);
+
+#endif /* _PLAN9_PLAN9_H */
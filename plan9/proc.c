@@ -0,0 +1,379 @@
+/*
+ * Copyright (C) 2008 Anant Narayanan <anant@kix.in>
+ * Per process Plan 9 state.
+ *
+ * Plan 9 processes carry state Linux knows nothing about (their name
+ * space, for one). It lives in a hash keyed by task and goes away when
+ * the task exits.
+ *
+ * rfork can't set up the child itself: the child may run before
+ * sys_clone even returns to us. So the parent prepares the child's
+ * state beforehand and leaves it on its pending list, and the child
+ * claims it the first time it asks for its state. A child that exits,
+ * or execs something other than a Plan 9 binary, before claiming it
+ * takes it off the list.
+ */
+#include <linux/init.h>
+#include <linux/hash.h>
+#include <linux/slab.h>
+#include <linux/sched.h>
+#include <linux/module.h>
+#include <linux/profile.h>
+#include <linux/rcupdate.h>
+#include <linux/spinlock.h>
+#include <linux/notifier.h>
+
+#include "plan9.h"
+#include "p9_constants.h"
+
+#define PROCHASHBITS	8
+
+static struct hlist_head proc_hash[1 << PROCHASHBITS];
+static DEFINE_SPINLOCK(proc_lock);
+
+static inline struct hlist_head *proc_bucket(struct task_struct *task)
+{
+	return &proc_hash[hash_ptr(task, PROCHASHBITS)];
+}
+
+static struct p9_proc *proc_alloc(void)
+{
+	struct p9_proc *p = kzalloc(sizeof(*p), GFP_KERNEL);
+
+	if (!p)
+		return NULL;
+	INIT_HLIST_NODE(&p->hash);
+	INIT_LIST_HEAD(&p->pending);
+	INIT_LIST_HEAD(&p->plist);
+	return p;
+}
+
+static void proc_free(struct p9_proc *p)
+{
+	if (p->ns)
+		p9_ns_put(p->ns);
+	if (p->egrp)
+		p9_egrp_put(p->egrp);
+	kfree(p);
+}
+
+static void proc_free_rcu(struct rcu_head *head)
+{
+	proc_free(container_of(head, struct p9_proc, rcu));
+}
+
+static struct p9_proc *proc_find(struct task_struct *task)
+{
+	struct p9_proc *p;
+	struct hlist_node *n;
+
+	hlist_for_each_entry_rcu(p, n, proc_bucket(task), hash)
+		if (p->task == task)
+			return p;
+	return NULL;
+}
+
+/* Take the state our parent set aside for us in rfork, if any */
+static struct p9_proc *proc_claim(void)
+{
+	pid_t pid;
+	struct p9_proc *parent, *p, *found = NULL;
+
+	rcu_read_lock();
+	pid = task_pid_vnr(current);
+	parent = proc_find(current->real_parent);
+	if (parent) {
+		spin_lock(&proc_lock);
+		list_for_each_entry(p, &parent->pending, plist)
+			if (p->pid == pid)
+				found = p;
+		/* pid 0: sys_clone hasn't returned to our parent yet */
+		if (!found)
+			list_for_each_entry(p, &parent->pending, plist)
+				if (p->pid == 0)
+					found = p;
+		if (found)
+			list_del_init(&found->plist);
+		spin_unlock(&proc_lock);
+	}
+	rcu_read_unlock();
+	return found;
+}
+
+/* Take task's unclaimed state off its parent's pending list, if it's there */
+static struct p9_proc *proc_unpend(struct task_struct *task)
+{
+	pid_t pid;
+	struct p9_proc *parent, *p, *found = NULL;
+
+	rcu_read_lock();
+	pid = task_pid_vnr(task);
+	parent = proc_find(task->real_parent);
+	if (parent) {
+		spin_lock(&proc_lock);
+		list_for_each_entry(p, &parent->pending, plist)
+			if (p->pid == pid)
+				found = p;
+		if (found)
+			list_del_init(&found->plist);
+		spin_unlock(&proc_lock);
+	}
+	rcu_read_unlock();
+	return found;
+}
+
+/*
+ * The Plan 9 state of the current process, set up on first use. A
+ * process that wasn't made by rfork starts with an empty name space,
+ * which is to say the Linux view of the file system, and with the
+ * environment execve gave it.
+ */
+struct p9_proc *p9_proc(void)
+{
+	struct p9_proc *p;
+
+	rcu_read_lock();
+	p = proc_find(current);
+	rcu_read_unlock();
+	if (p)
+		return p;
+
+	p = proc_claim();
+	if (!p) {
+		p = proc_alloc();
+		if (!p)
+			return NULL;
+		p->ns = p9_ns_new();
+		p->egrp = p9_egrp_new();
+		if (!p->ns || !p->egrp) {
+			proc_free(p);
+			return NULL;
+		}
+		if (current->mm)
+			p9_env_import(p->egrp,
+				(const char __user *)current->mm->env_start,
+				(const char __user *)current->mm->env_end);
+	}
+	p->task = current;
+	p->pid = task_pid_vnr(current);
+
+	spin_lock(&proc_lock);
+	hlist_add_head_rcu(&p->hash, proc_bucket(current));
+	spin_unlock(&proc_lock);
+	return p;
+}
+
+/* The state a child of ours will start with, on our pending list */
+static int proc_prefork(unsigned long flags, unsigned long spawn,
+			unsigned long spawnargv)
+{
+	struct p9_proc *p, *child;
+
+	p = p9_proc();
+	if (!p)
+		return -ENOMEM;
+	child = proc_alloc();
+	if (!child)
+		return -ENOMEM;
+
+	if (flags & RFCNAMEG)
+		child->ns = p9_ns_new();
+	else if (flags & RFNAMEG)
+		child->ns = p9_ns_copy(p->ns);
+	else
+		child->ns = p9_ns_get(p->ns);
+
+	if (flags & RFCENVG)
+		child->egrp = p9_egrp_new();
+	else if (flags & RFENVG)
+		child->egrp = p9_egrp_copy(p->egrp);
+	else
+		child->egrp = p9_egrp_get(p->egrp);
+
+	if (!child->ns || !child->egrp) {
+		proc_free(child);
+		return -ENOMEM;
+	}
+	child->spawn = spawn;
+	child->spawnargv = spawnargv;
+
+	spin_lock(&proc_lock);
+	list_add(&child->plist, &p->pending);
+	spin_unlock(&proc_lock);
+	return 0;
+}
+
+/*
+ * Called by rfork before it creates a child, to prepare the state the
+ * child will start with.
+ */
+int p9_proc_prefork(unsigned long flags)
+{
+	return proc_prefork(flags, 0, 0);
+}
+
+/*
+ * The same for spawn, whose child is to exec name with argv before it
+ * first leaves the kernel. p9_proc_postfork follows as for rfork.
+ */
+int p9_proc_prespawn(unsigned long flags, unsigned long name,
+		     unsigned long argv)
+{
+	return proc_prefork(flags, name, argv);
+}
+
+/*
+ * Called by a child of spawn whose exec failed, to hand the error to
+ * its parent. The parent is asleep until we exit, then looks.
+ */
+void p9_proc_spawnerr(long error)
+{
+	struct p9_proc *parent;
+
+	rcu_read_lock();
+	parent = proc_find(current->real_parent);
+	if (parent)
+		parent->spawnerr = error;
+	rcu_read_unlock();
+}
+
+/*
+ * Called by rfork once sys_clone has returned pid (or an error). The
+ * state is tagged with the child's pid, unless the child beat us to it
+ * and has claimed it already.
+ */
+void p9_proc_postfork(long pid)
+{
+	struct p9_proc *p, *child, *drop = NULL;
+
+	p = p9_proc();
+	if (!p)
+		return;
+
+	spin_lock(&proc_lock);
+	list_for_each_entry(child, &p->pending, plist) {
+		if (child->pid == 0) {
+			if (pid > 0) {
+				child->pid = pid;
+			} else {
+				list_del_init(&child->plist);
+				drop = child;
+			}
+			break;
+		}
+	}
+	spin_unlock(&proc_lock);
+
+	if (drop)
+		proc_free(drop);
+}
+
+/*
+ * Called once the current process has exec'd something other than a
+ * Plan 9 binary, which will never claim what rfork set aside for it.
+ */
+void p9_proc_exec(void)
+{
+	struct p9_proc *p = proc_unpend(current);
+
+	if (p)
+		proc_free(p);
+}
+
+/*
+ * Apply the name space and environment flags of an rfork without
+ * RFPROC to the current process.
+ */
+int p9_proc_rfork(unsigned long flags)
+{
+	struct p9_ns *ns;
+	struct p9_egrp *egrp;
+	struct p9_proc *p = p9_proc();
+
+	if (!p)
+		return -ENOMEM;
+
+	if (flags & (RFNAMEG | RFCNAMEG)) {
+		ns = (flags & RFCNAMEG) ? p9_ns_new() : p9_ns_copy(p->ns);
+		if (!ns)
+			return -ENOMEM;
+		/* p9_proc_ns may be looking from another process */
+		spin_lock(&proc_lock);
+		swap(ns, p->ns);
+		spin_unlock(&proc_lock);
+		p9_ns_put(ns);
+	}
+
+	if (flags & (RFENVG | RFCENVG)) {
+		egrp = (flags & RFCENVG) ? p9_egrp_new() :
+			p9_egrp_copy(p->egrp);
+		if (!egrp)
+			return -ENOMEM;
+		p9_egrp_put(p->egrp);
+		p->egrp = egrp;
+	}
+	return 0;
+}
+
+/* The name space of task, referenced, or NULL if it has no Plan 9 state */
+struct p9_ns *p9_proc_ns(struct task_struct *task)
+{
+	struct p9_proc *p;
+	struct p9_ns *ns = NULL;
+
+	rcu_read_lock();
+	spin_lock(&proc_lock);
+	p = proc_find(task);
+	if (p)
+		ns = p9_ns_get(p->ns);
+	spin_unlock(&proc_lock);
+	rcu_read_unlock();
+	return ns;
+}
+
+static int proc_exit(struct notifier_block *nb, unsigned long val, void *data)
+{
+	struct task_struct *task = data;
+	struct p9_proc *p, *child, *n;
+	LIST_HEAD(orphans);
+
+	spin_lock(&proc_lock);
+	p = proc_find(task);
+	if (p) {
+		hlist_del_rcu(&p->hash);
+		list_splice_init(&p->pending, &orphans);
+	}
+	spin_unlock(&proc_lock);
+
+	if (!p) {
+		/* It may have been rforked and never made a system call */
+		child = proc_unpend(task);
+		if (!child)
+			return NOTIFY_DONE;
+		proc_free(child);
+		return NOTIFY_OK;
+	}
+
+	/* Children that never made a Plan 9 system call */
+	list_for_each_entry_safe(child, n, &orphans, plist)
+		proc_free(child);
+
+	/* Dropping the name space may sleep, so don't leave it to RCU */
+	p9_ns_put(p->ns);
+	p->ns = NULL;
+	p9_egrp_put(p->egrp);
+	p->egrp = NULL;
+	call_rcu(&p->rcu, proc_free_rcu);
+	return NOTIFY_OK;
+}
+
+static struct notifier_block proc_exit_nb = {
+	.notifier_call = proc_exit,
+};
+
+static int __init proc_init(void)
+{
+	return profile_event_register(PROFILE_TASK_EXIT, &proc_exit_nb);
+}
+
+module_init(proc_init);
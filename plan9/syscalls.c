@@ -6,19 +6,63 @@
 #include <linux/fs.h>
 #include <linux/time.h>
 #include <linux/file.h>
+#include <linux/cred.h>
 #include <linux/mount.h>
+#include <linux/namei.h>
 #include <linux/dcache.h>
+#include <linux/sched.h>
 #include <linux/string.h>
 #include <linux/fsnotify.h>
 #include <linux/syscalls.h>
+#include <linux/fs_struct.h>
 
 #include <asm/current.h>
 #include <asm/uaccess.h>
 #include <asm/syscalls.h>
 #include <asm/processor.h>
 
+#include "plan9.h"
 #include "p9_constants.h"
 
+/*
+ * Map a Plan 9 open mode onto Linux open flags. Files are always
+ * opened for large file access, Plan 9 offsets are 64-bit.
+ */
+static int p9_openflags(unsigned long omode)
+{
+	int flags = O_LARGEFILE;
+
+	switch (omode & 3) {
+	case OWRITE:
+		flags |= O_WRONLY;
+		break;
+	case ORDWR:
+		flags |= O_RDWR;
+		break;
+	default:
+		/* OREAD and OEXEC */
+		flags |= O_RDONLY;
+		break;
+	}
+	if (omode & OTRUNC)
+		flags |= O_TRUNC;
+
+	return flags;
+}
+
+/* Look up a name from user space in the Plan 9 name space */
+static int p9_userpath(unsigned long name, int flags, struct path *path)
+{
+	int error;
+	char *tmp = getname((const char __user *)name);
+
+	if (IS_ERR(tmp))
+		return PTR_ERR(tmp);
+	error = p9_namei(tmp, flags, path, NULL);
+	putname(tmp);
+	return error;
+}
+
 asmlinkage long sys_plan9_unimplemented(struct pt_regs regs)
 {
 	if (printk_ratelimit())
@@ -35,6 +79,17 @@ asmlinkage long sys_plan9_deprecated(struct pt_regs regs)
 	return 0;
 }
 
+asmlinkage long sys_plan9_errstr(struct pt_regs regs)
+{
+	unsigned long buf, nbuf;
+	unsigned long *addr = (unsigned long *)regs.sp;
+
+	get_user(buf, ++addr);
+	get_user(nbuf, ++addr);
+
+	return p9_errstr((char __user *)buf, nbuf);
+}
+
 asmlinkage long sys_plan9_exits(struct pt_regs regs)
 {
 	printk(KERN_INFO "P9: Syscall %ld exits called!\n", regs.ax);
@@ -43,13 +98,28 @@ asmlinkage long sys_plan9_exits(struct pt_regs regs)
 
 asmlinkage long sys_plan9_chdir(struct pt_regs regs)
 {
+	long error;
+	struct path path;
 	unsigned long dirname;
 	unsigned long *addr = (unsigned long *)regs.sp;
 	printk(KERN_INFO "P9: Syscall %ld chdir called!\n", regs.ax);
 
 	get_user(dirname, ++addr);
-	
-	return sys_chdir((char __user *)dirname);
+
+	/* pwd stays on a union's mount point, so the union is searched */
+	error = p9_userpath(dirname, 0, &path);
+	if (error)
+		return error;
+	error = -ENOTDIR;
+	if (!S_ISDIR(path.dentry->d_inode->i_mode))
+		goto out;
+	error = inode_permission(path.dentry->d_inode, MAY_EXEC | MAY_ACCESS);
+	if (error)
+		goto out;
+	set_fs_pwd(current->fs, &path);
+out:
+	path_put(&path);
+	return error;
 }
 
 asmlinkage long sys_plan9_close(struct pt_regs regs)
@@ -86,9 +156,10 @@ asmlinkage long sys_plan9_dup(struct pt_regs regs)
 
 asmlinkage long sys_plan9_open(struct pt_regs regs)
 {
-	int fd, len;
+	long fd;
+	char *name;
 	struct file *f;
-	char path[PATH_MAX + 1];
+	struct path p;
 	unsigned long file, omode;
 	unsigned long *addr = (unsigned long *)regs.sp;
 	printk(KERN_INFO "P9: Syscall %ld open called!\n", regs.ax);
@@ -96,37 +167,29 @@ asmlinkage long sys_plan9_open(struct pt_regs regs)
 	get_user(file, ++addr);
 	get_user(omode, ++addr);
 
-	/* Special case for '#c/pid' */
-	if ((len = strncpy_from_user(path, (char __user *)file, PATH_MAX)) < 0) {
-		return -EFAULT;
-	}
-	path[len] = '\0';
-
-	if (strncmp(path, "#c/pid", 6) == 0) {
-		strncpy(path, "/dev/pid\0", 9);
-		printk(KERN_INFO "P9: open for #c/pid received, changed to %s!\n", path);
+	name = getname((const char __user *)file);
+	if (IS_ERR(name))
+		return PTR_ERR(name);
+	fd = p9_namei(name, 0, &p, NULL);
+	if (fd)
+		goto out;
+
+	fd = get_unused_fd();
+	if (fd < 0)
+		goto out_path;
+	f = p9_ns_open(&p, p9_openflags(omode));
+	if (IS_ERR(f)) {
+		put_unused_fd(fd);
+		fd = PTR_ERR(f);
 	} else {
-		printk(KERN_INFO "P9: open for %s received\n", path);
+		fsnotify_open(f->f_path.dentry);
+		fd_install(fd, f);
 	}
-	
-	fd = PTR_ERR(path);
-
-	if (!IS_ERR(path)) {
-		fd = get_unused_fd();
-		if (fd >= 0) {
-			f = do_filp_open(AT_FDCWD, path, (int)NULL, omode, (int)NULL);
-			if (IS_ERR(f)) {
-				put_unused_fd(fd);
-				fd = PTR_ERR(f);
-			} else {
-				fsnotify_open(f->f_path.dentry);
-				fd_install(fd, f);
-			}
-		}
-		putname(path);
-	}
-
-	return (long)fd;
+out_path:
+	path_put(&p);
+out:
+	putname(name);
+	return fd;
 }
 
 asmlinkage long sys_plan9_sleep(struct pt_regs regs)
@@ -152,11 +215,25 @@ asmlinkage long sys_plan9_sleep(struct pt_regs regs)
 	if (rval == 0)
 		return 0;
 	else
-		return -1;
+		return -EINTR;
+}
+
+asmlinkage long sys_plan9_pipe(struct pt_regs regs)
+{
+	unsigned long fd;
+	unsigned long *addr = (unsigned long *)regs.sp;
+
+	get_user(fd, ++addr);
+
+	return p9_pipe((int __user *)fd);
 }
 
 asmlinkage long sys_plan9_create(struct pt_regs regs)
 {
+	long fd;
+	char *name, *last;
+	struct file *f;
+	struct path dir;
 	unsigned long file, omode, perm;
 	unsigned long *addr = (unsigned long *)regs.sp;
 	printk(KERN_INFO "P9: Syscall %ld create called!\n", regs.ax);
@@ -164,54 +241,46 @@ asmlinkage long sys_plan9_create(struct pt_regs regs)
 	get_user(file, ++addr);
 	get_user(omode, ++addr);
 	get_user(perm, ++addr);
-	
-	/* TODO: check modes */
-	return sys_open((const char __user *)file, omode | O_CREAT, perm);
+
+	name = getname((const char __user *)file);
+	if (IS_ERR(name))
+		return PTR_ERR(name);
+	fd = p9_namei(name, P9_PARENT, &dir, &last);
+	if (fd)
+		goto out;
+
+	fd = -EEXIST;
+	if (last == NULL)
+		goto out_dir;
+	fd = get_unused_fd();
+	if (fd < 0)
+		goto out_dir;
+	f = p9_ns_create(&dir, last, p9_openflags(omode), perm);
+	if (IS_ERR(f)) {
+		put_unused_fd(fd);
+		fd = PTR_ERR(f);
+	} else {
+		fsnotify_open(f->f_path.dentry);
+		fd_install(fd, f);
+	}
+out_dir:
+	path_put(&dir);
+out:
+	putname(name);
+	return fd;
 }
 
-/* Original code is (C) Alexander Viro, linux-kernel, 12th Aug 2000
- * Original code was modified to fit this structure correctly.
- */
 asmlinkage long sys_plan9_fd2path(struct pt_regs regs)
 {
-	char *cwd;
-	int fd, error;
-	char __user *buf;
-
-	struct file *file;
-	struct path *path;
-	
-	unsigned long abuf, nbuf, len;
-	char *page = (char *) __get_free_page(GFP_USER);
+	unsigned long fd, buf, nbuf;
 	unsigned long *addr = (unsigned long *)regs.sp;
 	printk(KERN_INFO "P9: Syscall %ld fd2path called!\n", regs.ax);
-	
-	if (!page)
-		return -ENOMEM;
-	
+
 	get_user(fd, ++addr);
-	get_user(abuf, ++addr);
+	get_user(buf, ++addr);
 	get_user(nbuf, ++addr);
 
-	buf = (char __user *)abuf;
-	
-	file = fget(fd);
-	if (!file)
-		return -EBADF;
-	path = &(file->f_path);
-	fput(file);
-	
-	cwd = d_path(path, page, PAGE_SIZE);
-	error = -ERANGE;
-	len = PAGE_SIZE + page - cwd;
-	if (len <= nbuf) {
-		error = len;
-		if (copy_to_user(buf, cwd, len))
-			error = -EFAULT;
-	}
-
-	free_page((unsigned long) page);
-	return error;
+	return p9_fd2path(fd, (char __user *)buf, nbuf);
 }
 
 /* FIXME: Find out if this is brk_ or sbrk! */
@@ -228,16 +297,26 @@ asmlinkage long sys_plan9_brk(struct pt_regs regs)
 
 asmlinkage long sys_plan9_remove(struct pt_regs regs)
 {
+	long error;
+	struct path path;
 	unsigned long file;
 	unsigned long *addr = (unsigned long *) regs.sp;
 	printk(KERN_INFO "P9: Syscall %ld remove called!\n", regs.ax);
 
 	get_user(file, ++addr);
 
-	return sys_unlink((const char __user *)file);
+	error = p9_userpath(file, P9_MOUNTED, &path);
+	if (error)
+		return error;
+	error = p9_ns_remove(&path);
+	path_put(&path);
+	return error;
 }
 
-/* FIXME: Plan9's seek uses vlong, we ignore n here! */
+/*
+ * The vlong result is written back through the pointer passed as the
+ * first argument, sys_llseek does exactly that for us.
+ */
 asmlinkage long sys_plan9_seek(struct pt_regs regs)
 {
 	loff_t offset;
@@ -247,38 +326,57 @@ asmlinkage long sys_plan9_seek(struct pt_regs regs)
 
 	get_user(n, ++addr);
 	get_user(fd, ++addr);
-	addr = addr + 2;
-	ret = copy_from_user(&offset, addr, sizeof(loff_t));
+	ret = copy_from_user(&offset, ++addr, sizeof(loff_t));
 	if (ret != 0) {
 		printk(KERN_ALERT "P9: %ld bytes unread for seek!", ret);
+		return -EFAULT;
 	}
-	get_user(type, ++addr);
+	/* The vlong takes up two words */
+	addr = addr + 2;
+	get_user(type, addr);
 
-	return sys_lseek(fd, (off_t) offset, type);
+	return sys_llseek(fd, (unsigned long)(offset >> 32),
+			(unsigned long)offset, (loff_t __user *)n, type);
 }
 
 asmlinkage long sys_plan9_pread(struct pt_regs regs)
 {
+	long ret;
 	loff_t offset;
-	unsigned long ret, fd, buf, nbytes;
+	struct file *f;
+	int fput_needed;
+	unsigned long fd, buf, nbytes;
 	unsigned long *addr = (unsigned long *)regs.sp;
 	printk(KERN_INFO "P9: Syscall %ld pread called!\n", regs.ax);
 
 	get_user(fd, ++addr);
 	get_user(buf, ++addr);
 	get_user(nbytes, ++addr);
-	addr = addr + 2;
-	ret = copy_from_user(&offset, addr, sizeof(loff_t));
+	ret = copy_from_user(&offset, ++addr, sizeof(loff_t));
 	if (ret != 0) {
 		printk(KERN_ALERT "P9: %ld bytes unread for read!", ret);
+		return -EFAULT;
 	}
 	printk(KERN_INFO "P9: pread: offset: %llx\n", offset);
-	if (offset == 0xffffffff) {
+
+	/* Directories read as packed Plan 9 Dir entries */
+	f = fget_light(fd, &fput_needed);
+	if (!f)
+		return -EBADF;
+	if (S_ISDIR(f->f_path.dentry->d_inode->i_mode) || p9_ns_union(f)) {
+		ret = p9_dirread(f, (char __user *)buf, nbytes, offset == 0);
+		fput_light(f, fput_needed);
+		return ret;
+	}
+	fput_light(f, fput_needed);
+
+	/* An offset of -1 means the current file offset */
+	if (offset == -1) {
 		printk(KERN_INFO "P9: pread: calling with %lx, %lx, %lx\n",
 							fd, buf, nbytes);
 		return sys_read(fd, (char __user *)buf, nbytes);
 	} else {
-		return sys_pread64(fd, (char __user *)buf, nbytes, offset); 
+		return sys_pread64(fd, (char __user *)buf, nbytes, offset);
 	}
 }
 
@@ -292,13 +390,14 @@ asmlinkage long sys_plan9_pwrite(struct pt_regs regs)
 	get_user(fd, ++addr);
 	get_user(buf, ++addr);
 	get_user(nbytes, ++addr);
-	addr = addr + 2;
-	ret = copy_from_user(&offset, addr, sizeof(loff_t));
+	ret = copy_from_user(&offset, ++addr, sizeof(loff_t));
 	if (ret != 0) {
 		printk(KERN_ALERT "P9: %ld bytes unread for write!", ret);
+		return -EFAULT;
 	}
 	printk(KERN_INFO "P9: pwrite: offset: %llx\n", offset);
-	if (offset == 0xffffffff) {
+	/* An offset of -1 means the current file offset */
+	if (offset == -1) {
 		printk(KERN_INFO "P9: pwrite: calling with %lx, %lx, %lx\n",
 							fd, buf, nbytes);
 		return sys_write(fd, (char __user *)buf, nbytes);
@@ -307,6 +406,93 @@ asmlinkage long sys_plan9_pwrite(struct pt_regs regs)
 	}
 }
 
+asmlinkage long sys_plan9_stat(struct pt_regs regs)
+{
+	long error;
+	struct path path;
+	unsigned long file, edir, nedir;
+	unsigned long *addr = (unsigned long *)regs.sp;
+
+	get_user(file, ++addr);
+	get_user(edir, ++addr);
+	get_user(nedir, ++addr);
+
+	error = p9_userpath(file, P9_MOUNTED, &path);
+	if (error)
+		return error;
+	error = p9_statpath(&path, (u8 __user *)edir, nedir);
+	path_put(&path);
+
+	return error;
+}
+
+asmlinkage long sys_plan9_fstat(struct pt_regs regs)
+{
+	long error;
+	struct file *f;
+	unsigned long fd, edir, nedir;
+	unsigned long *addr = (unsigned long *)regs.sp;
+
+	get_user(fd, ++addr);
+	get_user(edir, ++addr);
+	get_user(nedir, ++addr);
+
+	f = fget(fd);
+	if (!f)
+		return -EBADF;
+	/* An open union stats as the directory it is mounted on */
+	if (p9_ns_union(f))
+		error = p9_statpath(p9_ns_union(f), (u8 __user *)edir, nedir);
+	else
+		error = p9_statpath(&f->f_path, (u8 __user *)edir, nedir);
+	fput(f);
+
+	return error;
+}
+
+asmlinkage long sys_plan9_wstat(struct pt_regs regs)
+{
+	long error;
+	struct path path;
+	unsigned long file, edir, nedir;
+	unsigned long *addr = (unsigned long *)regs.sp;
+
+	get_user(file, ++addr);
+	get_user(edir, ++addr);
+	get_user(nedir, ++addr);
+
+	error = p9_userpath(file, P9_MOUNTED, &path);
+	if (error)
+		return error;
+	error = p9_wstatpath(&path, (u8 __user *)edir, nedir);
+	path_put(&path);
+
+	return error;
+}
+
+asmlinkage long sys_plan9_fwstat(struct pt_regs regs)
+{
+	long error;
+	struct file *f;
+	unsigned long fd, edir, nedir;
+	unsigned long *addr = (unsigned long *)regs.sp;
+
+	get_user(fd, ++addr);
+	get_user(edir, ++addr);
+	get_user(nedir, ++addr);
+
+	f = fget(fd);
+	if (!f)
+		return -EBADF;
+	if (p9_ns_union(f))
+		error = p9_wstatpath(p9_ns_union(f), (u8 __user *)edir, nedir);
+	else
+		error = p9_wstatpath(&f->f_path, (u8 __user *)edir, nedir);
+	fput(f);
+
+	return error;
+}
+
 asmlinkage long sys_plan9_rfork(struct pt_regs regs)
 {
 	long ret = -1;
@@ -334,20 +520,9 @@ asmlinkage long sys_plan9_rfork(struct pt_regs regs)
 			printk(KERN_INFO "rfork with RFNOWAIT unimplemented!\n");	
 		}
 
-		if (flags & RFNAMEG) {
-			clone_flags |= (CLONE_NEWNS | CLONE_FILES);
-		} else if (flags & RFCNAMEG) {
-			clone_flags |= (CLONE_FILES);
-		}
-
 		if (flags & RFNOMNT) {
 			printk(KERN_INFO "rfork with RFNOMNT unimplemented!\n");
 		}
-		if (flags & RFENVG) {
-			printk(KERN_INFO "rfork with RFENVG unimplemented!\n");
-		} else if (flags & RFCENVG) {
-			printk(KERN_INFO "rfork with RFCENVG unimplemented!\n");
-		}
 		if (flags & RFNOTEG) {
 			printk(KERN_INFO "rfork with RNOTEG unimplemented!\n");
 		}
@@ -358,21 +533,290 @@ asmlinkage long sys_plan9_rfork(struct pt_regs regs)
 			printk(KERN_INFO "rfork with RFCENVG unimplemented!\n");
 		}
 
+		/* The child's name space and environment are ready before it runs */
+		ret = p9_proc_prefork(flags);
+		if (ret)
+			return ret;
+
 		regs.bx = clone_flags;
+		regs.cx = 0;
 		ret = sys_clone(&regs);
-
-		if (flags & RFCNAMEG) {
-			printk(KERN_INFO "rfork with RFCNAMEG called, unsharing!\n");
-			sys_unshare(CLONE_NEWNS);
-		}
+		if (ret != 0)
+			p9_proc_postfork(ret);
 		if (flags & RFFDG) {
 			printk(KERN_INFO "rfork with RFFDG unimplemented!\n");
 		} else if (flags & RFCFDG) {
 			printk(KERN_INFO "rfork with RFCFDG called, unsharing!\n");
 			sys_unshare(CLONE_FILES);
 		}
+	} else {
+		ret = p9_proc_rfork(flags);
 	}
 	
 	return ret;
 }
 
+
+/* Open path to exec it, checked as open_exec checks a file it opens */
+static struct file *p9_open_exec(struct path *path)
+{
+	int error;
+	struct file *f;
+
+	error = may_open(path, MAY_EXEC | MAY_OPEN, O_RDONLY);
+	if (error)
+		return ERR_PTR(error);
+	if (!S_ISREG(path->dentry->d_inode->i_mode) ||
+	    (path->mnt->mnt_flags & MNT_NOEXEC))
+		return ERR_PTR(-EACCES);
+	path_get(path);
+	f = dentry_open(path->dentry, path->mnt,
+			O_RDONLY | O_LARGEFILE | FMODE_EXEC, current_cred());
+	if (IS_ERR(f))
+		return f;
+	fsnotify_open(f->f_path.dentry);
+	/* Don't run what the cache holds of an older binary */
+	p9_mnt_revalidate(f);
+	return f;
+}
+
+/*
+ * exec(2), of anything Linux can run. The name is looked up in the name
+ * space, and it is the file found there that runs, whatever Linux would
+ * find under the same name: the file may be on a 9P mount or in a '#'
+ * device, or the name may have been pointed elsewhere since. The binary
+ * is loaded from the open file, see do_execve_file. A #! interpreter is
+ * given the name as it was passed, which a Plan 9 interpreter looks up
+ * in the same name space. The argument strings are copied just once,
+ * from the caller into the new stack, where load_plan9_binary lays out
+ * argv as Plan 9 wants it. Plan 9 passes the environment in '#e', not
+ * to exec.
+ */
+static long p9_exec(unsigned long name, unsigned long argv,
+		    struct pt_regs *regs)
+{
+	long error;
+	char *kname;
+	struct file *f;
+	struct path path;
+
+	kname = getname((const char __user *)name);
+	if (IS_ERR(kname))
+		return PTR_ERR(kname);
+	error = p9_namei(kname, 0, &path, NULL);
+	if (error)
+		goto out;
+	f = p9_open_exec(&path);
+	path_put(&path);
+	error = PTR_ERR(f);
+	if (IS_ERR(f))
+		goto out;
+
+	error = do_execve_file(f, kname, (char __user * __user *)argv, NULL,
+			       regs);
+	fput(f);
+	if (error == 0) {
+		/* Make sure we don't return using sysenter */
+		set_thread_flag(TIF_IRET);
+		if (!p9_binfmt(current->mm))
+			p9_proc_exec();
+	}
+out:
+	putname(kname);
+	return error;
+}
+
+asmlinkage long sys_plan9_exec(struct pt_regs regs)
+{
+	unsigned long name, argv;
+	unsigned long *addr = (unsigned long *)regs.sp;
+
+	get_user(name, ++addr);
+	get_user(argv, ++addr);
+
+	return p9_exec(name, argv, &regs);
+}
+
+/*
+ * spawn(flags, name, argv): rfork(RFPROC|flags) and exec(name, argv) in
+ * the child, without copying our address space for the child to throw
+ * away. The child borrows it, as with vfork, and we sleep until it has
+ * exec'd or exited. It execs on its way out of the kernel, before it
+ * runs a single instruction of ours, see p9_ret_from_fork. An exec that
+ * fails is reported here, and the child is gone. Without RFFDG our fds
+ * are shared with the child only until the exec, which, as always on
+ * Linux, gives it a copy of its own. This is not a Plan 9 system call.
+ */
+asmlinkage long sys_plan9_spawn(struct pt_regs regs)
+{
+	long ret;
+	struct p9_proc *p;
+	struct pt_regs child;
+	unsigned long flags, name, argv;
+	unsigned long *addr = (unsigned long *)regs.sp;
+
+	get_user(flags, ++addr);
+	get_user(name, ++addr);
+	get_user(argv, ++addr);
+
+	if (flags & (RFMEM | RFNOWAIT | RFCFDG))
+		return -EINVAL;
+	if ((flags & (RFNAMEG | RFCNAMEG)) == (RFNAMEG | RFCNAMEG))
+		return -EINVAL;
+	if ((flags & (RFENVG | RFCENVG)) == (RFENVG | RFCENVG))
+		return -EINVAL;
+
+	p = p9_proc();
+	if (!p)
+		return -ENOMEM;
+	ret = p9_proc_prespawn(flags, name, argv);
+	if (ret)
+		return ret;
+
+	p->spawnerr = 0;
+	child = regs;
+	child.bx = CLONE_VM | CLONE_VFORK | SIGCHLD;
+	if (!(flags & RFFDG))
+		child.bx |= CLONE_FILES;
+	child.cx = 0;
+	ret = sys_clone(&child);
+	p9_proc_postfork(ret);
+
+	/* The child set this before it let us go */
+	if (ret > 0 && p->spawnerr) {
+		sys_wait4(ret, NULL, __WALL, NULL);
+		ret = p->spawnerr;
+	}
+	return ret;
+}
+
+/*
+ * Called from ret_from_fork by every new process, on its way out to user
+ * space. A child of spawn execs here. If that fails it can't go on, the
+ * user stack it would return to is still its parent's, so it leaves the
+ * error to its parent and exits.
+ */
+void p9_ret_from_fork(struct pt_regs *regs)
+{
+	long error;
+	unsigned long name;
+	struct p9_proc *p;
+
+	/* spawn's children are the only vfork children of Plan 9 binaries */
+	if (!current->vfork_done || !p9_binfmt(current->mm))
+		return;
+
+	p = p9_proc();
+	if (p) {
+		if (!p->spawn)
+			return;
+		name = p->spawn;
+		p->spawn = 0;
+		error = p9_exec(name, p->spawnargv, regs);
+	} else
+		error = -ENOMEM;
+
+	if (error) {
+		p9_proc_spawnerr(error);
+		sys_exit(1);
+	}
+}
+
+asmlinkage long sys_plan9_bind(struct pt_regs regs)
+{
+	long error;
+	struct path new, old;
+	unsigned long name, oldname, flag;
+	unsigned long *addr = (unsigned long *)regs.sp;
+
+	get_user(name, ++addr);
+	get_user(oldname, ++addr);
+	get_user(flag, ++addr);
+
+	error = p9_userpath(name, 0, &new);
+	if (error)
+		return error;
+	error = p9_userpath(oldname, 0, &old);
+	if (!error) {
+		error = p9_bind(&new, &old, flag);
+		path_put(&old);
+	}
+	path_put(&new);
+
+	return error;
+}
+
+asmlinkage long sys_plan9_unmount(struct pt_regs regs)
+{
+	long error;
+	struct path new, old;
+	unsigned long name, oldname;
+	unsigned long *addr = (unsigned long *)regs.sp;
+
+	get_user(name, ++addr);
+	get_user(oldname, ++addr);
+
+	error = p9_userpath(oldname, 0, &old);
+	if (error)
+		return error;
+	/* Without a name, everything bound onto old goes */
+	if (name) {
+		error = p9_userpath(name, 0, &new);
+		if (!error) {
+			error = p9_unmount(&new, &old);
+			path_put(&new);
+		}
+	} else {
+		error = p9_unmount(NULL, &old);
+	}
+	path_put(&old);
+
+	return error;
+}
+
+asmlinkage long sys_plan9_mount(struct pt_regs regs)
+{
+	long error;
+	char *spec;
+	struct path old;
+	unsigned long fd, afd, oldname, flag, aname;
+	unsigned long *addr = (unsigned long *)regs.sp;
+
+	get_user(fd, ++addr);
+	get_user(afd, ++addr);
+	get_user(oldname, ++addr);
+	get_user(flag, ++addr);
+	get_user(aname, ++addr);
+
+	/* A nil aname attaches the server's default tree */
+	spec = aname ? getname((const char __user *)aname) : (char *)"";
+	if (IS_ERR(spec))
+		return PTR_ERR(spec);
+
+	error = p9_userpath(oldname, 0, &old);
+	if (!error) {
+		error = p9_mount(fd, afd, &old, flag, spec);
+		path_put(&old);
+	}
+	if (aname)
+		putname(spec);
+
+	return error;
+}
+
+/*
+ * nsec(2). As with seek, the vlong result is stored through a pointer
+ * passed first. Most processes won't need this: see the time page.
+ */
+asmlinkage long sys_plan9_nsec(struct pt_regs regs)
+{
+	s64 ns;
+	unsigned long ret;
+	unsigned long *addr = (unsigned long *)regs.sp;
+
+	get_user(ret, ++addr);
+	ns = p9_nsec();
+	if (copy_to_user((s64 __user *)ret, &ns, sizeof(ns)))
+		return -EFAULT;
+	return 0;
+}
@@ -0,0 +1,159 @@
+/*
+ * Copyright (C) 2008 Anant Narayanan <anant@kix.in>
+ * Plan 9 system statistics, as read from '#c/sysstat'.
+ *
+ * Each CPU gets a line of ten numbers: its number, then context
+ * switches, interrupts, system calls, page faults, TLB faults, TLB
+ * purges, load, and the percentage of time it was idle and taking
+ * interrupts. The counts are all kept per CPU and bumped without locks
+ * where they happen; they are only added up when the file is read.
+ *
+ * The system call count is kept by the Plan 9 system call entry, and
+ * context switches at the scheduler's sched_switch tracepoint (they
+ * are 0 in a kernel without tracepoints): the scheduler's own count
+ * is private to it. Page faults and TLB purges (flush IPIs taken) come
+ * from the kernel's own counters, and the interrupts from what
+ * /proc/stat adds up. TLB faults are 0, x86 handles them in hardware.
+ * Load is the load average times 1000, the same on every line. The
+ * percentages are sampled once a second.
+ */
+#include <linux/fs.h>
+#include <linux/init.h>
+#include <linux/slab.h>
+#include <linux/irqnr.h>
+#include <linux/math64.h>
+#include <linux/sched.h>
+#include <linux/timer.h>
+#include <linux/percpu.h>
+#include <linux/vmstat.h>
+#include <linux/cpumask.h>
+#include <linux/kernel_stat.h>
+#include <linux/uaccess.h>
+#include <asm/hardirq.h>
+#include <trace/events/sched.h>
+
+#include "plan9.h"
+
+#define NUMSIZE		12
+
+/* Plan 9 system calls on this CPU, counted in plan9_system_call */
+DEFINE_PER_CPU(unsigned long, p9_syscalls);
+
+/* Context switches on this CPU, counted at sched_switch */
+static DEFINE_PER_CPU(unsigned long, sysstat_cswitch);
+
+/* Where the last sample left a CPU's time */
+struct sysstat_sample {
+	cputime64_t idle;
+	cputime64_t intr;
+	cputime64_t total;
+	unsigned int idlepct;
+	unsigned int intrpct;
+};
+
+static DEFINE_PER_CPU(struct sysstat_sample, sysstat_sample);
+static struct timer_list sysstat_timer;
+
+static unsigned long sysstat_intr(int cpu)
+{
+	int irq;
+	unsigned long n = 0;
+
+	for_each_irq_nr(irq)
+		n += kstat_irqs_cpu(irq, cpu);
+	return n + arch_irq_stat_cpu(cpu);
+}
+
+static void sysstat_tick(unsigned long unused)
+{
+	int cpu;
+	cputime64_t idle, intr, total;
+	struct cpu_usage_stat *st;
+	struct sysstat_sample *s;
+
+	for_each_online_cpu(cpu) {
+		st = &kstat_cpu(cpu).cpustat;
+		s = &per_cpu(sysstat_sample, cpu);
+		idle = cputime64_add(st->idle, st->iowait);
+		intr = cputime64_add(st->irq, st->softirq);
+		total = cputime64_add(idle, intr);
+		total = cputime64_add(total, st->user);
+		total = cputime64_add(total, st->nice);
+		total = cputime64_add(total, st->system);
+		total = cputime64_add(total, st->steal);
+
+		if (total != s->total) {
+			s->idlepct = div64_u64((idle - s->idle) * 100,
+					       total - s->total);
+			s->intrpct = div64_u64((intr - s->intr) * 100,
+					       total - s->total);
+		}
+		s->idle = idle;
+		s->intr = intr;
+		s->total = total;
+	}
+	mod_timer(&sysstat_timer, jiffies + HZ);
+}
+
+#ifdef CONFIG_TRACEPOINTS
+/* Called by schedule() with the runqueue locked, for every switch */
+static void sysstat_switch(struct rq *rq, struct task_struct *prev,
+			   struct task_struct *next)
+{
+	__get_cpu_var(sysstat_cswitch)++;
+}
+#endif
+
+ssize_t p9_sysstat_read(char __user *buf, size_t count, loff_t *offset)
+{
+	int cpu, n = 0, size;
+	char *b;
+	ssize_t ret;
+	unsigned long tlbpurge, load;
+	struct sysstat_sample *s;
+
+	size = num_possible_cpus() * 10 * NUMSIZE + 1;
+	b = kmalloc(size, GFP_KERNEL);
+	if (!b)
+		return -ENOMEM;
+
+	load = (avenrun[0] * 1000) >> FSHIFT;
+	for_each_online_cpu(cpu) {
+		s = &per_cpu(sysstat_sample, cpu);
+#ifdef CONFIG_SMP
+		tlbpurge = per_cpu(irq_stat, cpu).irq_tlb_count;
+#else
+		tlbpurge = 0;
+#endif
+		n += scnprintf(b + n, size - n,
+			       "%*d %*lu %*lu %*lu %*lu %*lu %*lu %*lu %*u %*u\n",
+			       NUMSIZE - 1, cpu,
+			       NUMSIZE - 1, per_cpu(sysstat_cswitch, cpu),
+			       NUMSIZE - 1, sysstat_intr(cpu),
+			       NUMSIZE - 1, per_cpu(p9_syscalls, cpu),
+			       NUMSIZE - 1,
+			       per_cpu(vm_event_states, cpu).event[PGFAULT],
+			       NUMSIZE - 1, 0UL,
+			       NUMSIZE - 1, tlbpurge,
+			       NUMSIZE - 1, load,
+			       NUMSIZE - 1, s->idlepct,
+			       NUMSIZE - 1, s->intrpct);
+	}
+	ret = simple_read_from_buffer(buf, count, offset, b, n);
+	kfree(b);
+	return ret;
+}
+
+static int __init sysstat_init(void)
+{
+	init_timer_deferrable(&sysstat_timer);
+	sysstat_timer.function = sysstat_tick;
+	sysstat_tick(0);
+#ifdef CONFIG_TRACEPOINTS
+	return register_trace_sched_switch(sysstat_switch);
+#else
+	return 0;
+#endif
+}
+
+module_init(sysstat_init);
@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2008 Anant Narayanan <anant@kix.in>
+ * Plan 9 time.
+ *
+ * Every Plan 9 process has a read-only time page mapped at the top of
+ * its address space (see TIME_ADDR in binfmt_plan9.h), so that nsec()
+ * needn't enter the kernel. Once a second the kernel notes the time
+ * and the TSC together; in between, a reader extrapolates with the TSC:
+ *
+ *	do {
+ *		s = tp->seq;
+ *		ns = tp->nsec + ((rdtsc() - tp->tsc) * tp->mult >> tp->shift);
+ *	} while ((s & 1) || s != tp->seq);
+ *
+ * This only works if the TSC ticks at the same constant rate on every
+ * CPU. Otherwise P9TIME_TSC is clear and nsec() should ask the kernel,
+ * with the nsec system call or by reading '#c/bintime'.
+ */
+#include <linux/mm.h>
+#include <linux/init.h>
+#include <linux/time.h>
+#include <linux/timer.h>
+#include <linux/jiffies.h>
+#include <linux/uaccess.h>
+#include <asm/tsc.h>
+
+#include "plan9.h"
+
+/* Fraction bits of p9_timepage.mult */
+#define TIMESHIFT	22
+
+static struct p9_timepage *timepage;
+static struct page *timepages[2];
+static struct timer_list time_timer;
+
+s64 p9_nsec(void)
+{
+	struct timespec ts;
+
+	getnstimeofday(&ts);
+	return timespec_to_ns(&ts);
+}
+
+/* TSC ticks a second, or 0 if there's no TSC to go by */
+u64 p9_fasthz(void)
+{
+	return (u64)tsc_khz * 1000;
+}
+
+static void time_update(unsigned long unused)
+{
+	u64 mult;
+	u32 flags = 0;
+	cycles_t tsc;
+	unsigned long irqflags;
+	struct timespec ts;
+
+	if (tsc_khz && boot_cpu_has(X86_FEATURE_CONSTANT_TSC) &&
+	    !check_tsc_unstable()) {
+		mult = ((u64)NSEC_PER_MSEC << TIMESHIFT) / tsc_khz;
+		if (mult <= 0xffffffff)
+			flags = P9TIME_TSC;
+	}
+
+	local_irq_save(irqflags);
+	getnstimeofday(&ts);
+	tsc = get_cycles();
+	local_irq_restore(irqflags);
+
+	timepage->seq++;
+	smp_wmb();
+	timepage->flags = flags;
+	timepage->nsec = timespec_to_ns(&ts);
+	timepage->tsc = tsc;
+	timepage->mult = flags ? mult : 0;
+	timepage->shift = TIMESHIFT;
+	timepage->fasthz = p9_fasthz();
+	smp_wmb();
+	timepage->seq++;
+
+	mod_timer(&time_timer, jiffies + HZ);
+}
+
+/* Map the time page at addr in mm, whose mmap_sem is held for writing */
+int p9_timepage_map(struct mm_struct *mm, unsigned long addr)
+{
+	return install_special_mapping(mm, addr, PAGE_SIZE,
+				       VM_READ | VM_MAYREAD, timepages);
+}
+
+static int __init time_init(void)
+{
+	timepages[0] = alloc_page(GFP_KERNEL | __GFP_ZERO);
+	if (!timepages[0])
+		return -ENOMEM;
+	timepage = page_address(timepages[0]);
+
+	setup_timer(&time_timer, time_update, 0);
+	time_update(0);
+	return 0;
+}
+
+core_initcall(time_init);
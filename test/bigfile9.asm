@@ -0,0 +1,161 @@
+; Large file test for the Plan 9 system calls: write a few bytes 5GB
+; into a sparse file, seek to its end and read them back. Then, with
+; the file offset at that end, pwrite the same bytes at 0xFFFFFFFF,
+; which must land there and not at the offset (nor read as -1, "the
+; offset"), and read them back from there. Finally remove the file.
+; Prints "ok" on success and exits with "fail" otherwise.
+
+section .data
+	file:      db '/tmp/bigfile9',0
+	hello:     db 'Hello world!',10
+	helloLen:  equ $-hello
+	ok:        db 'ok',10
+	okLen:     equ $-ok
+	fail:      db 'fail',0
+
+section .bss
+	fd:        resd 1
+	result:    resd 2                  ; vlong written back by seek
+	buf:       resb helloLen
+
+section .text
+	global _start
+
+; Plan 9 passes arguments on the stack above the return address
+sys:
+	int 40h
+	ret
+
+; seek(&result, fd, 0LL, 2): the end must still be 5GB+helloLen
+atend:
+	push dword 2
+	push dword 0
+	push dword 0
+	push dword [fd]
+	push dword result
+	mov eax,39
+	call sys
+	add esp,20
+	cmp dword [result],0x40000000+helloLen
+	jne .no
+	cmp dword [result+4],1
+.no:
+	ret
+
+; Is buf the same as hello?
+same:
+	mov esi,hello
+	mov edi,buf
+	mov ecx,helloLen
+	repe cmpsb
+	ret
+
+; Zero buf, so that a read that does nothing doesn't pass
+clear:
+	mov edi,buf
+	mov ecx,helloLen
+	xor eax,eax
+	rep stosb
+	ret
+
+_start:
+	push dword 644o                    ; create("/tmp/bigfile9", ORDWR|OTRUNC, 0644)
+	push dword 18
+	push dword file
+	mov eax,22
+	call sys
+	add esp,12
+	cmp eax,0
+	jl bad
+	mov [fd],eax
+
+	push dword 1                       ; pwrite(fd, hello, helloLen, 0x140000000LL)
+	push dword 0x40000000
+	push dword helloLen
+	push dword hello
+	push dword [fd]
+	mov eax,51
+	call sys
+	add esp,20
+	cmp eax,helloLen
+	jne bad
+
+	call atend
+	jne bad
+
+	call clear
+	push dword 1                       ; pread(fd, buf, helloLen, 0x140000000LL)
+	push dword 0x40000000
+	push dword helloLen
+	push dword buf
+	push dword [fd]
+	mov eax,50
+	call sys
+	add esp,20
+	cmp eax,helloLen
+	jne bad
+	call same
+	jne bad
+
+	push dword 0                       ; pwrite(fd, hello, helloLen, 0xFFFFFFFFLL)
+	push dword 0xFFFFFFFF
+	push dword helloLen
+	push dword hello
+	push dword [fd]
+	mov eax,51
+	call sys
+	add esp,20
+	cmp eax,helloLen
+	jne bad
+
+	call atend                         ; not written at the offset, the end
+	jne bad
+
+	call clear
+	push dword 0                       ; pread(fd, buf, helloLen, 0xFFFFFFFFLL)
+	push dword 0xFFFFFFFF
+	push dword helloLen
+	push dword buf
+	push dword [fd]
+	mov eax,50
+	call sys
+	add esp,20
+	cmp eax,helloLen
+	jne bad
+	call same
+	jne bad
+
+	push dword [fd]                    ; close(fd)
+	mov eax,4
+	call sys
+	add esp,4
+
+	push dword file                    ; remove("/tmp/bigfile9")
+	mov eax,25
+	call sys
+	add esp,4
+	cmp eax,0
+	jl failed
+
+	push dword -1                      ; pwrite(1, ok, okLen, -1LL)
+	push dword -1
+	push dword okLen
+	push dword ok
+	push dword 1
+	mov eax,51
+	call sys
+	add esp,20
+
+	push dword 0                       ; exits(nil)
+	mov eax,8
+	call sys
+
+bad:
+	push dword file                    ; remove("/tmp/bigfile9")
+	mov eax,25
+	call sys
+	add esp,4
+failed:
+	push dword fail                    ; exits("fail")
+	mov eax,8
+	call sys
@@ -0,0 +1,248 @@
+; Rendering benchmark for '#i', which needs no display: draw a 512x512
+; a8r8g8b8 image over the screen, a translucent colour over all of it
+; and an opaque one onto all of it, NDRAW times each, and print the
+; nanoseconds one draw took. Exits with "fail" if any step does.
+
+NDRAW      equ 1000
+
+section .data
+	new:       db '#i/draw/new',0
+	dir:       db '#i/draw/'
+	dirLen:    equ $-dir
+	data:      db '/data',0
+	dataLen:   equ $-data
+
+	; 'b' id[4] screenid[4] refresh[1] chan[4] repl[1] R[4*4] clipR[4*4] rrggbbaa[4]
+	alloc:     db 'b'                  ; 1: the image, half transparent
+	           dd 1,0
+	           db 0
+	           dd 0x48081828           ; a8r8g8b8
+	           db 0
+	           dd 0,0,512,512
+	           dd 0,0,512,512
+	           dd 0x40206080
+	           db 'b'                  ; 2: a translucent colour
+	           dd 2,0
+	           db 0
+	           dd 0x48081828
+	           db 1
+	           dd 0,0,1,1
+	           dd -0x3FFFFFFF,-0x3FFFFFFF,0x3FFFFFFF,0x3FFFFFFF
+	           dd 0x20304040
+	           db 'b'                  ; 3: an opaque one
+	           dd 3,0
+	           db 0
+	           dd 0x68081828           ; x8r8g8b8
+	           db 1
+	           dd 0,0,1,1
+	           dd -0x3FFFFFFF,-0x3FFFFFFF,0x3FFFFFFF,0x3FFFFFFF
+	           dd 0x336699FF
+	           db 'b'                  ; 4: opaque white, the mask
+	           dd 4,0
+	           db 0
+	           dd 0x00000038           ; k8
+	           db 1
+	           dd 0,0,1,1
+	           dd -0x3FFFFFFF,-0x3FFFFFFF,0x3FFFFFFF,0x3FFFFFFF
+	           dd 0xFFFFFFFF
+	allocLen:  equ $-alloc
+
+	; 'd' dstid[4] srcid[4] maskid[4] R[4*4] P[2*4] P[2*4]
+	image:     db 'd'
+	           dd 0,1,4
+	           dd 0,0,512,512
+	           dd 0,0,0,0
+	imageLen:  equ $-image
+	over:      db 'd'
+	           dd 0,2,4
+	           dd 0,0,1024,768
+	           dd 0,0,0,0
+	overLen:   equ $-over
+	fill:      db 'd'
+	           dd 0,3,4
+	           dd 0,0,1024,768
+	           dd 0,0,0,0
+	fillLen:   equ $-fill
+
+	imageMsg:  db 'image '
+	overMsg:   db 'over  '
+	fillMsg:   db 'fill  '
+	msgLen:    equ 6
+	ns:        db ' ns',10
+	nsLen:     equ $-ns
+	fail:      db 'fail',0
+
+section .bss
+	fd:        resd 1
+	dfd:       resd 1
+	t0:        resd 2                  ; vlongs from nsec
+	t1:        resd 2
+	ctl:       resb 144
+	path:      resb 64
+	num:       resb 12
+
+section .text
+	global _start
+
+; Plan 9 passes arguments on the stack above the return address
+sys:
+	int 40h
+	ret
+
+; Write the draw message at esi, ecx bytes long, NDRAW times and print
+; the label at edi with how long one write took
+bench:
+	push dword t0                      ; nsec(&t0)
+	mov eax,53
+	call sys
+	add esp,4
+
+	mov ebx,NDRAW
+.again:
+	push dword -1                      ; pwrite(dfd, esi, ecx, -1LL)
+	push dword -1
+	push ecx
+	push esi
+	push dword [dfd]
+	mov eax,51
+	call sys
+	add esp,20
+	cmp eax,ecx
+	jne bad
+	dec ebx
+	jnz .again
+
+	push dword t1                      ; nsec(&t1)
+	mov eax,53
+	call sys
+	add esp,4
+
+	push dword -1                      ; pwrite(1, edi, msgLen, -1LL)
+	push dword -1
+	push dword msgLen
+	push edi
+	push dword 1
+	mov eax,51
+	call sys
+	add esp,20
+
+	mov eax,[t1]                       ; (t1 - t0) / NDRAW in decimal
+	mov edx,[t1+4]
+	sub eax,[t0]
+	sbb edx,[t0+4]
+	mov ecx,NDRAW
+	div ecx
+	mov edi,num+12
+	mov ecx,10
+.digit:
+	xor edx,edx
+	div ecx
+	add dl,'0'
+	dec edi
+	mov [edi],dl
+	test eax,eax
+	jnz .digit
+
+	mov ecx,num+12
+	sub ecx,edi
+	push dword -1                      ; pwrite(1, edi, ecx, -1LL)
+	push dword -1
+	push ecx
+	push edi
+	push dword 1
+	mov eax,51
+	call sys
+	add esp,20
+
+	push dword -1                      ; pwrite(1, ns, nsLen, -1LL)
+	push dword -1
+	push dword nsLen
+	push dword ns
+	push dword 1
+	mov eax,51
+	call sys
+	add esp,20
+	ret
+
+_start:
+	push dword 2                       ; open("#i/draw/new", ORDWR)
+	push dword new
+	mov eax,14
+	call sys
+	add esp,8
+	cmp eax,0
+	jl bad
+	mov [fd],eax
+
+	push dword -1                      ; pread(fd, ctl, 144, -1LL)
+	push dword -1
+	push dword 144
+	push dword ctl
+	push dword [fd]
+	mov eax,50
+	call sys
+	add esp,20
+	cmp eax,12
+	jl bad
+
+	mov esi,dir                        ; path = "#i/draw/" n "/data"
+	mov edi,path
+	mov ecx,dirLen
+	rep movsb
+	mov esi,ctl                        ; n, right aligned in the first 11
+	mov ecx,11
+skip:
+	cmp byte [esi],' '
+	jne digits
+	inc esi
+	loop skip
+	jmp bad
+digits:
+	movsb
+	dec ecx
+	jnz digits
+	mov esi,data
+	mov ecx,dataLen
+	rep movsb
+
+	push dword 2                       ; open(path, ORDWR)
+	push dword path
+	mov eax,14
+	call sys
+	add esp,8
+	cmp eax,0
+	jl bad
+	mov [dfd],eax
+
+	push dword -1                      ; pwrite(dfd, alloc, allocLen, -1LL)
+	push dword -1
+	push dword allocLen
+	push dword alloc
+	push dword [dfd]
+	mov eax,51
+	call sys
+	add esp,20
+	cmp eax,allocLen
+	jne bad
+
+	mov esi,image
+	mov ecx,imageLen
+	mov edi,imageMsg
+	call bench
+	mov esi,over
+	mov ecx,overLen
+	mov edi,overMsg
+	call bench
+	mov esi,fill
+	mov ecx,fillLen
+	mov edi,fillMsg
+	call bench
+
+	push dword 0                       ; exits(nil)
+	mov eax,8
+	call sys
+
+bad:
+	push dword fail                    ; exits("fail")
+	mov eax,8
+	call sys
@@ -0,0 +1,111 @@
+; '#s' test for the Plan 9 system calls: post one end of a pipe as
+; #s/srv9test, open the entry, remove it and check it no longer opens.
+; Prints "ok" on success and exits with "fail" otherwise.
+
+section .data
+	srv:       db '#s/srv9test',0
+	ok:        db 'ok',10
+	okLen:     equ $-ok
+	fail:      db 'fail',0
+
+section .bss
+	sfd:       resd 1
+	fds:       resd 2                  ; from pipe
+	num:       resb 12
+
+section .text
+	global _start
+
+; Plan 9 passes arguments on the stack above the return address
+sys:
+	int 40h
+	ret
+
+_start:
+	push dword fds                     ; pipe(fds)
+	mov eax,21
+	call sys
+	add esp,4
+	cmp eax,0
+	jl bad
+
+	push dword 600o                    ; create("#s/srv9test", OWRITE, 0600)
+	push dword 1
+	push dword srv
+	mov eax,22
+	call sys
+	add esp,12
+	cmp eax,0
+	jl bad
+	mov [sfd],eax
+
+	mov eax,[fds]                      ; fds[0] in decimal
+	mov edi,num+12
+	mov ecx,10
+digit:
+	xor edx,edx
+	div ecx
+	add dl,'0'
+	dec edi
+	mov [edi],dl
+	test eax,eax
+	jnz digit
+	mov ecx,num+12
+	sub ecx,edi
+
+	push dword -1                      ; pwrite(sfd, num, n, -1LL): post it
+	push dword -1
+	push ecx
+	push edi
+	push dword [sfd]
+	mov eax,51
+	call sys
+	add esp,20
+	cmp eax,0
+	jl bad
+
+	push dword 0                       ; open("#s/srv9test", OREAD)
+	push dword srv
+	mov eax,14
+	call sys
+	add esp,8
+	cmp eax,0
+	jl bad
+
+	push eax                           ; close(fd)
+	mov eax,4
+	call sys
+	add esp,4
+
+	push dword srv                     ; remove("#s/srv9test")
+	mov eax,25
+	call sys
+	add esp,4
+	cmp eax,0
+	jl bad
+
+	push dword 0                       ; open("#s/srv9test", OREAD) fails now
+	push dword srv
+	mov eax,14
+	call sys
+	add esp,8
+	cmp eax,0
+	jge bad
+
+	push dword -1                      ; pwrite(1, ok, okLen, -1LL)
+	push dword -1
+	push dword okLen
+	push dword ok
+	push dword 1
+	mov eax,51
+	call sys
+	add esp,20
+
+	push dword 0                       ; exits(nil)
+	mov eax,8
+	call sys
+
+bad:
+	push dword fail                    ; exits("fail")
+	mov eax,8
+	call sys
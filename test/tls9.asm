@@ -0,0 +1,373 @@
+; '#a' test for the Plan 9 system calls: push a client and a server
+; conversation onto two '#|' pipes, with fixed secrets, and pass their
+; records from one pipe to the other. For TLS 1.0 and 1.2, each with
+; sha1 and aes_128_cbc and with md5 and rc4_128, a handshake message
+; and application data go each way under the new cipher and must come
+; out as they went in. Then a data record with its last byte changed on
+; the way must fail to read, with the error "bad record mac".
+; Prints "ok" on success and exits with "fail" otherwise.
+
+section .data
+	clone:     db '#a/tls/clone',0
+	tlsdir:    db '#a/tls/',0
+	shand:     db '/hand',0
+	sdata:     db '/data',0
+	sfd:       db 'fd ',0
+	v301:      db 'version 0x301',0
+	v303:      db 'version 0x303',0
+	ssecret:   db 'secret ',0
+	aes:       db 'sha1 aes_128_cbc ',0
+	rc4:       db 'md5 rc4_128 ',0
+	client:    db '1 ',0
+	server:    db '0 ',0
+	; 108 bytes: enough MAC secrets, keys and IVs for either suite
+	key:       db 'AwoRGB8mLTQ7QklQV15lbHN6gYiPlp2kq7K5wMfO1dzj6vH4/wYN'
+	           db 'FBsiKTA3PkVMU1phaG92fYSLkpmgp661vMPK0djf5u30+wIJEBce'
+	           db 'JSwzOkFIT1ZdZGtyeYCHjpWco6qxuL/GzdTb4unw',0
+	changecipher: db 'changecipher',0
+	opened:    db 'opened',0
+	hand:      db 'a handshake message'
+	handLen:   equ $-hand
+	data:      db 'some application data',10
+	dataLen:   equ $-data
+	badmac:    db 'bad record mac',0
+	badmacLen: equ $-badmac
+	cases:     dd v301,aes, v301,rc4, v303,aes, v303,rc4, 0
+	ok:        db 'ok',10
+	okLen:     equ $-ok
+	fail:      db 'fail',0
+
+section .bss
+	; A conversation: ctl, hand and data, then its pipe's two ends,
+	; the one it is pushed on and the one its records are passed from
+	c1:        resd 5
+	c2:        resd 5
+	case:      resd 1
+	version:   resd 1
+	algs:      resd 1
+	role:      resd 1
+	text:      resd 1
+	textLen:   resd 1
+	tamper:    resd 1
+	num:       resb 12
+	path:      resb 64
+	msg:       resb 512
+	buf:       resb 20000              ; a whole record
+	bufLen:    equ $-buf
+
+section .text
+	global _start
+
+; Plan 9 passes arguments on the stack above the return address
+sys:
+	int 40h
+	ret
+
+; Append the string at esi to edi, without its nul
+append:
+	lodsb
+	test al,al
+	jz .done
+	stosb
+	jmp append
+.done:
+	ret
+
+; Append eax in decimal to edi
+appendnum:
+	mov esi,num+12
+	mov ecx,10
+.digit:
+	xor edx,edx
+	div ecx
+	add dl,'0'
+	dec esi
+	mov [esi],dl
+	test eax,eax
+	jnz .digit
+	mov ecx,num+12
+	sub ecx,esi
+	rep movsb
+	ret
+
+; pwrite(ebx, esi, ecx, -1LL), which must write it all
+put:
+	push dword -1
+	push dword -1
+	push ecx
+	push esi
+	push ebx
+	mov eax,51
+	call sys
+	add esp,20
+	cmp eax,ecx
+	jne bad
+	ret
+
+; pread(ebx, buf, bufLen, -1LL)
+get:
+	push dword -1
+	push dword -1
+	push dword bufLen
+	push dword buf
+	push ebx
+	mov eax,50
+	call sys
+	add esp,20
+	ret
+
+; Read fd ebx, which must give the ecx bytes at esi
+expect:
+	call get
+	cmp eax,ecx
+	jne bad
+	mov edi,buf
+	repe cmpsb
+	jne bad
+	ret
+
+; Write msg, up to edi, to the ctl file ebx
+say:
+	mov esi,msg
+	mov ecx,edi
+	sub ecx,esi
+	jmp put
+
+; Write the string at esi to the ctl file ebx
+ctl:
+	mov edi,msg
+	call append
+	jmp say
+
+; Pass one record from conversation esi's pipe on to edi's, with its
+; last byte changed if tamper is set
+relay:
+	mov ebx,[esi+16]
+	call get
+	cmp eax,0
+	jle bad
+	mov ecx,eax
+	cmp dword [tamper],0
+	je .pass
+	xor byte [buf+ecx-1],1
+.pass:
+	mov ebx,[edi+16]
+	mov esi,buf
+	jmp put
+
+; Write text to fd ebx, pass the record from conversation esi to edi,
+; and read it back from fd edx
+trip:
+	push edx
+	push edi
+	push esi
+	mov esi,[text]
+	mov ecx,[textLen]
+	call put
+	pop esi
+	pop edi
+	call relay
+	pop ebx
+	mov esi,[text]
+	mov ecx,[textLen]
+	jmp expect
+
+; Make conversation ebp and push it on a new pipe, with version,
+; algs and role
+setup:
+	lea eax,[ebp+12]                   ; pipe(&conv[3])
+	push eax
+	mov eax,21
+	call sys
+	add esp,4
+	cmp eax,0
+	jl bad
+
+	push dword 2                       ; open("#a/tls/clone", ORDWR)
+	push dword clone
+	mov eax,14
+	call sys
+	add esp,8
+	cmp eax,0
+	jl bad
+	mov [ebp],eax
+
+	mov ebx,eax                        ; its number, for #a/tls/n
+	call get
+	cmp eax,0
+	jle bad
+	mov ecx,eax
+	mov edi,path
+	mov esi,tlsdir
+	call append
+	mov esi,buf
+	rep movsb
+	push edi
+	mov esi,shand
+	call append
+	mov byte [edi],0
+	push dword 2                       ; open("#a/tls/n/hand", ORDWR)
+	push dword path
+	mov eax,14
+	call sys
+	add esp,8
+	cmp eax,0
+	jl bad
+	mov [ebp+4],eax
+	pop edi
+	mov esi,sdata
+	call append
+	mov byte [edi],0
+	push dword 2                       ; open("#a/tls/n/data", ORDWR)
+	push dword path
+	mov eax,14
+	call sys
+	add esp,8
+	cmp eax,0
+	jl bad
+	mov [ebp+8],eax
+
+	mov ebx,[ebp]
+	mov edi,msg                        ; fd n
+	mov esi,sfd
+	call append
+	mov eax,[ebp+12]
+	call appendnum
+	call say
+	mov esi,[version]                  ; version v
+	call ctl
+	mov edi,msg                        ; secret hashalg encalg isclient keys
+	mov esi,ssecret
+	call append
+	mov esi,[algs]
+	call append
+	mov esi,[role]
+	call append
+	mov esi,key
+	call append
+	jmp say
+
+; One version and pair of algorithms, from setup to the spoilt record
+tlscase:
+	mov ebp,c1
+	mov dword [role],client
+	call setup
+	mov ebp,c2
+	mov dword [role],server
+	call setup
+
+	mov ebx,[c1]                       ; each side changes cipher
+	mov esi,changecipher
+	call ctl
+	mov esi,c1
+	mov edi,c2
+	call relay
+	mov ebx,[c2]
+	mov esi,changecipher
+	call ctl
+	mov esi,c2
+	mov edi,c1
+	call relay
+
+	mov dword [text],hand              ; handshake, client to server
+	mov dword [textLen],handLen
+	mov ebx,[c1+4]
+	mov edx,[c2+4]
+	mov esi,c1
+	mov edi,c2
+	call trip
+	mov ebx,[c2+4]                     ; and back
+	mov edx,[c1+4]
+	mov esi,c2
+	mov edi,c1
+	call trip
+
+	mov ebx,[c1]
+	mov esi,opened
+	call ctl
+	mov ebx,[c2]
+	mov esi,opened
+	call ctl
+
+	mov dword [text],data              ; data, client to server
+	mov dword [textLen],dataLen
+	mov ebx,[c1+8]
+	mov edx,[c2+8]
+	mov esi,c1
+	mov edi,c2
+	call trip
+	mov ebx,[c2+8]                     ; and back
+	mov edx,[c1+8]
+	mov esi,c2
+	mov edi,c1
+	call trip
+
+	mov ebx,[c1+8]                     ; data spoilt on the way
+	mov esi,data
+	mov ecx,dataLen
+	call put
+	mov dword [tamper],1
+	mov esi,c1
+	mov edi,c2
+	call relay
+	mov dword [tamper],0
+	mov ebx,[c2+8]
+	call get
+	cmp eax,0
+	jge bad
+
+	push dword bufLen                  ; errstr(buf, bufLen)
+	push dword buf
+	mov eax,41
+	call sys
+	add esp,8
+	mov esi,badmac
+	mov edi,buf
+	mov ecx,badmacLen
+	repe cmpsb
+	jne bad
+
+	mov esi,c1                         ; close both conversations and pipes
+	mov edx,10
+.close:
+	push dword [esi]
+	mov eax,4
+	call sys
+	add esp,4
+	add esi,4
+	dec edx
+	jnz .close
+	ret
+
+_start:
+	mov dword [case],cases
+next:
+	mov eax,[case]
+	mov ebx,[eax]
+	test ebx,ebx
+	jz done
+	mov [version],ebx
+	mov ebx,[eax+4]
+	mov [algs],ebx
+	call tlscase
+	add dword [case],8
+	jmp next
+
+done:
+	push dword -1                      ; pwrite(1, ok, okLen, -1LL)
+	push dword -1
+	push dword okLen
+	push dword ok
+	push dword 1
+	mov eax,51
+	call sys
+	add esp,20
+
+	push dword 0                       ; exits(nil)
+	mov eax,8
+	call sys
+
+bad:
+	push dword fail                    ; exits("fail")
+	mov eax,8
+	call sys